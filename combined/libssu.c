@@ -103,12 +103,15 @@ static void (*dl_destroy_mat)(mat_t**) = NULL;
 static void (*dl_destroy_mat_full_fp64)(mat_full_fp64_t**) = NULL;
 static void (*dl_destroy_mat_full_fp32)(mat_full_fp32_t**) = NULL;
 static void (*dl_destroy_partial_mat)(partial_mat_t**) = NULL;
+static void (*dl_destroy_partial_mat_fp32)(partial_mat_fp32_t**) = NULL;
 static void (*dl_destroy_partial_dyn_mat)(partial_dyn_mat_t**) = NULL;
 static void (*dl_destroy_results_vec)(r_vec**) = NULL;
 static void (*dl_destroy_bptree_opaque)(opaque_bptree_t**) = NULL;
 
 static IOStatus (*dl_read_bptree_opaque)(const char*, opaque_bptree_t**) = NULL;
 static void (*dl_load_bptree_opaque)(const char*, opaque_bptree_t**) = NULL;
+static IOStatus (*dl_write_bptree_opaque)(const char*, const opaque_bptree_t*) = NULL;
+static IOStatus (*dl_update_bptree_cache)(const char*, const char*) = NULL;
 static void (*dl_convert_bptree_opaque)(const support_bptree_t*, opaque_bptree_t**) = NULL;
 static int (*dl_get_bptree_opaque_els)(opaque_bptree_t*) = NULL;
 
@@ -136,6 +139,12 @@ void destroy_partial_mat(partial_mat_t** result) {
    (*dl_destroy_partial_mat)(result);
 }
 
+void destroy_partial_mat_fp32(partial_mat_fp32_t** result) {
+   cond_ssu_load("destroy_partial_mat_fp32", (void **) &dl_destroy_partial_mat_fp32);
+
+   (*dl_destroy_partial_mat_fp32)(result);
+}
+
 void destroy_partial_dyn_mat(partial_dyn_mat_t** result) {
    cond_ssu_load("destroy_partial_dyn_mat", (void **) &dl_destroy_partial_dyn_mat);
 
@@ -166,6 +175,18 @@ void load_bptree_opaque(const char* newick, opaque_bptree_t** tree_data) {
    (*dl_load_bptree_opaque)(newick,tree_data);
 }
 
+IOStatus write_bptree_opaque(const char* cache_filename, const opaque_bptree_t* tree_data) {
+   cond_ssu_load("write_bptree_opaque", (void **) &dl_write_bptree_opaque);
+
+   return (*dl_write_bptree_opaque)(cache_filename,tree_data);
+}
+
+IOStatus update_bptree_cache(const char* newick_filename, const char* cache_filename) {
+   cond_ssu_load("update_bptree_cache", (void **) &dl_update_bptree_cache);
+
+   return (*dl_update_bptree_cache)(newick_filename,cache_filename);
+}
+
 void convert_bptree_opaque(const support_bptree_t* in_tree, opaque_bptree_t** tree_data) {
    cond_ssu_load("convert_bptree_opaque", (void **) &dl_convert_bptree_opaque);
 
@@ -285,6 +306,35 @@ ComputeStatus one_off_matrix_fp32_v3t(const char* biom_filename, const opaque_bp
 
 /*********************************************************************/
 
+static ComputeStatus (*dl_one_off_matrix_multi_v3)(const char*, const char*, const char* const *, const double*, unsigned int,
+                                                   bool, bool, unsigned int, unsigned int, bool, const char *, mat_full_fp64_t**) = NULL;
+static ComputeStatus (*dl_one_off_matrix_multi_fp32_v3)(const char*, const char*, const char* const *, const double*, unsigned int,
+                                                        bool, bool, unsigned int, unsigned int, bool, const char *, mat_full_fp32_t**) = NULL;
+
+ComputeStatus one_off_matrix_multi_v3(const char* biom_filename, const char* tree_filename,
+                                      const char* const * unifrac_methods, const double* alphas, unsigned int n_methods,
+                                      bool bypass_tips, bool normalize_sample_counts, unsigned int n_substeps,
+                                      unsigned int subsample_depth, bool subsample_with_replacement, const char *mmap_dir,
+                                      mat_full_fp64_t** results) {
+   cond_ssu_load("one_off_matrix_multi_v3", (void **) &dl_one_off_matrix_multi_v3);
+
+   return (*dl_one_off_matrix_multi_v3)(biom_filename, tree_filename, unifrac_methods, alphas, n_methods,
+                           bypass_tips, normalize_sample_counts, n_substeps, subsample_depth, subsample_with_replacement, mmap_dir, results);
+}
+
+ComputeStatus one_off_matrix_multi_fp32_v3(const char* biom_filename, const char* tree_filename,
+                                           const char* const * unifrac_methods, const double* alphas, unsigned int n_methods,
+                                           bool bypass_tips, bool normalize_sample_counts, unsigned int n_substeps,
+                                           unsigned int subsample_depth, bool subsample_with_replacement, const char *mmap_dir,
+                                           mat_full_fp32_t** results) {
+   cond_ssu_load("one_off_matrix_multi_fp32_v3", (void **) &dl_one_off_matrix_multi_fp32_v3);
+
+   return (*dl_one_off_matrix_multi_fp32_v3)(biom_filename, tree_filename, unifrac_methods, alphas, n_methods,
+                                bypass_tips, normalize_sample_counts, n_substeps, subsample_depth, subsample_with_replacement, mmap_dir, results);
+}
+
+/*********************************************************************/
+
 static ComputeStatus (*dl_faith_pd_one_off)(const char*, const char*, r_vec**) = NULL;
 ComputeStatus faith_pd_one_off(const char* biom_filename, const char* tree_filename,
                                       r_vec** result) {
@@ -348,6 +398,23 @@ ComputeStatus unifrac_multi_to_file_v3(const char* biom_filename, const char* tr
                                   pcoa_dims, permanova_perms, grouping_filename, grouping_columns, mmap_dir);
 }
 
+static ComputeStatus (*dl_unifrac_alphas_to_file_v3)(const char*, const char*, const char*, const char*, const double*, unsigned int,
+                                               bool, bool, unsigned int, const char*, unsigned int, bool,
+                                               unsigned int, const char *) = NULL;
+
+ComputeStatus unifrac_alphas_to_file_v3(const char* biom_filename, const char* tree_filename, const char* out_filename,
+                                               const char* unifrac_method, const double* alphas, unsigned int n_alphas,
+                                               bool bypass_tips, bool normalize_sample_counts, unsigned int n_substeps, const char* format,
+                                               unsigned int subsample_depth, bool subsample_with_replacement,
+                                               unsigned int pcoa_dims,
+                                               const char *mmap_dir) {
+   cond_ssu_load("unifrac_alphas_to_file_v3", (void **) &dl_unifrac_alphas_to_file_v3);
+
+   return (*dl_unifrac_alphas_to_file_v3)(biom_filename, tree_filename, out_filename, unifrac_method, alphas, n_alphas,
+                                   bypass_tips, normalize_sample_counts, n_substeps, format, subsample_depth, subsample_with_replacement,
+                                   pcoa_dims, mmap_dir);
+}
+
 
 /*********************************************************************/
 
@@ -462,6 +529,7 @@ ComputeStatus one_dense_pair_v3(unsigned int n_obs, const char ** obs_ids, const
 /*********************************************************************/
 
 static ComputeStatus (*dl_partial_v3)(const char*, const char*, const char*, bool, double, bool, bool, unsigned int, unsigned int, unsigned int, partial_mat_t**) = NULL;
+static ComputeStatus (*dl_partial_fp32_v3)(const char*, const char*, const char*, bool, double, bool, bool, unsigned int, unsigned int, unsigned int, partial_mat_fp32_t**) = NULL;
 static MergeStatus (*dl_merge_partial_to_mmap_matrix)(partial_dyn_mat_t**, int, const char *, mat_full_fp64_t**) = NULL;
 static MergeStatus (*dl_merge_partial_to_mmap_matrix_fp32)(partial_dyn_mat_t**, int, const char *, mat_full_fp32_t**) = NULL;
 static MergeStatus (*dl_validate_partial)(const partial_dyn_mat_t* const *, int);
@@ -469,6 +537,7 @@ static IOStatus (*dl_read_partial)(const char*, partial_mat_t**);
 static IOStatus (*dl_read_partial_header)(const char*, partial_dyn_mat_t**);
 static IOStatus (*dl_read_partial_one_stripe)(partial_dyn_mat_t*, uint32_t);
 static IOStatus (*dl_write_partial)(const char*, const partial_mat_t*);
+static IOStatus (*dl_write_partial_fp32)(const char*, const partial_mat_fp32_t*);
 
 
 ComputeStatus partial_v3(const char* biom_filename, const char* tree_filename,
@@ -481,6 +550,16 @@ ComputeStatus partial_v3(const char* biom_filename, const char* tree_filename,
 		   bypass_tips,normalize_sample_counts,n_substeps,stripe_start,stripe_stop,result);
 }
 
+ComputeStatus partial_fp32_v3(const char* biom_filename, const char* tree_filename,
+                             const char* unifrac_method, bool variance_adjust, double alpha,
+                             bool bypass_tips, bool normalize_sample_counts, unsigned int n_substeps, unsigned int stripe_start,
+                             unsigned int stripe_stop, partial_mat_fp32_t** result) {
+   cond_ssu_load("partial_fp32_v3", (void **) &dl_partial_fp32_v3);
+
+   return (*dl_partial_fp32_v3)(biom_filename,tree_filename,unifrac_method,variance_adjust,alpha,
+		   bypass_tips,normalize_sample_counts,n_substeps,stripe_start,stripe_stop,result);
+}
+
 MergeStatus merge_partial_to_mmap_matrix(partial_dyn_mat_t* * partial_mats, int n_partials, const char *mmap_dir, mat_full_fp64_t** result) {
    cond_ssu_load("merge_partial_to_mmap_matrix", (void **) &dl_merge_partial_to_mmap_matrix);
 
@@ -523,6 +602,12 @@ IOStatus write_partial(const char* filename, const partial_mat_t* result) {
    return (*dl_write_partial)(filename,result);
 }
 
+IOStatus write_partial_fp32(const char* filename, const partial_mat_fp32_t* result) {
+   cond_ssu_load("write_partial_fp32", (void **) &dl_write_partial_fp32);
+
+   return (*dl_write_partial_fp32)(filename,result);
+}
+
 // compat versions
 
 #include "../src/api_compat.hpp"
@@ -18,6 +18,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <lz4.h>
 #include <time.h>
 #if defined(_OPENMP)
@@ -89,7 +90,9 @@
 
 #define SYNC_TREE_TABLE(tree, table) std::unordered_set<std::string> to_keep(table.get_obs_ids().begin(),           \
                                                                              table.get_obs_ids().end());            \
-                                     su::BPTree tree_sheared = tree.shear(to_keep).collapse();
+                                     uint32_t n_compacted = 0;                                                      \
+                                     su::BPTree tree_sheared = tree.shear(to_keep).compact(n_compacted);            \
+                                     if(print_tdbg) printf("INFO (unifrac): Tree compaction saved %u embedding slots\n", n_compacted);
 
 #define VALIDATE_TREE_TABLE(tree, table)                if( (table.n_samples <= 0) || (table.n_obs <= 0) ) {                     \
                                                             return table_empty;                                                  \
@@ -99,9 +102,11 @@
                                                             return table_and_tree_do_not_overlap;                                \
                                                         }   
 
-#define PARSE_TREE_TABLE(tree_filename, table_filename) su::BPTree tree(get_tree_content(tree_filename)); \
-                                                        su::biom table(biom_filename);                    \
-							VALIDATE_TREE_TABLE(tree, table)
+#define PARSE_TREE_TABLE_MMAP(tree_filename, table_filename, mmap_dir) su::BPTree tree(load_tree_file(tree_filename));   \
+                                                                  su::biom table(biom_filename, mmap_dir);          \
+                                                                  VALIDATE_TREE_TABLE(tree, table)
+
+#define PARSE_TREE_TABLE(tree_filename, table_filename) PARSE_TREE_TABLE_MMAP(tree_filename, table_filename, NULL)
 
 #define PARSE_SYNC_TREE_TABLE(tree_filename, table_filename) PARSE_TREE_TABLE(tree_filename, table_filename) \
                                                              SYNC_TREE_TABLE(tree, table)
@@ -126,16 +131,80 @@ inline std::string get_tree_content(const char* tree_filename) {
     return content;
 }
 
+// Load the tree from either a newick file or a binary tree cache
+inline su::BPTree load_tree_file(const char* tree_filename) {
+    if(su::BPTree::is_cache_file(tree_filename)) {
+        su::BPTree tree;
+        IOStatus err = tree.read_cache(tree_filename);
+        if(err != read_okay) {
+            fprintf(stderr, "Unable to load tree cache %s, error %i; [%s]:%d\n", tree_filename, int(err), __FILE__, __LINE__);
+            exit(EXIT_FAILURE);
+        }
+        return tree;
+    }
+    return su::BPTree(get_tree_content(tree_filename));
+}
+
 /* Read tree from file and fill tree_data */
 IOStatus read_bptree_opaque(const char* tree_filename, opaque_bptree_t** tree_data) {
     SETUP_TDBG("read_bptree_opaque")
     if(tree_data==NULL) return unexpected_end;
     CHECK_FILE(tree_filename, open_error)
+    if(su::BPTree::is_cache_file(tree_filename)) {
+        su::BPTree *tree = new su::BPTree();
+        IOStatus err = tree->read_cache(tree_filename);
+        if(err != read_okay) {
+            delete tree;
+            return err;
+        }
+        TDBG_STEP("load_cache")
+        *tree_data = (opaque_bptree_t*) tree;
+        return read_okay;
+    }
     TDBG_STEP("load_files")
     *tree_data = (opaque_bptree_t*) new su::BPTree(get_tree_content(tree_filename));
     return read_okay;
 }
 
+/* Write tree_data as a binary tree cache */
+IOStatus write_bptree_opaque(const char* cache_filename, const opaque_bptree_t* tree_data) {
+    SETUP_TDBG("write_bptree_opaque")
+    if(tree_data==NULL) return unexpected_end;
+    const su::BPTree *tree = (const su::BPTree *) tree_data;
+    return tree->write_cache(cache_filename);
+}
+
+// Modification time of a file, in nanoseconds
+inline int64_t get_mtime_ns(const struct stat &st) {
+#ifdef __APPLE__
+    return int64_t(st.st_mtimespec.tv_sec)*1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    return int64_t(st.st_mtim.tv_sec)*1000000000 + st.st_mtim.tv_nsec;
+#endif
+}
+
+/* Make sure cache_filename is an up to date binary cache of newick_filename */
+IOStatus update_bptree_cache(const char* newick_filename, const char* cache_filename) {
+    SETUP_TDBG("update_bptree_cache")
+    struct stat st;
+    if(stat(newick_filename, &st)!=0) return open_error;
+    const uint64_t source_size = st.st_size;
+    const int64_t source_mtime = get_mtime_ns(st);
+
+    // only the header is needed to tell if the cache is stale
+    uint64_t cached_size = 0;
+    int64_t cached_mtime = 0;
+    if((su::BPTree::read_cache_source(cache_filename, &cached_size, &cached_mtime) == read_okay) &&
+       (cached_size == source_size) && (cached_mtime == source_mtime)) {
+        return read_okay;
+    }
+
+    CHECK_FILE(newick_filename, open_error)
+    su::BPTree tree(get_tree_content(newick_filename));
+    TDBG_STEP("parse_newick")
+    return tree.write_cache(cache_filename, source_size, source_mtime);
+}
+
 void load_bptree_opaque(const char* newick, opaque_bptree_t** tree_data) {
     SETUP_TDBG("load_bptree_opaque")
     *tree_data = (opaque_bptree_t*) new su::BPTree(newick);
@@ -167,26 +236,12 @@ int get_bptree_opaque_els(opaque_bptree_t* tree_data) {
 	return 0; // just to have a reasonable default
 }
 
-void destroy_stripes(vector<double*> &dm_stripes, vector<double*> &dm_stripes_total, unsigned int n_samples,
-                     unsigned int stripe_start, unsigned int stripe_stop) {
-    unsigned int n_rotations = (n_samples + 1) / 2;
-
-    if(stripe_stop == 0) {
-        for(unsigned int i = 0; i < n_rotations; i++) {
-            free(dm_stripes[i]);
-            if(dm_stripes_total[i] != NULL)
-                free(dm_stripes_total[i]);
-        }
-    } else {
-        // if a stripe_stop is specified, and if we're in the stripe window, do not free
-        // dm_stripes. this is done as the pointers in dm_stripes are assigned to the partial_mat_t
-        // and subsequently freed in destroy_partial_mat. but, we do need to free dm_stripes_total
-        // if appropriate
-        for(unsigned int i = stripe_start; i < stripe_stop; i++) {
-            if(dm_stripes_total[i] != NULL)
-                free(dm_stripes_total[i]);
-        }
-    }
+template<class TFloat>
+void destroy_stripes(vector<TFloat*> &dm_stripes, const std::vector<su::task_parameters> &tasks) {
+    // the stripes of each task are allocated in a single buffer by process_stripes
+    // dm_stripes_total is already released by process_stripes
+    for(unsigned int tid = 0; tid < tasks.size(); tid++)
+        su::release_stripes(dm_stripes, &tasks[tid]);
 }
 
 
@@ -327,9 +382,13 @@ void initialize_mat_full_no_biom_T(TMat* &result, const char* const * sample_ids
     }
 }
 
-void initialize_partial_mat(partial_mat_t* &result, biom_interface &table, std::vector<double*> &dm_stripes,
-                            unsigned int stripe_start, unsigned int stripe_stop, bool is_upper_triangle) {
-    result = (partial_mat_t*)malloc(sizeof(partial_mat));
+// Note: partial_mat_t owns each stripe individually, so the stripes are moved out of
+//       the task buffers (which are released in the process)
+template<class TPMat, class TFloat>
+void initialize_partial_mat_T(TPMat* &result, biom_interface &table, std::vector<TFloat*> &dm_stripes,
+                              const std::vector<su::task_parameters> &tasks,
+                              unsigned int stripe_start, unsigned int stripe_stop, bool is_upper_triangle) {
+    result = (TPMat*)malloc(sizeof(TPMat));
     result->n_samples = table.n_samples;
 
     result->sample_ids = (char**)malloc(sizeof(char*) * result->n_samples);
@@ -341,14 +400,26 @@ void initialize_partial_mat(partial_mat_t* &result, biom_interface &table, std::
         result->sample_ids[i][len] = '\0';
     }
 
-    result->stripes = (double**)malloc(sizeof(double*) * (stripe_stop - stripe_start));
+    result->stripes = (TFloat**)malloc(sizeof(TFloat*) * (stripe_stop - stripe_start));
     result->stripe_start = stripe_start;
     result->stripe_stop = stripe_stop;
     result->is_upper_triangle = is_upper_triangle;
     result->stripe_total = dm_stripes.size();
 
-    for(unsigned int i = stripe_start; i < stripe_stop; i++) {
-        result->stripes[i - stripe_start] = dm_stripes[i];
+    const uint32_t n_samples = result->n_samples;
+    for(unsigned int tid = 0; tid < tasks.size(); tid++) {
+        for(unsigned int i = tasks[tid].start; i < tasks[tid].stop; i++) {
+            TFloat *stripe = (TFloat*)malloc(sizeof(TFloat) * n_samples);
+            if(stripe == NULL) {
+                fprintf(stderr, "Failed to allocate %zd bytes; [%s]:%d\n",
+                        sizeof(TFloat) * n_samples, __FILE__, __LINE__);
+                exit(EXIT_FAILURE);
+            }
+            memcpy(stripe, dm_stripes[i], sizeof(TFloat) * n_samples);
+            result->stripes[i - stripe_start] = stripe;
+        }
+        // keep peak memory in check
+        su::release_stripes(dm_stripes, &tasks[tid]);
     }
 }
 
@@ -403,7 +474,8 @@ void destroy_mat_full_fp32(mat_full_fp32_t** result) {
     destroy_mat_full_T<mat_full_fp32_t,float>(result);
 }
 
-void destroy_partial_mat(partial_mat_t** result) {
+template<class TPMat>
+inline void destroy_partial_mat_T(TPMat** result) {
     for(unsigned int i = 0; i < (*result)->n_samples; i++) {
         if((*result)->sample_ids[i] != NULL)
             free((*result)->sample_ids[i]);
@@ -421,6 +493,14 @@ void destroy_partial_mat(partial_mat_t** result) {
     free(*result);
 }
 
+void destroy_partial_mat(partial_mat_t** result) {
+    destroy_partial_mat_T<partial_mat_t>(result);
+}
+
+void destroy_partial_mat_fp32(partial_mat_fp32_t** result) {
+    destroy_partial_mat_T<partial_mat_fp32_t>(result);
+}
+
 void destroy_partial_dyn_mat(partial_dyn_mat_t** result) {
     for(unsigned int i = 0; i < (*result)->n_samples; i++) {
         if((*result)->sample_ids[i] != NULL)
@@ -435,6 +515,12 @@ void destroy_partial_dyn_mat(partial_dyn_mat_t** result) {
             free((*result)->stripes[i]);
     if((*result)->stripes != NULL)
         free((*result)->stripes);
+    if((*result)->stripes_fp32 != NULL) {
+        for(unsigned int i = 0; i < n_stripes; i++)
+            if((*result)->stripes_fp32[i] != NULL)
+                free((*result)->stripes_fp32[i]);
+        free((*result)->stripes_fp32);
+    }
     if((*result)->offsets != NULL)
         free((*result)->offsets);
     if((*result)->filename != NULL)
@@ -490,17 +576,18 @@ void set_tasks(std::vector<su::task_parameters> &tasks,
     }
 }
 
-compute_status one_off_inmem_cpp(su::biom_interface &table, const su::BPTree &tree,
-                             const char* unifrac_method, bool variance_adjust, double alpha,
-                             bool bypass_tips, bool normalize_sample_counts, unsigned int n_substeps, mat_t** result) {
+// TFloat is the native precision of the method
+template<class TFloat>
+compute_status one_off_inmem_T(su::biom_interface &table, const su::BPTree &tree,
+                               Method method, bool variance_adjust, double alpha,
+                               bool bypass_tips, bool normalize_sample_counts, unsigned int n_substeps, mat_t** result) {
     SETUP_TDBG("one_off_inmem")
     SYNC_TREE_TABLE(tree, table)
     TDBG_STEP("sync_tree_table")
-    SET_METHOD(unifrac_method, unknown_method)
 
     const unsigned int stripe_stop = (table.n_samples + 1) / 2;
-    std::vector<double*> dm_stripes(stripe_stop);
-    std::vector<double*> dm_stripes_total(stripe_stop);
+    std::vector<TFloat*> dm_stripes(stripe_stop);
+    std::vector<TFloat*> dm_stripes_total(stripe_stop);
 
     if(n_substeps > dm_stripes.size()) {
         fprintf(stderr, "More substeps were requested than stripes. Using %zd substeps.\n", long(dm_stripes.size()));
@@ -519,20 +606,34 @@ compute_status one_off_inmem_cpp(su::biom_interface &table, const su::BPTree &tr
     }
 
     TDBG_STEP("stripes_to_condensed_form")
-    destroy_stripes(dm_stripes, dm_stripes_total, table.n_samples, 0, 0);
+    destroy_stripes(dm_stripes, tasks);
 
     return okay;
 }
 
-compute_status partial_v3(const char* biom_filename, const char* tree_filename,
-                          const char* unifrac_method, bool variance_adjust, double alpha, bool bypass_tips, bool normalize_sample_counts,
-                          unsigned int n_substeps, unsigned int stripe_start, unsigned int stripe_stop,
-                          partial_mat_t** result) {
+compute_status one_off_inmem_cpp(su::biom_interface &table, const su::BPTree &tree,
+                             const char* unifrac_method, bool variance_adjust, double alpha,
+                             bool bypass_tips, bool normalize_sample_counts, unsigned int n_substeps, mat_t** result) {
+    SET_METHOD(unifrac_method, unknown_method)
+    if (su::is_fp32_method(method)) {
+        return one_off_inmem_T<float>(table, tree, method, variance_adjust, alpha, bypass_tips, normalize_sample_counts, n_substeps, result);
+    } else {
+        return one_off_inmem_T<double>(table, tree, method, variance_adjust, alpha, bypass_tips, normalize_sample_counts, n_substeps, result);
+    }
+}
+
+// TFloat is the precision of the stripes
+template<class TPMat, class TFloat>
+compute_status partial_T(const char* biom_filename, const char* tree_filename,
+                         const char* unifrac_method, bool variance_adjust, double alpha, bool bypass_tips, bool normalize_sample_counts,
+                         unsigned int n_substeps, unsigned int stripe_start, unsigned int stripe_stop,
+                         TPMat** result) {
 
     SETUP_TDBG("partial")
     CHECK_FILE(biom_filename, table_missing)
     CHECK_FILE(tree_filename, tree_missing)
     SET_METHOD(unifrac_method, unknown_method)
+    if (std::is_same<TFloat,float>::value && (!su::is_fp32_method(method))) return invalid_method;
     PARSE_SYNC_TREE_TABLE(tree_filename, table_filename)
 
     TDBG_STEP("load_files")
@@ -540,8 +641,8 @@ compute_status partial_v3(const char* biom_filename, const char* tree_filename,
     // partial, however we do not allocate arrays for non-computed stripes so
     // there is a little memory waste here but should be on the order of
     // 8 bytes * N samples per vector.
-    std::vector<double*> dm_stripes((table.n_samples + 1) / 2);
-    std::vector<double*> dm_stripes_total((table.n_samples + 1) / 2);
+    std::vector<TFloat*> dm_stripes((table.n_samples + 1) / 2);
+    std::vector<TFloat*> dm_stripes_total((table.n_samples + 1) / 2);
 
     if(n_substeps > dm_stripes.size()) {
         fprintf(stderr, "More substeps were requested than stripes. Using %zd substeps.\n", long(dm_stripes.size()));
@@ -559,13 +660,28 @@ compute_status partial_v3(const char* biom_filename, const char* tree_filename,
     su::process_stripes(table, tree_sheared, method, variance_adjust, dm_stripes, dm_stripes_total, tasks);
 
     TDBG_STEP("process_stripes")
-    initialize_partial_mat(*result, table, dm_stripes, stripe_start, stripe_stop, true);  // true -> is_upper_triangle
+    initialize_partial_mat_T(*result, table, dm_stripes, tasks, stripe_start, stripe_stop, true);  // true -> is_upper_triangle
     TDBG_STEP("partial_mat")
-    destroy_stripes(dm_stripes, dm_stripes_total, table.n_samples, stripe_start, stripe_stop);
 
     return okay;
 }
 
+compute_status partial_v3(const char* biom_filename, const char* tree_filename,
+                          const char* unifrac_method, bool variance_adjust, double alpha, bool bypass_tips, bool normalize_sample_counts,
+                          unsigned int n_substeps, unsigned int stripe_start, unsigned int stripe_stop,
+                          partial_mat_t** result) {
+    return partial_T<partial_mat_t,double>(biom_filename, tree_filename, unifrac_method, variance_adjust, alpha, bypass_tips, normalize_sample_counts,
+                                           n_substeps, stripe_start, stripe_stop, result);
+}
+
+compute_status partial_fp32_v3(const char* biom_filename, const char* tree_filename,
+                               const char* unifrac_method, bool variance_adjust, double alpha, bool bypass_tips, bool normalize_sample_counts,
+                               unsigned int n_substeps, unsigned int stripe_start, unsigned int stripe_stop,
+                               partial_mat_fp32_t** result) {
+    return partial_T<partial_mat_fp32_t,float>(biom_filename, tree_filename, unifrac_method, variance_adjust, alpha, bypass_tips, normalize_sample_counts,
+                                               n_substeps, stripe_start, stripe_stop, result);
+}
+
 compute_status faith_pd_one_off(const char* biom_filename, const char* tree_filename,
                                 r_vec** result){
     SETUP_TDBG("faith_pd_one_off")
@@ -635,45 +751,52 @@ compute_status one_off_wtree_v3(const char* biom_filename, const opaque_bptree_t
  */
 
 // TMat mat_full_fp32_t
-template<class TReal, class TMat>
-compute_status one_off_matrix_T(su::biom_interface &table, const su::BPTree &tree,
-                                const char* unifrac_method, bool variance_adjust, double alpha,
-                                bool bypass_tips, bool normalize_sample_counts, unsigned int n_substeps,
-                                const char *mmap_dir,  
-                                TMat** result) {
+// TFloat is the native precision of the method
+template<class TReal, class TMat, class TFloat>
+compute_status one_off_matrix_stripes_T(su::biom_interface &table, const su::BPTree &tree,
+                                        Method method, bool variance_adjust, double alpha,
+                                        bool bypass_tips, bool normalize_sample_counts, unsigned int n_substeps,
+                                        const char *mmap_dir,
+                                        TMat** result) {
     SETUP_TDBG("one_off_matrix_inmem")
-    if (mmap_dir!=NULL) {
-     if (mmap_dir[0]==0) mmap_dir = NULL; // easier to have a simple test going on
-    }
-
-    SET_METHOD(unifrac_method, unknown_method)
     SYNC_TREE_TABLE(tree, table)
 
     TDBG_STEP("sync_tree_table")
     const unsigned int stripe_stop = (table.n_samples + 1) / 2;
-    partial_mat_t *partial_mat = NULL;
 
-    {
-      std::vector<double*> dm_stripes(stripe_stop);
-      std::vector<double*> dm_stripes_total(stripe_stop);
+    std::vector<su::task_parameters> tasks(n_substeps);
+    set_tasks(tasks, alpha, table.n_samples, 0, stripe_stop, bypass_tips, normalize_sample_counts, n_substeps);
 
-      std::vector<su::task_parameters> tasks(n_substeps);
+    // Prefer the square tiles, which compute each pair only once
+    // Multiple substeps are only requested to limit memory use, which the tiles cannot do
+    su::DMTilesT<TFloat> *dm_tiles = NULL;
+    if (n_substeps==1) {
+      dm_tiles = new su::DMTilesT<TFloat>(table.n_samples, su::get_tile_size(method));
+      if (su::process_tiles(table, tree_sheared, method, variance_adjust, *dm_tiles, &(tasks[0]))) {
+        TDBG_STEP("process_tiles")
+      } else {
+        // not supported, fall back to the stripes
+        delete dm_tiles;
+        dm_tiles = NULL;
+      }
+    }
+
+    std::vector<TFloat*> dm_stripes(stripe_stop);
+    if (dm_tiles==NULL) {
+      std::vector<TFloat*> dm_stripes_total(stripe_stop);
 
-      set_tasks(tasks, alpha, table.n_samples, 0, stripe_stop, bypass_tips, normalize_sample_counts, n_substeps);
       su::process_stripes(table, tree_sheared, method, variance_adjust, dm_stripes, dm_stripes_total, tasks);
 
       TDBG_STEP("process_stripes")
-      initialize_partial_mat(partial_mat, table, dm_stripes, 0, stripe_stop, true);  // true -> is_upper_triangle
-      if ((partial_mat==NULL) || (partial_mat->stripes==NULL) || (partial_mat->sample_ids==NULL) ) {
-          fprintf(stderr, "Memory allocation error! (initialize_partial_mat)\n");
-          exit(EXIT_FAILURE);
-      }
-      destroy_stripes(dm_stripes, dm_stripes_total, table.n_samples, 0, stripe_stop);
     }
 
     // allow the caller to allocate the memory
     if((*result) == NULL) {
-        initialize_mat_full_no_biom_T<TReal,TMat>(*result, partial_mat->sample_ids, partial_mat->n_samples,mmap_dir);
+        const std::vector<std::string> &table_sample_ids = table.get_sample_ids();
+        std::vector<const char*> sample_ids(table.n_samples);
+        for(unsigned int i = 0; i < table.n_samples; i++) sample_ids[i] = table_sample_ids[i].c_str();
+
+        initialize_mat_full_no_biom_T<TReal,TMat>(*result, sample_ids.data(), table.n_samples, mmap_dir);
     }
 
     if (((*result)==NULL) || ((*result)->matrix==NULL) || ((*result)->sample_ids==NULL) ) {
@@ -682,19 +805,44 @@ compute_status one_off_matrix_T(su::biom_interface &table, const su::BPTree &tre
     }
 
 
-    {
-      MemoryStripes ps(partial_mat->stripes);
+    if (dm_tiles!=NULL) {
+      su::tiles_to_matrix_T<TReal,TFloat>(*dm_tiles, (*result)->matrix);
+      TDBG_STEP("tiles_to_matrix")
+      delete dm_tiles;
+    } else {
+      // use the computed stripes directly, no need for an intermediate copy
+      su::MemoryStripesT<TFloat> ps(dm_stripes);
       const uint32_t tile_size = (mmap_dir==NULL) ? \
                                   (128/sizeof(TReal)) : /* keep it small for memory access, to fit in chip cache */ \
                                   (4096/sizeof(TReal)); /* make it larger for mmap, as the limiting factor is swapping */
-      su::stripes_to_matrix_T<TReal>(ps, partial_mat->n_samples, partial_mat->stripe_total, (*result)->matrix, tile_size);
+      su::stripes_to_matrix_T<TReal,TFloat>(ps, table.n_samples, stripe_stop, (*result)->matrix, tile_size);
+      TDBG_STEP("stripes_to_matrix")
+      destroy_stripes(dm_stripes, tasks);
     }
-    TDBG_STEP("stripes_to_matrix")
-    destroy_partial_mat(&partial_mat);
 
     return okay;
 }
 
+template<class TReal, class TMat>
+compute_status one_off_matrix_T(su::biom_interface &table, const su::BPTree &tree,
+                                const char* unifrac_method, bool variance_adjust, double alpha,
+                                bool bypass_tips, bool normalize_sample_counts, unsigned int n_substeps,
+                                const char *mmap_dir,  
+                                TMat** result) {
+    if (mmap_dir!=NULL) {
+     if (mmap_dir[0]==0) mmap_dir = NULL; // easier to have a simple test going on
+    }
+
+    SET_METHOD(unifrac_method, unknown_method)
+    if (su::is_fp32_method(method)) {
+      return one_off_matrix_stripes_T<TReal,TMat,float>(table, tree, method, variance_adjust, alpha, bypass_tips, normalize_sample_counts,
+                                                        n_substeps, mmap_dir, result);
+    } else {
+      return one_off_matrix_stripes_T<TReal,TMat,double>(table, tree, method, variance_adjust, alpha, bypass_tips, normalize_sample_counts,
+                                                         n_substeps, mmap_dir, result);
+    }
+}
+
 
 template<class TReal, class TMat>
 compute_status one_off_matrix_v3_T(su::biom_inmem &table, const su::BPTree &tree,
@@ -723,7 +871,7 @@ compute_status one_off_matrix_v3(const char* biom_filename, const char* tree_fil
     SETUP_TDBG("one_off_matrix")
     CHECK_FILE(biom_filename, table_missing)
     CHECK_FILE(tree_filename, tree_missing)
-    PARSE_TREE_TABLE(tree_filename, biom_filename)
+    PARSE_TREE_TABLE_MMAP(tree_filename, biom_filename, mmap_dir)
     TDBG_STEP("load_files")
     return one_off_matrix_v3_T<double,mat_full_fp64_t>(table,tree,unifrac_method,variance_adjust,alpha,bypass_tips,normalize_sample_counts,n_substeps,subsample_depth,subsample_with_replacement,mmap_dir,result);
 }
@@ -736,11 +884,152 @@ compute_status one_off_matrix_fp32_v3(const char* biom_filename, const char* tre
     SETUP_TDBG("one_off_matrix_fp32")
     CHECK_FILE(biom_filename, table_missing)
     CHECK_FILE(tree_filename, tree_missing)
-    PARSE_TREE_TABLE(tree_filename, biom_filename)
+    PARSE_TREE_TABLE_MMAP(tree_filename, biom_filename, mmap_dir)
     TDBG_STEP("load_files")
     return one_off_matrix_v3_T<float,mat_full_fp32_t>(table,tree,unifrac_method,variance_adjust,alpha,bypass_tips,normalize_sample_counts,n_substeps,subsample_depth,subsample_with_replacement,mmap_dir,result);
 }
 
+/*
+ * ==============================   one_off_matrix_multi
+ */
+
+// TFloat is the native precision of the methods
+template<class TReal, class TMat, class TFloat>
+compute_status one_off_matrix_multi_stripes_T(su::biom_interface &table, const su::BPTree &tree,
+                                              const std::vector<Method> &methods, const std::vector<double> &alphas,
+                                              bool bypass_tips, bool normalize_sample_counts, unsigned int n_substeps,
+                                              const char *mmap_dir,
+                                              TMat** results) {
+    SETUP_TDBG("one_off_matrix_multi_inmem")
+    SYNC_TREE_TABLE(tree, table)
+
+    TDBG_STEP("sync_tree_table")
+    const unsigned int n_methods = methods.size();
+    const unsigned int stripe_stop = (table.n_samples + 1) / 2;
+
+    std::vector<std::vector<TFloat*>> dm_stripes(n_methods, std::vector<TFloat*>(stripe_stop));
+    std::vector<su::task_parameters> tasks(n_substeps);
+    {
+      std::vector<std::vector<TFloat*>> dm_stripes_total(n_methods, std::vector<TFloat*>(stripe_stop));
+
+      // the alpha is set per method by process_stripes_multi
+      set_tasks(tasks, alphas[0], table.n_samples, 0, stripe_stop, bypass_tips, normalize_sample_counts, n_substeps);
+      su::process_stripes_multi(table, tree_sheared, methods, alphas, dm_stripes, dm_stripes_total, tasks);
+
+      TDBG_STEP("process_stripes_multi")
+    }
+
+    const std::vector<std::string> &table_sample_ids = table.get_sample_ids();
+    std::vector<const char*> sample_ids(table.n_samples);
+    for(unsigned int i = 0; i < table.n_samples; i++) sample_ids[i] = table_sample_ids[i].c_str();
+
+    const uint32_t tile_size = (mmap_dir==NULL) ? \
+                                (128/sizeof(TReal)) : /* keep it small for memory access, to fit in chip cache */ \
+                                (4096/sizeof(TReal)); /* make it larger for mmap, as the limiting factor is swapping */
+    for(unsigned int m = 0; m < n_methods; m++) {
+        // allow the caller to allocate the memory
+        if(results[m] == NULL) {
+            initialize_mat_full_no_biom_T<TReal,TMat>(results[m], sample_ids.data(), table.n_samples, mmap_dir);
+        }
+
+        if ((results[m]==NULL) || (results[m]->matrix==NULL) || (results[m]->sample_ids==NULL) ) {
+            fprintf(stderr, "Memory allocation error! (initialize_mat)\n");
+            exit(EXIT_FAILURE);
+        }
+
+        {
+          // use the computed stripes directly, no need for an intermediate copy
+          su::MemoryStripesT<TFloat> ps(dm_stripes[m]);
+          su::stripes_to_matrix_T<TReal,TFloat>(ps, table.n_samples, stripe_stop, results[m]->matrix, tile_size);
+        }
+        // release as we go, to keep the peak memory low
+        destroy_stripes(dm_stripes[m], tasks);
+    }
+    TDBG_STEP("stripes_to_matrix")
+
+    return okay;
+}
+
+template<class TReal, class TMat>
+compute_status one_off_matrix_multi_T(su::biom_interface &table, const su::BPTree &tree,
+                                      const char* const * unifrac_methods, const double* alphas, unsigned int n_methods,
+                                      bool bypass_tips, bool normalize_sample_counts, unsigned int n_substeps,
+                                      const char *mmap_dir,
+                                      TMat** results) {
+    if (mmap_dir!=NULL) {
+     if (mmap_dir[0]==0) mmap_dir = NULL; // easier to have a simple test going on
+    }
+
+    if (n_methods==0) return unknown_method;
+
+    std::vector<Method> methods(n_methods);
+    std::vector<double> method_alphas(n_methods);
+    for(unsigned int i = 0; i < n_methods; i++) {
+        SET_METHOD(unifrac_methods[i], unknown_method)
+        methods[i] = method;
+        method_alphas[i] = alphas[i];
+    }
+
+    // all methods share the same stripes precision
+    const bool use_fp32 = su::is_fp32_method(methods[0]);
+    for(unsigned int i = 1; i < n_methods; i++) {
+        if (su::is_fp32_method(methods[i]) != use_fp32) return invalid_method;
+    }
+
+    if (use_fp32) {
+      return one_off_matrix_multi_stripes_T<TReal,TMat,float>(table, tree, methods, method_alphas, bypass_tips, normalize_sample_counts,
+                                                              n_substeps, mmap_dir, results);
+    } else {
+      return one_off_matrix_multi_stripes_T<TReal,TMat,double>(table, tree, methods, method_alphas, bypass_tips, normalize_sample_counts,
+                                                               n_substeps, mmap_dir, results);
+    }
+}
+
+template<class TReal, class TMat>
+compute_status one_off_matrix_multi_v3_T(su::biom_inmem &table, const su::BPTree &tree,
+                                         const char* const * unifrac_methods, const double* alphas, unsigned int n_methods,
+                                         bool bypass_tips, bool normalize_sample_counts, unsigned int n_substeps,
+                                         unsigned int subsample_depth, bool subsample_with_replacement, const char *mmap_dir,
+                                         TMat** results) {
+    SETUP_TDBG("one_off_matrix_multi_inmem_v3")
+    if (subsample_depth>0) {
+        su::skbio_biom_subsampled table_subsampled(table, subsample_with_replacement, subsample_depth);
+        if ((table_subsampled.n_samples==0) || (table_subsampled.n_obs==0)) {
+           return table_empty;
+        }
+        TDBG_STEP("subsample")
+        return one_off_matrix_multi_T<TReal,TMat>(table_subsampled,tree,unifrac_methods,alphas,n_methods,bypass_tips,normalize_sample_counts,n_substeps,mmap_dir,results);
+    } else {
+        return one_off_matrix_multi_T<TReal,TMat>(table,tree,unifrac_methods,alphas,n_methods,bypass_tips,normalize_sample_counts,n_substeps,mmap_dir,results);
+    }
+}
+
+compute_status one_off_matrix_multi_v3(const char* biom_filename, const char* tree_filename,
+                                       const char* const * unifrac_methods, const double* alphas, unsigned int n_methods,
+                                       bool bypass_tips, bool normalize_sample_counts, unsigned int n_substeps,
+                                       unsigned int subsample_depth, bool subsample_with_replacement, const char *mmap_dir,
+                                       mat_full_fp64_t** results) {
+    SETUP_TDBG("one_off_matrix_multi")
+    CHECK_FILE(biom_filename, table_missing)
+    CHECK_FILE(tree_filename, tree_missing)
+    PARSE_TREE_TABLE_MMAP(tree_filename, biom_filename, mmap_dir)
+    TDBG_STEP("load_files")
+    return one_off_matrix_multi_v3_T<double,mat_full_fp64_t>(table,tree,unifrac_methods,alphas,n_methods,bypass_tips,normalize_sample_counts,n_substeps,subsample_depth,subsample_with_replacement,mmap_dir,results);
+}
+
+compute_status one_off_matrix_multi_fp32_v3(const char* biom_filename, const char* tree_filename,
+                                            const char* const * unifrac_methods, const double* alphas, unsigned int n_methods,
+                                            bool bypass_tips, bool normalize_sample_counts, unsigned int n_substeps,
+                                            unsigned int subsample_depth, bool subsample_with_replacement, const char *mmap_dir,
+                                            mat_full_fp32_t** results) {
+    SETUP_TDBG("one_off_matrix_multi_fp32")
+    CHECK_FILE(biom_filename, table_missing)
+    CHECK_FILE(tree_filename, tree_missing)
+    PARSE_TREE_TABLE_MMAP(tree_filename, biom_filename, mmap_dir)
+    TDBG_STEP("load_files")
+    return one_off_matrix_multi_v3_T<float,mat_full_fp32_t>(table,tree,unifrac_methods,alphas,n_methods,bypass_tips,normalize_sample_counts,n_substeps,subsample_depth,subsample_with_replacement,mmap_dir,results);
+}
+
 /* As above, but from a pre-loaded tree object */
 compute_status one_off_matrix_v3t(const char* biom_filename, const opaque_bptree_t* tree_data,
                                  const char* unifrac_method, bool variance_adjust, double alpha,
@@ -751,7 +1040,7 @@ compute_status one_off_matrix_v3t(const char* biom_filename, const opaque_bptree
     if (tree_data==NULL) return tree_missing;
     CHECK_FILE(biom_filename, table_missing)
     const su::BPTree &tree = *( (const su::BPTree*) tree_data);
-    su::biom table(biom_filename);
+    su::biom table(biom_filename, mmap_dir);
     VALIDATE_TREE_TABLE(tree, table)
     TDBG_STEP("load_files")
     return one_off_matrix_v3_T<double,mat_full_fp64_t>(table,tree,unifrac_method,variance_adjust,alpha,bypass_tips,normalize_sample_counts,n_substeps,subsample_depth,subsample_with_replacement,mmap_dir,result);
@@ -766,7 +1055,7 @@ compute_status one_off_matrix_fp32_v3t(const char* biom_filename, const opaque_b
     if (tree_data==NULL) return tree_missing;
     CHECK_FILE(biom_filename, table_missing)
     const su::BPTree &tree = *( (const su::BPTree*) tree_data);
-    su::biom table(biom_filename);
+    su::biom table(biom_filename, mmap_dir);
     VALIDATE_TREE_TABLE(tree, table)
     TDBG_STEP("load_files")
     return one_off_matrix_v3_T<float,mat_full_fp32_t>(table,tree,unifrac_method,variance_adjust,alpha,bypass_tips,normalize_sample_counts,n_substeps,subsample_depth,subsample_with_replacement,mmap_dir,result);
@@ -947,10 +1236,12 @@ inline std::vector<std::string> stringlist_to_vector(const char *stringlist) {
 
 
 // Internal: Make sure TReal and real_id match
+// seeds - if not NULL, the random seed to use for each column, else use the shared generator
 template<class TReal, class TMat>
 inline compute_status compute_permanova_T(const char *grouping_filename, unsigned int n_columns, const char* const* columns,
                                           TMat * result, unsigned int permanova_perms,
-                                          TReal *fstats, TReal *pvalues, uint32_t *n_groups) {
+                                          TReal *fstats, TReal *pvalues, uint32_t *n_groups,
+                                          const int *seeds=NULL) {
      const uint32_t n_samples = result->n_samples;
      uint32_t *grouping = new uint32_t[n_samples];
 
@@ -967,7 +1258,8 @@ inline compute_status compute_permanova_T(const char *grouping_filename, unsigne
 
        su::permanova(result->matrix, n_samples,
                      grouping, permanova_perms,
-                     fstats[i], pvalues[i]);
+                     fstats[i], pvalues[i],
+                     (seeds==NULL) ? -1 : seeds[i]);
      }
      delete[] grouping;
 
@@ -1333,7 +1625,8 @@ public:
    }
 
    // Note: May destroy the content of result->matrix
-   void add_result(TMat * result, bool save_dist) {
+   // pcoa_seed - random seed used by pcoa, if negative use the shared generator
+   void add_result(TMat * result, bool save_dist, int pcoa_seed=-1) {
       SETUP_TDBG("WriteHDF5Multi_add_result")
 
       char fmtstr[64];
@@ -1366,7 +1659,7 @@ public:
          TReal * samples;
          TReal * proportion_explained;
 
-         su::pcoa_inplace(result->matrix, n_samples, pcoa_dims, eigenvalues, samples, proportion_explained);
+         su::pcoa_inplace(result->matrix, n_samples, pcoa_dims, eigenvalues, samples, proportion_explained, pcoa_seed);
          TDBG_STEP("pcoa computed")
 
          char fmtstr2[64];
@@ -1387,6 +1680,36 @@ public:
       n_results++;
    }
 
+   // Save the summary of all the results, instead of the individual ones
+   // Note: Destroys the content of mean->matrix, if pcoa is requested
+   void add_summary(TMat * mean, TMat * m2, uint32_t n) {
+      const auto n_samples = mean->n_samples;
+      {
+        herr_t status = write_hdf5_array2D<TReal>(output_file_id,real_id,
+                         "matrix_mean", n_samples, n_samples, mean->matrix);
+        if (status<0) throw "Mean write failed";
+      }
+      {
+        herr_t status = write_hdf5_array2D<TReal>(output_file_id,real_id,
+                         "matrix_m2", n_samples, n_samples, m2->matrix);
+        if (status<0) throw "M2 write failed";
+      }
+      {
+        herr_t status = write_hdf5_array<uint32_t>(output_file_id, H5T_STD_U32LE,
+                         "n_summarized", 1, &n);
+        if (status<0) throw "Summary count write failed";
+      }
+      // the order, and the pcoa of the mean, if requested
+      add_result(mean, false);
+   }
+
+   // the alpha of each result, in the order they were added
+   void write_alphas(unsigned int n_alphas, const double * alphas) {
+     herr_t status = write_hdf5_array<double>(output_file_id, H5T_IEEE_F64LE,
+                         "alphas", n_alphas, alphas);
+     if (status<0) throw "Alphas write failed";
+   }
+
    void write_stats(unsigned int           stat_n_vals,
                     const char* const    * stat_method_arr, const char* const  * stat_name_arr,
                     const TReal          * stat_val_arr,    const TReal        * stat_pval_arr, const uint32_t  * stat_perm_count_arr,
@@ -1426,6 +1749,70 @@ public:
 
 };
 
+// Running mean and M2 (sum of squared deviations from the mean) of a series of matrices,
+// using Welford's algorithm, so only two matrices are kept, whatever the number of matrices.
+// The variance is m2/(n-1).
+template<class TReal, class TMat>
+class MatrixRunningStats {
+protected:
+   const char *mmap_dir;
+   uint32_t n;
+   TMat *mean;
+   TMat *m2;
+public:
+   MatrixRunningStats(const char *_mmap_dir)
+   : mmap_dir(_mmap_dir)
+   , n(0)
+   , mean(NULL)
+   , m2(NULL)
+   {}
+
+   virtual ~MatrixRunningStats() {
+     if (mean!=NULL) destroy_mat_full_T<TMat,TReal>(&mean);
+     if (m2!=NULL) destroy_mat_full_T<TMat,TReal>(&m2);
+   }
+
+   uint32_t get_n() const {return n;}
+   TMat *get_mean() {return mean;}
+   TMat *get_m2() {return m2;}
+
+   // Returns false if result does not match the previous ones
+   bool add(const TMat * result) {
+     const uint64_t n_samples = result->n_samples;
+     if (n==0) {
+       initialize_mat_full_no_biom_T<TReal,TMat>(mean, result->sample_ids, n_samples, mmap_dir);
+       initialize_mat_full_no_biom_T<TReal,TMat>(m2, result->sample_ids, n_samples, mmap_dir);
+       if ((mean->matrix==NULL) || (m2->matrix==NULL)) return false;
+     } else if (mean->n_samples!=n_samples) {
+       return false;
+     }
+     n++;
+
+     const uint64_t n_els = n_samples*n_samples;
+     const TReal * const __restrict__ in = result->matrix;
+     TReal * const __restrict__ mean_buf = mean->matrix;
+     TReal * const __restrict__ m2_buf = m2->matrix;
+     if (n==1) {
+#pragma omp parallel for schedule(static)
+       for (uint64_t i=0; i<n_els; i++) {
+         mean_buf[i] = in[i];
+         m2_buf[i] = 0;
+       }
+     } else {
+       const TReal inv_n = TReal(1.0)/n;
+#pragma omp parallel for schedule(static)
+       for (uint64_t i=0; i<n_els; i++) {
+         const TReal x = in[i];
+         const TReal delta = x - mean_buf[i];
+         const TReal new_mean = mean_buf[i] + delta*inv_n;
+         mean_buf[i] = new_mean;
+         m2_buf[i] += delta*(x - new_mean);
+       }
+     }
+     return true;
+   }
+};
+
 class WriteHDF5MultiFP64 : public WriteHDF5Multi<double,mat_full_fp64_t> {
 public:
    WriteHDF5MultiFP64(const char* output_filename, unsigned int _pcoa_dims)
@@ -1438,10 +1825,25 @@ public:
    : WriteHDF5Multi(H5T_IEEE_F32LE, output_filename, _pcoa_dims) {}
 };
 
+// Join the threads on scope exit, so no joinable thread is ever destroyed
+class ThreadsJoiner {
+public:
+   ThreadsJoiner(std::thread &_t1, std::thread &_t2) : t1(_t1), t2(_t2) {}
+   ~ThreadsJoiner() { join(); }
+
+   void join() {
+     if (t1.joinable()) t1.join();
+     if (t2.joinable()) t2.join();
+   }
+private:
+   std::thread &t1;
+   std::thread &t2;
+};
+
 } // end namespace
 
 template<class TReal, class TMat>
-compute_status unifrac_multi_to_file_T(hid_t real_id, const bool save_dist,
+compute_status unifrac_multi_to_file_T(hid_t real_id, const bool save_dist, const bool summary,
                                         const char* biom_filename, const char* tree_filename, const char* out_filename,
                                         const char* unifrac_method, bool variance_adjust, double alpha,
                                         bool bypass_tips, bool normalize_sample_counts, unsigned int nsubsteps, const char* format,
@@ -1457,10 +1859,14 @@ compute_status unifrac_multi_to_file_T(hid_t real_id, const bool save_dist,
       fprintf(stderr, "ERROR: subsampling depth cannot be 0.\n");
       return table_empty;
     }
+    if (summary && (n_subsamples<1)) {
+      fprintf(stderr, "ERROR: number of subsamples cannot be 0 when summarizing.\n");
+      return table_empty;
+    }
 
     CHECK_FILE(biom_filename, table_missing)
     CHECK_FILE(tree_filename, tree_missing)
-    PARSE_TREE_TABLE(tree_filename, biom_filename)
+    PARSE_TREE_TABLE_MMAP(tree_filename, biom_filename, mmap_dir)
     TDBG_STEP("load_files")
 
     typedef const char* Tcstring;
@@ -1491,29 +1897,99 @@ compute_status unifrac_multi_to_file_T(hid_t real_id, const bool save_dist,
 
     try {
       su::WriteHDF5Multi<TReal,TMat> h5obj(real_id, out_filename,pcoa_dims);
+      // if summary, only the running stats are kept, and saved at the end
+      su::MatrixRunningStats<TReal,TMat> stats(mmap_dir);
+
+      // Pipelined, while subsample i is computed on this thread,
+      // subsample i+1 is rarefied and the result of subsample i-1 is written, each on its own thread.
+      // At most one table and one result are waiting at any time.
+      // The rarefactions are still done one at a time and in order, so the results do not change.
+      // The random seeds of each subsample's pcoa and permanova are drawn on this thread,
+      // before any side stage starts, so the results do not depend on the threading, either.
+      // With a single thread there is nothing to overlap, so the stages are run in order.
+      // Each active side stage uses n_side threads and compute gets the rest (but at least one),
+      // so no more than max_threads are used, unless max_threads is smaller than the number of stages.
+      const unsigned int max_threads = omp_get_max_threads();
+      const bool pipelined = (max_threads>1) && (!omp_in_parallel());
+      unsigned int n_side = 1; // threads used by each of the side stages, adjusted as we go
 
+      su::skbio_biom_subsampled *next_table = new su::skbio_biom_subsampled(table, subsample_with_replacement, subsample_depth);
+      TMat* to_write = NULL;
+      int to_write_pcoa_seed = -1;
+      std::vector<int> permanova_seeds(columns.size());
       for (unsigned int i=0; i<n_subsamples; i++) {
-        su::skbio_biom_subsampled table_subsampled(table, subsample_with_replacement, subsample_depth);
-        if ((table_subsampled.n_samples==0) || (table_subsampled.n_obs==0)) {
+        su::skbio_biom_subsampled *table_subsampled = next_table;
+        next_table = NULL;
+        if ((table_subsampled->n_samples==0) || (table_subsampled->n_obs==0)) {
+           delete table_subsampled;
            rc = table_empty;
            break;
         }
-        TDBG_STEP("subsampled")
 
+        // drawn from their own generator, so the subsamples get the same seeds as without stats
+        const int pcoa_seed = su::draw_random_seed();
+        for (unsigned int j=0; j<permanova_seeds.size(); j++) permanova_seeds[j] = su::draw_random_seed();
+
+        double t_rarefy = 0.0;
+        bool rarefy_failed = false;
+        auto rarefy_next = [&]() {
+            const double t0 = omp_get_wtime();
+            if (pipelined) omp_set_num_threads(n_side);
+            // exceptions cannot leave a thread
+            try {
+              next_table = new su::skbio_biom_subsampled(table, subsample_with_replacement, subsample_depth);
+            } catch (...) {
+              rarefy_failed = true;
+            }
+            t_rarefy = omp_get_wtime() - t0;
+        };
+
+        double t_write = 0.0;
+        bool write_failed = false;
+        auto write_prev = [&]() {
+            const double t0 = omp_get_wtime();
+            if (pipelined) omp_set_num_threads(n_side);
+            // exceptions cannot leave a thread
+            try {
+              if (summary) {
+                write_failed = !stats.add(to_write);
+              } else {
+                h5obj.add_result(to_write, save_dist, to_write_pcoa_seed);
+              }
+            } catch (...) {
+              write_failed = true;
+            }
+            destroy_mat_full_T<TMat,TReal>(&to_write);
+            to_write = NULL;
+            t_write = omp_get_wtime() - t0;
+        };
+
+        std::thread rarefy_thread;
+        std::thread write_thread;
+        su::ThreadsJoiner joiner(rarefy_thread, write_thread);
+        if (pipelined) {
+          if ((i+1)<n_subsamples) rarefy_thread = std::thread(rarefy_next);
+          if (to_write!=NULL) write_thread = std::thread(write_prev);
+          const unsigned int n_side_all = n_side * ((rarefy_thread.joinable() ? 1 : 0) + (write_thread.joinable() ? 1 : 0));
+          omp_set_num_threads((max_threads>n_side_all) ? (max_threads-n_side_all) : 1);
+        } else {
+          // nothing to overlap with, just do them in order
+          if ((i+1)<n_subsamples) rarefy_next();
+          if (to_write!=NULL) write_prev();
+        }
+
+        const double t0 = omp_get_wtime();
         TMat* result = NULL;
-        rc = one_off_matrix_T<TReal,TMat>(table_subsampled,tree,unifrac_method,variance_adjust,alpha,bypass_tips,normalize_sample_counts,nsubsteps,mmap_dir,&result);
-        if (rc!=okay) break;
-        TDBG_STEP("matrix computed")
+        try {
+          rc = one_off_matrix_T<TReal,TMat>(*table_subsampled,tree,unifrac_method,variance_adjust,alpha,bypass_tips,normalize_sample_counts,nsubsteps,mmap_dir,&result);
 
-        if (permanova_perms>0) {
+          if ((rc==okay) && (permanova_perms>0)) {
             const unsigned int n_columns = columns.size();
             TReal *fstats = pm_fstats+(i*n_columns);
             TReal *pvalues = pm_pvalues+(i*n_columns);
             uint32_t *n_groups = pm_n_groups+(i*n_columns);
 
-            rc = compute_permanova_T<TReal,TMat>(grouping_filename,n_columns,columns_c,result,permanova_perms,fstats,pvalues,n_groups);
-            if (rc!=okay) break;
-            TDBG_STEP("permanova computed")
+            rc = compute_permanova_T<TReal,TMat>(grouping_filename,n_columns,columns_c,result,permanova_perms,fstats,pvalues,n_groups,permanova_seeds.data());
 
             char fmtstr[32];
             snprintf(fmtstr,31,":%d",i);
@@ -1523,10 +1999,56 @@ compute_status unifrac_multi_to_file_T(hid_t real_id, const bool save_dist,
               pm_columns[idx] = columns[j] + fmtstr;
               pm_columns_c[idx] = pm_columns[idx].c_str();
             }
+          }
+        } catch (...) {
+          rc = output_error;
+        }
+        const double t_compute = omp_get_wtime() - t0;
+
+        joiner.join();
+        delete table_subsampled;
+        to_write = result;
+        to_write_pcoa_seed = pcoa_seed;
+        TDBG_STEP("subsample computed")
+
+        if ((rc==okay) && (write_failed || rarefy_failed)) rc = output_error;
+        if (rc!=okay) break;
+
+        // move threads toward whichever side is the bottleneck
+        const double t_side = std::max(t_rarefy, t_write);
+        if ((t_side > 1.1*t_compute) && ((2*(n_side+1))<max_threads)) {
+          n_side++;
+        } else if ((t_compute > 1.1*t_side) && (n_side>1)) {
+          n_side--;
         }
-        h5obj.add_result(result, save_dist);
-        destroy_mat_full_T<TMat,TReal>(&result);
       } // for i
+      if (pipelined) omp_set_num_threads(max_threads);
+      if (next_table!=NULL) delete next_table;
+
+      if (to_write!=NULL) {
+        try {
+          if (rc==okay) {
+            if (summary) {
+              if (!stats.add(to_write)) rc = output_error;
+            } else {
+              h5obj.add_result(to_write, save_dist, to_write_pcoa_seed);
+            }
+          }
+        } catch (...) {
+          rc = output_error;
+        }
+        destroy_mat_full_T<TMat,TReal>(&to_write);
+      }
+      if ((rc==okay) && summary) {
+        if (stats.get_n()==0) {
+          // nothing was summarized, so there is nothing to save
+          rc = table_empty;
+        } else {
+          h5obj.add_summary(stats.get_mean(), stats.get_m2(), stats.get_n());
+        }
+      }
+      TDBG_STEP("subsamples saved")
+
       if ((rc==okay)&&(permanova_perms>0)) {
               const unsigned int n_columns = columns.size();
               const unsigned int n_els = n_columns*n_subsamples;
@@ -1572,14 +2094,22 @@ compute_status unifrac_multi_to_file_v3(const char* biom_filename, const char* t
 {
     bool fp64;
     bool save_dist;
-    compute_status rc = is_fp64(unifrac_method, format, fp64, save_dist);
+    // hdf5_summary only saves the mean and M2 across the subsamples
+    const bool summary = (std::string(format)=="hdf5_summary");
+    compute_status rc;
+    if (summary) {
+      save_dist = false;
+      rc = is_fp64_method(unifrac_method, fp64);
+    } else {
+      rc = is_fp64(unifrac_method, format, fp64, save_dist);
+    }
 
     if (rc!=okay) {
       return rc;
     }
 
     if (fp64) {
-      rc = unifrac_multi_to_file_T<double,mat_full_fp64_t>(H5T_IEEE_F64LE, save_dist,
+      rc = unifrac_multi_to_file_T<double,mat_full_fp64_t>(H5T_IEEE_F64LE, save_dist, summary,
                                      biom_filename, tree_filename, out_filename,
                                      unifrac_method, variance_adjust, alpha,
                                      bypass_tips, normalize_sample_counts, nsubsteps, format,
@@ -1587,7 +2117,7 @@ compute_status unifrac_multi_to_file_v3(const char* biom_filename, const char* t
                                      pcoa_dims, permanova_perms, grouping_filename, grouping_columns,
                                      mmap_dir);
    } else {
-      rc = unifrac_multi_to_file_T<float,mat_full_fp32_t>(H5T_IEEE_F32LE, save_dist,
+      rc = unifrac_multi_to_file_T<float,mat_full_fp32_t>(H5T_IEEE_F32LE, save_dist, summary,
                                      biom_filename, tree_filename, out_filename,
                                      unifrac_method, variance_adjust, alpha,
                                      bypass_tips, normalize_sample_counts, nsubsteps, format,
@@ -1599,6 +2129,94 @@ compute_status unifrac_multi_to_file_v3(const char* biom_filename, const char* t
    return rc;
 }
 
+template<class TReal, class TMat>
+compute_status unifrac_alphas_to_file_T(hid_t real_id, const bool save_dist,
+                                        const char* biom_filename, const char* tree_filename, const char* out_filename,
+                                        const char* unifrac_method, const double* alphas, unsigned int n_alphas,
+                                        bool bypass_tips, bool normalize_sample_counts, unsigned int nsubsteps,
+                                        unsigned int subsample_depth, bool subsample_with_replacement,
+                                        unsigned int pcoa_dims,
+                                        const char *mmap_dir)
+{
+    compute_status rc = okay;
+    SETUP_TDBG("unifrac_alphas_to_file")
+
+    CHECK_FILE(biom_filename, table_missing)
+    CHECK_FILE(tree_filename, tree_missing)
+    PARSE_TREE_TABLE_MMAP(tree_filename, biom_filename, mmap_dir)
+    TDBG_STEP("load_files")
+
+    // all the alphas are computed together, as a single multi-method run
+    std::vector<const char*> methods(n_alphas, unifrac_method);
+    std::vector<TMat*> results(n_alphas, NULL);
+    rc = one_off_matrix_multi_v3_T<TReal,TMat>(table,tree,methods.data(),alphas,n_alphas,bypass_tips,normalize_sample_counts,nsubsteps,
+                                               subsample_depth,subsample_with_replacement,mmap_dir,results.data());
+    TDBG_STEP("matrices computed")
+
+    if (rc==okay) {
+      try {
+        su::WriteHDF5Multi<TReal,TMat> h5obj(real_id, out_filename,pcoa_dims);
+        h5obj.write_alphas(n_alphas, alphas);
+        for (unsigned int i=0; i<n_alphas; i++) {
+          h5obj.add_result(results[i], save_dist);
+          destroy_mat_full_T<TMat,TReal>(&results[i]);
+          results[i] = NULL;
+        }
+      } catch (...) {
+         // the only one throwing should be h5obj
+         rc = output_error;
+      }
+    }
+    for (unsigned int i=0; i<n_alphas; i++) {
+      if (results[i]!=NULL) destroy_mat_full_T<TMat,TReal>(&results[i]);
+    }
+
+    TDBG_STEP("finished")
+    return rc;
+}
+
+compute_status unifrac_alphas_to_file_v3(const char* biom_filename, const char* tree_filename, const char* out_filename,
+                                         const char* unifrac_method, const double* alphas, unsigned int n_alphas,
+                                         bool bypass_tips, bool normalize_sample_counts, unsigned int nsubsteps, const char* format,
+                                         unsigned int subsample_depth, bool subsample_with_replacement,
+                                         unsigned int pcoa_dims,
+                                         const char *mmap_dir)
+{
+    const std::string method_string(unifrac_method);
+    if ((method_string!="generalized") && (method_string!="generalized_fp32") && (method_string!="generalized_fp64")) {
+      return invalid_method;
+    }
+    if (n_alphas==0) {
+      return invalid_method;
+    }
+
+    bool fp64;
+    bool save_dist;
+    compute_status rc = is_fp64(unifrac_method, format, fp64, save_dist);
+
+    if (rc!=okay) {
+      return rc;
+    }
+
+    if (fp64) {
+      rc = unifrac_alphas_to_file_T<double,mat_full_fp64_t>(H5T_IEEE_F64LE, save_dist,
+                                     biom_filename, tree_filename, out_filename,
+                                     unifrac_method, alphas, n_alphas,
+                                     bypass_tips, normalize_sample_counts, nsubsteps,
+                                     subsample_depth, subsample_with_replacement,
+                                     pcoa_dims, mmap_dir);
+   } else {
+      rc = unifrac_alphas_to_file_T<float,mat_full_fp32_t>(H5T_IEEE_F32LE, save_dist,
+                                     biom_filename, tree_filename, out_filename,
+                                     unifrac_method, alphas, n_alphas,
+                                     bypass_tips, normalize_sample_counts, nsubsteps,
+                                     subsample_depth, subsample_with_replacement,
+                                     pcoa_dims, mmap_dir);
+   }
+
+   return rc;
+}
+
 IOStatus write_mat(const char* output_filename, mat_t* result) {
     std::ofstream output;
     SETUP_TDBG("write_mat")
@@ -1969,7 +2587,9 @@ IOStatus write_vec(const char* output_filename, r_vec* result) {
     return write_okay;
 }
 
-IOStatus write_partial(const char* output_filename, const partial_mat_t* result) {
+// TReal is the precision of the stripes, must match the magic
+template<class TPMat, class TReal>
+IOStatus write_partial_T(const char* output_filename, const TPMat* result, const uint32_t magic) {
     int fd = open(output_filename, O_WRONLY | O_CREAT | O_TRUNC,  S_IRUSR |  S_IWUSR );
     if (fd==-1) return write_error;
 
@@ -2001,7 +2621,7 @@ IOStatus write_partial(const char* output_filename, const partial_mat_t* result)
       if (sample_id_length_compressed<1)  {close(fd); return open_error;}
 
       uint32_t header[8];
-      header[0] = PARTIAL_MAGIC_V2;
+      header[0] = magic;
       header[1] = result->n_samples;
       header[2] = n_stripes;
       header[3] = result->stripe_start;
@@ -2021,13 +2641,13 @@ IOStatus write_partial(const char* output_filename, const partial_mat_t* result)
     }
 
     {
-      int max_compressed = LZ4_compressBound(sizeof(double) * result->n_samples);
+      int max_compressed = LZ4_compressBound(sizeof(TReal) * result->n_samples);
       char * const cmp_buf_raw = (char *)malloc(max_compressed+sizeof(uint32_t));
       char * const cmp_buf = cmp_buf_raw + sizeof(uint32_t);
 
       /* stripe information */
       for(unsigned int i = 0; i < n_stripes; i++) {
-        int cmp_size = LZ4_compress_default((const char *) result->stripes[i],cmp_buf,sizeof(double) * result->n_samples,max_compressed);
+        int cmp_size = LZ4_compress_default((const char *) result->stripes[i],cmp_buf,sizeof(TReal) * result->n_samples,max_compressed);
         if (cmp_size<1)  {close(fd); return open_error;}
 
         uint32_t *cmp_buf_size_p = (uint32_t *)cmp_buf_raw;
@@ -2043,7 +2663,7 @@ IOStatus write_partial(const char* output_filename, const partial_mat_t* result)
     /* footer */
     {
       uint32_t header[1];
-      header[0] = PARTIAL_MAGIC_V2;
+      header[0] = magic;
 
       cnt=write(fd,header, 1 * sizeof(uint32_t));
       if (cnt<1)  {close(fd); return open_error;}
@@ -2054,6 +2674,14 @@ IOStatus write_partial(const char* output_filename, const partial_mat_t* result)
     return write_okay;
 }
 
+IOStatus write_partial(const char* output_filename, const partial_mat_t* result) {
+    return write_partial_T<partial_mat_t,double>(output_filename, result, PARTIAL_MAGIC_V2);
+}
+
+IOStatus write_partial_fp32(const char* output_filename, const partial_mat_fp32_t* result) {
+    return write_partial_T<partial_mat_fp32_t,float>(output_filename, result, PARTIAL_MAGIC_V2_FP32);
+}
+
 IOStatus _is_partial_file(const char* input_filename) {
     int fd = open(input_filename, O_RDONLY );
     if (fd==-1) return open_error;
@@ -2063,20 +2691,22 @@ IOStatus _is_partial_file(const char* input_filename) {
     close(fd);
 
     if (cnt!=sizeof(uint32_t)) return magic_incompatible;
-    if ( header[0] != PARTIAL_MAGIC_V2) return magic_incompatible;
+    if ( (header[0] != PARTIAL_MAGIC_V2) && (header[0] != PARTIAL_MAGIC_V2_FP32) ) return magic_incompatible;
 
     return read_okay;
 }
 
+// magic is set to the one found in the file, which determines the precision of the stripes
 template<class TPMat>
-inline IOStatus read_partial_header_fd(int fd, TPMat &result) {
+inline IOStatus read_partial_header_fd(int fd, TPMat &result, uint32_t &magic) {
     ssize_t cnt=-1;
 
     uint32_t header[8];
     cnt = read(fd,header,8*sizeof(uint32_t));
     if (cnt != (8*sizeof(uint32_t))) {return magic_incompatible;}
 
-    if ( header[0] != PARTIAL_MAGIC_V2) {return magic_incompatible;}
+    if ( (header[0] != PARTIAL_MAGIC_V2) && (header[0] != PARTIAL_MAGIC_V2_FP32) ) {return magic_incompatible;}
+    magic = header[0];
 
     const uint32_t n_samples = header[1];
     const uint32_t n_stripes = header[2];
@@ -2136,8 +2766,37 @@ inline IOStatus read_partial_header_fd(int fd, TPMat &result) {
     return read_okay;
 }
 
+// Decompress a stripe into a double buffer of n_samples elements
+// The stripe is stored as fp32 if magic is PARTIAL_MAGIC_V2_FP32, and is converted in place
+// Returns false if the content does not match the expected size
+inline bool decompress_partial_stripe(const char *cmp_buf, uint32_t cmp_size, double *stripe, uint32_t n_samples, uint32_t magic) {
+    if (magic != PARTIAL_MAGIC_V2_FP32) {
+      const int cnt = LZ4_decompress_safe(cmp_buf, (char *) stripe, cmp_size, sizeof(double) * n_samples);
+      return (cnt == int(sizeof(double) * n_samples));
+    }
+
+    const int cnt = LZ4_decompress_safe(cmp_buf, (char *) stripe, cmp_size, sizeof(float) * n_samples);
+    if (cnt != int(sizeof(float) * n_samples)) return false;
+
+    // fp32 stripe, expand in place, starting from the end
+    const float *stripe32 = (const float *) stripe;
+    for(int64_t i = int64_t(n_samples)-1; i >= 0; i--) {
+        const double val = stripe32[i];
+        stripe[i] = val;
+    }
+    return true;
+}
+
+// Same as above, but into a float buffer, which is only possible if magic is PARTIAL_MAGIC_V2_FP32
+inline bool decompress_partial_stripe(const char *cmp_buf, uint32_t cmp_size, float *stripe, uint32_t n_samples, uint32_t magic) {
+    if (magic != PARTIAL_MAGIC_V2_FP32) return false;
+
+    const int cnt = LZ4_decompress_safe(cmp_buf, (char *) stripe, cmp_size, sizeof(float) * n_samples);
+    return (cnt == int(sizeof(float) * n_samples));
+}
+
 template<class TPMat>
-inline IOStatus read_partial_data_fd(int fd, TPMat &result) {
+inline IOStatus read_partial_data_fd(int fd, TPMat &result, uint32_t magic) {
     ssize_t cnt=-1;
 
     const uint32_t n_samples = result.n_samples;
@@ -2168,8 +2827,7 @@ inline IOStatus read_partial_data_fd(int fd, TPMat &result) {
             fprintf(stderr, "failed\n");
             exit(1);
         }
-        cnt = LZ4_decompress_safe(cmp_buf, (char *) result.stripes[i],cmp_size,sizeof(double) * n_samples);
-        if (cnt != ssize_t( sizeof(double) * n_samples ) ) {free(cmp_buf); return magic_incompatible;}
+        if (!decompress_partial_stripe(cmp_buf, cmp_size, result.stripes[i], n_samples, magic)) {free(cmp_buf); return magic_incompatible;}
 
         cmp_buf_size_p = (uint32_t *)(cmp_buf+cmp_size);
       }
@@ -2180,8 +2838,9 @@ inline IOStatus read_partial_data_fd(int fd, TPMat &result) {
     return read_okay;
 }
 
-template<class TPMat>
-inline IOStatus read_partial_one_stripe_fd(int fd, TPMat &result, uint32_t stripe_idx) {
+// Read the stripe in stripes[stripe_idx], which is either result.stripes or result.stripes_fp32
+template<class TPMat, class TFloat>
+inline IOStatus read_partial_one_stripe_fd(int fd, TPMat &result, TFloat** stripes, uint32_t stripe_idx, uint32_t magic) {
     ssize_t cnt=-1;
 
     const uint32_t n_samples = result.n_samples;
@@ -2229,13 +2888,18 @@ inline IOStatus read_partial_one_stripe_fd(int fd, TPMat &result, uint32_t strip
         cnt = read(fd,cmp_buf , read_size );
         if (cnt != ssize_t(read_size)) {free(cmp_buf); return magic_incompatible;}
 
-        result.stripes[stripe_idx] = (double *) malloc(sizeof(double) * n_samples);
-        if(result.stripes[stripe_idx] == NULL) {
+        stripes[stripe_idx] = (TFloat *) malloc(sizeof(TFloat) * n_samples);
+        if(stripes[stripe_idx] == NULL) {
             fprintf(stderr, "failed\n");
             exit(1);
         }
-        cnt = LZ4_decompress_safe(cmp_buf, (char *) result.stripes[stripe_idx],cmp_size,sizeof(double) * n_samples);
-        if (cnt != ssize_t( sizeof(double) * n_samples ) ) {free(cmp_buf); return magic_incompatible;}
+        if (!decompress_partial_stripe(cmp_buf, cmp_size, stripes[stripe_idx], n_samples, magic)) {
+            // do not leave a partially filled stripe behind, it would be considered as read
+            free(stripes[stripe_idx]);
+            stripes[stripe_idx] = NULL;
+            free(cmp_buf);
+            return magic_incompatible;
+        }
       }
 
       free(cmp_buf);
@@ -2252,13 +2916,13 @@ IOStatus read_partial(const char* input_filename, partial_mat_t** result_out) {
     partial_mat_t* result = (partial_mat_t*)malloc(sizeof(partial_mat));
 
     IOStatus sts = magic_incompatible;
+    uint32_t magic = 0;
 
-    sts = read_partial_header_fd<partial_mat_t>(fd, *result);
+    sts = read_partial_header_fd<partial_mat_t>(fd, *result, magic);
     if (sts==read_okay)
-       sts = read_partial_data_fd<partial_mat_t>(fd, *result);
+       sts = read_partial_data_fd<partial_mat_t>(fd, *result, magic);
 
     if (sts==read_okay) {
-      IOStatus sts = read_okay;
       /* sanity check the footer */
       uint32_t header[1];
       header[0] = 0;
@@ -2266,7 +2930,7 @@ IOStatus read_partial(const char* input_filename, partial_mat_t** result_out) {
       if (cnt != ssize_t(sizeof(uint32_t))) {sts= magic_incompatible;}
     
       if (sts==read_okay) {
-        if ( header[0] != PARTIAL_MAGIC_V2) {sts= magic_incompatible;}
+        if (header[0] != magic) {sts= magic_incompatible;}
       }
     }
 
@@ -2287,14 +2951,17 @@ IOStatus read_partial_header(const char* input_filename, partial_dyn_mat_t** res
 
     /* initialize the partial result structure */
     partial_dyn_mat_t* result = (partial_dyn_mat_t*)malloc(sizeof(partial_dyn_mat));
+    uint32_t magic = 0;
     {
-      IOStatus sts = read_partial_header_fd<partial_dyn_mat_t>(fd, *result);
+      IOStatus sts = read_partial_header_fd<partial_dyn_mat_t>(fd, *result, magic);
       if (sts!=read_okay) {free(result); close(fd); return sts;}
     }
 
     // save the offset of the first stripe
     const uint32_t n_stripes = result->stripe_stop-result->stripe_start;
     result->stripes = (double**) calloc(n_stripes,sizeof(double*));
+    // fp32 stripes are kept as such, see read_partial_one_stripe
+    result->stripes_fp32 = (magic==PARTIAL_MAGIC_V2_FP32) ? ((float**) calloc(n_stripes,sizeof(float*))) : NULL;
     result->offsets = (uint64_t*) calloc(n_stripes,sizeof(uint64_t));
     result->offsets[0] = lseek(fd,0,SEEK_CUR);
     
@@ -2306,18 +2973,32 @@ IOStatus read_partial_header(const char* input_filename, partial_dyn_mat_t** res
     return read_okay;
 }
 
-IOStatus read_partial_one_stripe(partial_dyn_mat_t* result, uint32_t stripe_idx) {
-    if (result->stripes[stripe_idx]!=0) return read_okay; // will not re-read
+// Read the stripe in stripes, which is either result->stripes or result->stripes_fp32
+// fp32 partials can be read in both, fp64 ones only in result->stripes
+template<class TFloat>
+inline IOStatus read_partial_one_stripe_T(partial_dyn_mat_t* result, TFloat** stripes, uint32_t stripe_idx) {
+    if (stripes[stripe_idx]!=0) return read_okay; // will not re-read
 
     int fd = open(result->filename, O_RDONLY );
     if (fd==-1) return open_error;
 
-    IOStatus sts = read_partial_one_stripe_fd<partial_dyn_mat_t>(fd, *result, stripe_idx);
+    // the header was already validated, and set stripes_fp32 based on the magic
+    const uint32_t magic = (result->stripes_fp32!=NULL) ? PARTIAL_MAGIC_V2_FP32 : PARTIAL_MAGIC_V2;
+
+    IOStatus sts = read_partial_one_stripe_fd<partial_dyn_mat_t,TFloat>(fd, *result, stripes, stripe_idx, magic);
 
     close(fd);
     return sts;
 }
 
+IOStatus read_partial_one_stripe(partial_dyn_mat_t* result, uint32_t stripe_idx) {
+    if (result->stripes_fp32!=NULL) {
+      return read_partial_one_stripe_T<float>(result, result->stripes_fp32, stripe_idx);
+    } else {
+      return read_partial_one_stripe_T<double>(result, result->stripes, stripe_idx);
+    }
+}
+
 
 template<class TPMat>
 MergeStatus check_partial(const TPMat* const * partial_mats, int n_partials, bool verbose) {
@@ -2397,8 +3078,15 @@ MergeStatus validate_partial(const partial_dyn_mat_t* const * partial_mats, int
     return check_partial(partial_mats, n_partials, true);
 }
 
+// The stripes buffer of a partial matching the precision
+template<class TFloat> inline TFloat** get_partial_stripes(partial_dyn_mat_t &partial_mat);
+template<> inline double** get_partial_stripes<double>(partial_dyn_mat_t &partial_mat) {return partial_mat.stripes;}
+template<> inline float** get_partial_stripes<float>(partial_dyn_mat_t &partial_mat) {return partial_mat.stripes_fp32;}
+
 // Will keep only the strictly necessary stripes in memory... reading just in time
-class PartialStripes : public su::ManagedStripes {
+// Note: float stripes are only available if all the partials are fp32
+template<class TFloat>
+class PartialStripesT : public su::ManagedStripesT<TFloat> {
         private:
            const uint32_t n_partials;
            mutable partial_dyn_mat_t* * partial_mats; // link only, not owned
@@ -2414,32 +3102,34 @@ class PartialStripes : public su::ManagedStripes {
               return 0; // should never get here
            }
         public:
-           PartialStripes(uint32_t _n_partials, partial_dyn_mat_t* * _partial_mats)
+           PartialStripesT(uint32_t _n_partials, partial_dyn_mat_t* * _partial_mats)
            : n_partials(_n_partials)
            , partial_mats(_partial_mats)
            {}
 
-           virtual const double *get_stripe(uint32_t stripe) const {
+           virtual const TFloat *get_stripe(uint32_t stripe) const {
               uint32_t pidx = find_partial_idx(stripe);
               partial_dyn_mat_t * const partial_mat = partial_mats[pidx];
+              TFloat ** const stripes = get_partial_stripes<TFloat>(*partial_mat);
               uint32_t sidx = stripe-partial_mat->stripe_start;
 
-              if (partial_mat->stripes[sidx]==NULL) {
-                  read_partial_one_stripe(partial_mat,sidx);
+              if (stripes[sidx]==NULL) {
+                  read_partial_one_stripe_T<TFloat>(partial_mat,stripes,sidx);
                   // ignore any errors, not clear what to do
                   // will just return NULL
               }
 
-              return partial_mat->stripes[sidx];
+              return stripes[sidx];
            }
            virtual void release_stripe(uint32_t stripe) const {
               uint32_t pidx = find_partial_idx(stripe);
               partial_dyn_mat_t * const partial_mat = partial_mats[pidx];
+              TFloat ** const stripes = get_partial_stripes<TFloat>(*partial_mat);
               uint32_t sidx = stripe-partial_mat->stripe_start;
 
-              if (partial_mat->stripes[sidx]!=NULL) {
-                 free(partial_mat->stripes[sidx]);
-                 partial_mat->stripes[sidx]=NULL;
+              if (stripes[sidx]!=NULL) {
+                 free(stripes[sidx]);
+                 stripes[sidx]=NULL;
               }
            }
 };
@@ -2461,11 +3151,21 @@ MergeStatus merge_partial_to_matrix_T(partial_dyn_mat_t* * partial_mats, int n_p
     if ((*result)->matrix==NULL) return incomplete_stripe_set;
     if ((*result)->sample_ids==NULL) return incomplete_stripe_set;
 
-    PartialStripes ps(n_partials,partial_mats);
     const uint32_t tile_size = (mmap_dir==NULL) ? \
                                   (128/sizeof(TReal)) : /* keep it small for memory access, to fit in chip cache */ \
                                   (4096/sizeof(TReal)); /* make it larger for mmap, as the limiting factor is swapping */
-    su::stripes_to_matrix_T<TReal>(ps, partial_mats[0]->n_samples, partial_mats[0]->stripe_total, (*result)->matrix, tile_size);
+
+    // fp32 partials are merged as such, they are only widened if mixed with fp64 ones
+    bool all_fp32 = true;
+    for (int i=0; i<n_partials; i++) all_fp32 = all_fp32 && (partial_mats[i]->stripes_fp32!=NULL);
+
+    if (all_fp32) {
+      PartialStripesT<float> ps(n_partials,partial_mats);
+      su::stripes_to_matrix_T<TReal,float>(ps, partial_mats[0]->n_samples, partial_mats[0]->stripe_total, (*result)->matrix, tile_size);
+    } else {
+      PartialStripesT<double> ps(n_partials,partial_mats);
+      su::stripes_to_matrix_T<TReal,double>(ps, partial_mats[0]->n_samples, partial_mats[0]->stripe_total, (*result)->matrix, tile_size);
+    }
 
     return merge_okay;
 }
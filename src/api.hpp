@@ -21,6 +21,7 @@
 
 #define PARTIAL_MAGIC "SSU-PARTIAL-01"
 #define PARTIAL_MAGIC_V2 0x088ABA02
+#define PARTIAL_MAGIC_V2_FP32 0x088ABA32
 
 /*
  * Set random seed used by this library.
@@ -106,6 +107,21 @@ typedef struct partial_mat {
     bool is_upper_triangle;
 } partial_mat_t;
 
+/* a partial result containing stripe data, fp32
+ *
+ * Same as partial_mat_t, but
+ * stripes <float**> the stripe data of dimension (stripe_stop - stripe_start, n_samples)
+ */
+typedef struct partial_mat_fp32 {
+    uint32_t n_samples;
+    char** sample_ids;
+    float** stripes;
+    uint32_t stripe_start;
+    uint32_t stripe_stop;
+    uint32_t stripe_total;
+    bool is_upper_triangle;
+} partial_mat_fp32_t;
+
 /* a partial resuly, can be populated dynamically
  *
  * n_samples <uint> the number of samples.
@@ -118,6 +134,7 @@ typedef struct partial_mat {
  * is_upper_triangle <bool> whether the stripes correspond to the upper triangle of the resulting matrix.
  *      This is useful for asymmetric unifrac metrics.
  * filename <char*> Name of the file from which to read
+ * stripes_fp32 <float**> the stripe data, if stored as fp32 in the file (PARTIAL_MAGIC_V2_FP32), NULL otherwise
  */
 typedef struct partial_dyn_mat {
     uint32_t n_samples;
@@ -129,6 +146,7 @@ typedef struct partial_dyn_mat {
     uint32_t stripe_total;
     bool is_upper_triangle;
     char* filename;
+    float** stripes_fp32;
 } partial_dyn_mat_t;
 
 /* support structure to carry in biom table information 
@@ -176,20 +194,58 @@ typedef struct opaque_bptree {
 
 /* Read tree from file and fill tree_data
  *
- * tree_filename <const char*> the filename to the correspodning tree.
+ * tree_filename <const char*> the filename to the correspodning tree, either newick or a binary tree cache.
  * tree_data <opaque_bptree_t**> the resulting tree data object, this is initialized within the method so using **
  *
  * read_bptree_opaque returns the following error codes:
  *
- * read_okay      : no problems encountered
- * open_error     : the filename for the tree does not exist
- * unexpected_end : any other error.
+ * read_okay          : no problems encountered
+ * open_error         : the filename for the tree does not exist
+ * magic_incompatible : the tree cache has the wrong magic or version, or is too short
+ * bad_header         : the tree cache is truncated, or its content is inconsistent
+ * read_error         : the tree cache could not be fully read
+ * unexpected_end     : any other error.
  */
 EXTERN IOStatus read_bptree_opaque(const char* tree_filename, opaque_bptree_t** tree_data);
 
 /* Load tree from newick string and fill tree_data */
 EXTERN void load_bptree_opaque(const char* newick, opaque_bptree_t** tree_data);
 
+/* Write tree_data into a binary tree cache file
+ *
+ * cache_filename <const char*> the file to write
+ * tree_data <opaque_bptree_t*> the tree to save
+ *
+ * The cache can be used in place of the newick file in all the functions
+ * that take a tree_filename, and is loaded without any parsing.
+ *
+ * write_bptree_opaque returns the following error codes:
+ *
+ * write_okay     : no problems encountered
+ * open_error     : the file could not be created
+ * write_error    : the file could not be fully written
+ * unexpected_end : tree_data is NULL
+ */
+EXTERN IOStatus write_bptree_opaque(const char* cache_filename, const opaque_bptree_t* tree_data);
+
+/* Make sure cache_filename is an up to date binary tree cache of newick_filename
+ *
+ * newick_filename <const char*> the newick file
+ * cache_filename <const char*> the binary tree cache
+ *
+ * The cache is (re)created if missing, invalid, or if the size or modification time
+ * (to the nanosecond) of newick_filename do not match the ones recorded in the cache.
+ * Only the header of the cache is read for this check.
+ *
+ * update_bptree_cache returns the following error codes:
+ *
+ * read_okay   : the cache was already up to date
+ * write_okay  : the cache was (re)created
+ * open_error  : newick_filename does not exist, or the cache could not be created
+ * write_error : the cache could not be fully written
+ */
+EXTERN IOStatus update_bptree_cache(const char* newick_filename, const char* cache_filename);
+
 /* Convert nexplicit tree structure into the opaque form */
 EXTERN void convert_bptree_opaque(const support_bptree_t* in_tree, opaque_bptree_t** tree_data);
 
@@ -197,6 +253,7 @@ EXTERN void destroy_mat(mat_t** result);
 EXTERN void destroy_mat_full_fp64(mat_full_fp64_t** result);
 EXTERN void destroy_mat_full_fp32(mat_full_fp32_t** result);
 EXTERN void destroy_partial_mat(partial_mat_t** result);
+EXTERN void destroy_partial_mat_fp32(partial_mat_fp32_t** result);
 EXTERN void destroy_partial_dyn_mat(partial_dyn_mat_t** result);
 EXTERN void destroy_results_vec(r_vec** result);
 
@@ -435,6 +492,45 @@ EXTERN ComputeStatus one_off_matrix_fp32(const char* biom_filename, const char*
                                          const char *mmap_dir,
                                          mat_full_fp32_t** result);
 
+/* Compute several UniFrac methods at once - matrix form
+ *
+ * The tree is traversed only once, and the proportions of each node are shared by all the methods.
+ *
+ * biom_filename <const char*> the filename to the biom table.
+ * tree_filename <const char*> the filename to the correspodning tree.
+ * unifrac_methods <const char**> the requested unifrac methods, must all be of the same precision.
+ * alphas <const double*> GUniFrac alpha for each method, only relevant if method == generalized.
+ * n_methods <uint> the number of elements in unifrac_methods, alphas and results.
+ * bypass_tips <bool> disregard tips, reduces compute by about 50%
+ * normalize_sample_counts <bool> normalize sample counts, use false for absolute quants mode
+ * n_substeps <uint> the number of substeps/blocks to use.
+ * subsample_depth <uint> Depth of subsampling, if >0
+ * subsample_with_replacement <bool> Use subsampling with replacement? (only True supported)
+ * mmap_dir <const char*> If not NULL, area to use for temp memory storage
+ * results <mat_full_fp64_t**> array of n_methods resulting distance matrices, each NULL element is initialized within the method
+ *
+ * one_off_matrix_multi_v3 returns the following error codes:
+ *
+ * okay           : no problems encountered
+ * table_missing  : the filename for the table does not exist
+ * tree_missing   : the filename for the tree does not exist
+ * unknown_method : one of the requested methods is unknown, or no method was requested.
+ * invalid_method : the requested methods do not have the same precision.
+ * table_empty    : the table does not have any entries
+ */
+EXTERN ComputeStatus one_off_matrix_multi_v3(const char* biom_filename, const char* tree_filename,
+                                             const char* const * unifrac_methods, const double* alphas, unsigned int n_methods,
+                                             bool bypass_tips, bool normalize_sample_counts, unsigned int n_substeps,
+                                             unsigned int subsample_depth, bool subsample_with_replacement, const char *mmap_dir,
+                                             mat_full_fp64_t** results);
+
+/* As above, but fp32 variant */
+EXTERN ComputeStatus one_off_matrix_multi_fp32_v3(const char* biom_filename, const char* tree_filename,
+                                                  const char* const * unifrac_methods, const double* alphas, unsigned int n_methods,
+                                                  bool bypass_tips, bool normalize_sample_counts, unsigned int n_substeps,
+                                                  unsigned int subsample_depth, bool subsample_with_replacement, const char *mmap_dir,
+                                                  mat_full_fp32_t** results);
+
 /* Compute UniFrac from a pair of dense vectors 
  *
  * n_obs <unsigned int> the number of observations, corresponding to length of obs_ids, sample1 and sample2
@@ -562,6 +658,9 @@ EXTERN ComputeStatus unifrac_to_file(const char* biom_filename, const char* tree
  * normalize_sample_counts <bool> normalize sample counts, use false for absolute quants mode
  * n_substeps <uint> the number of substeps to use.
  * format <const char*> output format to use.
+ *                      hdf5_summary saves only the mean and M2 (sum of squared deviations) matrices
+ *                      across the subsamples, as matrix_mean, matrix_m2 and n_summarized,
+ *                      using the precision of the method. The pcoa, if any, is of the mean matrix.
  * n_subsamples <uint> Number of subsamples to compute.
  * subsample_depth <uint> Depth of subsampling.
  * subsample_with_replacement <bool> Use subsampling with replacement? (only True supported)
@@ -588,6 +687,43 @@ EXTERN ComputeStatus unifrac_multi_to_file_v3(const char* biom_filename, const c
                                               unsigned int permanova_perms, const char *grouping_filename, const char *grouping_columns,
                                               const char *mmap_dir);
 
+/* Compute Generalized UniFrac for several alphas and save all the matrices in a single file
+ *
+ * All the alphas are computed in the same pass over the tree, and in the same inner loop.
+ * The output file holds matrix:<i> (and pcoa_*:<i>) for alphas[i], and the alphas themselves.
+ *
+ * biom_filename <const char*> the filename to the biom table.
+ * tree_filename <const char*> the filename to the corresponding tree.
+ * out_filename <const char*> the filename of the output file.
+ * unifrac_method <const char*> the requested unifrac method, must be one of the generalized ones.
+ * alphas <const double*> the GUniFrac alphas.
+ * n_alphas <uint> the number of elements in alphas.
+ * bypass_tips <bool> disregard tips, reduces compute by about 50%
+ * normalize_sample_counts <bool> normalize sample counts, use false for absolute quants mode
+ * n_substeps <uint> the number of substeps to use.
+ * format <const char*> output format to use, one of the hdf5 ones.
+ * subsample_depth <uint> Depth of subsampling, if >0
+ * subsample_with_replacement <bool> Use subsampling with replacement? (only True supported)
+ * pcoa_dims <uint> if not 0, number of dimensions to use or PCoA
+ * mmap_dir <const char*> if not empty, temp dir to use for disk-based memory 
+ *
+ * unifrac_alphas_to_file_v3 returns the following error codes:
+ *
+ * okay           : no problems encountered
+ * table_missing  : the filename for the table does not exist
+ * tree_missing   : the filename for the tree does not exist
+ * unknown_method : the requested format is unknown.
+ * invalid_method : the requested method is not a generalized one, or no alphas were provided.
+ * table_empty    : the table does not have any entries
+ * output_error   : failed to properly write the output file
+ */
+EXTERN ComputeStatus unifrac_alphas_to_file_v3(const char* biom_filename, const char* tree_filename, const char* out_filename,
+                                               const char* unifrac_method, const double* alphas, unsigned int n_alphas,
+                                               bool bypass_tips, bool normalize_sample_counts, unsigned int n_substeps, const char* format,
+                                               unsigned int subsample_depth, bool subsample_with_replacement,
+                                               unsigned int pcoa_dims,
+                                               const char *mmap_dir);
+
 /* Older version, will be deprecated in the future */
 EXTERN ComputeStatus unifrac_multi_to_file_v2(const char* biom_filename, const char* tree_filename, const char* out_filename,
                                               const char* unifrac_method, bool variance_adjust, double alpha,
@@ -807,6 +943,19 @@ EXTERN ComputeStatus partial_v3(const char* biom_filename, const char* tree_file
                                 bool bypass_tips, bool normalize_sample_count, unsigned int n_substeps,
 				unsigned int stripe_start, unsigned int stripe_stop, partial_mat_t** result);
 
+/* Same as partial_v3, but the stripes are kept in fp32 precision
+ *
+ * Only the fp32 methods are supported, i.e. the default method names or explicit *_fp32 names.
+ *
+ * partial_fp32_v3 returns the same error codes as partial_v3, plus
+ *
+ * invalid_method : the requested method is not a fp32 method.
+ */
+EXTERN ComputeStatus partial_fp32_v3(const char* biom_filename, const char* tree_filename,
+                                     const char* unifrac_method, bool variance_adjust, double alpha,
+                                     bool bypass_tips, bool normalize_sample_count, unsigned int n_substeps,
+                                     unsigned int stripe_start, unsigned int stripe_stop, partial_mat_fp32_t** result);
+
 /* Older version, will be deprecated in the future */
 EXTERN ComputeStatus partial(const char* biom_filename, const char* tree_filename,
                              const char* unifrac_method, bool variance_adjust, double alpha,
@@ -856,6 +1005,14 @@ EXTERN ComputeStatus partial(const char* biom_filename, const char* tree_filenam
  */
 EXTERN IOStatus write_partial(const char* filename, const partial_mat_t* result);
 
+/* Write a partial matrix object, fp32
+ *
+ * Same as write_partial, but the stripe values are stored as float,
+ * and PARTIAL_MAGIC_V2_FP32 is used as the magic.
+ * The read functions accept both formats, converting to double as needed.
+ */
+EXTERN IOStatus write_partial_fp32(const char* filename, const partial_mat_fp32_t* result);
+
 /* Read a partial matrix object
  *
  * filename <const char*> the file to write into
@@ -892,6 +1049,8 @@ EXTERN IOStatus read_partial_header(const char* input_filename, partial_dyn_mat_
  * result <partial_dyn_mat_t*> the partial results object
  * stripe_idx <uint> relative stripe number 
  *
+ * The stripe is read in result->stripes_fp32, if not NULL, else in result->stripes.
+ *
  * The following error codes are returned:
  *
  * read_okay          : no problems
@@ -14,4 +14,10 @@ do
         /usr/bin/time -l ./sk ${bench}.tre ${bench}.biom $method > ${res}.${method}.sk.dm 2> ${res}.${method}.sk.stats
         python compare_dms.py ${res}.${method}.sk.dm ${res}.${method}.su.dm
     done
+    # square tiles (default) vs stripes compute engine
+    for method in {unweighted,weighted_normalized,weighted_unnormalized,generalized}
+    do
+        /usr/bin/time -l ./ssu -t ${bench}.tre -i ${bench}.biom -m $method -r hdf5 -o ${res}.${method}.tiles.h5 2> ${res}.${method}.tiles.stats
+        UNIFRAC_USE_TILES=N /usr/bin/time -l ./ssu -t ${bench}.tre -i ${bench}.biom -m $method -r hdf5 -o ${res}.${method}.stripes.h5 2> ${res}.${method}.stripes.stats
+    done
 done
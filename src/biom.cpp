@@ -10,12 +10,13 @@
 #include <cstdlib>
 #include <iostream>
 #include <stdio.h>
+#include <algorithm>
 #include "biom.hpp"
 
 using namespace H5;
 using namespace su;
 
-biom::biom(std::string filename) 
+biom::biom(std::string filename, const char *mmap_dir) 
   : biom_inmem(true)
   , has_hdf5_backing(true) {
     file = H5File(filename.c_str(), H5F_ACC_RDONLY);
@@ -51,15 +52,9 @@ biom::biom(std::string filename)
         }
     }
 
-    uint32_t *current_indices = NULL;
-    double *current_data = NULL;
-    for(unsigned int i = 0; i < obs_ids.size(); i++)  {
-        std::string id_ = obs_ids[i];
-        unsigned int n = get_obs_data_direct(id_, current_indices, current_data);
-        resident_obj.obs_counts_resident[i] = n;
-        resident_obj.obs_indices_resident[i] = current_indices;
-        resident_obj.obs_data_resident[i] = current_data;
-    }
+    load_obs_data(mmap_dir);
+    // counts are typically integers, use less memory if so
+    resident_obj.compact_values();
     compute_sample_counts();
 }
 
@@ -164,49 +159,47 @@ void biom::load_indptr(const char *path, std::vector<uint32_t> &indptr) {
     free(dataout);
 }
 
-unsigned int biom::get_obs_data_direct(const std::string &id, uint32_t *& current_indices_out, double *& current_data_out) {
+void biom::load_obs_data(const char *mmap_dir) {
     if(!has_hdf5_backing) {
         fprintf(stderr, "Lacks HDF5 backing; [%s]:%d\n", 
                 __FILE__, __LINE__);
         exit(EXIT_FAILURE);
     }
 
-    uint32_t idx = obs_id_index.at(id);
-    uint32_t start = obs_indptr[idx];
-    uint32_t end = obs_indptr[idx + 1];
-    
-    hsize_t count[1] = {end - start};
-    hsize_t offset[1] = {start};
-
     DataType indices_dtype = obs_indices.getDataType();
     DataType data_dtype = obs_data.getDataType();
 
     DataSpace indices_dataspace = obs_indices.getSpace();
     DataSpace data_dataspace = obs_data.getSpace();
-    
-    DataSpace indices_memspace(1, count, NULL);
-    DataSpace data_memspace(1, count, NULL);
 
-    indices_dataspace.selectHyperslab(H5S_SELECT_SET, count, offset); 
-    data_dataspace.selectHyperslab(H5S_SELECT_SET, count, offset); 
+    #pragma omp parallel for schedule(static)
+    for(uint32_t i = 0; i < n_obs; i++)
+        resident_obj.obs_counts_resident[i] = obs_indptr[i + 1] - obs_indptr[i];
 
-    current_indices_out = (uint32_t*)malloc(sizeof(uint32_t) * count[0]);
-    if(current_indices_out == NULL) {
-        fprintf(stderr, "Failed to allocate %zd bytes; [%s]:%d\n", 
-                long(sizeof(uint32_t) * count[0]), __FILE__, __LINE__);
-        exit(EXIT_FAILURE);
-    }
-    current_data_out = (double*)malloc(sizeof(double) * count[0]);
-    if(current_data_out == NULL) {
-        fprintf(stderr, "Failed to allocate %zd bytes; [%s]:%d\n", 
-                long(sizeof(double) * count[0]), __FILE__, __LINE__);
-        exit(EXIT_FAILURE);
-    }
+    // the arena is laid out in obs order, just like the datasets
+    resident_obj.malloc_arena(mmap_dir);
 
-    obs_indices.read((void*)current_indices_out, indices_dtype, indices_memspace, indices_dataspace);
-    obs_data.read((void*)current_data_out, data_dtype, data_memspace, data_dataspace);
-    
-    return count[0];
+    if(n_obs == 0)
+        return;
+
+    uint32_t *arena_indices = resident_obj.obs_indices_resident[0];
+    double *arena_data = resident_obj.obs_data_resident[0];
+
+    const uint64_t first_el = obs_indptr[0];
+    const uint64_t total_nnz = obs_indptr[n_obs] - first_el;
+
+    /* read straight into the arena, in large chunks */
+    for(uint64_t chunk_start = 0; chunk_start < total_nnz; chunk_start += LOAD_CHUNK_NNZ) {
+        hsize_t count[1] = {std::min(total_nnz - chunk_start, uint64_t(LOAD_CHUNK_NNZ))};
+        hsize_t offset[1] = {first_el + chunk_start};
+
+        DataSpace memspace(1, count, NULL);
+        indices_dataspace.selectHyperslab(H5S_SELECT_SET, count, offset); 
+        data_dataspace.selectHyperslab(H5S_SELECT_SET, count, offset); 
+
+        obs_indices.read((void*)(arena_indices + chunk_start), indices_dtype, memspace, indices_dataspace);
+        obs_data.read((void*)(arena_data + chunk_start), data_dtype, memspace, data_dataspace);
+    }
 }
 
 unsigned int biom::get_sample_data_direct(const std::string &id, uint32_t *& current_indices_out, double *& current_data_out) {
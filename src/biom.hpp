@@ -25,8 +25,9 @@ namespace su {
             /* default constructor
              *
              * @param filename The path to the BIOM table to read
+             * @param mmap_dir If not NULL, keep the observation data in a file-backed buffer in this directory
              */
-            biom(std::string filename);
+            biom(std::string filename, const char *mmap_dir=NULL);
 
             /* constructor from compress sparse data
              * Note: deprecated, use biom_inmem directly, instead 
@@ -84,7 +85,18 @@ namespace su {
             H5::DataSet sample_data;
             H5::H5File file;
             
-            unsigned int get_obs_data_direct(const std::string &id, uint32_t *& current_indices_out, double *& current_data_out);
+            /* max number of nonzero values read from the observation datasets at once */
+            static constexpr uint32_t LOAD_CHUNK_NNZ = 8*1024*1024;
+
+            /* load all the observation data into resident_obj
+             *
+             * The indices and data datasets are read in large chunks
+             * directly into the contiguous arena of resident_obj.
+             *
+             * @param mmap_dir If not NULL, back the arena with a file in this directory
+             */
+            void load_obs_data(const char *mmap_dir);
+
             unsigned int get_sample_data_direct(const std::string &id, uint32_t *& current_indices_out, double *& current_data_out);
 
             /* load ids from an axis
@@ -8,9 +8,14 @@
  */
 
 #include <cstdlib>
+#include <cmath>
 #include <cstring>
 #include <iostream>
 #include <stdio.h>
+#include <string>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "biom_inmem.hpp"
 
 using namespace su;
@@ -50,6 +55,13 @@ sparse_data::sparse_data(bool _clean_on_destruction)
   , obs_indices_resident(NULL)
   , obs_data_resident(NULL)
   , obs_counts_resident(NULL)
+  , storage(values_fp64)
+  , obs_data32_resident(NULL)
+  , obs_data16_resident(NULL)
+  , arena(NULL)
+  , arena_nnz(0)
+  , arena_bytes(0)
+  , arena_mmapped(false)
 {}
 
 sparse_data::sparse_data(const sparse_data& other, bool _clean_on_destruction)
@@ -59,18 +71,49 @@ sparse_data::sparse_data(const sparse_data& other, bool _clean_on_destruction)
   , obs_indices_resident(_clean_on_destruction?NULL:other.obs_indices_resident)
   , obs_data_resident(_clean_on_destruction?NULL:other.obs_data_resident)
   , obs_counts_resident(_clean_on_destruction?NULL:other.obs_counts_resident)
+  , storage(other.storage)
+  , obs_data32_resident(_clean_on_destruction?NULL:other.obs_data32_resident)
+  , obs_data16_resident(_clean_on_destruction?NULL:other.obs_data16_resident)
+  , arena(NULL)
+  , arena_nnz(0)
+  , arena_bytes(0)
+  , arena_mmapped(false)
 {
     if (_clean_on_destruction && (n_obs>0)) { // must make a copy
         malloc_resident();
+        for (uint32_t i = 0; i < n_obs; i++) obs_counts_resident[i] = other.obs_counts_resident[i];
+        malloc_arena();
+
+        const unsigned int val_size = value_size();
+        #pragma omp parallel for schedule(dynamic,64)
         for (uint32_t i = 0; i < n_obs; i++) {
-            const unsigned int cnt = other.obs_counts_resident[i];
-            obs_counts_resident[i]  = cnt;
-            obs_data_resident[i]    = malloc_and_copy<double>(cnt, other.obs_data_resident[i]);
-            obs_indices_resident[i] = malloc_and_copy<uint32_t>(cnt, other.obs_indices_resident[i]);
+            const unsigned int cnt = obs_counts_resident[i];
+            std::memcpy((void *) get_obs_values(i), other.get_obs_values(i), val_size * cnt);
+            std::memcpy(obs_indices_resident[i], other.obs_indices_resident[i], sizeof(uint32_t) * cnt);
         }
     }
 }
 
+template<class TVal>
+static inline void filter_obs_values(const unsigned int other_cnt,
+                                     const uint32_t * __restrict__ other_indices,
+                                     const TVal     * __restrict__ other_data,
+                                     const double sample_counts[], const double min_sample_counts,
+                                     const uint32_t * __restrict__ count_diffs,
+                                     uint32_t * __restrict__ my_indices,
+                                     double   * __restrict__ my_data) {
+   uint32_t j_cnt = 0;
+   for (unsigned int j = 0; j < other_cnt; j++) {
+      const uint32_t el_idx = other_indices[j];
+      if (sample_counts[el_idx]>=min_sample_counts) {
+         my_data[j_cnt] = other_data[j];
+         // we did not copy all elements, so we need to scale the indices
+         my_indices[j_cnt] = other_indices[j]-count_diffs[el_idx];
+         j_cnt++;
+      }
+   }
+}
+
 sparse_data::sparse_data(const sparse_data& other, const double sample_counts[], const double min_sample_counts)
   : n_obs(other.n_obs)
   , n_samples(count_filtered_samples(other.n_samples,sample_counts,min_sample_counts))
@@ -78,6 +121,13 @@ sparse_data::sparse_data(const sparse_data& other, const double sample_counts[],
   , obs_indices_resident(NULL)
   , obs_data_resident(NULL)
   , obs_counts_resident(NULL)
+  , storage(values_fp64)
+  , obs_data32_resident(NULL)
+  , obs_data16_resident(NULL)
+  , arena(NULL)
+  , arena_nnz(0)
+  , arena_bytes(0)
+  , arena_mmapped(false)
 {
     if ((n_obs>0) && (n_samples>0)) {
         // since we are not copying all element, we will need to scale the indeces
@@ -92,33 +142,29 @@ sparse_data::sparse_data(const sparse_data& other, const double sample_counts[],
         }
 
         malloc_resident();
+        // first pass, size the arena
+        #pragma omp parallel for schedule(static)
         for(unsigned int i = 0; i < other.n_obs; i++) {
-          const unsigned int cnt = other.count_filtered_els(i, sample_counts,min_sample_counts);
-          obs_counts_resident[i]  = cnt;
-          if (cnt>0) {
-            obs_data_resident[i]    = malloc_wcheck<double>(cnt);
-            obs_indices_resident[i] = malloc_wcheck<uint32_t>(cnt);
-            {
-               // explicitly mark restrict to allow for compiler optimization
-               double   * __restrict__ my_data    = obs_data_resident[i];
-               uint32_t * __restrict__ my_indices = obs_indices_resident[i];
-               const double   * __restrict__ other_data    = other.obs_data_resident[i];
-               const uint32_t * __restrict__ other_indices = other.obs_indices_resident[i];
-               const unsigned int other_cnt = other.obs_counts_resident[i];
-               uint32_t j_cnt = 0;
-               for (unsigned int j = 0; j < other_cnt; j++) {
-                  const uint32_t el_idx = other_indices[j];
-                  if (sample_counts[el_idx]>=min_sample_counts) {
-                     my_data[j_cnt] = other_data[j];
-                     // we did not copy all elements, so we need to scale the indices
-                     my_indices[j_cnt] = other_indices[j]-count_diffs[el_idx];
-                     j_cnt++;
-                  }
-               }
+          obs_counts_resident[i] = other.count_filtered_els(i, sample_counts,min_sample_counts);
+        }
+        malloc_arena();
+
+        // second pass, fill it
+        #pragma omp parallel for schedule(dynamic,64)
+        for(unsigned int i = 0; i < other.n_obs; i++) {
+          if (obs_counts_resident[i]>0) {
+            const unsigned int other_cnt = other.obs_counts_resident[i];
+            const uint32_t *other_indices = other.obs_indices_resident[i];
+            if (other.storage==values_fp64) {
+              filter_obs_values<double>(other_cnt, other_indices, other.obs_data_resident[i], sample_counts, min_sample_counts, count_diffs,
+                                        obs_indices_resident[i], obs_data_resident[i]);
+            } else if (other.storage==values_uint32) {
+              filter_obs_values<uint32_t>(other_cnt, other_indices, other.obs_data32_resident[i], sample_counts, min_sample_counts, count_diffs,
+                                          obs_indices_resident[i], obs_data_resident[i]);
+            } else {
+              filter_obs_values<uint16_t>(other_cnt, other_indices, other.obs_data16_resident[i], sample_counts, min_sample_counts, count_diffs,
+                                          obs_indices_resident[i], obs_data_resident[i]);
             }
-          } else {
-            obs_data_resident[i]    = NULL;
-            obs_indices_resident[i] = NULL;
           }
         }
         delete[] count_diffs;
@@ -137,7 +183,14 @@ sparse_data::sparse_data(const uint32_t _n_obs,
   , clean_on_destruction(false)
   , obs_indices_resident(NULL)
   , obs_data_resident(NULL)
-  , obs_counts_resident(NULL) {
+  , obs_counts_resident(NULL)
+  , storage(values_fp64)
+  , obs_data32_resident(NULL)
+  , obs_data16_resident(NULL)
+  , arena(NULL)
+  , arena_nnz(0)
+  , arena_bytes(0)
+  , arena_mmapped(false) {
 
     malloc_resident();
 
@@ -165,16 +218,31 @@ sparse_data::sparse_data(const uint32_t _n_obs,
   , clean_on_destruction(true)
   , obs_indices_resident(NULL)
   , obs_data_resident(NULL)
-  , obs_counts_resident(NULL) {
+  , obs_counts_resident(NULL)
+  , storage(values_fp64)
+  , obs_data32_resident(NULL)
+  , obs_data16_resident(NULL)
+  , arena(NULL)
+  , arena_nnz(0)
+  , arena_bytes(0)
+  , arena_mmapped(false) {
 
     if (n_obs>0) {
         malloc_resident();
+        // first pass, size the arena
+        #pragma omp parallel for schedule(static)
         for (uint32_t i = 0; i < n_obs; i++) {
-            // pre-allocate with max size
-            // the waste is stypically acceptable
-            obs_data_resident[i]    = malloc_wcheck<double>(n_samples);
-            obs_indices_resident[i] = malloc_wcheck<uint32_t>(n_samples);
+            unsigned int cnt = 0;
+            for (uint32_t j=0; j<n_samples; j++) {
+              if (data[j][i]>0.0) cnt++;
+            }
+            obs_counts_resident[i]  = cnt;
+        }
+        malloc_arena();
 
+        // second pass, fill it
+        #pragma omp parallel for schedule(static)
+        for (uint32_t i = 0; i < n_obs; i++) {
             unsigned int cnt = 0;
             for (uint32_t j=0; j<n_samples; j++) {
               double val = data[j][i];
@@ -184,13 +252,14 @@ sparse_data::sparse_data(const uint32_t _n_obs,
                 cnt++;
               }
             }
-            obs_counts_resident[i]  = cnt;
         }
     }
 }
 
 sparse_data::~sparse_data() {
-    if(clean_on_destruction) {
+    if(arena != NULL) {
+        free_arena();
+    } else if(clean_on_destruction) {
         if(obs_indices_resident != NULL && obs_data_resident != NULL) {
             for(unsigned int i = 0; i < n_obs; i++) {
                 if(obs_indices_resident[i] != NULL)
@@ -208,8 +277,14 @@ sparse_data::~sparse_data() {
 void sparse_data::malloc_resident() { 
     /* load obs sparse data */
     obs_indices_resident = malloc_wcheck<uint32_t*   >(n_obs);
-    obs_data_resident    = malloc_wcheck<double*     >(n_obs);
     obs_counts_resident  = malloc_wcheck<unsigned int>(n_obs);
+    if (storage==values_fp64) {
+        obs_data_resident   = malloc_wcheck<double*   >(n_obs);
+    } else if (storage==values_uint32) {
+        obs_data32_resident = malloc_wcheck<uint32_t* >(n_obs);
+    } else {
+        obs_data16_resident = malloc_wcheck<uint16_t* >(n_obs);
+    }
 }
 
 void sparse_data::free_resident() { 
@@ -225,6 +300,175 @@ void sparse_data::free_resident() {
        free(obs_counts_resident);
         obs_counts_resident = NULL;
     }
+    if(obs_data32_resident != NULL) {
+        free(obs_data32_resident);
+        obs_data32_resident = NULL;
+    }
+    if(obs_data16_resident != NULL) {
+        free(obs_data16_resident);
+        obs_data16_resident = NULL;
+    }
+}
+
+void sparse_data::malloc_arena(const char *mmap_dir) {
+    uint64_t nnz = 0;
+    for (uint32_t i = 0; i < n_obs; i++) nnz += obs_counts_resident[i];
+
+    const uint64_t indices_bytes = arena_values_offset(nnz);
+    const uint64_t bufsize = std::max(indices_bytes + value_size() * nnz, uint64_t(8));
+
+    char *buf = NULL;
+    if ((mmap_dir==NULL) || (mmap_dir[0]==0)) {
+        buf = (char *)malloc(bufsize);
+        arena_mmapped = false;
+    } else {
+        std::string mmap_template(mmap_dir);
+        mmap_template+="/su_mmap_XXXXXX";
+        // note: mkstemp will update mmap_template in place
+        int fd=mkstemp((char *) mmap_template.c_str());
+        if (fd>=0) {
+            // remove the file name, so it will be destroyed on close
+            unlink(mmap_template.c_str());
+            if (ftruncate(fd,bufsize)==0) {
+                void *mbuf = mmap(NULL, bufsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_NORESERVE, fd, 0);
+                if (mbuf!=MAP_FAILED) buf = (char *)mbuf;
+            }
+            // the mapping stays valid after close
+            close(fd);
+        }
+        arena_mmapped = true;
+    }
+    if(buf == NULL) {
+        fprintf(stderr, "Failed to allocate %ld bytes; [%s]:%d\n", 
+                long(bufsize), __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+    arena = buf;
+    arena_nnz = nnz;
+    arena_bytes = bufsize;
+
+    uint64_t offset = 0;
+    for (uint32_t i = 0; i < n_obs; i++) {
+        set_obs_arena_offset(i, offset);
+        offset += obs_counts_resident[i];
+    }
+}
+
+void sparse_data::set_obs_arena_offset(uint32_t idx, uint64_t offset) {
+    char *values = arena + arena_values_offset(arena_nnz);
+    obs_indices_resident[idx] = ((uint32_t *) arena) + offset;
+    if (storage==values_fp64) {
+        obs_data_resident[idx]   = ((double *) values) + offset;
+    } else if (storage==values_uint32) {
+        obs_data32_resident[idx] = ((uint32_t *) values) + offset;
+    } else {
+        obs_data16_resident[idx] = ((uint16_t *) values) + offset;
+    }
+}
+
+template<class TVal>
+static inline void narrow_values_inplace(char *values, uint64_t nnz) {
+    // process in blocks, staging through a local buffer
+    // since the output is narrower, it never overwrites values not yet read
+    constexpr uint64_t BLOCK = 4096;
+    double in_buf[BLOCK];
+    TVal out_buf[BLOCK];
+    for (uint64_t k = 0; k < nnz; k += BLOCK) {
+        const uint64_t n = std::min(BLOCK, nnz - k);
+        std::memcpy(in_buf, values + sizeof(double) * k, sizeof(double) * n);
+        for (uint64_t j = 0; j < n; j++) out_buf[j] = TVal(in_buf[j]);
+        std::memcpy(values + sizeof(TVal) * k, out_buf, sizeof(TVal) * n);
+    }
+}
+
+bool sparse_data::compact_values() {
+    if ((arena==NULL) || (storage!=values_fp64) || (arena_nnz==0) || (n_obs==0)) return false;
+
+    const uint64_t nnz = arena_nnz;
+    const uint64_t values_offset = arena_values_offset(nnz);
+    const double * values = (const double *) (arena + values_offset);
+
+    // can only compact if all the values are small non-negative integers
+    bool all_int = true;
+    double max_val = 0.0;
+    #pragma omp parallel for schedule(static) reduction(&&:all_int) reduction(max:max_val)
+    for (uint64_t k = 0; k < nnz; k++) {
+        const double val = values[k];
+        if (!((val>=0.0) && (val<=4294967295.0) && (val==std::floor(val)))) all_int = false;
+        else max_val = std::max(max_val, val);
+    }
+    if (!all_int) return false;
+
+    // remember where each obs is, as the arena may move
+    // note: not all the arena elements may be referenced, e.g. after take_arena
+    std::vector<uint64_t> obs_offsets(n_obs);
+    for (uint32_t i = 0; i < n_obs; i++) obs_offsets[i] = obs_indices_resident[i] - ((uint32_t *) arena);
+
+    const value_storage_t new_storage = (max_val<=65535.0) ? values_uint16 : values_uint32;
+    if (new_storage==values_uint16) {
+        narrow_values_inplace<uint16_t>(arena + values_offset, nnz);
+    } else {
+        narrow_values_inplace<uint32_t>(arena + values_offset, nnz);
+    }
+
+    free(obs_data_resident);
+    obs_data_resident = NULL;
+    storage = new_storage;
+    if (storage==values_uint32) {
+        obs_data32_resident = malloc_wcheck<uint32_t* >(n_obs);
+    } else {
+        obs_data16_resident = malloc_wcheck<uint16_t* >(n_obs);
+    }
+
+    // release the unused tail of the arena
+    const uint64_t new_bytes = std::max(values_offset + value_size() * nnz, uint64_t(8));
+    if (arena_mmapped) {
+        const uint64_t page_size = sysconf(_SC_PAGESIZE);
+        const uint64_t keep_bytes = ((new_bytes + page_size - 1) / page_size) * page_size;
+        if (keep_bytes < arena_bytes) {
+            munmap(arena + keep_bytes, arena_bytes - keep_bytes);
+            arena_bytes = keep_bytes;
+        }
+    } else {
+        char *new_arena = (char *) realloc(arena, new_bytes);
+        if (new_arena != NULL) { // else, keep using the larger buffer
+            arena = new_arena;
+            arena_bytes = new_bytes;
+        }
+    }
+
+    for (uint32_t i = 0; i < n_obs; i++) set_obs_arena_offset(i, obs_offsets[i]);
+    return true;
+}
+
+void sparse_data::free_arena() {
+    if (arena != NULL) {
+        if (arena_mmapped) {
+            munmap(arena, arena_bytes);
+        } else {
+            free(arena);
+        }
+        arena = NULL;
+        arena_nnz = 0;
+        arena_bytes = 0;
+        arena_mmapped = false;
+    }
+}
+
+void sparse_data::take_arena(sparse_data& other) {
+    free_arena();
+    arena = other.arena;
+    arena_nnz = other.arena_nnz;
+    arena_bytes = other.arena_bytes;
+    arena_mmapped = other.arena_mmapped;
+
+    other.arena = NULL;
+    other.arena_nnz = 0;
+    other.arena_bytes = 0;
+    other.arena_mmapped = false;
+    // the obs buffers of other now belong to us
+    other.clean_on_destruction = false;
 }
 
 uint32_t sparse_data::count_filtered_els(uint32_t idx, const double sample_counts[], const double min_sample_counts) const {
@@ -247,12 +491,12 @@ void sparse_data::describe_internals() const {
       printf("\t%3d %3d\n",i,obs_counts_resident[i]);
     }
   }
-  if (obs_data_resident!=NULL) {
+  if (obs_indices_resident!=NULL) {
     printf("obs_indices_resident & obs_data_resident\n");
     for (uint32_t i=0; i<n_obs; i++) {
        uint32_t cnt = obs_counts_resident[i];
        for (uint32_t j=0; j<cnt; j++) {
-         printf("\t%3d %3d %3d %7.1f\n",i,j,obs_indices_resident[i][j],obs_data_resident[i][j]);
+         printf("\t%3d %3d %3d %7.1f\n",i,j,obs_indices_resident[i][j],get_obs_value(i,j));
        }
     }
   }
@@ -440,9 +684,19 @@ void biom_inmem::create_id_index(const std::vector<std::string> &ids,
 
 template<class TFloat>
 void biom_inmem::get_obs_data_TT(const uint32_t idx, TFloat* out) const {
+    if (resident_obj.storage==sparse_data::values_fp64) {
+      get_obs_data_TTT<TFloat,double>(idx, resident_obj.obs_data_resident[idx], out);
+    } else if (resident_obj.storage==sparse_data::values_uint32) {
+      get_obs_data_TTT<TFloat,uint32_t>(idx, resident_obj.obs_data32_resident[idx], out);
+    } else {
+      get_obs_data_TTT<TFloat,uint16_t>(idx, resident_obj.obs_data16_resident[idx], out);
+    }
+}
+
+template<class TFloat, class TVal>
+void biom_inmem::get_obs_data_TTT(const uint32_t idx, const TVal * const data, TFloat* out) const {
     unsigned int count = resident_obj.obs_counts_resident[idx];
     const uint32_t * const indices = resident_obj.obs_indices_resident[idx];
-    const double * const data = resident_obj.obs_data_resident[idx];
 
     // reset our output buffer
     for(unsigned int i = 0; i < n_samples; i++)
@@ -467,13 +721,32 @@ void biom_inmem::get_obs_data(const std::string &id, float* out) const {
   biom_inmem::get_obs_data_TT(id,out);
 }
 
+void biom_inmem::get_obs_data(const uint32_t idx, double* out) const {
+  biom_inmem::get_obs_data_TT(idx,out);
+}
+
+void biom_inmem::get_obs_data(const uint32_t idx, float* out) const {
+  biom_inmem::get_obs_data_TT(idx,out);
+}
+
 
 // note: out is supposed to be fully filled, i.e. out[start:end]
 template<class TFloat>
 void biom_inmem::get_obs_data_range_TT(const uint32_t idx, unsigned int start, unsigned int end, bool normalize, TFloat* out) const {
+    if (resident_obj.storage==sparse_data::values_fp64) {
+      get_obs_data_range_TTT<TFloat,double>(idx, resident_obj.obs_data_resident[idx], start, end, normalize, out);
+    } else if (resident_obj.storage==sparse_data::values_uint32) {
+      get_obs_data_range_TTT<TFloat,uint32_t>(idx, resident_obj.obs_data32_resident[idx], start, end, normalize, out);
+    } else {
+      get_obs_data_range_TTT<TFloat,uint16_t>(idx, resident_obj.obs_data16_resident[idx], start, end, normalize, out);
+    }
+}
+
+// integer values are converted to double on the fly
+template<class TFloat, class TVal>
+void biom_inmem::get_obs_data_range_TTT(const uint32_t idx, const TVal * const data, unsigned int start, unsigned int end, bool normalize, TFloat* out) const {
     unsigned int count = resident_obj.obs_counts_resident[idx];
     const uint32_t * const indices = resident_obj.obs_indices_resident[idx];
-    const double * const data = resident_obj.obs_data_resident[idx];
 
     // reset our output buffer
     for(unsigned int i = start; i < end; i++)
@@ -483,7 +756,7 @@ void biom_inmem::get_obs_data_range_TT(const uint32_t idx, unsigned int start, u
       for(unsigned int i = 0; i < count; i++) {
         const uint32_t j = indices[i];
         if ((j>=start)&&(j<end)) { 
-          out[j-start] = data[i]/sample_counts[j];
+          out[j-start] = double(data[i])/sample_counts[j];
         }
       }
     } else {
@@ -510,21 +783,49 @@ void biom_inmem::get_obs_data_range(const std::string &id, unsigned int start, u
   biom_inmem::get_obs_data_range_TT(id,start,end,normalize,out);
 }
 
+void biom_inmem::get_obs_data_range(const uint32_t idx, unsigned int start, unsigned int end, bool normalize, double* out) const {
+  biom_inmem::get_obs_data_range_TT(idx,start,end,normalize,out);
+}
+
+void biom_inmem::get_obs_data_range(const uint32_t idx, unsigned int start, unsigned int end, bool normalize, float* out) const {
+  biom_inmem::get_obs_data_range_TT(idx,start,end,normalize,out);
+}
+
+uint32_t biom_inmem::get_obs_sparse(const uint32_t idx, uint32_t* indices_out, double* data_out) const {
+  const uint32_t cnt = resident_obj.obs_counts_resident[idx];
+  const uint32_t *indices = resident_obj.obs_indices_resident[idx];
+  for (uint32_t j=0; j<cnt; j++) {
+    indices_out[j] = indices[j];
+    data_out[j] = resident_obj.get_obs_value(idx, j);
+  }
+  return cnt;
+}
+
 void biom_inmem::compute_sample_counts() {
     sample_counts = (double*)calloc(sizeof(double), n_samples);
 
     for(unsigned int i = 0; i < n_obs; i++) {
-        unsigned int count = resident_obj.obs_counts_resident[i];
-        uint32_t *indices = resident_obj.obs_indices_resident[i];
-        double *data = resident_obj.obs_data_resident[i];
-        for(unsigned int j = 0; j < count; j++) {
-            uint32_t index = indices[j];
-            double datum = data[j];
-            sample_counts[index] += datum;
+        if (resident_obj.storage==sparse_data::values_fp64) {
+            add_sample_counts_T<double>(i, resident_obj.obs_data_resident[i]);
+        } else if (resident_obj.storage==sparse_data::values_uint32) {
+            add_sample_counts_T<uint32_t>(i, resident_obj.obs_data32_resident[i]);
+        } else {
+            add_sample_counts_T<uint16_t>(i, resident_obj.obs_data16_resident[i]);
         }
     }
 }
 
+template<class TVal>
+void biom_inmem::add_sample_counts_T(const uint32_t idx, const TVal *data) {
+    unsigned int count = resident_obj.obs_counts_resident[idx];
+    uint32_t *indices = resident_obj.obs_indices_resident[idx];
+    for(unsigned int j = 0; j < count; j++) {
+        uint32_t index = indices[j];
+        double datum = data[j];
+        sample_counts[index] += datum;
+    }
+}
+
 const double *biom_inmem::get_sample_counts() const {
   return sample_counts;
 }
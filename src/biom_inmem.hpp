@@ -20,6 +20,13 @@
 namespace su {
     class sparse_data {
         public:
+            /* native type of the observation values */
+            enum value_storage_t {
+                values_fp64 = 0,  // obs_data_resident
+                values_uint32,    // obs_data32_resident
+                values_uint16     // obs_data16_resident
+            };
+
             /* default constructor */
             sparse_data(bool _clean_on_destruction);
 
@@ -59,9 +66,11 @@ namespace su {
              */
             sparse_data(const sparse_data& other, const double sample_counts[], const double min_sample_counts);
 
-            /* remove ownership of this obs_idx buffer */
-            uint32_t *steal_indices(uint32_t obs_idx) {uint32_t *out=obs_indices_resident[obs_idx]; obs_indices_resident[obs_idx]=NULL; return out;}
-            double *steal_data(uint32_t obs_idx) {double *out=obs_data_resident[obs_idx]; obs_data_resident[obs_idx]=NULL; return out;}
+            /* take ownership of the arena of other
+             * The obs buffers of this object can then point anywhere inside it.
+             * other will not release any buffer on destruction anymore.
+             */
+            void take_arena(sparse_data& other);
 
             /* prevent default copy constructor and operator from being generated */
             sparse_data(const sparse_data& other) = delete;
@@ -70,8 +79,47 @@ namespace su {
             /* Helper functions */
             void malloc_resident();
             void free_resident();
+
+            /* Allocate a single contiguous CSR arena, sized from obs_counts_resident,
+             * and point obs_indices_resident and the obs values of the current storage inside it.
+             * Must be called after malloc_resident and after all obs_counts_resident have been set.
+             *
+             * @param mmap_dir If not NULL or empty, back the arena with an unlinked file in this directory
+             */
+            void malloc_arena(const char *mmap_dir=NULL);
+            void free_arena();
+
+            /* Convert the arena values in place to the narrowest integer storage that can hold them.
+             * Only applies to arena-backed fp64 data with non-negative integer values.
+             *
+             * Returns true if the storage was changed.
+             */
+            bool compact_values();
+
+            /* size in bytes of a single value in the current storage */
+            unsigned int value_size() const {return (storage==values_fp64) ? sizeof(double) : ((storage==values_uint32) ? sizeof(uint32_t) : sizeof(uint16_t));}
+
+            /* the values of observation idx, in their native storage */
+            const void *get_obs_values(uint32_t idx) const {
+                return (storage==values_fp64) ? (const void *)obs_data_resident[idx] :
+                       ((storage==values_uint32) ? (const void *)obs_data32_resident[idx] : (const void *)obs_data16_resident[idx]);
+            }
+
+            /* a single value of observation idx, converted to double */
+            double get_obs_value(uint32_t idx, uint32_t el) const {
+                return (storage==values_fp64) ? obs_data_resident[idx][el] :
+                       ((storage==values_uint32) ? double(obs_data32_resident[idx][el]) : double(obs_data16_resident[idx][el]));
+            }
+
             uint32_t count_filtered_els(uint32_t idx, const double sample_counts[], const double min_sample_counts) const;
 
+        protected:
+            /* byte offset of the values inside the arena, keeps them 8-byte aligned */
+            static uint64_t arena_values_offset(uint64_t nnz) {return ((sizeof(uint32_t) * nnz + 7) / 8) * 8;}
+
+            /* point the buffers of observation idx at element offset inside the arena */
+            void set_obs_arena_offset(uint32_t idx, uint64_t offset);
+
         public:  // keep it open for ease of access
             uint32_t n_obs;     // row dimension
             uint32_t n_samples; // column dimension
@@ -81,6 +129,18 @@ namespace su {
             double **obs_data_resident;
             unsigned int *obs_counts_resident;
 
+            // only the obs values array matching storage is used, the others are NULL
+            value_storage_t storage;
+            uint32_t **obs_data32_resident;
+            uint16_t **obs_data16_resident;
+
+            // contiguous CSR storage; if not NULL, all the obs buffers point inside it
+            // layout: uint32_t indices[arena_nnz], padding to 8 bytes, values[arena_nnz]
+            char *arena;
+            uint64_t arena_nnz;
+            uint64_t arena_bytes;
+            bool arena_mmapped;
+
             // debug helper functions
             void describe_internals() const;
     };
@@ -158,6 +218,19 @@ namespace su {
             void get_obs_data_range(const std::string &id, unsigned int start, unsigned int end, bool normalize, double* out) const;
             void get_obs_data_range(const std::string &id, unsigned int start, unsigned int end, bool normalize, float* out) const;
 
+            /* get the index position of an observation */
+            uint32_t get_obs_index(const std::string &id) const {return obs_id_index.at(id);}
+
+            /* as above, but using the observation index */
+            void get_obs_data(const uint32_t idx, double* out) const; 
+            void get_obs_data(const uint32_t idx, float* out) const;
+            void get_obs_data_range(const uint32_t idx, unsigned int start, unsigned int end, bool normalize, double* out) const;
+            void get_obs_data_range(const uint32_t idx, unsigned int start, unsigned int end, bool normalize, float* out) const;
+
+            /* sparse access, using the observation index */
+            uint32_t get_obs_nnz(const uint32_t idx) const {return resident_obj.obs_counts_resident[idx];}
+            uint32_t get_obs_sparse(const uint32_t idx, uint32_t* indices_out, double* data_out) const;
+
             /* getters to local variables */
             virtual const std::vector<std::string> &get_sample_ids() const;
             virtual const std::vector<std::string> &get_obs_ids() const;
@@ -198,6 +271,11 @@ namespace su {
             template<class TFloat> void get_obs_data_TT(const std::string &id, TFloat* out) const;
             template<class TFloat> void get_obs_data_range_TT(const uint32_t idx, unsigned int start, unsigned int end, bool normalize, TFloat* out) const;
             template<class TFloat> void get_obs_data_range_TT(const std::string &id, unsigned int start, unsigned int end, bool normalize, TFloat* out) const;
+
+            // templatized on both the output and the storage type
+            template<class TFloat, class TVal> void get_obs_data_TTT(const uint32_t idx, const TVal *data, TFloat* out) const;
+            template<class TFloat, class TVal> void get_obs_data_range_TTT(const uint32_t idx, const TVal *data, unsigned int start, unsigned int end, bool normalize, TFloat* out) const;
+            template<class TVal> void add_sample_counts_T(const uint32_t idx, const TVal *data);
         public:
             const sparse_data& get_resident_obj() const {return resident_obj;}
 
@@ -61,6 +61,38 @@ namespace su {
             virtual void get_obs_data_range(const std::string &id, unsigned int start, unsigned int end, bool normalize, double* out) const = 0;
             virtual void get_obs_data_range(const std::string &id, unsigned int start, unsigned int end, bool normalize, float* out) const = 0;
 
+            /* get the index position of an observation
+             *
+             * @param id The observation ID to look up
+             *
+             * The index can be used with the index-based getters below,
+             * avoiding the repeated ID lookups.
+             */
+            virtual uint32_t get_obs_index(const std::string &id) const = 0;
+
+            /* as above, but using the observation index, as returned by get_obs_index */
+            virtual void get_obs_data(const uint32_t idx, double* out) const = 0; 
+            virtual void get_obs_data(const uint32_t idx, float* out) const = 0;
+            virtual void get_obs_data_range(const uint32_t idx, unsigned int start, unsigned int end, bool normalize, double* out) const = 0;
+            virtual void get_obs_data_range(const uint32_t idx, unsigned int start, unsigned int end, bool normalize, float* out) const = 0;
+
+            /* get the number of non-zero values of an observation
+             *
+             * @param idx The observation index, as returned by get_obs_index
+             */
+            virtual uint32_t get_obs_nnz(const uint32_t idx) const = 0;
+
+            /* get the sparse observation data
+             *
+             * @param idx The observation index, as returned by get_obs_index
+             * @param indices_out An allocated array of at least size get_obs_nnz(idx).
+             *      Will contain the sample index of each value.
+             * @param data_out An allocated array of at least size get_obs_nnz(idx).
+             *
+             * Returns the number of values written, i.e. get_obs_nnz(idx)
+             */
+            virtual uint32_t get_obs_sparse(const uint32_t idx, uint32_t* indices_out, double* data_out) const = 0;
+
             // cache the IDs contained within the table
             virtual const std::vector<std::string> &get_sample_ids() const =0;
             virtual const std::vector<std::string> &get_obs_ids() const = 0;
@@ -14,6 +14,7 @@
 #include <vector>
 #include <algorithm>
 #include <omp.h>
+#include <math.h>
 
 #include "biom_subsampled.hpp"
 
@@ -87,177 +88,205 @@ linked_sparse_transposed::~linked_sparse_transposed() {
 }
 
 namespace su {
-  // Equivalent to iterator over np.repeat
-  // https://github.com/biocore/biom-format/blob/b0e71a00ecb349a6f5f1ca64a23d71f380ddc19c/biom/_subsample.pyx#LL64C24-L64C55
-  class WeightedSampleIterator
-  {
-  public:
-    // While we do not implememnt the whole random_access_iterator interface
-    // we want the implementations to use operator- and that requires random
-    using iterator_category = std::random_access_iterator_tag;
-    using difference_type   = int64_t;
-    using value_type        = uint32_t;
-    using pointer           = const uint32_t*;
-    using reference         = const uint32_t&;
-
-    WeightedSampleIterator(uint64_t *_data_in, uint32_t _idx, uint64_t _cnt)
-    : data_in(_data_in)
-    , idx(_idx)
-    , cnt(_cnt)
-    {}
-
-    reference operator*() const { return idx; }
-    pointer operator->() const { return &idx; }
-
-    WeightedSampleIterator& operator++()
-    {  
-       cnt++;
-       if (cnt>=data_in[idx]) {
-         cnt = 0;
-         idx++;
-       }
-       return *this;
+  // log(k!), tabulated for small k, Stirling series otherwise
+  inline double log_factorial(uint64_t k) {
+    static constexpr uint64_t N_TABLE = 126;
+    static const std::vector<double> table = []() {
+       std::vector<double> t(N_TABLE);
+       t[0] = 0.0;
+       for (uint64_t i=1; i<N_TABLE; i++) t[i] = t[i-1] + log(double(i));
+       return t;
+    }();
+
+    if (k<N_TABLE) return table[k];
+
+    const double halfln2pi = 0.9189385332046728;
+    const double dk = double(k);
+    return (dk + 0.5)*log(dk) - dk + (halfln2pi + (1.0/dk)*(1.0/12.0 - 1.0/(360.0*dk*dk)));
+  }
+
+  // Number of good items picked when drawing sample items, without replacement,
+  // out of good+bad items, i.e. a draw from the hypergeometric distribution.
+  // Requires sample<=good+bad.
+  //
+  // Uses the same algorithms as numpy:
+  //   the ratio-of-uniforms method of Stadlober (1989) for large samples,
+  //   and simple sequential selection for small ones.
+  template<class TGen>
+  inline uint64_t random_hypergeometric(TGen &generator, const uint64_t good, const uint64_t bad, const uint64_t sample) {
+    if ((good==0) || (sample==0)) return 0;
+    if (bad==0) return sample;
+
+    const uint64_t total = good + bad;
+    if ((sample < 10) || (sample > (total - 10))) {
+      // sequential selection, cost proportional to the smaller of sample and total-sample
+      const bool flipped = (sample > total/2);
+      uint64_t computed_sample = flipped ? (total - sample) : sample;
+      uint64_t remaining_total = total;
+      uint64_t remaining_good = good;
+
+      while ((computed_sample > 0) && (remaining_good > 0) &&
+             (remaining_total > remaining_good)) {
+        --remaining_total;
+        // pick uniformly in [0,remaining_total]
+        if (std::uniform_int_distribution<uint64_t>(0,remaining_total)(generator) < remaining_good) {
+          --remaining_good;
+        }
+        --computed_sample;
+      }
+
+      if (remaining_total == remaining_good) {
+        // only good ones left
+        remaining_good -= computed_sample;
+      }
+
+      return flipped ? remaining_good : (good - remaining_good);
     }
 
-    WeightedSampleIterator operator++(int) { WeightedSampleIterator tmp = *this; ++(*this); return tmp; }
+    // ratio-of-uniforms
+    static constexpr double D1 = 1.7155277699214135;
+    static constexpr double D2 = 0.8989161620588988;
 
-    friend bool operator== (const WeightedSampleIterator& a, const WeightedSampleIterator& b)
-    {
-       return (a.data_in == b.data_in) && (a.idx == b.idx) && (a.cnt==b.cnt);
-    };
+    const uint64_t computed_sample = std::min(sample, total - sample);
+    const uint64_t mingoodbad = std::min(good, bad);
+    const uint64_t maxgoodbad = std::max(good, bad);
 
-    friend bool operator!= (const WeightedSampleIterator& a, const WeightedSampleIterator& b)
-    {
-       return !((a.data_in == b.data_in) && (a.idx == b.idx) && (a.cnt==b.cnt));
-    };
+    const double p = double(mingoodbad)/total;
+    const double q = double(maxgoodbad)/total;
+    const double mu = computed_sample * p; // mean
+    const double a = mu + 0.5;
+    const double var = double(total - computed_sample) * computed_sample * p * q / (total - 1);
+    const double c = sqrt(var + 0.5);
+    const double h = D1*c + D2;
 
-    friend int64_t operator-(const WeightedSampleIterator& b, const WeightedSampleIterator& a)
-    {
-       int64_t diff = 0;
-       //assert(a.data_in == b.data_in);
-       //assert(a.idx <= b.idx);
-       //assert((a.idx > b.idx) || (a.cnt<=b.cnt));
+    const uint64_t m = uint64_t(floor(double(computed_sample + 1) * (mingoodbad + 1) / (total + 2)));
+    const double g = log_factorial(m) +
+                     log_factorial(mingoodbad - m) +
+                     log_factorial(computed_sample - m) +
+                     log_factorial(maxgoodbad - computed_sample + m);
 
-       for (uint32_t i = a.idx; i<b.idx; i++) {
-          diff += a.data_in[i];
-       }
+    const double b = std::min(double(std::min(computed_sample, mingoodbad) + 1), floor(a + 16*c));
 
-       return diff + b.cnt - a.cnt;
-    };
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    uint64_t K;
+    while (true) {
+      const double U = uniform(generator);
+      const double V = uniform(generator);
+      const double X = a + h*(V - 0.5) / U;
 
-  private:
+      // fast rejection
+      if ((X < 0.0) || (X >= b)) continue;
 
-    uint64_t *data_in;
-    uint32_t idx; // index of data_in
-    uint64_t cnt; // how deep in data_in[idx] are we (must be < data_in[idx])
-  };
+      K = uint64_t(floor(X));
+
+      const double gp = log_factorial(K) +
+                        log_factorial(mingoodbad - K) +
+                        log_factorial(computed_sample - K) +
+                        log_factorial(maxgoodbad - computed_sample + K);
+      const double T = g - gp;
+
+      // fast acceptance
+      if ((U*(4.0 - U) - 3.0) <= T) break;
 
+      // fast rejection
+      if (U*(U - T) >= 1) continue;
+
+      // acceptance
+      if (2.0*log(U) <= T) break;
+    }
+
+    if (good > bad) K = computed_sample - K;
+    if (computed_sample < sample) K = good - K;
+
+    return K;
+  }
+
+  // Rarefaction, i.e. subsampling without replacement
+  //
+  // Uses sequential conditional hypergeometric draws, one per non-zero element,
+  // so the cost does not depend on the depth.
   class WeightedSample
   {
   public:
-    WeightedSample(uint32_t _max_count, uint32_t _n, uint32_t random_seed)
-    : max_count(_max_count)
-    , n(_n)
-    , generator(random_seed)
-    , current_count(0)
-    , data(max_count)
-    , sample_out(n)
-    , data_out(max_count)
+    // Each (random_seed, stream) pair gets its own independent random stream
+    WeightedSample(uint32_t _n, uint32_t random_seed, uint32_t stream)
+    : n(_n)
+    , generator(random_seed, stream)
     {}
 
    void do_sample(unsigned int length, double* *data_arr) {
-        for (unsigned int j=0; j<length; j++) data_out[j] = 0;
+        uint64_t remaining_total = 0;
+        for (unsigned int j=0; j<length; j++) remaining_total += uint64_t(*(data_arr[j]));
 
-        // note: We are assuming length>=n
+        // note: We are assuming remaining_total>=n
         //      Enforced by the caller (via filtering)
-        assign(length,data_arr);
-        std::sample(begin(), end(),
-                    sample_out.begin(), n,
-                    generator);
-
-        for (uint32_t j=0; j<n; j++) data_out[sample_out[j]]++;
-
-        for (unsigned int j=0; j<length; j++) *(data_arr[j]) = data_out[j];
+        uint64_t remaining_n = n;
+        for (unsigned int j=0; j<length; j++) {
+          const uint64_t cnt = uint64_t(*(data_arr[j]));
+          remaining_total -= cnt;
+          // how many of the remaining picks land on this element
+          const uint64_t picked = random_hypergeometric(generator, cnt, remaining_total, remaining_n);
+          remaining_n -= picked;
+          *(data_arr[j]) = picked;
+        }
     }
 
 private:
-    void assign(uint32_t length, double * *data_arr) {
-       current_count = length;
-       for (uint32_t j=0; j<length; j++) data[j] = *(data_arr[j]);
-    }
-
-    WeightedSampleIterator begin() { return WeightedSampleIterator(data.data(),0,0); }
-    WeightedSampleIterator end()   { return WeightedSampleIterator(data.data(),current_count,0); } // current_count is out of bounds
-
-    uint32_t max_count;
     uint32_t n;
-    std::mt19937 generator;
-
-    uint32_t current_count;
-
-    // use persistent buffer to minimize allocation costs
-    std::vector<uint64_t> data;  // original values
-    std::vector<uint32_t> sample_out;     // random output buffer
-    std::vector<uint32_t> data_out; // computed values
+    Philox4x32 generator;
   };
 
+  // Multinomial sampling, i.e. subsampling with replacement
+  //
+  // Uses sequential conditional binomial draws, one per non-zero element,
+  // so the cost does not depend on the depth.
   class WeightedSampleWithReplacement
   {
   public:
-    WeightedSampleWithReplacement(uint32_t _max_count, uint32_t _n, uint32_t random_seed)
-    : max_count(_max_count)
-    , n(_n)
-    , generator(random_seed)
-    , current_count(0)
-    , data(max_count)
-    , data_out(max_count)
+    // Each (random_seed, stream) pair gets its own independent random stream
+    WeightedSampleWithReplacement(uint32_t _n, uint32_t random_seed, uint32_t stream)
+    : n(_n)
+    , generator(random_seed, stream)
     {}
 
    void do_sample(unsigned int length, double* *data_arr) {
-        assign(length,data_arr);
-
-        // note: We are assuming length>=n
-        //      Enforced by the caller (via filtering)
-        double *data_in = data.data();
-        std::discrete_distribution<uint32_t> multinomial(data_in, data_in+length);
-        for (unsigned int j=0; j<length; j++) data_out[j] = 0;
-        for (uint32_t j=0; j<n; j++) data_out[multinomial(generator)]++;
-
-        for (unsigned int j=0; j<length; j++) *(data_arr[j]) = data_out[j];
+        double remaining_total = 0.0;
+        for (unsigned int j=0; j<length; j++) remaining_total += *(data_arr[j]);
+
+        uint64_t remaining_n = n;
+        for (unsigned int j=0; j<length; j++) {
+          const double cnt = *(data_arr[j]);
+          // how many of the remaining picks land on this element
+          uint64_t picked = 0;
+          if ((remaining_n>0) && (cnt>0.0)) {
+            if ((j+1)==length) {
+              picked = remaining_n; // nothing else left
+            } else {
+              const double p = std::min(cnt/remaining_total, 1.0);
+              picked = std::binomial_distribution<uint64_t>(remaining_n, p)(generator);
+            }
+          }
+          remaining_total -= cnt;
+          remaining_n -= picked;
+          *(data_arr[j]) = picked;
+        }
     }
 
 private:
-    void assign(uint32_t length, double * *data_arr) {
-       current_count = length;
-       for (uint32_t j=0; j<length; j++) data[j] = *(data_arr[j]);
-    }
-
-    uint32_t max_count;
     uint32_t n;
-    std::mt19937 generator;
-
-    uint32_t current_count;
-
-    // use persistent buffer to minimize allocation costs
-    std::vector<double> data;  // original values
-    std::vector<uint32_t> data_out; // computed values
+    Philox4x32 generator;
   };
 } // end namespace su
 
 
 template<class TWork>
 inline void linked_sparse_transposed::transposed_subsample(const uint32_t n, const uint32_t random_seed) {
-    const uint32_t max_threads = omp_get_max_threads();
-    std::mt19937 master_generator(random_seed);
-
-    // use common buffer to minimize allocation cost, but need one per thread
-    std::vector<TWork> sample_data_arr;
-    for (uint32_t i=0; i<max_threads; i++) sample_data_arr.emplace(sample_data_arr.end(), max_count, n, master_generator());
-    
-    #pragma omp parallel for
+    // each obs has its own random stream, keyed by its index,
+    // so the result does not depend on the number of threads
+    #pragma omp parallel for schedule(dynamic,64)
     for (uint32_t i=0; i<n_obs; i++) {
-        int my_thread_num = omp_get_thread_num();
-        sample_data_arr[my_thread_num].do_sample(obs_counts_resident[i], obs_data_resident[i]);
+        TWork sample_data(n, random_seed, i);
+        sample_data.do_sample(obs_counts_resident[i], obs_data_resident[i]);
     }
 }
 
@@ -298,6 +327,8 @@ biom_subsampled::biom_subsampled(const biom_inmem &parent, const bool w_replacem
    // Note: We could filter out the zero rows
    // But that's just an optimization and will not be worth it most of the time
    steal_nonzero(parent,tmp_obj);
+   // subsampled values are always integers
+   resident_obj.compact_values();
 
    /* define a mapping between an ID and its corresponding offset */
    #pragma omp parallel for schedule(static)
@@ -326,6 +357,8 @@ void biom_subsampled::steal_nonzero(const biom_inmem &parent, sparse_data& subsa
    resident_obj.n_samples = subsampled_obj.n_samples;
    resident_obj.n_obs = subsampled_obj.n_obs;
    resident_obj.malloc_resident();
+   // the non-zero obs buffers will keep pointing inside the subsampled arena
+   resident_obj.take_arena(subsampled_obj);
    obs_ids.reserve(parent.n_obs);
 
    const std::vector<std::string> &parent_obs_ids = parent.get_obs_ids();
@@ -340,8 +373,8 @@ void biom_subsampled::steal_nonzero(const biom_inmem &parent, sparse_data& subsa
 
      if (nz>0) {
         // steal non-zero data
-        resident_obj.obs_indices_resident[n_obs] = subsampled_obj.steal_indices(i);
-        resident_obj.obs_data_resident[n_obs] = subsampled_obj.steal_data(i); 
+        resident_obj.obs_indices_resident[n_obs] = subsampled_obj.obs_indices_resident[i];
+        resident_obj.obs_data_resident[n_obs] = subsampled_obj.obs_data_resident[i];
         resident_obj.obs_counts_resident[n_obs] = cnt;
         obs_ids.push_back(parent_obs_ids[i]);
         n_obs++;
@@ -14,6 +14,63 @@
 #include "biom_inmem.hpp"
 
 namespace su {
+    // Counter-based random generator, Philox4x32-10 (Salmon et al. SC 2011)
+    //
+    // The output is a pure function of the key and of the position in the stream,
+    // so independent streams can be created cheaply, e.g. one per observation,
+    // and the results do not depend on how the work is split between threads.
+    // Satisfies the UniformRandomBitGenerator requirements.
+    class Philox4x32 {
+        public:
+            typedef uint32_t result_type;
+
+            Philox4x32(const uint32_t key0, const uint32_t key1)
+              : key{key0, key1}, counter(0), idx(4) {}
+
+            static constexpr result_type min() {return 0;}
+            static constexpr result_type max() {return UINT32_MAX;}
+
+            result_type operator()() {
+                if (idx>=4) {
+                    generate_block();
+                    idx = 0;
+                }
+                return block[idx++];
+            }
+
+            // Compute the 4 output words for the given key and counter
+            static void philox(const uint32_t key_in[2], const uint32_t ctr_in[4], uint32_t out[4]) {
+                uint32_t k0 = key_in[0];
+                uint32_t k1 = key_in[1];
+                uint32_t c0 = ctr_in[0];
+                uint32_t c1 = ctr_in[1];
+                uint32_t c2 = ctr_in[2];
+                uint32_t c3 = ctr_in[3];
+                for (unsigned int r=0; r<10; r++) {
+                    const uint64_t p0 = uint64_t(0xD2511F53) * c0;
+                    const uint64_t p1 = uint64_t(0xCD9E8D57) * c2;
+                    c0 = uint32_t(p1 >> 32) ^ c1 ^ k0;
+                    c1 = uint32_t(p1);
+                    c2 = uint32_t(p0 >> 32) ^ c3 ^ k1;
+                    c3 = uint32_t(p0);
+                    k0 += 0x9E3779B9;
+                    k1 += 0xBB67AE85;
+                }
+                out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+            }
+        private:
+            void generate_block() {
+                const uint32_t ctr[4] = {uint32_t(counter), uint32_t(counter >> 32), 0, 0};
+                philox(key, ctr, block);
+                counter++;
+            }
+
+            uint32_t key[2];
+            uint64_t counter;  // index of the next block
+            uint32_t block[4]; // current output block
+            unsigned int idx;  // next word to return from block
+    };
+
     // Keep a transposed version of a sparse object
     class linked_sparse_transposed {
         public:
@@ -13,6 +13,9 @@
 #include <scikit-bio-binaries/distance.h>
 
 static std::mt19937 myRandomGenerator;
+// Used only by draw_random_seed, so that drawing the pcoa and permanova seeds
+// does not change the sequence of subsampling seeds drawn from myRandomGenerator
+static std::mt19937 myStatsRandomGenerator{std::mt19937()()};
 
 static constexpr int ACC_CPU=0;
 static constexpr int ACC_NV=1;
@@ -36,6 +39,13 @@ void su::set_random_seed(uint32_t new_seed) {
   // propagate to the dependency, too
   auto new_seed_skbb = myRandomGenerator();
   skbb_set_random_seed(new_seed_skbb);
+  // same seed as the dependency, which the stats used before getting explicit seeds
+  myStatsRandomGenerator.seed(new_seed_skbb);
+}
+
+int su::draw_random_seed() {
+  // keep it non-negative, negative values mean "use the shared generator"
+  return int(myStatsRandomGenerator() >> 1);
 }
 
 // test only once, then use persistent value
@@ -197,20 +207,20 @@ void su::pcoa(const double * mat, const uint32_t n_samples, const uint32_t n_dim
   skbb_pcoa_fsvd_fp64_to_fp32(n_samples, mat, n_dims, -1, eigenvalues, samples, proportion_explained);
 }
 
-void su::pcoa_inplace(double * mat, const uint32_t n_samples, const uint32_t n_dims, double * &eigenvalues, double * &samples, double * &proportion_explained) {
+void su::pcoa_inplace(double * mat, const uint32_t n_samples, const uint32_t n_dims, double * &eigenvalues, double * &samples, double * &proportion_explained, const int seed) {
   eigenvalues = (double *) malloc(sizeof(double)*n_dims);
   samples = (double *) malloc((sizeof(double)*n_dims)*n_samples);
   proportion_explained = (double *) malloc(sizeof(double)*n_dims);
   skbio_check_acc();
-  skbb_pcoa_fsvd_inplace_fp64(n_samples, mat, n_dims, -1, eigenvalues, samples, proportion_explained);
+  skbb_pcoa_fsvd_inplace_fp64(n_samples, mat, n_dims, seed, eigenvalues, samples, proportion_explained);
 }
 
-void su::pcoa_inplace(float  * mat, const uint32_t n_samples, const uint32_t n_dims, float  * &eigenvalues, float  * &samples, float  * &proportion_explained) {
+void su::pcoa_inplace(float  * mat, const uint32_t n_samples, const uint32_t n_dims, float  * &eigenvalues, float  * &samples, float  * &proportion_explained, const int seed) {
   eigenvalues = (float *) malloc(sizeof(float)*n_dims);
   samples = (float *) malloc((sizeof(float)*n_dims)*n_samples);
   proportion_explained = (float *) malloc(sizeof(float)*n_dims);
   skbio_check_acc();
-  skbb_pcoa_fsvd_inplace_fp32(n_samples, mat, n_dims, -1, eigenvalues, samples, proportion_explained);
+  skbb_pcoa_fsvd_inplace_fp32(n_samples, mat, n_dims, seed, eigenvalues, samples, proportion_explained);
 }
 
 //
@@ -220,17 +230,19 @@ void su::pcoa_inplace(float  * mat, const uint32_t n_samples, const uint32_t n_d
 void su::permanova(const double * mat, unsigned int n_dims,
                    const uint32_t *grouping,
                    unsigned int n_perm,
-                   double &fstat_out, double &pvalue_out) {
+                   double &fstat_out, double &pvalue_out,
+                   const int seed) {
   skbio_check_acc();
-  skbb_permanova_fp64(n_dims, mat, grouping, n_perm, -1, &fstat_out, &pvalue_out);
+  skbb_permanova_fp64(n_dims, mat, grouping, n_perm, seed, &fstat_out, &pvalue_out);
 }
 
 void su::permanova(const float * mat, unsigned int n_dims,
                    const uint32_t *grouping,
                    unsigned int n_perm,
-                   float &fstat_out, float &pvalue_out) {
+                   float &fstat_out, float &pvalue_out,
+                   const int seed) {
   skbio_check_acc();
-  skbb_permanova_fp32(n_dims, mat, grouping, n_perm, -1, &fstat_out, &pvalue_out);
+  skbb_permanova_fp32(n_dims, mat, grouping, n_perm, seed, &fstat_out, &pvalue_out);
 }
 
 // ======================= skbio_biom_subsampled  ================================
@@ -14,6 +14,13 @@ namespace su {
 // in this module
 void set_random_seed(uint32_t new_seed);
 
+// Draw a new non-negative seed from an internal random generator,
+// separate from the one used for subsampling, but also set by set_random_seed
+// Can be passed to pcoa_inplace and permanova, to get results
+// that do not depend on the order other threads use the generator in
+// Note: Not thread safe, call from one thread only
+int draw_random_seed();
+
 // Center the matrix
 // mat and center must be nxn and symmetric
 // centered must be pre-allocated and same size as mat...will work even if centered==mat
@@ -40,13 +47,15 @@ void pcoa(const float  * mat, const uint32_t n_samples, const uint32_t n_dims, f
 void pcoa(const double * mat, const uint32_t n_samples, const uint32_t n_dims, float  * &eigenvalues, float  * &samples, float  * &proportion_explained);
 
 // in-place version, will use mat as temp buffer internally
-void pcoa_inplace(double * mat, const uint32_t n_samples, const uint32_t n_dims, double * &eigenvalues, double * &samples, double * &proportion_explained);
-void pcoa_inplace(float  * mat, const uint32_t n_samples, const uint32_t n_dims, float  * &eigenvalues, float  * &samples, float  * &proportion_explained);
+// seed - in, random seed to use, if negative use the shared generator (not thread safe)
+void pcoa_inplace(double * mat, const uint32_t n_samples, const uint32_t n_dims, double * &eigenvalues, double * &samples, double * &proportion_explained, const int seed=-1);
+void pcoa_inplace(float  * mat, const uint32_t n_samples, const uint32_t n_dims, float  * &eigenvalues, float  * &samples, float  * &proportion_explained, const int seed=-1);
 
 
 // Compute Permanova
-void permanova(const double * mat, unsigned int n_dims, const uint32_t *grouping, unsigned int n_perm, double &fstat_out, double &pvalue_out);
-void permanova(const float  * mat, unsigned int n_dims, const uint32_t *grouping, unsigned int n_perm, float  &fstat_out, float  &pvalue_out);
+// seed - in, random seed to use, if negative use the shared generator (not thread safe)
+void permanova(const double * mat, unsigned int n_dims, const uint32_t *grouping, unsigned int n_perm, double &fstat_out, double &pvalue_out, const int seed=-1);
+void permanova(const float  * mat, unsigned int n_dims, const uint32_t *grouping, unsigned int n_perm, float  &fstat_out, float  &pvalue_out, const int seed=-1);
 
 // biom_subsampled using the internal random generator
 class skbio_biom_subsampled : public biom_subsampled {
@@ -187,13 +187,28 @@ def print_header(variant,method):
 #  nmspace - namespace to use for the concrete implementations
 
 def print_body(method,lines,nmspace):
+    # functions inside this block only exist in the CPU variant
+    cpu_only_if = '#if !(defined(_OPENACC) || defined(OMPGPU))'
+    # one entry per open #if, True if it is a CPU only block
+    cpu_only_stack = []
     # now we can generate the concrete functions
     i=0
     while (i<len(lines)):
         line = lines[i]
         i+=1
+        if line.startswith('#if'):
+            cpu_only_stack.append(line.strip()==cpu_only_if)
+            continue
+        if line.startswith('#el'):
+            cpu_only_stack[-1] = False # the alternative is never CPU only
+            continue
+        if line.startswith('#endif'):
+            cpu_only_stack.pop()
+            continue
         if not line.startswith('static inline '):
             continue # not the beginning of an intersting function
+        if (nmspace!='su_cpu') and any(cpu_only_stack):
+            continue # not available in the accelerator variants
         if line.find('_T(')<0:
             continue # not the beginning of an intersting function
 
@@ -10,16 +10,16 @@
 // Using inlined-header-only funtions
 #include "biom.hpp"
 
-enum Format {format_invalid,format_ascii, format_hdf5_fp32, format_hdf5_fp64, format_hdf5_nodist};
+enum Format {format_invalid,format_ascii, format_hdf5_fp32, format_hdf5_fp64, format_hdf5_nodist, format_hdf5_summary};
 
 void usage() {
-    std::cout << "usage: ssu -i <biom> -o <out.dm> -m [METHOD] -t <newick> [-a alpha] [-f]  [--vaw]" << std::endl;
+    std::cout << "usage: ssu -i <biom> -o <out.dm> -m [METHOD] -t <newick> [-a alpha] [-f]  [--vaw] [--tree-cache path]" << std::endl;
     std::cout << "    [--mode MODE] [--start starting-stripe] [--stop stopping-stripe] [--partial-pattern <glob>]" << std::endl;
     std::cout << "    [--n-partials number_of_partitions] [--report-bare] [--format|-r out-mode]" << std::endl;
     std::cout << "    [--normalize-sample-counts true|false] [--n-substeps n] [--pcoa dims] [--diskbuf path]" << std::endl;
     std::cout << std::endl;
     std::cout << "    -i\t\tThe input BIOM table." << std::endl;
-    std::cout << "    -t\t\tThe input phylogeny in newick." << std::endl;
+    std::cout << "    -t\t\tThe input phylogeny in newick, or a tree cache." << std::endl;
     std::cout << "    -m\t\tThe method, [unweighted | weighted_normalized | weighted_unnormalized | unweighted_unnormalized | generalized |" << std::endl;
     std::cout << "                       unweighted_fp64 | weighted_normalized_fp64 | weighted_unnormalized_fp64 |" << std::endl;
     std::cout << "                       unweighted_unnormalized_fp64 | generalized_fp64 |" << std::endl;
@@ -29,6 +29,7 @@ void usage() {
     std::cout << "    -g\t\t[OPTIONAL] The input grouping in TSV." << std::endl;
     std::cout << "    -c\t\t[OPTIONAL] The columns(s) to use for grouping, multiple values comma separated." << std::endl;
     std::cout << "    -a\t\t[OPTIONAL] Generalized UniFrac alpha, default is 1." << std::endl;
+    std::cout << "    \t\t    If mode==one-off, a comma separated list of alphas computes them all in a single pass, saved in a single HDF5 file." << std::endl;
     std::cout << "    -f\t\t[OPTIONAL] Bypass tips, reduces compute by about 50%." << std::endl;
     std::cout << "    --vaw\t[OPTIONAL] Variance adjusted, default is to not adjust for variance." << std::endl;
     std::cout << "    --mode\t[OPTIONAL] Mode of operation:" << std::endl;
@@ -38,6 +39,8 @@ void usage() {
     std::cout << "    \t\t    merge-partial : Merge partial UniFrac results." << std::endl;
     std::cout << "    \t\t    check-partial : Check partial UniFrac results." << std::endl;
     std::cout << "    \t\t    multi : compute UniFrac multiple times." << std::endl;
+    std::cout << "    \t\t    multi-metric : compute several methods with a single pass over the tree." << std::endl;
+    std::cout << "    \t\t                   -m, -a and -o are comma separated lists, one element per method (a single -a applies to all)." << std::endl;
     std::cout << "    --start\t[OPTIONAL] If mode==partial, the starting stripe." << std::endl;
     std::cout << "    --stop\t[OPTIONAL] If mode==partial, the stopping stripe." << std::endl;
     std::cout << "    --partial-pattern\t[OPTIONAL] If mode==merge-partial or check-partial, a glob pattern for partial outputs to merge." << std::endl;
@@ -53,6 +56,7 @@ void usage() {
     std::cout << "    \t\t    hdf5_fp32 : HFD5 format, using fp32 precision." << std::endl;
     std::cout << "    \t\t    hdf5_fp64 : HFD5 format, using fp64 precision." << std::endl;
     std::cout << "    \t\t    hdf5_nodist : HFD5 format, no distance matrix. (default if mode==multi)" << std::endl;
+    std::cout << "    \t\t    hdf5_summary : HFD5 format, only mean and M2 distance matrices across subsamples. (only if mode==multi)" << std::endl;
     std::cout << "    --subsample-depth\tDepth of subsampling of the input BIOM before computing unifrac (required for mode==multi, optional for one-off)" << std::endl;
     std::cout << "    --subsample-replacement\t[OPTIONAL] Subsample with or without replacement (default is with)" << std::endl;
     std::cout << "    --n-subsamples\t[OPTIONAL] if mode==multi, number of subsampled UniFracs to compute (default: 100)" << std::endl;
@@ -60,6 +64,7 @@ void usage() {
     std::cout << "    --pcoa\t[OPTIONAL] Number of PCoA dimensions to compute (default: 10, do not compute if 0)" << std::endl;
     std::cout << "    --seed\t[OPTIONAL] Seed to use for initializing the random gnerator" << std::endl;
     std::cout << "    --diskbuf\t[OPTIONAL] Use a disk buffer to reduce memory footprint. Provide path to a fast partition (ideally NVMe)." << std::endl;
+    std::cout << "    --tree-cache\t[OPTIONAL] Binary tree cache to use instead of parsing the newick. Created from -t if missing or out of date." << std::endl;
     std::cout << "    -n\t\t[OPTIONAL] DEPRECATED, no-op." << std::endl;
     std::cout << std::endl;
     std::cout << "Environment variables: " << std::endl;
@@ -377,18 +382,33 @@ int mode_partial(std::string table_filename, std::string tree_filename,
         return EXIT_FAILURE;
     }
 
-    partial_mat_t *result = NULL;
+    io_status err = write_okay;
     compute_status status;
-    status = partial_v3(table_filename.c_str(), tree_filename.c_str(), method_string.c_str(), 
-                        vaw, g_unifrac_alpha, bypass_tips, normalize_sample_counts,
-			nsubsteps, start_stripe, stop_stripe, &result);
-    if(status != okay || result == NULL) {
+
+    // fp32 methods keep the fp32 precision in the partial file, halving its size
+    partial_mat_fp32_t *result_fp32 = NULL;
+    status = partial_fp32_v3(table_filename.c_str(), tree_filename.c_str(), method_string.c_str(), 
+                             vaw, g_unifrac_alpha, bypass_tips, normalize_sample_counts,
+                             nsubsteps, start_stripe, stop_stripe, &result_fp32);
+    if(status == okay && result_fp32 != NULL) {
+        err = write_partial_fp32(output_filename.c_str(), result_fp32);
+        destroy_partial_mat_fp32(&result_fp32);
+    } else if(status == invalid_method) {
+        partial_mat_t *result = NULL;
+        status = partial_v3(table_filename.c_str(), tree_filename.c_str(), method_string.c_str(), 
+                            vaw, g_unifrac_alpha, bypass_tips, normalize_sample_counts,
+                            nsubsteps, start_stripe, stop_stripe, &result);
+        if(status != okay || result == NULL) {
+            fprintf(stderr, "Compute failed in partial: %s\n", compute_status_messages[status]);
+            exit(EXIT_FAILURE);
+        }
+   
+        err = write_partial(output_filename.c_str(), result);
+        destroy_partial_mat(&result);
+    } else {
         fprintf(stderr, "Compute failed in partial: %s\n", compute_status_messages[status]);
         exit(EXIT_FAILURE);
     }
-   
-    io_status err = write_partial(output_filename.c_str(), result);
-    destroy_partial_mat(&result);
 
     if(err != write_okay){
         fprintf(stderr, "Write failed: %s\n", err == open_error ? "could not open output" : "unknown error");
@@ -542,6 +562,180 @@ int mode_multi(const std::string &table_filename, const std::string &tree_filena
     return (status==okay) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
+inline std::vector<std::string> split_comma_list(const std::string &list) {
+    std::vector<std::string> out;
+    std::istringstream in(list);
+    std::string el;
+    while(std::getline(in, el, ',')) {
+        if(!el.empty()) out.push_back(el);
+    }
+    return out;
+}
+
+int mode_multi_metric(const std::string &table_filename, const std::string &tree_filename,
+                      const std::string &output_filenames, Format format_val,
+                      const std::string &method_strings, const std::string &alpha_strings,
+                      unsigned int subsample_depth, bool subsample_with_replacement, unsigned int pcoa_dims,
+                      bool vaw, bool bypass_tips, bool normalize_sample_counts,
+                      unsigned int nsubsteps, const std::string &mmap_dir) {
+    const std::vector<std::string> outputs = split_comma_list(output_filenames);
+    const std::vector<std::string> methods = split_comma_list(method_strings);
+    const std::vector<std::string> alpha_args = split_comma_list(alpha_strings);
+
+    if(outputs.empty()) {
+        err("output filename missing");
+        return EXIT_FAILURE;
+    }
+
+    if(table_filename.empty()) {
+        err("table filename missing");
+        return EXIT_FAILURE;
+    }
+
+    if(tree_filename.empty()) {
+        err("tree filename missing");
+        return EXIT_FAILURE;
+    }
+
+    if(methods.empty()) {
+        err("method missing");
+        return EXIT_FAILURE;
+    }
+
+    if(outputs.size() != methods.size()) {
+        err("In '--mode multi-metric', there must be one output filename per method");
+        return EXIT_FAILURE;
+    }
+
+    if((alpha_args.size() > 1) && (alpha_args.size() != methods.size())) {
+        err("In '--mode multi-metric', -a must be either a single value or one value per method");
+        return EXIT_FAILURE;
+    }
+
+    if(vaw) {
+        err("Variance adjusted UniFrac not supported in multi-metric mode");
+        return EXIT_FAILURE;
+    }
+
+    const unsigned int n_methods = methods.size();
+    std::vector<const char*> methods_c(n_methods);
+    std::vector<double> alphas(n_methods);
+    for(unsigned int i = 0; i < n_methods; i++) {
+        methods_c[i] = methods[i].c_str();
+        if(alpha_args.empty())
+            alphas[i] = 1.0;
+        else
+            alphas[i] = atof(alpha_args[(alpha_args.size()==1) ? 0 : i].c_str());
+    }
+
+    const char * mmap_dir_c = mmap_dir.empty() ? NULL : mmap_dir.c_str();
+    const bool use_fp32 = (format_val==format_hdf5_fp32) || (format_val==format_hdf5_nodist);
+    std::vector<mat_full_fp64_t*> results_fp64(n_methods, NULL);
+    std::vector<mat_full_fp32_t*> results_fp32(n_methods, NULL);
+
+    compute_status status;
+    if(use_fp32) {
+        status = one_off_matrix_multi_fp32_v3(table_filename.c_str(), tree_filename.c_str(),
+                                              methods_c.data(), alphas.data(), n_methods,
+                                              bypass_tips, normalize_sample_counts, nsubsteps,
+                                              subsample_depth, subsample_with_replacement, mmap_dir_c,
+                                              results_fp32.data());
+    } else {
+        status = one_off_matrix_multi_v3(table_filename.c_str(), tree_filename.c_str(),
+                                         methods_c.data(), alphas.data(), n_methods,
+                                         bypass_tips, normalize_sample_counts, nsubsteps,
+                                         subsample_depth, subsample_with_replacement, mmap_dir_c,
+                                         results_fp64.data());
+    }
+
+    if(status != okay) {
+        fprintf(stderr, "Compute failed in multi-metric: %s\n", compute_status_messages[status]);
+        return EXIT_FAILURE;
+    }
+
+    IOStatus iostatus = write_okay;
+    for(unsigned int i = 0; i < n_methods; i++) {
+        if(iostatus == write_okay) {
+            if(use_fp32) {
+                iostatus = write_mat_from_matrix_hdf5_fp32(outputs[i].c_str(), results_fp32[i], pcoa_dims, format_val!=format_hdf5_nodist);
+            } else if(format_val==format_ascii) {
+                iostatus = write_mat_from_matrix(outputs[i].c_str(), results_fp64[i]);
+            } else {
+                iostatus = write_mat_from_matrix_hdf5_fp64(outputs[i].c_str(), results_fp64[i], pcoa_dims, true);
+            }
+        }
+        if(use_fp32)
+            destroy_mat_full_fp32(&results_fp32[i]);
+        else
+            destroy_mat_full_fp64(&results_fp64[i]);
+    }
+
+    if(iostatus != write_okay) {
+        std::ostringstream msg;
+        msg << "Unable to write; err " << iostatus;
+        err(msg.str());
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+int mode_multi_alpha(const std::string &table_filename, const std::string &tree_filename,
+                     const std::string &output_filename, const std::string &format_str, Format format_val,
+                     const std::string &method_string, const std::string &alpha_strings,
+                     unsigned int subsample_depth, bool subsample_with_replacement, unsigned int pcoa_dims,
+                     bool vaw, bool bypass_tips, bool normalize_sample_counts,
+                     unsigned int nsubsteps, const std::string &mmap_dir) {
+    const std::vector<std::string> alpha_args = split_comma_list(alpha_strings);
+
+    if(output_filename.empty()) {
+        err("output filename missing");
+        return EXIT_FAILURE;
+    }
+
+    if(table_filename.empty()) {
+        err("table filename missing");
+        return EXIT_FAILURE;
+    }
+
+    if(tree_filename.empty()) {
+        err("tree filename missing");
+        return EXIT_FAILURE;
+    }
+
+    if(method_string.empty()) {
+        err("method missing");
+        return EXIT_FAILURE;
+    }
+
+    if(format_val==format_ascii) {
+        err("Multiple alphas are only supported with HDF5 output.");
+        return EXIT_FAILURE;
+    }
+
+    if(vaw) {
+        err("Variance adjusted UniFrac not supported with multiple alphas");
+        return EXIT_FAILURE;
+    }
+
+    std::vector<double> alphas(alpha_args.size());
+    for(unsigned int i = 0; i < alpha_args.size(); i++)
+        alphas[i] = atof(alpha_args[i].c_str());
+
+    const char * mmap_dir_c = mmap_dir.empty() ? NULL : mmap_dir.c_str();
+    compute_status status = unifrac_alphas_to_file_v3(table_filename.c_str(), tree_filename.c_str(), output_filename.c_str(),
+                                                      method_string.c_str(), alphas.data(), alphas.size(),
+                                                      bypass_tips, normalize_sample_counts, nsubsteps, format_str.c_str(),
+                                                      subsample_depth, subsample_with_replacement,
+                                                      pcoa_dims, mmap_dir_c);
+
+    if (status != okay) {
+        fprintf(stderr, "Compute failed in one_off: %s\n", compute_status_messages[status]);
+    }
+
+    return (status==okay) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 void ssu_sig_handler(int signo) {
     if (signo == SIGUSR1) {
         printf("Status cannot be reported.\n");
@@ -564,8 +758,12 @@ Format get_format(const std::string &format_string, const std::string &method_st
         format_val = format_hdf5_fp64;
     } else if (format_string == "hdf5_nodist") {
         format_val = format_hdf5_nodist;
+    } else if (format_string == "hdf5_summary") {
+        format_val = format_hdf5_summary;
     } else if (format_string == "hdf5") {
-        if ((method_string=="unweighted_fp64") || (method_string=="weighted_normalized_fp64") || (method_string=="weighted_unnormalized_fp64") || (method_string=="generalized_fp64") || (method_string=="unweighted_unnormalized_fp64"))
+        // in multi-metric mode, all the methods have the same precision
+        const std::string first_method = method_string.substr(0, method_string.find(','));
+        if ((first_method=="unweighted_fp64") || (first_method=="weighted_normalized_fp64") || (first_method=="weighted_unnormalized_fp64") || (first_method=="generalized_fp64") || (first_method=="unweighted_unnormalized_fp64"))
            format_val = format_hdf5_fp64;
         else
            format_val = format_hdf5_fp32;
@@ -577,6 +775,8 @@ Format get_format(const std::string &format_string, const std::string &method_st
 std::string format2str(Format format_val) {
   if (format_val==format_hdf5_nodist) {
     return "hdf5_nodist";
+  } else if (format_val==format_hdf5_summary) {
+    return "hdf5_summary";
   } else if (format_val==format_hdf5_fp32) {
     return "hdf5_fp32";
   } else if (format_val==format_hdf5_fp64) {
@@ -622,6 +822,7 @@ int main(int argc, char **argv){
     std::string subsample_replacement_arg = input.getCmdOption("--subsample-replacement");
     std::string n_subsamples_arg = input.getCmdOption("--n-subsamples");
     std::string diskbuf_arg = input.getCmdOption("--diskbuf");
+    std::string tree_cache_arg = input.getCmdOption("--tree-cache");
 
     if(nsubsteps_arg.empty()) {
         nsubsteps = 1;
@@ -687,7 +888,11 @@ int main(int argc, char **argv){
       format_arg=sformat_arg; // easier to use a single variable
     }
     if(format_val==format_invalid) {
-        err("Invalid format, must be one of ascii|hdf5|hdf5_fp32|hdf5_fp64|hdf5_nodist");
+        err("Invalid format, must be one of ascii|hdf5|hdf5_fp32|hdf5_fp64|hdf5_nodist|hdf5_summary");
+        return EXIT_FAILURE;
+    }
+    if((format_val==format_hdf5_summary) && (mode_arg!="multi") && (mode_arg!="multiple")) {
+        err("Format hdf5_summary only supported in multi mode");
         return EXIT_FAILURE;
     }
 
@@ -747,7 +952,24 @@ int main(int argc, char **argv){
         }
     }
 
-    if(mode_arg.empty() || mode_arg == "one-off")
+    if(!tree_cache_arg.empty()) {
+        if(!tree_filename.empty()) {
+            IOStatus sts = update_bptree_cache(tree_filename.c_str(), tree_cache_arg.c_str());
+            if((sts != read_okay) && (sts != write_okay)) {
+                err("Unable to create the tree cache.");
+                return EXIT_FAILURE;
+            }
+        }
+        // all the modes can read the cache in place of the newick
+        tree_filename = tree_cache_arg;
+    }
+
+    if((mode_arg.empty() || mode_arg == "one-off") && (gunifrac_arg.find(',') != std::string::npos))
+        return mode_multi_alpha(table_filename, tree_filename, output_filename, format2str(format_val), format_val,
+                                method_string, gunifrac_arg,
+                                subsample_depth, !subsample_without_replacement, pcoa_dims,
+                                vaw, bypass_tips, normalize_sample_counts, nsubsteps, diskbuf_arg);
+    else if(mode_arg.empty() || mode_arg == "one-off")
         return mode_one_off(table_filename, tree_filename, output_filename,  format2str(format_val), format_val, method_string,
                             subsample_depth, !subsample_without_replacement,
                             pcoa_dims, permanova_perms, grouping_filename, grouping_columns,
@@ -772,8 +994,12 @@ int main(int argc, char **argv){
                             n_subsamples,subsample_depth, !subsample_without_replacement,
                             pcoa_dims, permanova_perms, grouping_filename, grouping_columns,
                             vaw, g_unifrac_alpha, bypass_tips, normalize_sample_counts, nsubsteps, diskbuf_arg);
+    else if(mode_arg == "multi-metric")
+        return mode_multi_metric(table_filename, tree_filename, output_filename, format_val, method_string, gunifrac_arg,
+                                 subsample_depth, !subsample_without_replacement, pcoa_dims,
+                                 vaw, bypass_tips, normalize_sample_counts, nsubsteps, diskbuf_arg);
     else 
-        err("Unknown mode. Valid options are: one-off, partial, merge-partial, check-partial, partial-report, multi");
+        err("Unknown mode. Valid options are: one-off, partial, merge-partial, check-partial, partial-report, multi, multi-metric");
 
     return EXIT_SUCCESS;
 }
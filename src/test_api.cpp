@@ -2,8 +2,12 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <H5Cpp.h>
 #include <H5Dpublic.h>
+#include <omp.h>
+#include <vector>
+#include <string>
 #include "test_helper.hpp"
 
 //void test_write_mat() {
@@ -77,6 +81,7 @@ partial_dyn_mat_t* make_test_pdm(int case_id) {
     fill_test_pm<partial_dyn_mat_t,double>(pm,case_id);
     pm->offsets = (uint64_t*)calloc(pm->stripe_stop-pm->stripe_start,sizeof(uint64_t));
     pm->filename = strdup("dummy");
+    pm->stripes_fp32 = NULL;
 
     return pm;
 }
@@ -142,6 +147,97 @@ TMat* mat_full_three_rep() {
     return res;
 }
 
+void test_read_write_partial_mat_fp32() {
+    SUITE_START("test read/write partial_mat_fp32_t");
+
+    partial_mat_fp32_t* pm = (partial_mat_fp32_t*)malloc(sizeof(partial_mat_fp32_t));
+    fill_test_pm<partial_mat_fp32_t,float>(pm,0);
+
+    io_status err = write_partial_fp32("/tmp/ssu_io_fp32.dat", pm);
+    ASSERT(err == write_okay);
+
+    // fp32 partials are widened to double on read
+    partial_mat_t *obs = NULL;
+    err = read_partial("/tmp/ssu_io_fp32.dat", &obs);
+
+    ASSERT(err == read_okay);
+    ASSERT(obs->n_samples == 6);
+    ASSERT(obs->stripe_start == 0);
+    ASSERT(obs->stripe_stop == 3);
+    ASSERT(obs->stripe_total == 3);
+    ASSERT(strcmp(obs->sample_ids[2], "Cx") == 0);
+
+    for(int i = 0; i < 3; i++) {
+        for(int j = 0; j < 6; j++) {
+            ASSERT(obs->stripes[i][j] == ((i * 6) + j + 1));
+        }
+    }
+
+    destroy_partial_mat(&obs);
+
+    // but kept as fp32 when read one stripe at a time
+    partial_dyn_mat_t *dobs = NULL;
+    err = read_partial_header("/tmp/ssu_io_fp32.dat", &dobs);
+    ASSERT(err == read_okay);
+    ASSERT(dobs->stripes_fp32 != NULL);
+    err = read_partial_one_stripe(dobs,1);
+    ASSERT(err == read_okay);
+    ASSERT(dobs->stripes[1] == NULL);
+    for(int j = 0; j < 6; j++) {
+        ASSERT(dobs->stripes_fp32[1][j] == (6 + j + 1));
+    }
+    destroy_partial_dyn_mat(&dobs);
+
+    destroy_partial_mat_fp32(&pm);
+    SUITE_END();
+}
+
+// Overwrite the magic at the beginning and/or at the end of a partial file
+void set_partial_magic(const char *fname, uint32_t header_magic, uint32_t footer_magic) {
+    FILE *fp = fopen(fname, "r+b");
+    fwrite(&header_magic, sizeof(uint32_t), 1, fp);
+    fseek(fp, -long(sizeof(uint32_t)), SEEK_END);
+    fwrite(&footer_magic, sizeof(uint32_t), 1, fp);
+    fclose(fp);
+}
+
+void test_read_partial_mat_magic_mismatch() {
+    SUITE_START("test read partial_mat_t magic mismatch");
+
+    partial_mat_t* pm = make_test_pm(0);
+    io_status err = write_partial("/tmp/ssu_io_mm.dat", pm);
+    ASSERT(err == write_okay);
+
+    // fp64 stripes, but the magic claims fp32
+    set_partial_magic("/tmp/ssu_io_mm.dat", PARTIAL_MAGIC_V2_FP32, PARTIAL_MAGIC_V2_FP32);
+    partial_mat_t *obs = NULL;
+    err = read_partial("/tmp/ssu_io_mm.dat", &obs);
+    ASSERT(err == magic_incompatible);
+    ASSERT(obs == NULL);
+
+    partial_dyn_mat_t *dobs = NULL;
+    err = read_partial_header("/tmp/ssu_io_mm.dat", &dobs);
+    ASSERT(err == read_okay);
+    err = read_partial_one_stripe(dobs,0);
+    ASSERT(err == magic_incompatible);
+    destroy_partial_dyn_mat(&dobs);
+
+    // header and footer must agree
+    set_partial_magic("/tmp/ssu_io_mm.dat", PARTIAL_MAGIC_V2, PARTIAL_MAGIC_V2_FP32);
+    err = read_partial("/tmp/ssu_io_mm.dat", &obs);
+    ASSERT(err == magic_incompatible);
+
+    // and the original is still fine
+    set_partial_magic("/tmp/ssu_io_mm.dat", PARTIAL_MAGIC_V2, PARTIAL_MAGIC_V2);
+    err = read_partial("/tmp/ssu_io_mm.dat", &obs);
+    ASSERT(err == read_okay);
+    ASSERT(obs->stripes[2][5] == 18);
+    destroy_partial_mat(&obs);
+
+    destroy_partial_mat(&pm);
+    SUITE_END();
+}
+
 void test_read_write_partial_mat() {
     SUITE_START("test read/write partial_mat_t");
 
@@ -549,6 +645,68 @@ void test_merge_partial_io() {
     SUITE_END();
 }
 
+void test_merge_partial_fp32() {
+    SUITE_START("test merge partial fp32");
+
+    partial_mat_fp32_t* s1 = (partial_mat_fp32_t*)malloc(sizeof(partial_mat_fp32_t));
+    fill_test_pm<partial_mat_fp32_t,float>(s1,1);
+    partial_mat_fp32_t* s2 = (partial_mat_fp32_t*)malloc(sizeof(partial_mat_fp32_t));
+    fill_test_pm<partial_mat_fp32_t,float>(s2,2);
+    partial_mat_t* s2_64 = make_test_pm(2);
+
+    io_status ierr;
+    ierr = write_partial_fp32("/tmp/ssu_io32_1.dat", s1);
+    ASSERT(ierr == write_okay);
+    ierr = write_partial_fp32("/tmp/ssu_io32_2.dat", s2);
+    ASSERT(ierr == write_okay);
+    ierr = write_partial("/tmp/ssu_io64_2.dat", s2_64);
+    ASSERT(ierr == write_okay);
+
+    mat_full_fp32_t* exp = mat_full_three_rep<mat_full_fp32_t,float>();
+
+    // all fp32, and fp32 mixed with fp64
+    const char *second_names[2] = {"/tmp/ssu_io32_2.dat", "/tmp/ssu_io64_2.dat"};
+    for (int mixed=0; mixed<2; mixed++) {
+      partial_dyn_mat_t* pms[2] = {NULL, NULL};
+      ierr = read_partial_header("/tmp/ssu_io32_1.dat", &pms[0]);
+      ASSERT(ierr == read_okay);
+      ierr = read_partial_header(second_names[mixed], &pms[1]);
+      ASSERT(ierr == read_okay);
+      ASSERT((pms[1]->stripes_fp32 == NULL) == (mixed==1));
+
+      mat_full_fp32_t *obs = NULL;
+      merge_status err = merge_partial_to_mmap_matrix_fp32(pms, 2, NULL, &obs);
+      ASSERT(err == merge_okay);
+      ASSERT(obs->n_samples == exp->n_samples);
+      for(unsigned int i = 0; i < (obs->n_samples*obs->n_samples); i++) {
+          ASSERT(obs->matrix[i] == exp->matrix[i]);
+      }
+      for(unsigned int i = 0; i < obs->n_samples; i++)
+          ASSERT(strcmp(obs->sample_ids[i], exp->sample_ids[i]) == 0);
+
+      // all released after use
+      ASSERT(pms[0]->stripes[0]==NULL);
+      ASSERT(pms[0]->stripes_fp32[0]==NULL);
+      ASSERT(pms[0]->stripes[1]==NULL);
+      ASSERT(pms[0]->stripes_fp32[1]==NULL);
+      ASSERT(pms[1]->stripes[0]==NULL);
+
+      destroy_mat_full_fp32(&obs);
+      destroy_partial_dyn_mat(&pms[0]);
+      destroy_partial_dyn_mat(&pms[1]);
+    }
+
+    destroy_mat_full_fp32(&exp);
+    destroy_partial_mat_fp32(&s1);
+    destroy_partial_mat_fp32(&s2);
+    destroy_partial_mat(&s2_64);
+    unlink("/tmp/ssu_io32_1.dat");
+    unlink("/tmp/ssu_io32_2.dat");
+    unlink("/tmp/ssu_io64_2.dat");
+
+    SUITE_END();
+}
+
 void test_merge_partial_mmap() {
     SUITE_START("test merge partial_mmap");
 
@@ -687,17 +845,351 @@ void test_to_file() {
     SUITE_END();
 }
 
+void test_one_off_matrix_multi() {
+    SUITE_START("test one_off_matrix_multi");
+
+    const char* methods[] = {"unweighted_fp64", "weighted_normalized_fp64", "generalized_fp64"};
+    const double alphas[] = {1.0, 1.0, 0.5};
+    mat_full_fp64_t* results[] = {NULL, NULL, NULL};
+
+    ComputeStatus urc;
+    urc = one_off_matrix_multi_v3("test.biom","test.tre",methods,alphas,3,false,true,1,0,true,NULL,results);
+    ASSERT(urc == okay);
+
+    // must match the methods computed one at a time
+    for(unsigned int m = 0; m < 3; m++) {
+        mat_full_fp64_t* exp = NULL;
+        urc = one_off_matrix_v3("test.biom","test.tre",methods[m],false,alphas[m],false,true,1,0,true,NULL,&exp);
+        ASSERT(urc == okay);
+        ASSERT(results[m]->n_samples == exp->n_samples);
+        for(unsigned int i = 0; i < (exp->n_samples*exp->n_samples); i++) {
+            ASSERT(fabs(results[m]->matrix[i] - exp->matrix[i]) < 0.000001);
+        }
+        destroy_mat_full_fp64(&exp);
+        destroy_mat_full_fp64(&results[m]);
+    }
+
+    // all the methods must have the same precision
+    const char* mixed_methods[] = {"unweighted_fp64", "weighted_normalized_fp32"};
+    mat_full_fp32_t* mixed_results[] = {NULL, NULL};
+    urc = one_off_matrix_multi_fp32_v3("test.biom","test.tre",mixed_methods,alphas,2,false,true,1,0,true,NULL,mixed_results);
+    ASSERT(urc == invalid_method);
+
+    SUITE_END();
+}
+
+void test_alphas_to_file() {
+    SUITE_START("test unifrac_alphas_to_file");
+
+    static const char h5name[]="/tmp/ssu_t2.h5";
+    const double alphas[] = {1.0, 0.0, 0.5};
+
+    ComputeStatus urc;
+    unlink(h5name);
+    urc=unifrac_alphas_to_file_v3("test.biom","test.tre",h5name,"generalized_fp64",alphas,3,false,true,1,"hdf5_fp64",0,true,0,NULL);
+    ASSERT(urc == okay);
+
+    // each matrix must match the alpha computed on its own
+    {
+      try {
+        H5::H5File file(h5name, H5F_ACC_RDONLY);
+        H5::DataSet ads(file.openDataSet("alphas"));
+        double obs_alphas[3];
+        ads.read(obs_alphas, H5::PredType::NATIVE_DOUBLE);
+
+        for(unsigned int a = 0; a < 3; a++) {
+          ASSERT(obs_alphas[a] == alphas[a]);
+
+          char dsname[64];
+          snprintf(dsname,63,"matrix:%d",a);
+          H5::DataSet mds(file.openDataSet(dsname));
+          double obs[36];
+          mds.read(obs, H5::PredType::NATIVE_DOUBLE);
+
+          mat_full_fp64_t* exp = NULL;
+          urc = one_off_matrix_v3("test.biom","test.tre","generalized_fp64",false,alphas[a],false,true,1,0,true,NULL,&exp);
+          ASSERT(urc == okay);
+          ASSERT(exp->n_samples == 6);
+          for(unsigned int i = 0; i < 36; i++) {
+            ASSERT(fabs(obs[i] - exp->matrix[i]) < 0.000001);
+          }
+          destroy_mat_full_fp64(&exp);
+        }
+      } catch(...) {
+        int rc=1;
+        ASSERT(rc == 0); // if we get here is always an error, just to get a nice message
+      }
+    }
+    unlink(h5name);
+
+    // only generalized has an alpha
+    urc=unifrac_alphas_to_file_v3("test.biom","test.tre",h5name,"unweighted",alphas,3,false,true,1,"hdf5_fp64",0,true,0,NULL);
+    ASSERT(urc == invalid_method);
+
+    SUITE_END();
+}
+
+void test_multi_summary() {
+    SUITE_START("test unifrac_multi_to_file summary");
+
+    static const char h5name_all[]="/tmp/ssu_t3.h5";
+    static const char h5name_sum[]="/tmp/ssu_t4.h5";
+    const unsigned int n_subsamples = 4;
+
+    ComputeStatus urc;
+    unlink(h5name_all);
+    unlink(h5name_sum);
+
+    // same seed, so the same subsamples
+    ssu_set_random_seed(42);
+    urc=unifrac_multi_to_file_v3("test.biom","test.tre",h5name_all,"unweighted_fp64",false,1.0,false,true,1,"hdf5_fp64",
+                                 n_subsamples,5,true,0,0,NULL,NULL,NULL);
+    ASSERT(urc == okay);
+    ssu_set_random_seed(42);
+    urc=unifrac_multi_to_file_v3("test.biom","test.tre",h5name_sum,"unweighted_fp64",false,1.0,false,true,1,"hdf5_summary",
+                                 n_subsamples,5,true,0,0,NULL,NULL,NULL);
+    ASSERT(urc == okay);
+
+    // nothing to summarize
+    urc=unifrac_multi_to_file_v3("test.biom","test.tre","/tmp/ssu_t5.h5","unweighted_fp64",false,1.0,false,true,1,"hdf5_summary",
+                                 0,5,true,0,0,NULL,NULL,NULL);
+    ASSERT(urc == table_empty);
+
+    {
+      try {
+        // 2 samples left after subsampling
+        double exp_mean[4] = {0., 0., 0., 0.};
+        double exp_m2[4] = {0., 0., 0., 0.};
+        {
+          H5::H5File file(h5name_all, H5F_ACC_RDONLY);
+          double vals[n_subsamples][4];
+          for (unsigned int i=0; i<n_subsamples; i++) {
+            char dsname[64];
+            snprintf(dsname,63,"matrix:%d",i);
+            H5::DataSet mds(file.openDataSet(dsname));
+            mds.read(vals[i], H5::PredType::NATIVE_DOUBLE);
+            for (unsigned int j=0; j<4; j++) exp_mean[j] += vals[i][j]/n_subsamples;
+          }
+          for (unsigned int i=0; i<n_subsamples; i++) {
+            for (unsigned int j=0; j<4; j++) exp_m2[j] += (vals[i][j]-exp_mean[j])*(vals[i][j]-exp_mean[j]);
+          }
+        }
+
+        H5::H5File file(h5name_sum, H5F_ACC_RDONLY);
+        // no individual matrices
+        ASSERT(H5Lexists(file.getId(), "matrix:0", H5P_DEFAULT) <= 0);
+
+        uint32_t n_summarized = 0;
+        H5::DataSet nds(file.openDataSet("n_summarized"));
+        nds.read(&n_summarized, H5::PredType::NATIVE_UINT32);
+        ASSERT(n_summarized == n_subsamples);
+
+        double obs_mean[4];
+        double obs_m2[4];
+        H5::DataSet mds(file.openDataSet("matrix_mean"));
+        mds.read(obs_mean, H5::PredType::NATIVE_DOUBLE);
+        H5::DataSet m2ds(file.openDataSet("matrix_m2"));
+        m2ds.read(obs_m2, H5::PredType::NATIVE_DOUBLE);
+        for (unsigned int j=0; j<4; j++) {
+          ASSERT(fabs(obs_mean[j] - exp_mean[j]) < 0.000001);
+          ASSERT(fabs(obs_m2[j] - exp_m2[j]) < 0.000001);
+        }
+      } catch(...) {
+        int rc=1;
+        ASSERT(rc == 0); // if we get here is always an error, just to get a nice message
+      }
+    }
+    unlink(h5name_all);
+    unlink(h5name_sum);
+
+    SUITE_END();
+}
+
+void test_update_bptree_cache() {
+    SUITE_START("test update_bptree_cache");
+
+    static const char newick_name[]="/tmp/ssu_t6.tre";
+    static const char cache_name[]="/tmp/ssu_t6.tre.cache";
+    unlink(cache_name);
+    {
+      FILE *f = fopen(newick_name, "w");
+      fputs("((a:1,b:2)c:1,d:3);\n", f);
+      fclose(f);
+    }
+
+    // the two timestamps only differ in the nanoseconds
+    struct timespec times[2];
+    times[0].tv_sec = 1000000000; times[0].tv_nsec = 1;
+    times[1].tv_sec = 1000000000; times[1].tv_nsec = 1;
+    ASSERT(utimensat(AT_FDCWD, newick_name, times, 0) == 0);
+
+    ASSERT(update_bptree_cache(newick_name, cache_name) == write_okay);
+    ASSERT(update_bptree_cache(newick_name, cache_name) == read_okay);
+
+    times[1].tv_nsec = 2;
+    ASSERT(utimensat(AT_FDCWD, newick_name, times, 0) == 0);
+    ASSERT(update_bptree_cache(newick_name, cache_name) == write_okay);
+    ASSERT(update_bptree_cache(newick_name, cache_name) == read_okay);
+
+    // a truncated cache is not up to date
+    ASSERT(truncate(cache_name, 64) == 0);
+    ASSERT(update_bptree_cache(newick_name, cache_name) == write_okay);
+
+    opaque_bptree_t* tree_data = NULL;
+    ASSERT(read_bptree_opaque(cache_name, &tree_data) == read_okay);
+    ASSERT(get_bptree_opaque_els(tree_data) == 3); // a, b and d
+    destroy_bptree_opaque(&tree_data);
+
+    unlink(cache_name);
+    unlink(newick_name);
+
+    SUITE_END();
+}
+
+// read any dataset as raw bytes, with variable length strings expanded
+std::vector<char> read_h5_dataset_bytes(H5::H5File &file, const char *dsname) {
+    H5::DataSet ds(file.openDataSet(dsname));
+    H5::DataType dtype(ds.getDataType());
+    const hsize_t n_els = ds.getSpace().getSimpleExtentNpoints();
+    std::vector<char> out;
+    if ((dtype.getClass()==H5T_STRING) && dtype.isVariableStr()) {
+      std::vector<char*> strs(n_els);
+      ds.read(strs.data(), dtype);
+      for (hsize_t i=0; i<n_els; i++) out.insert(out.end(), strs[i], strs[i]+strlen(strs[i])+1);
+      H5Dvlen_reclaim(dtype.getId(), ds.getSpace().getId(), H5P_DEFAULT, strs.data());
+    } else {
+      out.resize(n_els*dtype.getSize());
+      ds.read(out.data(), dtype);
+    }
+    return out;
+}
+
+void test_multi_threads_match() {
+    SUITE_START("test unifrac_multi_to_file threads match");
+
+    static const char tsv_name[]="/tmp/ssu_t7.tsv";
+    static const char h5name_1[]="/tmp/ssu_t7_1.h5";
+    static const char h5name_4[]="/tmp/ssu_t7_4.h5";
+    const unsigned int n_subsamples = 6;
+    {
+      FILE *f = fopen(tsv_name, "w");
+      fputs("#SampleID\tcol1\tcol2\n"
+            "Sample1\ta\tx\nSample2\ta\ty\nSample3\ta\tx\n"
+            "Sample4\tb\ty\nSample5\tb\tx\nSample6\tb\ty\n", f);
+      fclose(f);
+    }
+
+    // pcoa and permanova use random numbers, too,
+    // but the results must not depend on the number of threads
+    const int max_threads = omp_get_max_threads();
+    const char *h5names[2] = {h5name_1, h5name_4};
+    const int n_threads[2] = {1, 4};
+    for (int t=0; t<2; t++) {
+      unlink(h5names[t]);
+      omp_set_num_threads(n_threads[t]);
+      ssu_set_random_seed(42);
+      ComputeStatus urc=unifrac_multi_to_file_v3("test.biom","test.tre",h5names[t],"unweighted_fp64",false,1.0,false,true,1,"hdf5_fp64",
+                                                 n_subsamples,1,true,3,99,tsv_name,"col1,col2",NULL);
+      ASSERT(urc == okay);
+    }
+    omp_set_num_threads(max_threads);
+
+    try {
+      H5::H5File file1(h5name_1, H5F_ACC_RDONLY);
+      H5::H5File file4(h5name_4, H5F_ACC_RDONLY);
+      const hsize_t n_objs = file1.getNumObjs();
+      ASSERT(n_objs == file4.getNumObjs());
+      ASSERT(H5Lexists(file1.getId(), "pcoa_samples:5", H5P_DEFAULT) > 0);
+      ASSERT(H5Lexists(file1.getId(), "stat_values", H5P_DEFAULT) > 0);
+      for (hsize_t i=0; i<n_objs; i++) {
+        const std::string dsname = file1.getObjnameByIdx(i);
+        ASSERT(H5Lexists(file4.getId(), dsname.c_str(), H5P_DEFAULT) > 0);
+        ASSERT(read_h5_dataset_bytes(file1, dsname.c_str()) == read_h5_dataset_bytes(file4, dsname.c_str()));
+      }
+    } catch(...) {
+      int rc=1;
+      ASSERT(rc == 0); // if we get here is always an error, just to get a nice message
+    }
+    unlink(h5name_1);
+    unlink(h5name_4);
+    unlink(tsv_name);
+
+    SUITE_END();
+}
+
+void test_multi_seed_sequential() {
+    SUITE_START("test unifrac_multi_to_file seed matches sequential");
+
+    static const char tsv_name[]="/tmp/ssu_t8.tsv";
+    static const char h5name[]="/tmp/ssu_t8.h5";
+    const unsigned int n_subsamples = 4;
+    {
+      FILE *f = fopen(tsv_name, "w");
+      fputs("#SampleID\tcol1\n"
+            "Sample1\ta\nSample2\ta\nSample3\ta\n"
+            "Sample4\tb\nSample5\tb\nSample6\tb\n", f);
+      fclose(f);
+    }
+
+    // pipelined, and with pcoa and permanova drawing their own seeds
+    const int max_threads = omp_get_max_threads();
+    unlink(h5name);
+    omp_set_num_threads(4);
+    ssu_set_random_seed(42);
+    ComputeStatus urc=unifrac_multi_to_file_v3("test.biom","test.tre",h5name,"unweighted_fp64",false,1.0,false,true,1,"hdf5_fp64",
+                                               n_subsamples,3,true,3,99,tsv_name,"col1",NULL);
+    ASSERT(urc == okay);
+    omp_set_num_threads(max_threads);
+
+    // the same seed must give the same subsamples as one subsampled one_off after the other
+    ssu_set_random_seed(42);
+    try {
+      H5::H5File file(h5name, H5F_ACC_RDONLY);
+      for (unsigned int i=0; i<n_subsamples; i++) {
+        mat_full_fp64_t* exp = NULL;
+        urc=one_off_matrix_v3("test.biom","test.tre","unweighted_fp64",false,1.0,false,true,1,3,true,NULL,&exp);
+        ASSERT(urc == okay);
+
+        char dsname[64];
+        snprintf(dsname,63,"matrix:%d",i);
+        H5::DataSet mds(file.openDataSet(dsname));
+        const uint64_t n_els = uint64_t(exp->n_samples)*exp->n_samples;
+        ASSERT(mds.getSpace().getSimpleExtentNpoints() == n_els);
+        std::vector<double> obs(n_els);
+        mds.read(obs.data(), H5::PredType::NATIVE_DOUBLE);
+        for (uint64_t j=0; j<n_els; j++) ASSERT(fabs(obs[j] - exp->matrix[j]) < 0.000001);
+        destroy_mat_full_fp64(&exp);
+      }
+    } catch(...) {
+      int rc=1;
+      ASSERT(rc == 0); // if we get here is always an error, just to get a nice message
+    }
+    unlink(h5name);
+    unlink(tsv_name);
+
+    SUITE_END();
+}
+
 int main(int argc, char** argv) {
     /* one_off and partial are executed as integration tests */    
 
     //test_write_mat();
     //test_read_mat();
     test_read_write_partial_mat();
+    test_read_write_partial_mat_fp32();
+    test_read_partial_mat_magic_mismatch();
     //test_merge_partial_mat();
     test_merge_partial_dyn_mat();
     test_merge_partial_io();
+    test_merge_partial_fp32();
     test_merge_partial_mmap();
     test_to_file();
+    test_one_off_matrix_multi();
+    test_alphas_to_file();
+    test_multi_summary();
+    test_multi_threads_match();
+    test_multi_seed_sequential();
+    test_update_bptree_cache();
 
     printf("\n");
     printf(" %i / %i suites failed\n", suites_failed, suites_run);
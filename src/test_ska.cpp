@@ -2,6 +2,7 @@
 #include "skbio_alt.hpp"
 #include "api.hpp"
 #include <unistd.h>
+#include <omp.h>
 #include "test_helper.hpp"
 
 void test_center_mat() {
@@ -916,6 +917,126 @@ void test_subsample_woreplacement_limit() {
     SUITE_END();
 }
 
+void test_subsample_deep() {
+    SUITE_START("test subsample deep");
+
+    // deep enough to exercise all the binomial and hypergeometric code paths
+    const char *t_obs_ids[] = {"OTU0","OTU1","OTU2","OTU3","OTU4",
+                               "OTU5","OTU6","OTU7","OTU8","OTU9"};
+    const char *t_samp_ids[] = {"S1"};
+    uint32_t t_index[] = {0,0,0,0,0,0,0,0,0,0};
+    uint32_t t_idxptr[] = {0,1,2,3,4,5,6,7,8,9,10};
+    double t_data[] = {50000., 1., 20000., 3., 7000., 600., 13000., 3., 5000., 4386.};
+    su::biom_inmem org_table(t_obs_ids,t_samp_ids,t_index,t_idxptr,t_data,10,1);
+    const double org_sum = 100000.0;
+    const uint32_t n = 20000;
+    const int n_reps = 100;
+
+    for (int w_replacement=0; w_replacement<2; w_replacement++) {
+      double mean[10] = {0., 0., 0., 0., 0., 0., 0., 0., 0., 0.};
+      for (int i=0; i<n_reps; i++) {
+         su::skbio_biom_subsampled table(org_table,w_replacement==1,n);
+         ASSERTINTEQ(table.n_samples , uint32_t(1));
+
+         double data_sum = 0.0;
+         for (auto obs_id : table.get_obs_ids()) {
+            double line[1];
+            table.get_obs_data(obs_id, line);
+            uint32_t o = 0;
+            while (obs_id != t_obs_ids[o]) o++;
+            // without replacement, can never pick more than available
+            if (w_replacement==0) ASSERT(line[0] <= t_data[o]);
+            data_sum += line[0];
+            mean[o] += line[0]/n_reps;
+         }
+         ASSERT(data_sum == double(n));
+      }
+
+      // the mean must be close to the expected value,
+      // its std dev is below 7 without replacement, and below 8 with it
+      const double max_diff = (w_replacement==0) ? 30.0 : 40.0;
+      for (uint32_t o=0; o<10; o++) {
+         const double exp_mean = t_data[o]*n/org_sum;
+         ASSERT(fabs(mean[o] - exp_mean) < max_diff);
+      }
+    }
+
+    SUITE_END();
+}
+
+void test_philox() {
+    SUITE_START("test philox generator");
+
+    // known answers, from the Random123 test vectors
+    {
+      const uint32_t key[2] = {0, 0};
+      const uint32_t ctr[4] = {0, 0, 0, 0};
+      const uint32_t exp[4] = {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8};
+      uint32_t out[4];
+      su::Philox4x32::philox(key, ctr, out);
+      for (int i=0; i<4; i++) ASSERT(out[i] == exp[i]);
+    }
+    {
+      const uint32_t key[2] = {0xffffffff, 0xffffffff};
+      const uint32_t ctr[4] = {0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff};
+      const uint32_t exp[4] = {0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd};
+      uint32_t out[4];
+      su::Philox4x32::philox(key, ctr, out);
+      for (int i=0; i<4; i++) ASSERT(out[i] == exp[i]);
+    }
+    {
+      const uint32_t key[2] = {0xa4093822, 0x299f31d0};
+      const uint32_t ctr[4] = {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344};
+      const uint32_t exp[4] = {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1};
+      uint32_t out[4];
+      su::Philox4x32::philox(key, ctr, out);
+      for (int i=0; i<4; i++) ASSERT(out[i] == exp[i]);
+    }
+
+    // the stream walks the counter, 4 words at a time
+    {
+      su::Philox4x32 gen(0, 0);
+      ASSERT(gen() == 0x6627e8d5);
+      ASSERT(gen() == 0xe169c58d);
+      ASSERT(gen() == 0xbc57ac4c);
+      ASSERT(gen() == 0x9b00dbd8);
+      const uint32_t key[2] = {0, 0};
+      const uint32_t ctr[4] = {1, 0, 0, 0};
+      uint32_t out[4];
+      su::Philox4x32::philox(key, ctr, out);
+      ASSERT(gen() == out[0]);
+    }
+
+    SUITE_END();
+}
+
+void test_subsample_thread_independent() {
+    SUITE_START("test subsample independent of thread count");
+
+    su::biom org_table("test.biom");
+    const int org_threads = omp_get_max_threads();
+
+    for (int w_replacement=0; w_replacement<2; w_replacement++) {
+      omp_set_num_threads(1);
+      su::biom_subsampled table1(org_table, w_replacement==1, 5, 42);
+      omp_set_num_threads(4);
+      su::biom_subsampled table4(org_table, w_replacement==1, 5, 42);
+
+      ASSERT(table1.get_sample_ids() == table4.get_sample_ids());
+      ASSERT(table1.get_obs_ids() == table4.get_obs_ids());
+      for (auto obs_id : table1.get_obs_ids()) {
+         double line1[2];
+         double line4[2];
+         table1.get_obs_data(obs_id, line1);
+         table4.get_obs_data(obs_id, line4);
+         for (int j=0; j<2; j++) ASSERT(line1[j] == line4[j]);
+      }
+    }
+    omp_set_num_threads(org_threads);
+
+    SUITE_END();
+}
+
 int main(int argc, char** argv) {
     test_center_mat();
     test_pcoa();
@@ -928,6 +1049,9 @@ int main(int argc, char** argv) {
     test_subsample_replacement_limit();
     test_subsample_woreplacement();
     test_subsample_woreplacement_limit();
+    test_subsample_deep();
+    test_philox();
+    test_subsample_thread_independent();
 
     printf("\n");
     printf(" %i / %i suites failed\n", suites_failed, suites_run);
@@ -5,6 +5,8 @@
 #include "biom.hpp"
 #include "unifrac.hpp"
 #include "unifrac_internal.hpp"
+#include "unifrac_cmp.hpp"
+#include <omp.h>
 #endif
 
 #include "test_helper.hpp"
@@ -35,7 +37,7 @@ uint64_t _testv_comb_2(uint64_t N) {
 }
 
 // minor variant of internal function in api... repeated here for testing
-void _testv_stripes_to_condensed_form(double* stripes[], uint32_t n, uint32_t m, double* cf) {
+void _testv_stripes_to_condensed_form(const double* const stripes[], uint32_t n, uint32_t m, double* cf) {
     uint64_t comb_N = _testv_comb_2(n);
     for(unsigned int stripe = 0; stripe < m; stripe++) {
         // compute the (i, j) position of each element in each stripe
@@ -55,6 +57,24 @@ void _testv_stripes_to_condensed_form(double* stripes[], uint32_t n, uint32_t m,
     }
 }
 
+// the expected strides of test.biom with test.tre, shared by the tests of the different engines
+const double exp_unweighted_strides[3][6] = {{0.2, 0.42857143, 0.71428571, 0.33333333, 0.6, 0.2},
+                                             {0.57142857, 0.66666667, 0.85714286, 0.4, 0.5, 0.33333333},
+                                             {0.6, 0.6, 0.42857143, 0.6, 0.6, 0.42857143}};
+const double exp_weighted_normalized_strides[3][6] = {{0.38095238, 0.33333333, 0.73333333, 0.33333333, 0.5, 0.26785714},
+                                                      {0.58095238, 0.66666667, 0.86666667, 0.25, 0.28571429, 0.45833333},
+                                                      {0.47619048, 0.66666667, 0.46666667, 0.47619048, 0.66666667, 0.46666667}};
+
+// compare the 3 strides of the 6 test.biom samples against the expected ones
+template<class TStrides>
+void check_test_strides(const TStrides &strides, const double exp_strides[3][6]) {
+    for(unsigned int i = 0; i < 3; i++) {
+        for(unsigned int j = 0; j < 6; j++) {
+            ASSERT(fabs(strides[i][j] - exp_strides[i][j]) < 0.000001);
+        }
+    }
+}
+
 
 #ifndef API_ONLY
 void test_bptree_simple_result(const su::BPTree &tree) {
@@ -163,6 +183,74 @@ void test_bptree_constructor_inmem() {
     SUITE_END();
 }
 
+void test_bptree_cache() {
+    SUITE_START("bptree cache");
+                                //01234567
+                                //11101000
+    su::BPTree existing("(('123:foo; bar':1,b:2)c);");
+    ASSERT(existing.write_cache("/tmp/ssu_bptree_cache.dat", 123, 456) == write_okay);
+    ASSERT(su::BPTree::is_cache_file("/tmp/ssu_bptree_cache.dat"));
+
+    su::BPTree tree;
+    uint64_t source_size = 0;
+    int64_t source_mtime = 0;
+    ASSERT(tree.read_cache("/tmp/ssu_bptree_cache.dat", &source_size, &source_mtime) == read_okay);
+    ASSERT(source_size == 123);
+    ASSERT(source_mtime == 456);
+    test_bptree_simple_result(tree);
+
+    // an out of range index must be rejected, and leave the tree untouched
+    // 8 parens: 64 bytes of header, structure at 64, lengths at 128, openclose at 192
+    {
+        FILE *f = fopen("/tmp/ssu_bptree_cache_bad.dat", "wb");
+        FILE *in = fopen("/tmp/ssu_bptree_cache.dat", "rb");
+        char buf[4096];
+        size_t cnt;
+        while ((cnt = fread(buf, 1, sizeof(buf), in)) > 0) fwrite(buf, 1, cnt, f);
+        fclose(in);
+        const uint32_t bad_idx = 1000;
+        fseek(f, 192 + 3*sizeof(uint32_t), SEEK_SET);
+        fwrite(&bad_idx, sizeof(bad_idx), 1, f);
+        fclose(f);
+    }
+    ASSERT(tree.read_cache("/tmp/ssu_bptree_cache_bad.dat") == bad_header);
+    test_bptree_simple_result(tree);
+    remove("/tmp/ssu_bptree_cache_bad.dat");
+
+    // the header alone gives the same source info
+    source_size = 0;
+    source_mtime = 0;
+    ASSERT(su::BPTree::read_cache_source("/tmp/ssu_bptree_cache.dat", &source_size, &source_mtime) == read_okay);
+    ASSERT(source_size == 123);
+    ASSERT(source_mtime == 456);
+
+    // the cached indexes must behave as the parsed ones
+    su::BPTree exp_tree("((3,4,(6)5)2,7,((10,100)9)8)1;");
+    ASSERT(exp_tree.write_cache("/tmp/ssu_bptree_cache.dat") == write_okay);
+    su::BPTree obs_tree;
+    ASSERT(obs_tree.read_cache("/tmp/ssu_bptree_cache.dat") == read_okay);
+    ASSERT(obs_tree.nparens == exp_tree.nparens);
+    for(unsigned int i = 0; i < (exp_tree.nparens / 2); i++) {
+        ASSERT(obs_tree.postorderselect(i) == exp_tree.postorderselect(i));
+        ASSERT(obs_tree.preorderselect(i) == exp_tree.preorderselect(i));
+    }
+    for(unsigned int i = 1; i < (exp_tree.nparens - 1); i++)
+        ASSERT(obs_tree.parent(i) == exp_tree.parent(i));
+    ASSERT(obs_tree.get_tip_names() == exp_tree.get_tip_names());
+
+    // not a cache
+    ASSERT(!su::BPTree::is_cache_file("test.tre"));
+    su::BPTree bad_tree;
+    ASSERT(bad_tree.read_cache("test.tre") == magic_incompatible);
+    ASSERT(bad_tree.read_cache("/tmp/does_not_exist_ssu_bptree_cache.dat") == open_error);
+    ASSERT(su::BPTree::read_cache_source("test.tre", NULL, NULL) == magic_incompatible);
+    ASSERT(su::BPTree::read_cache_source("/tmp/does_not_exist_ssu_bptree_cache.dat", NULL, NULL) == open_error);
+
+    remove("/tmp/ssu_bptree_cache.dat");
+
+    SUITE_END();
+}
+
 void test_bptree_mask() {
     SUITE_START("bptree mask");
                                 //01234567
@@ -576,6 +664,60 @@ void test_biom_constructor_from_dense() {
     SUITE_END();
 }
 
+void test_sparse_data_compact_values() {
+    SUITE_START("sparse data compact values");
+    double sample1[] = {0, 5, 0, 2, 0};
+    double sample2[] = {0, 1, 0, 1, 1};
+    double sample3[] = {1, 0, 1, 1, 1};
+    double sample4[] = {0, 2, 4, 0, 0};
+    double* data_ptrs[] = {sample1,sample2,sample3,sample4};
+
+    {
+        su::sparse_data exp(5, 4, data_ptrs);
+        su::sparse_data obs(5, 4, data_ptrs);
+        ASSERT(obs.compact_values());
+        ASSERT(obs.storage == su::sparse_data::values_uint16);
+        ASSERT(!obs.compact_values()); // already compacted
+        for(unsigned int i = 0; i < 5; i++) {
+            ASSERT(obs.obs_counts_resident[i] == exp.obs_counts_resident[i]);
+            for(unsigned int j = 0; j < obs.obs_counts_resident[i]; j++) {
+                ASSERT(obs.obs_indices_resident[i][j] == exp.obs_indices_resident[i][j]);
+                ASSERT(obs.get_obs_value(i,j) == exp.obs_data_resident[i][j]);
+            }
+        }
+
+        // filtering a compacted object produces doubles again
+        double sample_counts[] = {7, 4, 4, 6};
+        su::sparse_data filtered(obs, sample_counts, 5);
+        ASSERT(filtered.storage == su::sparse_data::values_fp64);
+        ASSERT(filtered.n_samples == 2);
+        ASSERT(filtered.obs_counts_resident[1] == 2);
+        ASSERT(filtered.obs_indices_resident[1][1] == 1);
+        ASSERT(filtered.obs_data_resident[1][1] == 2.0);
+    }
+
+    sample4[2] = 100000;
+    {
+        su::sparse_data obs(5, 4, data_ptrs);
+        ASSERT(obs.compact_values());
+        ASSERT(obs.storage == su::sparse_data::values_uint32);
+        ASSERT(obs.get_obs_value(2,1) == 100000.0);
+        su::sparse_data copy(obs, true);
+        ASSERT(copy.storage == su::sparse_data::values_uint32);
+        ASSERT(copy.get_obs_value(2,1) == 100000.0);
+    }
+
+    sample4[2] = 0.5;
+    {
+        su::sparse_data obs(5, 4, data_ptrs);
+        ASSERT(!obs.compact_values());
+        ASSERT(obs.storage == su::sparse_data::values_fp64);
+        ASSERT(obs.obs_data_resident[2][1] == 0.5);
+    }
+
+    SUITE_END();
+}
+
 void test_biom_nullary() {
     SUITE_START("biom nullary");
     su::biom table;
@@ -597,6 +739,35 @@ void test_biom_get_obs_data() {
 }
 
 
+void test_bptree_postorder_plan() {
+    SUITE_START("test bptree postorder plan");
+    su::BPTree tree("((3:1,4:2,(6:3)5:4)2:5,7:6,((10:7,100:8)9:9)8:10)1;");
+    su::PostorderPlan plan(tree);
+
+    ASSERT(plan.n_nodes == tree.nparens / 2);
+    ASSERT(plan.child_start[plan.n_nodes] == plan.n_nodes - 1);
+    for(unsigned int k = 0; k < plan.n_nodes; k++) {
+        const uint32_t node = tree.postorderselect(k);
+        ASSERT(plan.nodes[k] == node);
+        ASSERT(plan.lengths[k] == tree.lengths[node]);
+        ASSERT(plan.isleaf(k) == tree.isleaf(node));
+
+        // children, left to right
+        uint32_t current = tree.leftchild(node);
+        uint32_t c = plan.child_start[k];
+        while(current != 0) {
+            ASSERT(c < plan.child_start[k+1]);
+            ASSERT(plan.nodes[plan.children[c]] == current);
+            ASSERT(plan.parents[plan.children[c]] == k);
+            c++;
+            current = tree.rightsibling(current);
+        }
+        ASSERT(c == plan.child_start[k+1]);
+    }
+    ASSERT(plan.parents[plan.n_nodes - 1] == plan.n_nodes);  // root
+    SUITE_END();
+}
+
 void test_bptree_leftchild() {
     SUITE_START("test bptree left child");
     su::BPTree tree("((3,4,(6)5)2,7,((10,100)9)8)1;");
@@ -692,40 +863,151 @@ void test_propstack_get() {
     SUITE_END();
 }
 
+void test_propstack_plan() {
+    SUITE_START("test propstack plan");
+    //                           0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5
+    //                           ( ( ) ( ( ) ( ) ) ( ( ) ( ) ) )
+    su::BPTree tree("(GG_OTU_1,(GG_OTU_2,GG_OTU_3),(GG_OTU_5,GG_OTU_4));");
+    su::biom table("test.biom");
+    su::PostorderPlan plan(tree);
+    std::vector<uint32_t> obs_index;
+    su::postorder_obs_index(tree, plan, table, obs_index);
+
+    // 3 pending nodes when GG_OTU_4 closes, plus the node itself
+    ASSERT(plan.max_live == 5);
+
+    su::PropStack<double> ps(table.n_samples, plan);
+    std::vector<double*> seen;
+    for(uint32_t k = 0; k < (plan.n_nodes - 1); k++) {
+        double *vec = ps.pop(k);
+        su::set_proportions(vec, plan, k, obs_index[k], table, ps);
+        ASSERT(ps.get(k) == vec);
+        bool found = false;
+        for(auto p : seen) found |= (p == vec);
+        if(!found) seen.push_back(vec);
+    }
+    // never needed more than the pre-allocated vectors
+    ASSERT(seen.size() <= plan.max_live);
+    SUITE_END();
+}
+
+void test_postorder_plan_split_subtrees() {
+    SUITE_START("test postorder plan split subtrees");
+    // postorder: a b x c d y z e f w g r
+    su::BPTree tree("(((a:1,b:1)x:1,(c:1,d:1)y:1)z:1,(e:1,f:1)w:1,g:1)r;");
+    su::PostorderPlan plan(tree);
+    std::vector<uint32_t> starts;
+    std::vector<uint32_t> ends;
+    std::vector<uint32_t> residual;
+
+    // x, y and w are the largest subtrees that fit, z is too big
+    plan.split_subtrees(3, 1, starts, ends, residual);
+    std::vector<uint32_t> exp_starts = {0, 3, 7, 10};
+    std::vector<uint32_t> exp_ends = {3, 6, 10, 11};
+    std::vector<uint32_t> exp_residual = {6};
+    ASSERT(starts == exp_starts);
+    ASSERT(ends == exp_ends);
+    ASSERT(residual == exp_residual);
+
+    // g is too small to be on its own
+    plan.split_subtrees(3, 2, starts, ends, residual);
+    exp_starts = {0, 3, 7};
+    exp_ends = {3, 6, 10};
+    exp_residual = {6, 10};
+    ASSERT(starts == exp_starts);
+    ASSERT(ends == exp_ends);
+    ASSERT(residual == exp_residual);
+
+    // w and g are siblings, so can share a range
+    plan.split_subtrees(4, 1, starts, ends, residual);
+    exp_starts = {0, 3, 7};
+    exp_ends = {3, 6, 11};
+    exp_residual = {6};
+    ASSERT(starts == exp_starts);
+    ASSERT(ends == exp_ends);
+    ASSERT(residual == exp_residual);
+    SUITE_END();
+}
+
 void test_unifrac_set_proportions() {
     SUITE_START("test unifrac set proportions");
     //                           0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5
     //                           ( ( ) ( ( ) ( ) ) ( ( ) ( ) ) )
     su::BPTree tree("(GG_OTU_1,(GG_OTU_2,GG_OTU_3),(GG_OTU_5,GG_OTU_4));");
     su::biom table("test.biom");
+    // postorder: GG_OTU_1 GG_OTU_2 GG_OTU_3 (3) GG_OTU_5 GG_OTU_4 (9) (0)
+    su::PostorderPlan plan(tree);
+    std::vector<uint32_t> obs_index;
+    su::postorder_obs_index(tree, plan, table, obs_index);
     su::PropStack<double> ps(table.n_samples);
 
-    double *obs = ps.pop(4); // GG_OTU_2
+    double *obs = ps.pop(1); // GG_OTU_2
     double exp4[] = {0.714285714286, 0.333333333333, 0.0, 0.333333333333, 1.0, 0.25};
-    set_proportions(obs, tree, 4, table, ps);
+    set_proportions(obs, plan, 1, obs_index[1], table, ps);
     for(unsigned int i = 0; i < table.n_samples; i++)
         ASSERT(fabs(obs[i] - exp4[i]) < 0.000001);
 
-    obs = ps.pop(6); // GG_OTU_3
+    obs = ps.pop(2); // GG_OTU_3
     double exp6[] = {0.0, 0.0, 0.25, 0.666666666667, 0.0, 0.5};
-    set_proportions(obs, tree, 6, table, ps);
+    set_proportions(obs, plan, 2, obs_index[2], table, ps);
     for(unsigned int i = 0; i < table.n_samples; i++)
         ASSERT(fabs(obs[i] - exp6[i]) < 0.000001);
 
     obs = ps.pop(3); // node containing GG_OTU_2 and GG_OTU_3
     double exp3[] = {0.71428571, 0.33333333, 0.25, 1.0, 1.0, 0.75};
-    set_proportions(obs, tree, 3, table, ps);
+    set_proportions(obs, plan, 3, obs_index[3], table, ps);
     for(unsigned int i = 0; i < table.n_samples; i++)
         ASSERT(fabs(obs[i] - exp3[i]) < 0.000001);
     SUITE_END();
 }
 
+void test_unifrac_postorder_obs_index() {
+    SUITE_START("test unifrac postorder obs index");
+    //                           0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5
+    //                           ( ( ) ( ( ) ( ) ) ( ( ) ( ) ) )
+    su::BPTree tree("(GG_OTU_1,(GG_OTU_2,GG_OTU_3),(GG_OTU_5,GG_OTU_4));");
+    su::biom table("test.biom");
+
+    su::PostorderPlan plan(tree);
+    std::vector<uint32_t> obs_index;
+    su::postorder_obs_index(tree, plan, table, obs_index);
+    ASSERT(obs_index.size() == 8);
+    for(unsigned int k = 0; k < obs_index.size(); k++) {
+        const uint32_t node = tree.postorderselect(k);
+        if(tree.isleaf(node)) {
+            ASSERT(table.get_obs_ids()[obs_index[k]] == tree.names[node]);
+        } else {
+            ASSERT(obs_index[k] == 0);
+        }
+    }
+
+    // index based proportions must match the ID based ones
+    su::PropStack<double> ps_exp(table.n_samples);
+    su::PropStack<double> ps_obs(table.n_samples);
+    for(unsigned int k = 0; k < obs_index.size(); k++) {
+        const uint32_t node = tree.postorderselect(k);
+        const uint32_t exp_idx = tree.isleaf(node) ? table.get_obs_index(tree.names[node]) : 0;
+        double *exp = ps_exp.pop(k);
+        double *obs = ps_obs.pop(k);
+        set_proportions_range(exp, plan, k, exp_idx, table, 0, table.n_samples, ps_exp);
+        set_proportions_range(obs, plan, k, obs_index[k], table, 0, table.n_samples, ps_obs);
+        for(unsigned int i = 0; i < table.n_samples; i++) {
+            ASSERT(obs[i] == exp[i]);
+        }
+    }
+    SUITE_END();
+}
+
 void test_unifrac_set_proportions_range() {
     SUITE_START("test unifrac set proportions range");
     //                           0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5
     //                           ( ( ) ( ( ) ( ) ) ( ( ) ( ) ) )
     su::BPTree tree("(GG_OTU_1,(GG_OTU_2,GG_OTU_3),(GG_OTU_5,GG_OTU_4));");
     su::biom table("test.biom");
+    // postorder: GG_OTU_1 GG_OTU_2 GG_OTU_3 (3) GG_OTU_5 GG_OTU_4 (9) (0)
+    su::PostorderPlan plan(tree);
+    std::vector<uint32_t> obs_index;
+    su::postorder_obs_index(tree, plan, table, obs_index);
 
     const double exp4[] = {0.714285714286, 0.333333333333, 0.0, 0.333333333333, 1.0, 0.25};
     const double exp6[] = {0.0, 0.0, 0.25, 0.666666666667, 0.0, 0.5};
@@ -736,18 +1018,18 @@ void test_unifrac_set_proportions_range() {
     {
       su::PropStack<double> ps(table.n_samples);
 
-      double *obs = ps.pop(4); // GG_OTU_2
-      set_proportions_range(obs, tree, 4, table, 0, table.n_samples, ps);
+      double *obs = ps.pop(1); // GG_OTU_2
+      set_proportions_range(obs, plan, 1, obs_index[1], table, 0, table.n_samples, ps);
       for(unsigned int i = 0; i < table.n_samples; i++)
         ASSERT(fabs(obs[i] - exp4[i]) < 0.000001);
 
-      obs = ps.pop(6); // GG_OTU_3
-      set_proportions_range(obs, tree, 6, table, 0, table.n_samples, ps);
+      obs = ps.pop(2); // GG_OTU_3
+      set_proportions_range(obs, plan, 2, obs_index[2], table, 0, table.n_samples, ps);
       for(unsigned int i = 0; i < table.n_samples; i++)
         ASSERT(fabs(obs[i] - exp6[i]) < 0.000001);
 
       obs = ps.pop(3); // node containing GG_OTU_2 and GG_OTU_3
-      set_proportions_range(obs, tree, 3, table, 0, table.n_samples, ps);
+      set_proportions_range(obs, plan, 3, obs_index[3], table, 0, table.n_samples, ps);
       for(unsigned int i = 0; i < table.n_samples; i++)
         ASSERT(fabs(obs[i] - exp3[i]) < 0.000001);
     }
@@ -756,18 +1038,18 @@ void test_unifrac_set_proportions_range() {
     {
       su::PropStack<double> ps(3);
 
-      double *obs = ps.pop(4); // GG_OTU_2
-      set_proportions_range(obs, tree, 4, table, 0, 3, ps);
+      double *obs = ps.pop(1); // GG_OTU_2
+      set_proportions_range(obs, plan, 1, obs_index[1], table, 0, 3, ps);
       for(unsigned int i = 0; i < 3; i++)
         ASSERT(fabs(obs[i] - exp4[i]) < 0.000001);
 
-      obs = ps.pop(6); // GG_OTU_3
-      set_proportions_range(obs, tree, 6, table, 0, 3, ps);
+      obs = ps.pop(2); // GG_OTU_3
+      set_proportions_range(obs, plan, 2, obs_index[2], table, 0, 3, ps);
       for(unsigned int i = 0; i < 3; i++)
         ASSERT(fabs(obs[i] - exp6[i]) < 0.000001);
 
       obs = ps.pop(3); // node containing GG_OTU_2 and GG_OTU_3
-      set_proportions_range(obs, tree, 3, table, 0, 3, ps);
+      set_proportions_range(obs, plan, 3, obs_index[3], table, 0, 3, ps);
       for(unsigned int i = 0; i < 3; i++)
         ASSERT(fabs(obs[i] - exp3[i]) < 0.000001);
     }
@@ -777,18 +1059,18 @@ void test_unifrac_set_proportions_range() {
     {
       su::PropStack<double> ps(4);
 
-      double *obs = ps.pop(4); // GG_OTU_2
-      set_proportions_range(obs, tree, 4, table, 2, table.n_samples, ps);
+      double *obs = ps.pop(1); // GG_OTU_2
+      set_proportions_range(obs, plan, 1, obs_index[1], table, 2, table.n_samples, ps);
       for(unsigned int i = 2; i < table.n_samples; i++)
         ASSERT(fabs(obs[i-2] - exp4[i]) < 0.000001);
 
-      obs = ps.pop(6); // GG_OTU_3
-      set_proportions_range(obs, tree, 6, table, 2, table.n_samples, ps);
+      obs = ps.pop(2); // GG_OTU_3
+      set_proportions_range(obs, plan, 2, obs_index[2], table, 2, table.n_samples, ps);
       for(unsigned int i = 2; i < table.n_samples; i++)
         ASSERT(fabs(obs[i-2] - exp6[i]) < 0.000001);
 
       obs = ps.pop(3); // node containing GG_OTU_2 and GG_OTU_3
-      set_proportions_range(obs, tree, 3, table, 2, table.n_samples, ps);
+      set_proportions_range(obs, plan, 3, obs_index[3], table, 2, table.n_samples, ps);
       for(unsigned int i = 2; i < table.n_samples; i++)
         ASSERT(fabs(obs[i-2] - exp3[i]) < 0.000001);
     }
@@ -800,18 +1082,18 @@ void test_unifrac_set_proportions_range() {
       const unsigned int end = 4;
       su::PropStack<double> ps(end-start);
 
-      double *obs = ps.pop(4); // GG_OTU_2
-      set_proportions_range(obs, tree, 4, table, start, end, ps);
+      double *obs = ps.pop(1); // GG_OTU_2
+      set_proportions_range(obs, plan, 1, obs_index[1], table, start, end, ps);
       for(unsigned int i =start; i < end; i++)
         ASSERT(fabs(obs[i-start] - exp4[i]) < 0.000001);
 
-      obs = ps.pop(6); // GG_OTU_3
-      set_proportions_range(obs, tree, 6, table, start, end, ps);
+      obs = ps.pop(2); // GG_OTU_3
+      set_proportions_range(obs, plan, 2, obs_index[2], table, start, end, ps);
       for(unsigned int i = start; i < end; i++)
         ASSERT(fabs(obs[i-start] - exp6[i]) < 0.000001);
 
       obs = ps.pop(3); // node containing GG_OTU_2 and GG_OTU_3
-      set_proportions_range(obs, tree, 3, table, start, end, ps);
+      set_proportions_range(obs, plan, 3, obs_index[3], table, start, end, ps);
       for(unsigned int i = start; i < end; i++)
         ASSERT(fabs(obs[i-start] - exp3[i]) < 0.000001);
     }
@@ -825,6 +1107,10 @@ void test_unifrac_set_proportions_range_float() {
     //                           ( ( ) ( ( ) ( ) ) ( ( ) ( ) ) )
     su::BPTree tree("(GG_OTU_1,(GG_OTU_2,GG_OTU_3),(GG_OTU_5,GG_OTU_4));");
     su::biom table("test.biom");
+    // postorder: GG_OTU_1 GG_OTU_2 GG_OTU_3 (3) GG_OTU_5 GG_OTU_4 (9) (0)
+    su::PostorderPlan plan(tree);
+    std::vector<uint32_t> obs_index;
+    su::postorder_obs_index(tree, plan, table, obs_index);
 
     const float exp4[] = {0.714285714286, 0.333333333333, 0.0, 0.333333333333, 1.0, 0.25};
     const float exp6[] = {0.0, 0.0, 0.25, 0.666666666667, 0.0, 0.5};
@@ -836,18 +1122,18 @@ void test_unifrac_set_proportions_range_float() {
       const unsigned int end = 4;
       su::PropStack<float> ps(end-start);
 
-      float *obs = ps.pop(4); // GG_OTU_2
-      set_proportions_range(obs, tree, 4, table, start, end, ps);
+      float *obs = ps.pop(1); // GG_OTU_2
+      set_proportions_range(obs, plan, 1, obs_index[1], table, start, end, ps);
       for(unsigned int i =start; i < end; i++)
         ASSERT(fabs(obs[i-start] - exp4[i]) < 0.000001);
 
-      obs = ps.pop(6); // GG_OTU_3
-      set_proportions_range(obs, tree, 6, table, start, end, ps);
+      obs = ps.pop(2); // GG_OTU_3
+      set_proportions_range(obs, plan, 2, obs_index[2], table, start, end, ps);
       for(unsigned int i = start; i < end; i++)
         ASSERT(fabs(obs[i-start] - exp6[i]) < 0.000001);
 
       obs = ps.pop(3); // node containing GG_OTU_2 and GG_OTU_3
-      set_proportions_range(obs, tree, 3, table, start, end, ps);
+      set_proportions_range(obs, plan, 3, obs_index[3], table, start, end, ps);
       for(unsigned int i = start; i < end; i++)
         ASSERT(fabs(obs[i-start] - exp3[i]) < 0.000001);
     }
@@ -1351,8 +1637,8 @@ void test_unnormalized_weighted_unifrac() {
         for(unsigned int j = 0; j < 6; j++) {
             ASSERT(fabs(strides[i][j] - exp[i][j]) < 0.000001);
         }
-        free(strides[i]);
     }
+    su::release_stripes(strides, &tasks[0]);
 #endif
 
     // repeat using the API
@@ -1382,14 +1668,7 @@ void test_generalized_unifrac() {
 #endif
 
     // weighted normalized unifrac as computed above
-    std::vector<double*> w_exp;
-    double w_stride1[] = {0.38095238, 0.33333333, 0.73333333, 0.33333333, 0.5, 0.26785714};
-    double w_stride2[] = {0.58095238, 0.66666667, 0.86666667, 0.25, 0.28571429, 0.45833333};
-    double w_stride3[] = {0.47619048, 0.66666667, 0.46666667, 0.47619048, 0.66666667, 0.46666667};
 #ifndef API_ONLY
-    w_exp.push_back(w_stride1);
-    w_exp.push_back(w_stride2);
-    w_exp.push_back(w_stride3);
     std::vector<double*> w_strides = su::make_strides(6);
     std::vector<double*> w_strides_total = su::make_strides(6);
     su::task_parameters w_task_p;
@@ -1474,18 +1753,18 @@ void test_generalized_unifrac() {
 
     for(unsigned int i = 0; i < 3; i++) {
         for(unsigned int j = 0; j < 6; j++) {
-            ASSERT(fabs(w_strides[i][j] - w_exp[i][j]) < 0.000001);
+            ASSERT(fabs(w_strides[i][j] - exp_weighted_normalized_strides[i][j]) < 0.000001);
             ASSERT(fabs(d0_strides[i][j] - d0_exp[i][j]) < 0.000001);
             ASSERT(fabs(d05_strides[i][j] - d05_exp[i][j]) < 0.000001);
         }
-        free(w_strides[i]);
-        free(d0_strides[i]);
-        free(d05_strides[i]);
     }
+    su::release_stripes(w_strides, &w_task_p);
+    su::release_stripes(d0_strides, &d0_task_p);
+    su::release_stripes(d05_strides, &d05_task_p);
 #endif
 
     // repeat using the API
-    double* cstripes[3];
+    const double* cstripes[3];
     double *expS = (double*)malloc(sizeof(double) * 15);
 
     mat_t *res = NULL;
@@ -1495,7 +1774,7 @@ void test_generalized_unifrac() {
 	               "generalized", false, 1.0,
 		       false, 1, &res);
     ASSERT(rc == okay);
-    cstripes[0] = w_stride1; cstripes[1] = w_stride2; cstripes[2] = w_stride3;
+    cstripes[0] = exp_weighted_normalized_strides[0]; cstripes[1] = exp_weighted_normalized_strides[1]; cstripes[2] = exp_weighted_normalized_strides[2];
     _testv_stripes_to_condensed_form(cstripes, 6, 3, expS);
     for(unsigned int i = 0; i < 15; i++) {
        ASSERT(fabs(res->condensed_form[i] - expS[i]) < 0.000001);
@@ -1576,8 +1855,8 @@ void test_vaw_unifrac_weighted_normalized() {
         for(unsigned int j = 0; j < 6; j++) {
             ASSERT(fabs(w_strides[i][j] - w_exp[i][j]) < 0.000001);
         }
-        free(w_strides[i]);
     }
+    su::release_stripes(w_strides, &tasks[0]);
 #endif
 
     // repeat using the API
@@ -1692,6 +1971,116 @@ void test_faith_pd_shear(){
     SUITE_END();
 }
 
+// A random tree over n_leaves tips, and a random table of n_samples samples over the tips,
+// with about one value in one_in present, each in [1,max_count], and no empty sample.
+// Some branches have zero length.
+// The tips below each branch are recorded, so tests can compute the expected values by brute force.
+class RandomTreeTable {
+  public:
+    std::string newick;
+    std::vector<std::string> obs_names;
+    std::vector<std::string> samp_names;
+    std::vector<std::vector<double> > data;  // data[sample][tip]
+    std::vector<double> edge_lengths;
+    std::vector<std::vector<unsigned int> > edge_leaves;
+
+    // ready to be passed to su::biom_inmem, pointing into the members above
+    std::vector<const char*> obs_ids;
+    std::vector<const char*> samp_ids;
+    std::vector<const double*> data_ptrs;
+
+    RandomTreeTable() = default;
+    RandomTreeTable(const RandomTreeTable&) = delete;
+    RandomTreeTable& operator=(const RandomTreeTable&) = delete;
+};
+
+void make_random_tree_and_table(uint64_t seed, unsigned int n_leaves, unsigned int n_samples,
+                                unsigned int one_in, unsigned int max_count, RandomTreeTable &out) {
+    uint64_t rnd = seed;
+    auto next_rnd = [&rnd]() { rnd = rnd*6364136223846793005ULL + 1442695040888963407ULL; return uint32_t(rnd>>33); };
+
+    out.obs_names.resize(n_leaves);
+    std::vector<std::string> nodes(n_leaves);
+    std::vector<std::vector<unsigned int> > node_leaves(n_leaves);
+    for (unsigned int i=0; i<n_leaves; i++) {
+        out.obs_names[i] = "O" + std::to_string(i);
+        nodes[i] = out.obs_names[i];
+        node_leaves[i].push_back(i);
+    }
+    out.edge_lengths.clear();
+    out.edge_leaves.clear();
+    auto add_edge = [&](unsigned int i) {
+        const double length = (next_rnd()%8)*0.25;
+        out.edge_lengths.push_back(length);
+        out.edge_leaves.push_back(node_leaves[i]);
+        return nodes[i] + ":" + std::to_string(length);
+    };
+    // join random pairs of nodes, until only the children of the root are left
+    while (nodes.size()>3) {
+        const unsigned int i = next_rnd()%nodes.size();
+        const std::string a = add_edge(i);
+        std::vector<unsigned int> a_leaves = node_leaves[i];
+        nodes.erase(nodes.begin()+i);
+        node_leaves.erase(node_leaves.begin()+i);
+        const unsigned int j = next_rnd()%nodes.size();
+        nodes[j] = "(" + a + "," + add_edge(j) + ")";
+        node_leaves[j].insert(node_leaves[j].end(), a_leaves.begin(), a_leaves.end());
+    }
+    out.newick = "(" + add_edge(0) + "," + add_edge(1) + "," + add_edge(2) + ");";
+
+    out.data.assign(n_samples, std::vector<double>(n_leaves, 0.0));
+    out.data_ptrs.resize(n_samples);
+    out.samp_names.resize(n_samples);
+    out.samp_ids.resize(n_samples);
+    for (unsigned int s=0; s<n_samples; s++) {
+        for (unsigned int i=0; i<n_leaves; i++) {
+            if ((next_rnd()%one_in)==0) out.data[s][i] = 1 + next_rnd()%max_count;
+        }
+        out.data[s][s%n_leaves] = 1; // no empty samples
+        out.data_ptrs[s] = out.data[s].data();
+        out.samp_names[s] = "S" + std::to_string(s);
+        out.samp_ids[s] = out.samp_names[s].c_str();
+    }
+    out.obs_ids.resize(n_leaves);
+    for (unsigned int i=0; i<n_leaves; i++) out.obs_ids[i] = out.obs_names[i].c_str();
+}
+
+void test_faith_pd_chunks() {
+    SUITE_START("test faith PD many samples");
+#ifndef API_ONLY
+    // more samples than fit in a single chunk, and not a multiple of 8,
+    // then few enough samples to be split in smaller chunks, one per thread
+    const unsigned int n_leaves = 300;
+    const unsigned int old_threads = omp_get_max_threads();
+    omp_set_num_threads(4);
+
+    const unsigned int sample_counts[] = {2503, 301, 5};
+    for (auto n_samples : sample_counts) {
+        RandomTreeTable rt;
+        make_random_tree_and_table(4321, n_leaves, n_samples, 10, 5, rt);
+        su::BPTree tree(rt.newick.c_str());
+        su::biom_inmem table(rt.obs_ids.data(), rt.samp_ids.data(), rt.data_ptrs.data(), n_leaves, n_samples);
+
+        std::vector<double> obs(n_samples, 0.0);
+        su::faith_pd(table, tree, obs.data());
+
+        // sample by sample, sum the branches with any of their leaves present
+        for (unsigned int s=0; s<n_samples; s++) {
+            double exp = 0.0;
+            for (unsigned int e=0; e<rt.edge_lengths.size(); e++) {
+                bool present = false;
+                for (auto leaf : rt.edge_leaves[e]) present |= (rt.data[s][leaf] > 0);
+                if (present) exp += rt.edge_lengths[e];
+            }
+            ASSERT(fabs(exp-obs[s]) < 0.000001);
+        }
+    }
+
+    omp_set_num_threads(old_threads);
+#endif
+    SUITE_END();
+}
+
 void test_unweighted_unifrac() {
     SUITE_START("test unweighted unifrac");
 #ifndef API_ONLY
@@ -1699,14 +2088,7 @@ void test_unweighted_unifrac() {
     su::biom table("test.biom");
 #endif
 
-    std::vector<double*> exp;
-    double stride1[] = {0.2, 0.42857143, 0.71428571, 0.33333333, 0.6, 0.2};
-    double stride2[] = {0.57142857, 0.66666667, 0.85714286, 0.4, 0.5, 0.33333333};
-    double stride3[] = {0.6, 0.6, 0.42857143, 0.6, 0.6, 0.42857143};
 #ifndef API_ONLY
-    exp.push_back(stride1);
-    exp.push_back(stride2);
-    exp.push_back(stride3);
     std::vector<double*> strides = su::make_strides(6);
     std::vector<double*> strides_total = su::make_strides(6);
 
@@ -1723,16 +2105,12 @@ void test_unweighted_unifrac() {
                         std::ref(strides_total),
                         std::ref(tasks));
 
-    for(unsigned int i = 0; i < 3; i++) {
-        for(unsigned int j = 0; j < 6; j++) {
-            ASSERT(fabs(strides[i][j] - exp[i][j]) < 0.000001);
-        }
-        free(strides[i]);
-    }
+    check_test_strides(strides, exp_unweighted_strides);
+    su::release_stripes(strides, &tasks[0]);
 #endif
 
     // repeat using the API
-    double* cstripes[] = {stride1, stride2, stride3};
+    const double* cstripes[] = {exp_unweighted_strides[0], exp_unweighted_strides[1], exp_unweighted_strides[2]};
     mat_t *res = NULL;
     ComputeStatus rc = one_off("test.biom", "test.tre",
 		               "unweighted", false, 0.0,
@@ -1749,6 +2127,403 @@ void test_unweighted_unifrac() {
     SUITE_END();
 }
 
+void test_unweighted_unifrac_dedup() {
+    SUITE_START("test unweighted unifrac dedup");
+#ifndef API_ONLY
+    // same as test_unweighted_unifrac, but with unary nodes splitting some of the branches
+    // their embs have the same presence as their child's, so get merged
+    su::BPTree tree("((GG_OTU_1:0.5):0.5,((GG_OTU_2:1,GG_OTU_3:1):0.25):0.75,(GG_OTU_5:1,GG_OTU_4:1):1);");
+    su::biom table("test.biom");
+
+    std::vector<double*> strides = su::make_strides(6);
+    std::vector<double*> strides_total = su::make_strides(6);
+
+    su::task_parameters task_p;
+    task_p.start = 0; task_p.stop = 3; task_p.tid = 0; task_p.n_samples = 6; task_p.bypass_tips = false; task_p.normalize_sample_counts = true;
+
+    std::vector<su::task_parameters> tasks;
+    tasks.push_back(task_p);
+    su::process_stripes(std::ref(table), 
+                        std::ref(tree),
+                        su::unweighted,
+                        false,
+                        std::ref(strides),
+                        std::ref(strides_total),
+                        std::ref(tasks));
+
+    check_test_strides(strides, exp_unweighted_strides);
+    su::release_stripes(strides, &tasks[0]);
+#endif
+    SUITE_END();
+}
+
+void test_unifrac_sparse_pairs() {
+    SUITE_START("test unifrac sparse pairs");
+#ifndef API_ONLY
+    su::BPTree tree("(GG_OTU_1:1,(GG_OTU_2:1,GG_OTU_3:1):1,(GG_OTU_5:1,GG_OTU_4:1):1);");
+    su::biom table("test.biom");
+    su::PostorderPlan plan(tree);
+    std::vector<uint32_t> obs_index;
+    su::postorder_obs_index(tree, plan, table, obs_index);
+
+    su::task_parameters task_p;
+    task_p.start = 0; task_p.stop = 3; task_p.tid = 0; task_p.n_samples = 6; task_p.bypass_tips = false; task_p.normalize_sample_counts = true;
+
+    su::register_report_status();
+    std::vector<double*> strides(3);
+    su::unifrac_sparse_pairs(table, plan, obs_index, su::unweighted, strides, &task_p);
+    check_test_strides(strides, exp_unweighted_strides);
+    su::release_stripes(strides, &task_p);
+
+    su::unifrac_sparse_pairs(table, plan, obs_index, su::weighted_normalized, strides, &task_p);
+    check_test_strides(strides, exp_weighted_normalized_strides);
+    su::release_stripes(strides, &task_p);
+    su::remove_report_status();
+#endif
+    SUITE_END();
+}
+
+void test_unifrac_sparse_pairs_stored_zero() {
+    SUITE_START("test unifrac sparse pairs stored zero");
+#ifndef API_ONLY
+    // 20 tips, most of them unused, so the table is sparse enough for the sparse-pair engine
+    su::BPTree tree("((O0:1,O1:1):1,(O2:1,O3:1):0.5,O4:1,O5:1,O6:1,O7:1,O8:1,O9:1,O10:1,O11:1,"
+                    "O12:1,O13:1,O14:1,O15:1,O16:1,O17:1,O18:1,O19:1);");
+    su::PostorderPlan plan(tree);
+    const char* obs_ids[] = {"O0", "O1", "O2", "O3", "O4", "O5", "O6", "O7", "O8", "O9",
+                             "O10", "O11", "O12", "O13", "O14", "O15", "O16", "O17", "O18", "O19"};
+    const char* samp_ids[] = {"S0", "S1", "S2"};
+
+    // O1 has an explicitly stored zero in S0, as left behind by rarefaction
+    uint32_t z_index[] = {0, 0, 2, 1, 2, 1};
+    uint32_t z_indptr[] = {0, 1, 3, 4, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6};
+    double z_data[] = {3., 0., 1., 2., 1., 1.};
+    su::biom_inmem z_table(obs_ids, samp_ids, z_index, z_indptr, z_data, 20, 3);
+
+    uint32_t nz_index[] = {0, 2, 1, 2, 1};
+    uint32_t nz_indptr[] = {0, 1, 2, 3, 4, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5};
+    double nz_data[] = {3., 1., 2., 1., 1.};
+    su::biom_inmem nz_table(obs_ids, samp_ids, nz_index, nz_indptr, nz_data, 20, 3);
+
+    std::vector<uint32_t> obs_index;
+    su::postorder_obs_index(tree, plan, z_table, obs_index);
+    ASSERT(su::sparse_pairs_preferred(z_table, plan, obs_index, su::generalized));
+
+    su::task_parameters task_p;
+    task_p.start = 0; task_p.stop = 2; task_p.tid = 0; task_p.n_samples = 3; task_p.bypass_tips = false; task_p.normalize_sample_counts = true;
+
+    su::register_report_status();
+    const double alphas[] = {1.0, 0.5, 0.0, 0.3};
+    for (unsigned int a=0; a<4; a++) {
+        task_p.g_unifrac_alpha = alphas[a];
+
+        std::vector<double*> sparse_strides(2);
+        su::unifrac_sparse_pairs(z_table, plan, obs_index, su::generalized, sparse_strides, &task_p);
+        std::vector<double*> dense_strides(2);
+        std::vector<double*> dense_strides_total(2);
+        su_cpu::unifrac(nz_table, tree, su::generalized, dense_strides, dense_strides_total, &task_p);
+        for(unsigned int i = 0; i < 2; i++) {
+            for(unsigned int j = 0; j < 3; j++) {
+                ASSERT(!std::isnan(sparse_strides[i][j]));
+                ASSERT(fabs(sparse_strides[i][j] - dense_strides[i][j]) < 0.000001);
+            }
+        }
+        su::release_stripes(sparse_strides, &task_p);
+        su::release_stripes(dense_strides, &task_p);
+        su::release_stripes(dense_strides_total, &task_p);
+
+        // variance adjusted is only computed by the dense engine, but must not be affected either
+        std::vector<double*> z_strides(2);
+        std::vector<double*> z_strides_total(2);
+        su::unifrac_vaw(z_table, tree, su::generalized, z_strides, z_strides_total, &task_p);
+        std::vector<double*> nz_strides(2);
+        std::vector<double*> nz_strides_total(2);
+        su::unifrac_vaw(nz_table, tree, su::generalized, nz_strides, nz_strides_total, &task_p);
+        for(unsigned int i = 0; i < 2; i++) {
+            for(unsigned int j = 0; j < 3; j++) {
+                ASSERT(!std::isnan(z_strides[i][j]));
+                ASSERT(fabs(z_strides[i][j] - nz_strides[i][j]) < 0.000001);
+            }
+        }
+        su::release_stripes(z_strides, &task_p);
+        su::release_stripes(z_strides_total, &task_p);
+        su::release_stripes(nz_strides, &task_p);
+        su::release_stripes(nz_strides_total, &task_p);
+    }
+    su::remove_report_status();
+#endif
+    SUITE_END();
+}
+
+void test_unifrac_subtrees() {
+    SUITE_START("test unifrac subtrees");
+#ifndef API_ONLY
+    // a random tree, big enough to be split in many subtrees
+    const unsigned int n_leaves = 2000;
+    const unsigned int n_samples = 10;
+    RandomTreeTable rt;
+    make_random_tree_and_table(12345, n_leaves, n_samples, 5, 6, rt);
+    su::BPTree tree(rt.newick.c_str());
+    su::biom_inmem table(rt.obs_ids.data(), rt.samp_ids.data(), rt.data_ptrs.data(), n_leaves, n_samples);
+
+    su::task_parameters task_p;
+    task_p.start = 0; task_p.stop = (n_samples+1)/2; task_p.tid = 0; task_p.n_samples = n_samples;
+    task_p.bypass_tips = false; task_p.normalize_sample_counts = true; task_p.g_unifrac_alpha = 0.5;
+
+    // compare the subtree split against the plain traversal, both multi-threaded
+    const unsigned int old_threads = omp_get_max_threads();
+    const unsigned int old_min_nodes = su_cpu::get_subtree_min_nodes_per_thread();
+    omp_set_num_threads(4);
+
+    su::register_report_status();
+    const su::Method methods[] = {su::unweighted, su::unweighted_unnormalized, su::weighted_normalized,
+                                  su::weighted_unnormalized, su::generalized};
+    for (unsigned int m=0; m<5; m++) {
+        for (unsigned int vaw=0; vaw<2; vaw++) {
+            std::vector<double*> exp_strides(task_p.stop);
+            std::vector<double*> exp_strides_total(task_p.stop);
+            std::vector<double*> obs_strides(task_p.stop);
+            std::vector<double*> obs_strides_total(task_p.stop);
+
+            su_cpu::set_subtree_min_nodes_per_thread(1000000);
+            if (vaw) su_cpu::unifrac_vaw(table, tree, methods[m], exp_strides, exp_strides_total, &task_p);
+            else     su_cpu::unifrac(table, tree, methods[m], exp_strides, exp_strides_total, &task_p);
+
+            su_cpu::set_subtree_min_nodes_per_thread(64);
+            if (vaw) su_cpu::unifrac_vaw(table, tree, methods[m], obs_strides, obs_strides_total, &task_p);
+            else     su_cpu::unifrac(table, tree, methods[m], obs_strides, obs_strides_total, &task_p);
+
+            // the per-thread results are reduced in a fixed order, so a second run must match exactly
+            std::vector<double*> rep_strides(task_p.stop);
+            std::vector<double*> rep_strides_total(task_p.stop);
+            if (vaw) su_cpu::unifrac_vaw(table, tree, methods[m], rep_strides, rep_strides_total, &task_p);
+            else     su_cpu::unifrac(table, tree, methods[m], rep_strides, rep_strides_total, &task_p);
+
+            for(unsigned int i = 0; i < task_p.stop; i++) {
+                for(unsigned int j = 0; j < n_samples; j++) {
+                    ASSERT(fabs(obs_strides[i][j] - exp_strides[i][j]) < 0.000001);
+                    ASSERT(rep_strides[i][j] == obs_strides[i][j]);
+                }
+            }
+            su::release_stripes(exp_strides, &task_p);
+            su::release_stripes(exp_strides_total, &task_p);
+            su::release_stripes(obs_strides, &task_p);
+            su::release_stripes(obs_strides_total, &task_p);
+            su::release_stripes(rep_strides, &task_p);
+            su::release_stripes(rep_strides_total, &task_p);
+        }
+    }
+    su::remove_report_status();
+
+    su_cpu::set_subtree_min_nodes_per_thread(old_min_nodes);
+    omp_set_num_threads(old_threads);
+#endif
+    SUITE_END();
+}
+
+// compare the tiles of unifrac_tiles against the matrix of the stripes of unifrac
+template<class TFloat>
+void check_unifrac_tiles(su::biom_interface &table, su::BPTree &tree, su::Method method,
+                         const su::task_parameters &task_p, uint32_t tile_size, double tolerance) {
+    const unsigned int n_samples = task_p.n_samples;
+
+    std::vector<TFloat*> strides(task_p.stop);
+    std::vector<TFloat*> strides_total(task_p.stop);
+    su_cpu::unifrac(table, tree, method, strides, strides_total, &task_p);
+    std::vector<double> exp(uint64_t(n_samples)*n_samples);
+    su::MemoryStripesT<TFloat> ps(strides);
+    su::stripes_to_matrix_T<double,TFloat>(ps, n_samples, task_p.stop, exp.data());
+
+    const su::PostorderPlan plan(tree);
+    std::vector<uint32_t> obs_index;
+    su::postorder_obs_index(tree, plan, table, obs_index);
+    su::DMTilesT<TFloat> tiles(n_samples, tile_size);
+    su_cpu::unifrac_tiles(table, plan, obs_index, method, tiles, &task_p);
+    std::vector<double> obs(uint64_t(n_samples)*n_samples, -1.0);
+    su::tiles_to_matrix_T<double,TFloat>(tiles, obs.data());
+
+    double max_err = 0.0;
+    unsigned int n_mismatches = 0;
+    for(unsigned int i = 0; i < n_samples; i++) {
+        for(unsigned int j = 0; j < n_samples; j++) {
+            const double e = exp[i*n_samples+j];
+            max_err = std::max(max_err, fabs(obs[i*n_samples+j] - e)/std::max(1.0, fabs(e)));
+            if ((i<j) && (tiles.get_val(i,j) != TFloat(obs[i*n_samples+j]))) n_mismatches++;
+        }
+    }
+    ASSERT(max_err <= tolerance);
+    ASSERT(n_mismatches == 0);
+    su::release_stripes(strides, &task_p);
+}
+
+void test_unifrac_tiles() {
+    SUITE_START("test unifrac tiles");
+#ifndef API_ONLY
+    // the known values of test_unweighted_unifrac
+    {
+      su::BPTree tree("(GG_OTU_1:1,(GG_OTU_2:1,GG_OTU_3:1):1,(GG_OTU_5:1,GG_OTU_4:1):1);");
+      su::biom table("test.biom");
+
+      su::task_parameters task_p;
+      task_p.start = 0; task_p.stop = 3; task_p.tid = 0; task_p.n_samples = 6; task_p.bypass_tips = false; task_p.normalize_sample_counts = true;
+      task_p.g_unifrac_alpha = 1.0;
+
+      // both a single tile, and several ones
+      for (uint32_t tile_size : {64, 4}) {
+        su::DMTilesT<double> tiles(6, tile_size);
+        ASSERT(su::process_tiles(table, tree, su::unweighted, false, tiles, &task_p));
+        for(unsigned int i = 0; i < 3; i++) {
+          for(unsigned int k = 0; k < 6; k++) {
+            const unsigned int l = (k+i+1)%6;
+            ASSERT(fabs(tiles.get_val(std::min(k,l), std::max(k,l)) - exp_unweighted_strides[i][k]) < 0.000001);
+          }
+        }
+
+        // variance adjusted is not supported by the tiles
+        ASSERT(!su::process_tiles(table, tree, su::unweighted, true, tiles, &task_p));
+      }
+
+      // fp32 weighted normalized is faster with the stripes
+      su::DMTilesT<float> tiles_fp32(6, 4);
+      ASSERT(!su::process_tiles(table, tree, su::weighted_normalized_fp32, false, tiles_fp32, &task_p));
+    }
+
+    // a random tree, with more nodes than fit in a single batch,
+    // and a number of samples that is not a multiple of the tile size
+    const unsigned int n_leaves = 1500;
+    const unsigned int n_samples = 150;
+    RandomTreeTable rt;
+    make_random_tree_and_table(2468, n_leaves, n_samples, 4, 6, rt);
+    su::BPTree tree(rt.newick.c_str());
+    su::biom_inmem table(rt.obs_ids.data(), rt.samp_ids.data(), rt.data_ptrs.data(), n_leaves, n_samples);
+
+    su::task_parameters task_p;
+    task_p.start = 0; task_p.stop = (n_samples+1)/2; task_p.tid = 0; task_p.n_samples = n_samples;
+    task_p.bypass_tips = false; task_p.normalize_sample_counts = true; task_p.g_unifrac_alpha = 0.5;
+
+    const unsigned int old_threads = omp_get_max_threads();
+    omp_set_num_threads(4);
+    su::register_report_status();
+
+    const su::Method methods[] = {su::unweighted, su::unweighted_unnormalized, su::weighted_normalized,
+                                  su::weighted_unnormalized, su::generalized};
+    const su::Method methods_fp32[] = {su::unweighted_fp32, su::unweighted_unnormalized_fp32, su::weighted_normalized_fp32,
+                                       su::weighted_unnormalized_fp32, su::generalized_fp32};
+    for (unsigned int m=0; m<5; m++) {
+        // the derived tile sizes are multiples of 8, and fp32 rows are half the size
+        const uint32_t tile_size_fp64 = su::get_tile_size(methods[m]);
+        const uint32_t tile_size_fp32 = su::get_tile_size(methods_fp32[m]);
+        ASSERT((tile_size_fp64>=8) && (tile_size_fp64%8==0) && (tile_size_fp64<=256));
+        ASSERT((tile_size_fp32>=tile_size_fp64) && (tile_size_fp32%8==0) && (tile_size_fp32<=256));
+
+        check_unifrac_tiles<double>(table, tree, methods[m], task_p, tile_size_fp64, 1e-12);
+        check_unifrac_tiles<float>(table, tree, methods_fp32[m], task_p, tile_size_fp32, 1e-5);
+        for (uint32_t tile_size : {64, 24}) {
+            check_unifrac_tiles<double>(table, tree, methods[m], task_p, tile_size, 1e-12);
+            check_unifrac_tiles<float>(table, tree, methods_fp32[m], task_p, tile_size, 1e-5);
+        }
+    }
+    // the generic alpha kernel
+    task_p.g_unifrac_alpha = 0.3;
+    check_unifrac_tiles<double>(table, tree, su::generalized, task_p, 64, 1e-12);
+
+    su::remove_report_status();
+    omp_set_num_threads(old_threads);
+#endif
+    SUITE_END();
+}
+
+void test_unifrac_multi() {
+    SUITE_START("test unifrac multi");
+#ifndef API_ONLY
+    su::BPTree tree("(GG_OTU_1:1,(GG_OTU_2:1,GG_OTU_3:1):1,(GG_OTU_5:1,GG_OTU_4:1):1);");
+    su::biom table("test.biom");
+
+    // the generalized (alpha=0) values of test_generalized_unifrac
+    const double d0_exp[3][6] = {{0.4408392, 0.5102041, 0.8649351, 0.5000000, 0.7485714, 0.3278410},
+                                 {0.6886965, 0.7500000, 0.9428571, 0.4857143, 0.5833333, 0.5208125},
+                                 {0.7060606, 0.8000000, 0.5952381, 0.7060606, 0.8000000, 0.5952381}};
+    const double (*exp[3])[6] = {exp_unweighted_strides, exp_weighted_normalized_strides, d0_exp};
+
+    std::vector<su::Method> methods = {su::unweighted, su::weighted_normalized, su::generalized};
+    std::vector<double> alphas = {1.0, 1.0, 0.0};
+    std::vector<std::vector<double*>> strides(3, std::vector<double*>(3));
+    std::vector<std::vector<double*>> strides_total(3, std::vector<double*>(3));
+
+    su::task_parameters task_p;
+    task_p.start = 0; task_p.stop = 3; task_p.tid = 0; task_p.n_samples = 6; task_p.bypass_tips = false; task_p.normalize_sample_counts = true;
+    task_p.g_unifrac_alpha = 1.0;
+
+    std::vector<su::task_parameters> tasks;
+    tasks.push_back(task_p);
+    su::process_stripes_multi(table, tree, methods, alphas, strides, strides_total, tasks);
+
+    for(unsigned int m = 0; m < 3; m++) {
+        check_test_strides(strides[m], exp[m]);
+        su::release_stripes(strides[m], &tasks[0]);
+    }
+
+    // fp32 methods need float stripes
+    std::vector<su::Method> methods_fp32 = {su::unweighted_fp32, su::weighted_normalized_fp32, su::generalized_fp32};
+    std::vector<std::vector<float*>> fstrides(3, std::vector<float*>(3));
+    std::vector<std::vector<float*>> fstrides_total(3, std::vector<float*>(3));
+    su::process_stripes_multi(table, tree, methods_fp32, alphas, fstrides, fstrides_total, tasks);
+
+    for(unsigned int m = 0; m < 3; m++) {
+        check_test_strides(fstrides[m], exp[m]);
+        su::release_stripes(fstrides[m], &tasks[0]);
+    }
+#endif
+    SUITE_END();
+}
+
+void test_unifrac_multi_alpha() {
+    SUITE_START("test unifrac multi alpha");
+#ifndef API_ONLY
+    su::BPTree tree("(GG_OTU_1:1,(GG_OTU_2:1,GG_OTU_3:1):1,(GG_OTU_5:1,GG_OTU_4:1):1);");
+    su::biom table("test.biom");
+
+    // all generalized, so they share a single fused task
+    std::vector<su::Method> methods = {su::generalized, su::generalized, su::generalized, su::generalized};
+    std::vector<double> alphas = {1.0, 0.0, 0.5, 0.3};
+    std::vector<std::vector<double*>> strides(4, std::vector<double*>(3));
+    std::vector<std::vector<double*>> strides_total(4, std::vector<double*>(3));
+
+    su::task_parameters task_p;
+    task_p.start = 0; task_p.stop = 3; task_p.tid = 0; task_p.n_samples = 6; task_p.bypass_tips = false; task_p.normalize_sample_counts = true;
+    task_p.g_unifrac_alpha = 1.0;
+
+    std::vector<su::task_parameters> tasks;
+    tasks.push_back(task_p);
+    su::process_stripes_multi(table, tree, methods, alphas, strides, strides_total, tasks);
+
+    // each alpha must match the single alpha compute
+    for(unsigned int m = 0; m < 4; m++) {
+        std::vector<double*> exp = su::make_strides(6);
+        std::vector<double*> exp_total = su::make_strides(6);
+        std::vector<su::task_parameters> exp_tasks;
+        exp_tasks.push_back(task_p);
+        exp_tasks[0].g_unifrac_alpha = alphas[m];
+        su::process_stripes(std::ref(table),
+                            std::ref(tree),
+                            su::generalized,
+                            false,
+                            std::ref(exp),
+                            std::ref(exp_total),
+                            std::ref(exp_tasks));
+
+        for(unsigned int i = 0; i < 3; i++) {
+            for(unsigned int j = 0; j < 6; j++) {
+                ASSERT(fabs(strides[m][i][j] - exp[i][j]) < 0.000001);
+            }
+        }
+        su::release_stripes(exp, &exp_tasks[0]);
+        su::release_stripes(strides[m], &tasks[0]);
+    }
+#endif
+    SUITE_END();
+}
+
 void test_unweighted_unifrac_fast() {
     SUITE_START("test unweighted unifrac no tips");
 #ifndef API_ONLY
@@ -1784,8 +2559,8 @@ void test_unweighted_unifrac_fast() {
         for(unsigned int j = 0; j < 6; j++) {
             ASSERT(fabs(strides[i][j] - exp[i][j]) < 0.000001);
         }
-        free(strides[i]);
     }
+    su::release_stripes(strides, &tasks[0]);
 #endif
 
     // repeat using the API
@@ -1841,8 +2616,8 @@ void test_unnormalized_unweighted_unifrac() {
         for(unsigned int j = 0; j < 6; j++) {
             ASSERT(fabs(strides[i][j] - exp[i][j]) < 0.000001);
         }
-        free(strides[i]);
     }
+    su::release_stripes(strides, &tasks[0]);
 #endif
 
     // repeat using the API
@@ -1870,14 +2645,7 @@ void test_normalized_weighted_unifrac() {
     su::biom table("test.biom");
 #endif
 
-    std::vector<double*> exp;
-    double stride1[] = {0.38095238, 0.33333333, 0.73333333, 0.33333333, 0.5, 0.26785714};
-    double stride2[] = {0.58095238, 0.66666667, 0.86666667, 0.25, 0.28571429, 0.45833333};
-    double stride3[] = {0.47619048, 0.66666667, 0.46666667, 0.47619048, 0.66666667, 0.46666667};
 #ifndef API_ONLY
-    exp.push_back(stride1);
-    exp.push_back(stride2);
-    exp.push_back(stride3);
     std::vector<double*> strides = su::make_strides(6);
     std::vector<double*> strides_total = su::make_strides(6);
 
@@ -1895,16 +2663,12 @@ void test_normalized_weighted_unifrac() {
                         std::ref(strides_total),
                         std::ref(tasks));
 
-    for(unsigned int i = 0; i < 3; i++) {
-        for(unsigned int j = 0; j < 6; j++) {
-            ASSERT(fabs(strides[i][j] - exp[i][j]) < 0.000001);
-        }
-        free(strides[i]);
-    }
+    check_test_strides(strides, exp_weighted_normalized_strides);
+    su::release_stripes(strides, &tasks[0]);
 #endif
 
     // repeat using the API
-    double* cstripes[] = {stride1, stride2, stride3};
+    const double* cstripes[] = {exp_weighted_normalized_strides[0], exp_weighted_normalized_strides[1], exp_weighted_normalized_strides[2]};
     mat_t *res = NULL;
     ComputeStatus rc = one_off("test.biom", "test.tre",
 		               "weighted_normalized", false, 0.0,
@@ -2024,6 +2788,27 @@ void test_bptree_collapse_edge() {
     SUITE_END();
 }
 
+void test_bptree_compact() {
+    SUITE_START("test bptree compact");
+    // x is a zero-length internal node, z is unary and d is a zero-length tip
+    su::BPTree tree("((a:1,b:2)x:0,((c:3,e:1)y:2)z:4,d:0)r;");
+    su::BPTree exp("(a:1,b:2,(c:3,e:1)y:6,d:0)r;");
+
+    uint32_t n_saved = 0;
+    su::BPTree obs = tree.compact(n_saved);
+    ASSERT(obs.get_structure() == exp.get_structure());
+    ASSERT(obs.names == exp.names);
+    ASSERT(vec_almost_equal(obs.lengths, exp.lengths));
+    ASSERT(n_saved == 3);
+
+    // nothing to compact
+    su::BPTree obs_exp = exp.compact(n_saved);
+    ASSERT(obs_exp.get_structure() == exp.get_structure());
+    ASSERT(n_saved == 1);
+
+    SUITE_END();
+}
+
 void test_unifrac_sample_counts() {
     SUITE_START("test unifrac sample counts");
     su::biom table("test.biom");
@@ -2235,20 +3020,24 @@ int main(int argc, char** argv) {
     test_bptree_postorder();
     test_bptree_preorder();
     test_bptree_parent();
+    test_bptree_postorder_plan();
     test_bptree_leftchild();
     test_bptree_rightchild();
     test_bptree_rightsibling();
     test_bptree_get_tip_names();
     test_bptree_mask();
+    test_bptree_cache();
     test_bptree_shear_simple();
     test_bptree_shear_deep();
     test_bptree_collapse_simple();
     test_bptree_collapse_edge();
+    test_bptree_compact();
     test_bptree_constructor_inmem();
 
     test_biom_constructor();
     test_biom_constructor_from_sparse();
     test_biom_constructor_from_dense();
+    test_sparse_data_compact_values();
     test_biom_nullary();
     test_biom_get_obs_data();
     test_biom_filter();
@@ -2256,8 +3045,11 @@ int main(int argc, char** argv) {
     test_propstack_constructor();
     test_propstack_push_and_pop();
     test_propstack_get();
+    test_propstack_plan();
+    test_postorder_plan_split_subtrees();
 
     test_unifrac_set_proportions();
+    test_unifrac_postorder_obs_index();
     test_unifrac_set_proportions_range();
     test_unifrac_set_proportions_range_float();
     test_unifrac_deconvolute_stripes();
@@ -2274,6 +3066,13 @@ int main(int argc, char** argv) {
 #endif
 
     test_unweighted_unifrac();
+    test_unweighted_unifrac_dedup();
+    test_unifrac_sparse_pairs();
+    test_unifrac_sparse_pairs_stored_zero();
+    test_unifrac_subtrees();
+    test_unifrac_tiles();
+    test_unifrac_multi();
+    test_unifrac_multi_alpha();
     test_unweighted_unifrac_fast();
     test_unnormalized_unweighted_unifrac();
     test_unnormalized_weighted_unifrac();
@@ -2289,6 +3088,7 @@ int main(int argc, char** argv) {
 
     test_faith_pd();
     test_faith_pd_shear();
+    test_faith_pd_chunks();
 
     printf("\n");
     printf(" %i / %i suites failed\n", suites_failed, suites_run);
@@ -2,6 +2,11 @@
 #include <stack>
 #include <algorithm>
 #include <cstring>
+#include <cstdio>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 using namespace su;
 
@@ -189,6 +194,44 @@ BPTree BPTree::collapse() const {
 
     return this->mask(collapsemask, new_lengths);
 }
+
+BPTree BPTree::compact(uint32_t &n_saved) const {
+    std::vector<bool> compactmask = std::vector<bool>(this->nparens);
+    std::vector<double> new_lengths = std::vector<double>(this->lengths);
+
+    uint32_t current, first, last;
+
+    n_saved = 0;
+    // preorder, so the length of a unary node is pushed down before its child is visited
+    for(uint32_t i = 0; i < this->nparens / 2; i++) {
+        current = this->preorderselect(i);
+
+        bool keep = true;
+        if(this->isleaf(current)) {
+            if(new_lengths[current] == 0.0)
+                n_saved++; // kept, but will not be embedded
+        } else if(current != 0) {  // 0 == root
+            first = this->leftchild(current);
+            last = this->rightchild(current);
+
+            if(first == last) {
+                new_lengths[first] = new_lengths[first] + new_lengths[current];
+                keep = false;
+            } else if(new_lengths[current] == 0.0) {
+                keep = false;
+            }
+        }
+
+        if(keep) {
+            compactmask[current] = true;
+            compactmask[this->close(current)] = true;
+        } else {
+            n_saved++;
+        }
+    }
+
+    return this->mask(compactmask, new_lengths);
+}
    /*
         mask = bit_array_create(self.B.size)
         bit_array_set_bit(mask, self.root())
@@ -503,3 +546,355 @@ const std::vector<uint32_t>& BPTree::get_openclose() const {
     return openclose;
 }
 
+
+// ===================== binary cache =====================
+//
+// Layout, all values in native byte order:
+//   header   : uint64_t[8] = {magic, version, nparens, names_bytes, source_size, source_mtime, 0, 0}
+//   structure: packed bits, uint64_t[(nparens+63)/64]
+//   lengths  : double[nparens]
+//   openclose, select_0_index, select_1_index, excess : uint32_t[nparens, nparens/2, nparens/2, nparens]
+//   names    : nparens NUL-terminated strings, names_bytes in total
+//   footer   : uint64_t magic
+// Each section starts at a 64-byte aligned offset.
+
+#define BPTREE_CACHE_ALIGN 64
+#define BPTREE_CACHE_HEADER_ELS 8
+
+namespace {
+    enum {cache_structure=0, cache_lengths, cache_openclose, cache_select_0, cache_select_1, cache_excess, cache_names, cache_footer, cache_end, cache_nsections};
+
+    inline uint64_t cache_align(uint64_t offset) {
+        return (offset + BPTREE_CACHE_ALIGN - 1) & ~uint64_t(BPTREE_CACHE_ALIGN - 1);
+    }
+
+    // compute the offset of each section
+    void cache_layout(uint64_t nparens, uint64_t names_bytes, uint64_t offsets[cache_nsections]) {
+        uint64_t sizes[cache_nsections-1];
+        sizes[cache_structure] = ((nparens + 63) / 64) * sizeof(uint64_t);
+        sizes[cache_lengths]   = nparens * sizeof(double);
+        sizes[cache_openclose] = nparens * sizeof(uint32_t);
+        sizes[cache_select_0]  = (nparens / 2) * sizeof(uint32_t);
+        sizes[cache_select_1]  = (nparens / 2) * sizeof(uint32_t);
+        sizes[cache_excess]    = nparens * sizeof(uint32_t);
+        sizes[cache_names]     = names_bytes;
+        sizes[cache_footer]    = sizeof(uint64_t);
+
+        uint64_t offset = BPTREE_CACHE_HEADER_ELS * sizeof(uint64_t);
+        for(int i = 0; i < cache_end; i++) {
+            offset = cache_align(offset);
+            offsets[i] = offset;
+            offset += sizes[i];
+        }
+        offsets[cache_end] = offset;
+    }
+
+    // write the whole buffer, retrying on short writes
+    bool cache_write(int fd, const void *buf, uint64_t size) {
+        const char *ptr = (const char *) buf;
+        while (size > 0) {
+            ssize_t cnt = ::write(fd, ptr, size);
+            if (cnt < 1) return false;
+            ptr += cnt;
+            size -= cnt;
+        }
+        return true;
+    }
+
+    // pad with zeros up to offset
+    bool cache_pad(int fd, uint64_t &pos, uint64_t offset) {
+        static const char zeros[BPTREE_CACHE_ALIGN] = {0};
+        if (offset > pos) {
+            if (!cache_write(fd, zeros, offset - pos)) return false;
+            pos = offset;
+        }
+        return true;
+    }
+
+    bool cache_write_section(int fd, uint64_t &pos, uint64_t offset, const void *buf, uint64_t size) {
+        if (!cache_pad(fd, pos, offset)) return false;
+        if (!cache_write(fd, buf, size)) return false;
+        pos += size;
+        return true;
+    }
+
+    // read the whole buffer from offset, retrying on short reads
+    bool cache_read(int fd, void *buf, uint64_t size, uint64_t offset) {
+        char *ptr = (char *) buf;
+        while (size > 0) {
+            ssize_t cnt = ::pread(fd, ptr, size, offset);
+            if (cnt < 1) return false;
+            ptr += cnt;
+            offset += cnt;
+            size -= cnt;
+        }
+        return true;
+    }
+
+    // validate the header against the size of the file, and compute the offset of each section
+    IOStatus cache_check_header(const uint64_t header[BPTREE_CACHE_HEADER_ELS], uint64_t file_size, uint64_t offsets[cache_nsections]) {
+        if ((header[0]!=BPTREE_CACHE_MAGIC) || (header[1]!=BPTREE_CACHE_VERSION)) return magic_incompatible;
+
+        const uint64_t n = header[2];
+        const uint64_t names_bytes = header[3];
+        if ((n > UINT32_MAX) || (names_bytes < n) || (names_bytes > file_size)) return bad_header;
+
+        cache_layout(n, names_bytes, offsets);
+        if (offsets[cache_end]!=file_size) return bad_header;
+        return read_okay;
+    }
+}
+
+IOStatus BPTree::write_cache(const char* filename, uint64_t source_size, int64_t source_mtime) const {
+    uint64_t names_bytes = 0;
+    for(unsigned int i = 0; i < nparens; i++)
+        names_bytes += names[i].length() + 1;
+
+    uint64_t offsets[cache_nsections];
+    cache_layout(nparens, names_bytes, offsets);
+
+    std::vector<uint64_t> packed((nparens + 63) / 64, 0);
+    for(unsigned int i = 0; i < nparens; i++) {
+        if(structure[i])
+            packed[i / 64] |= uint64_t(1) << (i % 64);
+    }
+
+    std::string names_buf;
+    names_buf.reserve(names_bytes);
+    for(unsigned int i = 0; i < nparens; i++) {
+        names_buf.append(names[i]);
+        names_buf.push_back('\0');
+    }
+
+    // write in a temporary file first, so concurrent readers never see a partial cache
+    std::string tmp_filename = std::string(filename) + ".tmp." + std::to_string(getpid());
+    int fd = ::open(tmp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd==-1) return open_error;
+
+    uint64_t header[BPTREE_CACHE_HEADER_ELS] = {BPTREE_CACHE_MAGIC, BPTREE_CACHE_VERSION, nparens, names_bytes,
+                                               source_size, uint64_t(source_mtime), 0, 0};
+    const uint64_t footer = BPTREE_CACHE_MAGIC;
+
+    uint64_t pos = 0;
+    bool ok = cache_write_section(fd, pos, 0, header, sizeof(header)) &&
+              cache_write_section(fd, pos, offsets[cache_structure], packed.data(), packed.size() * sizeof(uint64_t)) &&
+              cache_write_section(fd, pos, offsets[cache_lengths], lengths.data(), nparens * sizeof(double)) &&
+              cache_write_section(fd, pos, offsets[cache_openclose], openclose.data(), nparens * sizeof(uint32_t)) &&
+              cache_write_section(fd, pos, offsets[cache_select_0], select_0_index.data(), (nparens / 2) * sizeof(uint32_t)) &&
+              cache_write_section(fd, pos, offsets[cache_select_1], select_1_index.data(), (nparens / 2) * sizeof(uint32_t)) &&
+              cache_write_section(fd, pos, offsets[cache_excess], excess.data(), nparens * sizeof(uint32_t)) &&
+              cache_write_section(fd, pos, offsets[cache_names], names_buf.data(), names_bytes) &&
+              cache_write_section(fd, pos, offsets[cache_footer], &footer, sizeof(footer));
+
+    if (::close(fd)!=0) ok = false;
+    if (ok && (rename(tmp_filename.c_str(), filename)!=0)) ok = false;
+    if (!ok) {
+        unlink(tmp_filename.c_str());
+        return write_error;
+    }
+
+    return write_okay;
+}
+
+IOStatus BPTree::read_cache(const char* filename, uint64_t *source_size, int64_t *source_mtime) {
+    int fd = ::open(filename, O_RDONLY);
+    if (fd==-1) return open_error;
+
+    struct stat st;
+    if (fstat(fd, &st)!=0) {::close(fd); return read_error;}
+    const uint64_t file_size = st.st_size;
+
+    uint64_t header[BPTREE_CACHE_HEADER_ELS];
+    if (!cache_read(fd, header, sizeof(header), 0)) {::close(fd); return magic_incompatible;}
+
+    uint64_t offsets[cache_nsections];
+    {
+        IOStatus err = cache_check_header(header, file_size, offsets);
+        if (err!=read_okay) {::close(fd); return err;}
+    }
+
+    const uint32_t n = header[2];
+    const uint64_t names_bytes = header[3];
+
+    // the sections are read straight into their final storage, and only swapped in once validated
+    std::vector<uint64_t> packed((uint64_t(n) + 63) / 64);
+    std::vector<double> in_lengths(n);
+    std::vector<uint32_t> in_openclose(n);
+    std::vector<uint32_t> in_select_0(n / 2);
+    std::vector<uint32_t> in_select_1(n / 2);
+    std::vector<uint32_t> in_excess(n);
+    std::vector<char> names_buf(names_bytes);
+    uint64_t footer = 0;
+    const bool ok = cache_read(fd, packed.data(), packed.size() * sizeof(uint64_t), offsets[cache_structure]) &&
+                    cache_read(fd, in_lengths.data(), uint64_t(n) * sizeof(double), offsets[cache_lengths]) &&
+                    cache_read(fd, in_openclose.data(), uint64_t(n) * sizeof(uint32_t), offsets[cache_openclose]) &&
+                    cache_read(fd, in_select_0.data(), uint64_t(n / 2) * sizeof(uint32_t), offsets[cache_select_0]) &&
+                    cache_read(fd, in_select_1.data(), uint64_t(n / 2) * sizeof(uint32_t), offsets[cache_select_1]) &&
+                    cache_read(fd, in_excess.data(), uint64_t(n) * sizeof(uint32_t), offsets[cache_excess]) &&
+                    cache_read(fd, names_buf.data(), names_bytes, offsets[cache_names]) &&
+                    cache_read(fd, &footer, sizeof(footer), offsets[cache_footer]);
+    ::close(fd);
+    if (!ok) return read_error;
+    if (footer!=BPTREE_CACHE_MAGIC) return bad_header;
+
+    std::vector<bool> in_structure(n);
+    for(uint32_t i = 0; i < n; i++)
+        in_structure[i] = (packed[i / 64] >> (i % 64)) & 1;
+
+    // the indexes are used without bounds checks, so make sure they stay within the tree
+    for(uint32_t i = 0; i < n; i++) {
+        const uint32_t j = in_openclose[i];
+        if ((j >= n) || (in_structure[j] == in_structure[i]) || (in_excess[i] > n)) return bad_header;
+    }
+    for(uint32_t k = 0; k < (n / 2); k++) {
+        if ((in_select_0[k] >= n) || in_structure[in_select_0[k]]) return bad_header;
+        if ((in_select_1[k] >= n) || !in_structure[in_select_1[k]]) return bad_header;
+    }
+
+    // one name per parenthesis, each NUL-terminated; most are empty, so need no string
+    std::vector<std::string> in_names(n);
+    {
+        const char *p = names_buf.data();
+        const char * const names_end = p + names_bytes;
+        for(uint32_t i = 0; i < n; i++) {
+            const char *e = (const char *) memchr(p, '\0', names_end - p);
+            if (e == NULL) return bad_header;
+            if (e != p) in_names[i].assign(p, e - p);
+            p = e + 1;
+        }
+        if (p != names_end) return bad_header;
+    }
+
+    nparens = n;
+    structure.swap(in_structure);
+    lengths.swap(in_lengths);
+    openclose.swap(in_openclose);
+    select_0_index.swap(in_select_0);
+    select_1_index.swap(in_select_1);
+    excess.swap(in_excess);
+    names.swap(in_names);
+
+    if (source_size!=NULL) *source_size = header[4];
+    if (source_mtime!=NULL) *source_mtime = int64_t(header[5]);
+
+    return read_okay;
+}
+
+IOStatus BPTree::read_cache_source(const char* filename, uint64_t *source_size, int64_t *source_mtime) {
+    int fd = ::open(filename, O_RDONLY);
+    if (fd==-1) return open_error;
+
+    struct stat st;
+    uint64_t header[BPTREE_CACHE_HEADER_ELS];
+    const bool ok = (fstat(fd, &st)==0) && cache_read(fd, header, sizeof(header), 0);
+    ::close(fd);
+    if (!ok) return magic_incompatible;
+
+    uint64_t offsets[cache_nsections];
+    IOStatus err = cache_check_header(header, st.st_size, offsets);
+    if (err!=read_okay) return err;
+
+    if (source_size!=NULL) *source_size = header[4];
+    if (source_mtime!=NULL) *source_mtime = int64_t(header[5]);
+    return read_okay;
+}
+
+bool BPTree::is_cache_file(const char* filename) {
+    int fd = ::open(filename, O_RDONLY);
+    if (fd==-1) return false;
+
+    uint64_t header[2];
+    ssize_t cnt = ::read(fd, header, sizeof(header));
+    ::close(fd);
+
+    return (cnt==sizeof(header)) && (header[0]==BPTREE_CACHE_MAGIC);
+}
+
+PostorderPlan::PostorderPlan(const BPTree &tree)
+  : n_nodes(tree.nparens / 2)
+  , nodes(n_nodes)
+  , lengths(n_nodes)
+  , parents(n_nodes, n_nodes)
+  , child_start(n_nodes + 1)
+  , children()
+  , max_live(0) {
+    const std::vector<bool> &structure = tree.get_structure();
+    if (n_nodes>0) children.reserve(n_nodes - 1);
+
+    // open_stack holds the open parentheses not yet closed,
+    // together with where their children start in pending
+    // pending holds the postorder positions of the closed nodes whose parent is still open
+    std::vector<std::pair<uint32_t,uint32_t> > open_stack;
+    std::vector<uint32_t> pending;
+
+    uint32_t k = 0;
+    for(uint32_t i = 0; i < tree.nparens; i++) {
+        if(structure[i]) {
+            open_stack.emplace_back(i, pending.size());
+        } else {
+            const uint32_t node = open_stack.back().first;
+            const uint32_t first_child = open_stack.back().second;
+            open_stack.pop_back();
+
+            // the node vector is needed while all the pending ones are still alive
+            max_live = std::max(max_live, uint32_t(pending.size() + 1));
+
+            nodes[k] = node;
+            lengths[k] = tree.lengths[node];
+            child_start[k] = children.size();
+            for(uint32_t c = first_child; c < pending.size(); c++) {
+                children.push_back(pending[c]);
+                parents[pending[c]] = k;
+            }
+            pending.resize(first_child);
+            pending.push_back(k);
+            k++;
+        }
+    }
+    child_start[n_nodes] = children.size();
+}
+
+void PostorderPlan::split_subtrees(uint32_t max_size, uint32_t min_size,
+                                   std::vector<uint32_t> &range_starts,
+                                   std::vector<uint32_t> &range_ends,
+                                   std::vector<uint32_t> &residual) const {
+    range_starts.clear();
+    range_ends.clear();
+    residual.clear();
+    if (n_nodes<2) return;
+
+    // children come before their parents, so sizes can be accumulated in a single pass
+    std::vector<uint32_t> sizes(n_nodes, 1);
+    for(uint32_t k = 0; k < (n_nodes - 1); k++)
+        sizes[parents[k]] += sizes[k];
+
+    uint32_t cur_start = 0;
+    uint32_t cur_end = 0;   // empty range
+    auto close_range = [&]() {
+        if (cur_end - cur_start >= min_size) {
+            range_starts.push_back(cur_start);
+            range_ends.push_back(cur_end);
+        } else {
+            for(uint32_t k = cur_start; k < cur_end; k++)
+                residual.push_back(k);
+        }
+        cur_start = cur_end = 0;
+    };
+
+    for(uint32_t k = 0; k < (n_nodes - 1); k++) {
+        if (sizes[k] > max_size) {
+            // too big, will have to be computed from its children
+            close_range();
+            residual.push_back(k);
+        } else if (sizes[parents[k]] > max_size) {
+            // largest subtree that fits, the subtree spans [k+1-sizes[k],k]
+            const uint32_t sub_start = k + 1 - sizes[k];
+            if ((cur_end != sub_start) || ((cur_end - cur_start + sizes[k]) > max_size)) {
+                close_range();
+                cur_start = sub_start;
+            }
+            cur_end = k + 1;
+        } // else, inside a subtree, will be added together with its root
+    }
+    close_range();
+}
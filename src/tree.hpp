@@ -16,6 +16,11 @@
 #include <iostream>
 #include <vector>
 #include <unordered_set>
+#include "status_enum.hpp"
+
+/* binary tree cache, see BPTree::write_cache */
+#define BPTREE_CACHE_MAGIC   0x088ABB01
+#define BPTREE_CACHE_VERSION 1
 
 namespace su {
     class BPTree {
@@ -55,6 +60,43 @@ namespace su {
              */
             BPTree(const bool* input_structure, const double* input_lengths, const char* const * input_names, const int n_parens);
 
+            /* Save the tree in a binary cache file
+             *
+             * The file contains the topology, the lengths, the names and all the
+             * cached indexes, in 64-byte aligned sections, so it can be
+             * read back section by section without any parsing.
+             * The file is first written under a temporary name, then renamed.
+             *
+             * @param filename The file to write
+             * @param source_size The size of the newick file the tree was parsed from, 0 if unknown
+             * @param source_mtime The modification time of the newick file, in nanoseconds, 0 if unknown
+             */
+            IOStatus write_cache(const char* filename, uint64_t source_size=0, int64_t source_mtime=0) const;
+
+            /* Replace the content of this tree with the one from a binary cache file
+             *
+             * The cached indexes are checked to stay within the tree, and the tree
+             * is left untouched if the file is not a valid cache.
+             *
+             * @param filename The file written by write_cache
+             * @param source_size If not NULL, set to the source_size recorded in the file
+             * @param source_mtime If not NULL, set to the source_mtime recorded in the file
+             */
+            IOStatus read_cache(const char* filename, uint64_t *source_size=NULL, int64_t *source_mtime=NULL);
+
+            /* Get the source_size and source_mtime recorded in a binary cache file
+             *
+             * Only the header is read, and checked against the size of the file.
+             *
+             * @param filename The file written by write_cache
+             * @param source_size If not NULL, set to the source_size recorded in the file
+             * @param source_mtime If not NULL, set to the source_mtime recorded in the file
+             */
+            static IOStatus read_cache_source(const char* filename, uint64_t *source_size, int64_t *source_mtime);
+
+            /* Test if a file is a binary tree cache, by looking at its magic */
+            static bool is_cache_file(const char* filename);
+
             /* postorder tree traversal
              *
              * Get the index position of the ith node in a postorder tree
@@ -126,6 +168,17 @@ namespace su {
 
             BPTree collapse() const;
 
+            /* Remove the nodes that would only waste an embedding slot during compute
+             *
+             * Like collapse, unary chains are merged into a single branch with the summed length.
+             * In addition, zero-length internal branches are dropped, with their children
+             * attached to the parent. Zero-length tips carry counts, so they are kept, but
+             * will be skipped at compute time.
+             *
+             * n_saved is set to the number of embedding slots saved, tips included.
+             */
+            BPTree compact(uint32_t &n_saved) const;
+
         private:
             std::vector<bool> structure;          // the topology
             std::vector<uint32_t> openclose;      // cache'd mapping between parentheses
@@ -151,6 +204,56 @@ namespace su {
 	    // to be used in the constructors only
             template<typename T> void _init(T newick);
     };
+
+    /* Flat postorder traversal plan of a BPTree
+     *
+     * Built once, in a single pass over the topology, so that traversals
+     * do not need any select/openclose lookups.
+     * All the arrays are indexed by postorder position k, i.e. the k-th
+     * node returned by BPTree::postorderselect.
+     */
+    class PostorderPlan {
+        public:
+            /* default constructor
+             *
+             * @param tree The tree to build the plan of
+             */
+            PostorderPlan(const BPTree &tree);
+
+            /* number of nodes, including the root, which is the last one */
+            uint32_t n_nodes;
+
+            std::vector<uint32_t> nodes;       // index position of the node in the tree
+            std::vector<double> lengths;       // branch length of the node
+            std::vector<uint32_t> parents;     // postorder position of the parent, n_nodes for the root
+            std::vector<uint32_t> child_start; // the children of k are children[child_start[k]:child_start[k+1]]
+            std::vector<uint32_t> children;    // postorder positions, left to right
+
+            /* max number of node vectors alive at the same time during a postorder traversal,
+             * i.e. the node being computed plus all the computed nodes whose parent is not yet
+             */
+            uint32_t max_live;
+
+            /* Test if the node at postorder position k is a leaf */
+            bool isleaf(uint32_t k) const {return child_start[k]==child_start[k+1];}
+
+            /* Split the non-root nodes into independent pieces of work
+             *
+             * @param max_size Max number of nodes in a range
+             * @param min_size Ranges smaller than this are not worth splitting off
+             * @param range_starts Output, first postorder position of each range
+             * @param range_ends Output, one past the last postorder position of each range
+             * @param residual Output, the postorder positions not in any range, in postorder
+             *
+             * Each range is a contiguous run of whole subtrees, so it can be traversed
+             * without any knowledge of the rest of the tree. The residual nodes are the
+             * ancestors of the ranges, plus any subtree too small to be a range of its own.
+             */
+            void split_subtrees(uint32_t max_size, uint32_t min_size,
+                                std::vector<uint32_t> &range_starts,
+                                std::vector<uint32_t> &range_ends,
+                                std::vector<uint32_t> &residual) const;
+    };
 }
 
 #endif /* UNIFRAC_TREE_H */
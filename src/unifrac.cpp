@@ -18,6 +18,8 @@
 #include <algorithm>
 #include <pthread.h>
 #include <unistd.h>
+#include <type_traits>
+#include <omp.h>
 
 #include "unifrac_internal.hpp"
 
@@ -96,7 +98,8 @@ double** su::deconvolute_stripes(std::vector<double*> &stripes, uint32_t n) {
 }
 
 
-void su::stripes_to_condensed_form(std::vector<double*> &stripes, uint32_t n, double* cf, unsigned int start, unsigned int stop) {
+template<class TStripe>
+static inline void stripes_to_condensed_form_T(std::vector<TStripe*> &stripes, uint32_t n, double* cf, unsigned int start, unsigned int stop) {
     // n must be >= 2, but that should be enforced upstream as that would imply
     // computing unifrac on a single sample.
 
@@ -119,6 +122,14 @@ void su::stripes_to_condensed_form(std::vector<double*> &stripes, uint32_t n, do
     }
 }
 
+void su::stripes_to_condensed_form(std::vector<double*> &stripes, uint32_t n, double* cf, unsigned int start, unsigned int stop) {
+    stripes_to_condensed_form_T<double>(stripes, n, cf, start, stop);
+}
+
+void su::stripes_to_condensed_form(std::vector<float*> &stripes, uint32_t n, double* cf, unsigned int start, unsigned int stop) {
+    stripes_to_condensed_form_T<float>(stripes, n, cf, start, stop);
+}
+
 
 // write in a 2D matrix 
 // also suitable for writing to disk
@@ -173,15 +184,16 @@ void su::condensed_form_to_matrix_fp32(const double*  __restrict__ cf, const uin
 
 // Helper class
 // Will cache pointers and automatically release stripes when all elements are used
+template<class TStripe>
 class OnceManagedStripes {
    private:
     const uint32_t n_samples;
     const uint32_t n_stripes;
-    const ManagedStripes &stripes;
-    std::vector<const double *> stripe_ptr;
+    const ManagedStripesT<TStripe> &stripes;
+    std::vector<const TStripe *> stripe_ptr;
     std::vector<uint32_t> stripe_accessed;
 
-    const double *get_stripe(const uint32_t stripe) {
+    const TStripe *get_stripe(const uint32_t stripe) {
       if (stripe_ptr[stripe]==0) stripe_ptr[stripe]=stripes.get_stripe(stripe);
       return stripe_ptr[stripe];
     }
@@ -192,7 +204,7 @@ class OnceManagedStripes {
     }
 
    public:
-    OnceManagedStripes(const ManagedStripes &_stripes, const uint32_t _n_samples, const uint32_t _n_stripes)
+    OnceManagedStripes(const ManagedStripesT<TStripe> &_stripes, const uint32_t _n_samples, const uint32_t _n_stripes)
     : n_samples(_n_samples), n_stripes(_n_stripes)
     , stripes(_stripes)
     , stripe_ptr(n_stripes)
@@ -208,11 +220,11 @@ class OnceManagedStripes {
       }
     }
 
-    double get_val(const uint32_t stripe, const uint32_t el)
+    TStripe get_val(const uint32_t stripe, const uint32_t el)
     {
       if (stripe_ptr[stripe]==0) stripe_ptr[stripe]=stripes.get_stripe(stripe); 
-      const double *mystripe = stripe_ptr[stripe];
-      double val = mystripe[el];
+      const TStripe *mystripe = stripe_ptr[stripe];
+      TStripe val = mystripe[el];
 
       stripe_accessed[stripe]++;
       if (stripe_accessed[stripe]==n_samples) release_stripe(stripe); // we will not use this stripe anymore
@@ -225,8 +237,8 @@ class OnceManagedStripes {
 
 // write in a 2D matrix 
 // also suitable for writing to disk
-template<class TReal>
-void su::stripes_to_matrix_T(const ManagedStripes &_stripes, const uint32_t n_samples, const uint32_t n_stripes, TReal*  __restrict__ buf2d, uint32_t tile_size) {
+template<class TReal, class TStripe>
+void su::stripes_to_matrix_T(const ManagedStripesT<TStripe> &_stripes, const uint32_t n_samples, const uint32_t n_stripes, TReal*  __restrict__ buf2d, uint32_t tile_size) {
     // n_samples must be >= 2, but that should be enforced upstream as that would imply
     // computing unifrac on a single sample.
 
@@ -234,7 +246,7 @@ void su::stripes_to_matrix_T(const ManagedStripes &_stripes, const uint32_t n_sa
     const uint32_t TILE = (tile_size>0) ? tile_size : (128/sizeof(TReal));
     const uint32_t n_samples_tup = (n_samples+(TILE-1))/TILE; // round up
 
-    OnceManagedStripes stripes(_stripes, n_samples, n_stripes);
+    OnceManagedStripes<TStripe> stripes(_stripes, n_samples, n_stripes);
 
     
     for(uint32_t oi = 0; oi < n_samples_tup; oi++) { // off diagonal
@@ -328,8 +340,10 @@ void su::stripes_to_matrix_T(const ManagedStripes &_stripes, const uint32_t n_sa
 }
 
 // Make sure it gets instantiated
-template void su::stripes_to_matrix_T<double>(const ManagedStripes &stripes, const uint32_t n_samples, const uint32_t n_stripes, double*  __restrict__ buf2d, uint32_t tile_size);
-template void su::stripes_to_matrix_T<float>(const ManagedStripes &stripes, const uint32_t n_samples, const uint32_t n_stripes, float*  __restrict__ buf2d, uint32_t tile_size);
+template void su::stripes_to_matrix_T<double,double>(const ManagedStripesT<double> &stripes, const uint32_t n_samples, const uint32_t n_stripes, double*  __restrict__ buf2d, uint32_t tile_size);
+template void su::stripes_to_matrix_T<float,double>(const ManagedStripesT<double> &stripes, const uint32_t n_samples, const uint32_t n_stripes, float*  __restrict__ buf2d, uint32_t tile_size);
+template void su::stripes_to_matrix_T<double,float>(const ManagedStripesT<float> &stripes, const uint32_t n_samples, const uint32_t n_stripes, double*  __restrict__ buf2d, uint32_t tile_size);
+template void su::stripes_to_matrix_T<float,float>(const ManagedStripesT<float> &stripes, const uint32_t n_samples, const uint32_t n_stripes, float*  __restrict__ buf2d, uint32_t tile_size);
 
 void su::stripes_to_matrix(const ManagedStripes &stripes, const uint32_t n_samples, const uint32_t n_stripes, double*  __restrict__ buf2d, uint32_t tile_size) {
    return su::stripes_to_matrix_T<double>(stripes, n_samples, n_stripes, buf2d, tile_size);
@@ -339,6 +353,48 @@ void su::stripes_to_matrix_fp32(const ManagedStripes &stripes, const uint32_t n_
   return su::stripes_to_matrix_T<float>(stripes, n_samples, n_stripes, buf2d, tile_size);
 }
 
+// write in a 2D matrix, one tile (and its mirror) at a time
+template<class TReal, class TFloat>
+void su::tiles_to_matrix_T(const DMTilesT<TFloat> &tiles, TReal*  __restrict__ buf2d) {
+    const uint64_t n_samples = tiles.n_samples;
+    const uint64_t tile_size = tiles.tile_size;
+    const uint64_t n_blocks = tiles.n_blocks;
+
+#pragma omp parallel for collapse(2) schedule(dynamic,1) default(shared)
+    for(uint64_t bi = 0; bi < n_blocks; bi++) {
+      for(uint64_t bj = 0; bj < n_blocks; bj++) {
+        if (bj<bi) continue; // lower triangle, written as the mirror of the upper one
+
+        const TFloat * const __restrict__ tile = tiles.get_tile(bi,bj);
+        const uint64_t ks = bi*tile_size;
+        const uint64_t ls = bj*tile_size;
+        const uint64_t kmax = std::min(ks+tile_size,n_samples);
+        const uint64_t lmax = std::min(ls+tile_size,n_samples);
+
+        for(uint64_t k = ks; k < kmax; k++) {
+          const TFloat * const __restrict__ row = tile + (k-ks)*tile_size - ls;
+          uint64_t l = ls;
+          if (bi==bj) {
+            // on diagonal
+            buf2d[k*n_samples+k] = 0.0;
+            l = k+1;
+          }
+          for(; l < lmax; l++) {
+            const TReal val = row[l];
+            buf2d[k*n_samples+l] = val;
+            buf2d[l*n_samples+k] = val;
+          }
+        }
+      }
+    }
+}
+
+// Make sure it gets instantiated
+template void su::tiles_to_matrix_T<double,double>(const DMTilesT<double> &tiles, double*  __restrict__ buf2d);
+template void su::tiles_to_matrix_T<float,double>(const DMTilesT<double> &tiles, float*  __restrict__ buf2d);
+template void su::tiles_to_matrix_T<double,float>(const DMTilesT<float> &tiles, double*  __restrict__ buf2d);
+template void su::tiles_to_matrix_T<float,float>(const DMTilesT<float> &tiles, float*  __restrict__ buf2d);
+
 
 void progressbar(float progress) {
     // from http://stackoverflow.com/a/14539953
@@ -356,33 +412,99 @@ void progressbar(float progress) {
     std::cout.flush();
 }
 
+// Number of nodes packed in each presence word of faith_pd
+static constexpr unsigned int FAITH_PD_BATCH = 64;
+
+// Smallest sample chunk of faith_pd worth its own traversal of the tree
+static constexpr unsigned int FAITH_PD_MIN_CHUNK = 64;
+
 // Computes Faith's PD for the samples in  `table` over the phylogenetic
 // tree given by `tree`.
 // Assure that tree does not contain ids that are not in table
+//
+// The samples are split in chunks, each traversing the whole tree on its own thread.
+// The chunks are at most DEF_VEC_SIZE samples, but with few samples they are made smaller,
+// down to FAITH_PD_MIN_CHUNK, so that there is at least one chunk per thread.
+// The nodes are processed in batches of FAITH_PD_BATCH, with the presence of each node
+// packed in one bit per sample, and the branch lengths summed 8 bits at a time,
+// using a 256-element lookup table per byte.
 void su::faith_pd(biom_interface &table,
                   BPTree &tree,
                   double* result) {
-    PropStack<double> propstack(table.n_samples);
-
-    uint32_t node;
-    double *node_proportions;
-    double length;
+    // flatten the tree and resolve the leaf IDs once
+    const PostorderPlan plan(tree);
+    std::vector<uint32_t> obs_index;
+    postorder_obs_index(tree, plan, table, obs_index);
+
+    const unsigned int n_samples = table.n_samples;
+    const unsigned int max_chunk = PropStackFixed<double>::DEF_VEC_SIZE;
+    const unsigned int max_chunks = (n_samples + (FAITH_PD_MIN_CHUNK-1)) / FAITH_PD_MIN_CHUNK;
+    const unsigned int num_prop_chunks = std::max((n_samples + (max_chunk-1)) / max_chunk,
+                                                  std::min((unsigned int) omp_get_max_threads(), max_chunks));
+    const unsigned int chunk_size = (num_prop_chunks>0) ? ((n_samples + (num_prop_chunks-1)) / num_prop_chunks) : 0;
 
-    // for node in postorderselect
     const unsigned int max_k = (tree.nparens>1) ? ((tree.nparens / 2) - 1) : 0;
-    for(unsigned int k = 0; k < max_k; k++) {
-        node = tree.postorderselect(k);
-        // get branch length
-        length = tree.lengths[node];
-
-        // get node proportions and set intermediate scores
-        node_proportions = propstack.pop(node);
-        set_proportions(node_proportions, tree, node, table, propstack);
-
-        for (unsigned int sample = 0; sample < table.n_samples; sample++){
-            // calculate contribution of node to score
-            result[sample] += (node_proportions[sample] > 0) * length;
+
+#pragma omp parallel for schedule(dynamic,1)
+    for (unsigned int ck=0; ck<num_prop_chunks; ck++) {
+      const unsigned int tstart = std::min(ck*chunk_size, n_samples);
+      const unsigned int tend = std::min(tstart+chunk_size, n_samples);
+      const unsigned int n = tend - tstart;
+      if (n==0) continue;
+
+      PropStack<double> propstack(n, plan);
+
+      std::vector<uint64_t> presence(n);
+      std::vector<double> my_result(n, 0.0);
+      double lengths[FAITH_PD_BATCH];
+      double sums[FAITH_PD_BATCH/8][0x100];
+
+      unsigned int k = 0; // index in tree
+      while (k<max_k) {
+        unsigned int filled = 0;
+        for (unsigned int i=0; i<n; i++) presence[i] = 0;
+
+        while ((filled<FAITH_PD_BATCH) && (k<max_k)) {
+          // note: propstack is indexed by postorder position
+          const uint32_t node = k;
+          k++;
+
+          // only presence matters, so no need to normalize
+          double *node_proportions = propstack.pop(node);
+          set_proportions_range(node_proportions, plan, node, obs_index[node], table, tstart, tend, propstack, false);
+
+          // zero-length branches do not contribute, no need to waste a bit
+          if (plan.lengths[node] == 0.0) continue;
+
+          lengths[filled] = plan.lengths[node];
+          for (unsigned int i=0; i<n; i++) {
+            presence[i] |= uint64_t(node_proportions[i] > 0) << filled;
+          }
+          filled++;
         }
+        for (unsigned int e=filled; e<FAITH_PD_BATCH; e++) lengths[e] = 0.0;
+
+        // sum of the lengths for every combination of 8 bits
+        // built incrementally, by adding the lowest set bit to an already computed entry
+        for (unsigned int b=0; b<(FAITH_PD_BATCH/8); b++) {
+          double * const psum = sums[b];
+          const double * const pl = &(lengths[b*8]);
+          psum[0] = 0.0;
+          for (unsigned int b8_i=1; b8_i<0x100; b8_i++) {
+            psum[b8_i] = psum[b8_i & (b8_i-1)] + pl[__builtin_ctz(b8_i)];
+          }
+        }
+
+        for (unsigned int i=0; i<n; i++) {
+          const uint64_t w = presence[i];
+          my_result[i] += ((sums[0][ w        & 0xff] + sums[1][(w >>  8) & 0xff]) +
+                           (sums[2][(w >> 16) & 0xff] + sums[3][(w >> 24) & 0xff])) +
+                          ((sums[4][(w >> 32) & 0xff] + sums[5][(w >> 40) & 0xff]) +
+                           (sums[6][(w >> 48) & 0xff] + sums[7][ w >> 56        ]));
+        }
+      }
+
+      for (unsigned int i=0; i<n; i++) result[tstart+i] += my_result[i];
     }
 }
 
@@ -484,7 +606,45 @@ void su::unifrac(biom_interface &table,
                  const su::task_parameters* task_p) {
   check_acc();
   if (proc_use_acc==ACC_CPU) {
-    su_cpu::unifrac(table, tree, unifrac_method, dm_stripes, dm_stripes_total, task_p);
+    // very shallow samples are better served by the sparse-pair engine
+    // either way, the plan and the obs index are built only once
+    const PostorderPlan plan(tree);
+    std::vector<uint32_t> obs_index;
+    postorder_obs_index(tree, plan, table, obs_index);
+    if (sparse_pairs_preferred(table, plan, obs_index, unifrac_method)) {
+      unifrac_sparse_pairs(table, plan, obs_index, unifrac_method, dm_stripes, task_p);
+      return;
+    }
+    su_cpu::unifrac(table, plan, obs_index, unifrac_method, dm_stripes, dm_stripes_total, task_p);
+#if defined(UNIFRAC_ENABLE_ACC_NV)
+  } else if (proc_use_acc==ACC_NV) {
+    su_acc_nv::unifrac(table, tree, unifrac_method, dm_stripes, dm_stripes_total, task_p);
+#endif
+#if defined(UNIFRAC_ENABLE_ACC_AMD)
+  } else if (proc_use_acc==ACC_AMD) {
+    su_acc_amd::unifrac(table, tree, unifrac_method, dm_stripes, dm_stripes_total, task_p);
+#endif
+  }
+}
+
+void su::unifrac(biom_interface &table,
+                 BPTree &tree,
+                 Method unifrac_method,
+                 std::vector<float*> &dm_stripes,
+                 std::vector<float*> &dm_stripes_total,
+                 const su::task_parameters* task_p) {
+  check_acc();
+  if (proc_use_acc==ACC_CPU) {
+    // very shallow samples are better served by the sparse-pair engine
+    // either way, the plan and the obs index are built only once
+    const PostorderPlan plan(tree);
+    std::vector<uint32_t> obs_index;
+    postorder_obs_index(tree, plan, table, obs_index);
+    if (sparse_pairs_preferred(table, plan, obs_index, unifrac_method)) {
+      unifrac_sparse_pairs(table, plan, obs_index, unifrac_method, dm_stripes, task_p);
+      return;
+    }
+    su_cpu::unifrac(table, plan, obs_index, unifrac_method, dm_stripes, dm_stripes_total, task_p);
 #if defined(UNIFRAC_ENABLE_ACC_NV)
   } else if (proc_use_acc==ACC_NV) {
     su_acc_nv::unifrac(table, tree, unifrac_method, dm_stripes, dm_stripes_total, task_p);
@@ -497,6 +657,89 @@ void su::unifrac(biom_interface &table,
 }
 
 
+// Very shallow samples are better served by the sparse-pair engine, one method at a time,
+// so only share the traversal between the remaining methods
+template<class TFloat>
+static inline void unifrac_multi_cpu(biom_interface &table,
+                                     BPTree &tree,
+                                     const std::vector<su::Method> &unifrac_methods,
+                                     std::vector<std::vector<TFloat*>> &dm_stripes,
+                                     std::vector<std::vector<TFloat*>> &dm_stripes_total,
+                                     const std::vector<su::task_parameters> &task_ps) {
+  const su::PostorderPlan plan(tree);
+  std::vector<uint32_t> obs_index;
+  su::postorder_obs_index(tree, plan, table, obs_index);
+  std::vector<unsigned int> dense_idxs;
+  for (unsigned int i=0; i<unifrac_methods.size(); i++) {
+    if (su::sparse_pairs_preferred(table, plan, obs_index, unifrac_methods[i])) {
+      su::unifrac_sparse_pairs(table, plan, obs_index, unifrac_methods[i], dm_stripes[i], &(task_ps[i]));
+    } else {
+      dense_idxs.push_back(i);
+    }
+  }
+
+  if (dense_idxs.size()==unifrac_methods.size()) {
+    su_cpu::unifrac_multi(table, plan, obs_index, unifrac_methods, dm_stripes, dm_stripes_total, task_ps);
+  } else if (!dense_idxs.empty()) {
+    std::vector<su::Method> dense_methods;
+    std::vector<std::vector<TFloat*>> dense_stripes;
+    std::vector<std::vector<TFloat*>> dense_stripes_total;
+    std::vector<su::task_parameters> dense_task_ps;
+    for (auto i : dense_idxs) {
+      dense_methods.push_back(unifrac_methods[i]);
+      dense_stripes.push_back(dm_stripes[i]);
+      dense_stripes_total.push_back(dm_stripes_total[i]);
+      dense_task_ps.push_back(task_ps[i]);
+    }
+    su_cpu::unifrac_multi(table, plan, obs_index, dense_methods, dense_stripes, dense_stripes_total, dense_task_ps);
+    // the stripes were allocated in the copies
+    for (unsigned int j=0; j<dense_idxs.size(); j++) {
+      dm_stripes[dense_idxs[j]] = dense_stripes[j];
+      dm_stripes_total[dense_idxs[j]] = dense_stripes_total[j];
+    }
+  }
+}
+
+void su::unifrac_multi(biom_interface &table,
+                       BPTree &tree,
+                       const std::vector<Method> &unifrac_methods,
+                       std::vector<std::vector<double*>> &dm_stripes,
+                       std::vector<std::vector<double*>> &dm_stripes_total,
+                       const std::vector<task_parameters> &task_ps) {
+  check_acc();
+  if (proc_use_acc==ACC_CPU) {
+    unifrac_multi_cpu<double>(table, tree, unifrac_methods, dm_stripes, dm_stripes_total, task_ps);
+#if defined(UNIFRAC_ENABLE_ACC_NV)
+  } else if (proc_use_acc==ACC_NV) {
+    su_acc_nv::unifrac_multi(table, tree, unifrac_methods, dm_stripes, dm_stripes_total, task_ps);
+#endif
+#if defined(UNIFRAC_ENABLE_ACC_AMD)
+  } else if (proc_use_acc==ACC_AMD) {
+    su_acc_amd::unifrac_multi(table, tree, unifrac_methods, dm_stripes, dm_stripes_total, task_ps);
+#endif
+  }
+}
+
+void su::unifrac_multi(biom_interface &table,
+                       BPTree &tree,
+                       const std::vector<Method> &unifrac_methods,
+                       std::vector<std::vector<float*>> &dm_stripes,
+                       std::vector<std::vector<float*>> &dm_stripes_total,
+                       const std::vector<task_parameters> &task_ps) {
+  check_acc();
+  if (proc_use_acc==ACC_CPU) {
+    unifrac_multi_cpu<float>(table, tree, unifrac_methods, dm_stripes, dm_stripes_total, task_ps);
+#if defined(UNIFRAC_ENABLE_ACC_NV)
+  } else if (proc_use_acc==ACC_NV) {
+    su_acc_nv::unifrac_multi(table, tree, unifrac_methods, dm_stripes, dm_stripes_total, task_ps);
+#endif
+#if defined(UNIFRAC_ENABLE_ACC_AMD)
+  } else if (proc_use_acc==ACC_AMD) {
+    su_acc_amd::unifrac_multi(table, tree, unifrac_methods, dm_stripes, dm_stripes_total, task_ps);
+#endif
+  }
+}
+
 void su::unifrac_vaw(biom_interface &table,
                      BPTree &tree,
                      Method unifrac_method,
@@ -517,6 +760,59 @@ void su::unifrac_vaw(biom_interface &table,
   }
 }
 
+void su::unifrac_vaw(biom_interface &table,
+                     BPTree &tree,
+                     Method unifrac_method,
+                     std::vector<float*> &dm_stripes,
+                     std::vector<float*> &dm_stripes_total,
+                     const su::task_parameters* task_p) {
+  check_acc();
+  if (proc_use_acc==ACC_CPU) {
+   su_cpu::unifrac_vaw(table, tree, unifrac_method, dm_stripes, dm_stripes_total, task_p);
+#if defined(UNIFRAC_ENABLE_ACC_NV)
+  } else if (proc_use_acc==ACC_NV) {
+   su_acc_nv::unifrac_vaw(table, tree, unifrac_method, dm_stripes, dm_stripes_total, task_p);
+#endif
+#if defined(UNIFRAC_ENABLE_ACC_AMD)
+  } else if (proc_use_acc==ACC_AMD) {
+   su_acc_amd::unifrac_vaw(table, tree, unifrac_method, dm_stripes, dm_stripes_total, task_p);
+#endif
+  }
+}
+
+
+template<class TFloat>
+static inline void process_stripes_task(biom_interface &table,
+                                        BPTree &tree_sheared,
+                                        Method method,
+                                        bool variance_adjust,
+                                        std::vector<TFloat*> &dm_stripes,
+                                        std::vector<TFloat*> &dm_stripes_total,
+                                        const su::task_parameters* task_p) {
+    // dm_stripes_total is only allocated by the methods that need it
+    for(unsigned int i = task_p->start; i < task_p->stop; i++)
+        dm_stripes_total[i] = NULL;
+
+    if(variance_adjust)
+        su::unifrac_vaw(
+                                   std::ref(table),
+                                   std::ref(tree_sheared),
+                                   method,
+                                   std::ref(dm_stripes),
+                                   std::ref(dm_stripes_total),
+                                   task_p);
+    else
+        su::unifrac(
+                                   std::ref(table),
+                                   std::ref(tree_sheared),
+                                   method,
+                                   std::ref(dm_stripes),
+                                   std::ref(dm_stripes_total),
+                                   task_p);
+
+    // the totals are only needed while computing the task
+    su::release_stripes(dm_stripes_total, task_p);
+}
 
 void su::process_stripes(biom_interface &table,
                          BPTree &tree_sheared,
@@ -532,23 +828,186 @@ void su::process_stripes(biom_interface &table,
 
     // cannot use threading with openacc or openmp
     for(unsigned int tid = 0; tid < tasks.size(); tid++) {
-        if(variance_adjust)
-            su::unifrac_vaw(
-                                       std::ref(table),
-                                       std::ref(tree_sheared),
-                                       method,
-                                       std::ref(dm_stripes),
-                                       std::ref(dm_stripes_total),
-                                       &tasks[tid]);
-        else
-            su::unifrac(
-                                       std::ref(table),
-                                       std::ref(tree_sheared),
-                                       method,
-                                       std::ref(dm_stripes),
-                                       std::ref(dm_stripes_total),
-                                       &tasks[tid]);
+        if(su::is_fp32_method(method)) {
+            // compute in native precision, then convert
+            std::vector<float*> fp32_stripes(dm_stripes.size());
+            std::vector<float*> fp32_stripes_total(dm_stripes.size());
+            process_stripes_task<float>(table, tree_sheared, method, variance_adjust, fp32_stripes, fp32_stripes_total, &tasks[tid]);
+
+            // same layout, so we can just copy the whole buffer
+            su::initialize_stripes_block(dm_stripes, &tasks[tid]);
+            const uint64_t bufels = su::get_stripe_stride(tasks[tid].n_samples) * (tasks[tid].stop - tasks[tid].start);
+            double * const out = dm_stripes[tasks[tid].start];
+            const float * const in = fp32_stripes[tasks[tid].start];
+            for(uint64_t j = 0; j < bufels; j++)
+                out[j] = in[j];
+
+            su::release_stripes(fp32_stripes, &tasks[tid]);
+        } else {
+            process_stripes_task<double>(table, tree_sheared, method, variance_adjust, dm_stripes, dm_stripes_total, &tasks[tid]);
+        }
+    }
+
+    remove_report_status();
+}
+
+void su::process_stripes(biom_interface &table,
+                         BPTree &tree_sheared,
+                         Method method,
+                         bool variance_adjust,
+                         std::vector<float*> &dm_stripes,
+                         std::vector<float*> &dm_stripes_total,
+                         std::vector<su::task_parameters> &tasks) {
+    if(!su::is_fp32_method(method)) {
+        fprintf(stderr, "Only fp32 methods can use fp32 stripes\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // register a signal handler so we can ask the master thread for its
+    // progress
+    register_report_status();
+
+    // cannot use threading with openacc or openmp
+    for(unsigned int tid = 0; tid < tasks.size(); tid++) {
+        process_stripes_task<float>(table, tree_sheared, method, variance_adjust, dm_stripes, dm_stripes_total, &tasks[tid]);
     }
 
     remove_report_status();
 }
+
+// The tile engine is used by default, but can be explicitly disabled
+static inline bool tiles_enabled() {
+ if (const char* env_p = std::getenv("UNIFRAC_USE_TILES")) {
+   std::string env_s(env_p);
+   if ((env_s=="NO") || (env_s=="N") || (env_s=="no") || (env_s=="n") ||
+       (env_s=="NEVER") || (env_s=="never")) {
+     return false;
+   }
+ }
+ return true;
+}
+
+uint32_t su::get_tile_size(Method method) {
+    return su_cpu::get_tile_size(method);
+}
+
+// The fp32 normalized weighted stripes are already fast enough that the tiles do not pay off
+static inline bool tiles_preferred(Method method) {
+ return method!=su::weighted_normalized_fp32;
+}
+
+template<class TFloat>
+static inline bool process_tiles_T(biom_interface &table,
+                                   BPTree &tree_sheared,
+                                   Method method,
+                                   bool variance_adjust,
+                                   DMTilesT<TFloat> &dm_tiles,
+                                   const su::task_parameters* task_p) {
+    if(su::is_fp32_method(method) != std::is_same<TFloat,float>::value) {
+        fprintf(stderr, "The method must match the precision of the tiles; [%s]:%d\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+
+    // the tile engine only exists for the standard methods, on the CPU
+    if (variance_adjust || (!tiles_enabled()) || (!tiles_preferred(method))) return false;
+    check_acc();
+    if (proc_use_acc!=ACC_CPU) return false;
+
+    const PostorderPlan plan(tree_sheared);
+    std::vector<uint32_t> obs_index;
+    postorder_obs_index(tree_sheared, plan, table, obs_index);
+    // very shallow samples are better served by the sparse-pair engine, which uses stripes
+    if (sparse_pairs_preferred(table, plan, obs_index, method)) return false;
+
+    // register a signal handler so we can ask the master thread for its
+    // progress
+    register_report_status();
+
+    su_cpu::unifrac_tiles(table, plan, obs_index, method, dm_tiles, task_p);
+
+    remove_report_status();
+    return true;
+}
+
+bool su::process_tiles(biom_interface &table,
+                       BPTree &tree_sheared,
+                       Method method,
+                       bool variance_adjust,
+                       DMTilesT<double> &dm_tiles,
+                       const su::task_parameters* task_p) {
+    return process_tiles_T<double>(table, tree_sheared, method, variance_adjust, dm_tiles, task_p);
+}
+
+bool su::process_tiles(biom_interface &table,
+                       BPTree &tree_sheared,
+                       Method method,
+                       bool variance_adjust,
+                       DMTilesT<float> &dm_tiles,
+                       const su::task_parameters* task_p) {
+    return process_tiles_T<float>(table, tree_sheared, method, variance_adjust, dm_tiles, task_p);
+}
+
+template<class TFloat>
+static inline void process_stripes_multi_T(biom_interface &table,
+                                           BPTree &tree_sheared,
+                                           const std::vector<Method> &unifrac_methods,
+                                           const std::vector<double> &alphas,
+                                           std::vector<std::vector<TFloat*>> &dm_stripes,
+                                           std::vector<std::vector<TFloat*>> &dm_stripes_total,
+                                           std::vector<su::task_parameters> &tasks) {
+    const unsigned int n_methods = unifrac_methods.size();
+    if((alphas.size() != n_methods) || (dm_stripes.size() != n_methods) || (dm_stripes_total.size() != n_methods)) {
+        fprintf(stderr, "Inconsistent number of methods; [%s]:%d\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+    for(unsigned int i = 0; i < n_methods; i++) {
+        if(su::is_fp32_method(unifrac_methods[i]) != std::is_same<TFloat,float>::value) {
+            fprintf(stderr, "All methods must match the precision of the stripes; [%s]:%d\n", __FILE__, __LINE__);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // register a signal handler so we can ask the master thread for its
+    // progress
+    register_report_status();
+
+    // cannot use threading with openacc or openmp
+    for(unsigned int tid = 0; tid < tasks.size(); tid++) {
+        // same task, but each method has its own alpha
+        std::vector<su::task_parameters> method_tasks(n_methods, tasks[tid]);
+        for(unsigned int i = 0; i < n_methods; i++) {
+            method_tasks[i].g_unifrac_alpha = alphas[i];
+            // dm_stripes_total is only allocated by the methods that need it
+            for(unsigned int j = tasks[tid].start; j < tasks[tid].stop; j++)
+                dm_stripes_total[i][j] = NULL;
+        }
+
+        su::unifrac_multi(table, tree_sheared, unifrac_methods, dm_stripes, dm_stripes_total, method_tasks);
+
+        // the totals are only needed while computing the task
+        for(unsigned int i = 0; i < n_methods; i++)
+            su::release_stripes(dm_stripes_total[i], &tasks[tid]);
+    }
+
+    remove_report_status();
+}
+
+void su::process_stripes_multi(biom_interface &table,
+                               BPTree &tree_sheared,
+                               const std::vector<Method> &unifrac_methods,
+                               const std::vector<double> &alphas,
+                               std::vector<std::vector<double*>> &dm_stripes,
+                               std::vector<std::vector<double*>> &dm_stripes_total,
+                               std::vector<su::task_parameters> &tasks) {
+    process_stripes_multi_T<double>(table, tree_sheared, unifrac_methods, alphas, dm_stripes, dm_stripes_total, tasks);
+}
+
+void su::process_stripes_multi(biom_interface &table,
+                               BPTree &tree_sheared,
+                               const std::vector<Method> &unifrac_methods,
+                               const std::vector<double> &alphas,
+                               std::vector<std::vector<float*>> &dm_stripes,
+                               std::vector<std::vector<float*>> &dm_stripes_total,
+                               std::vector<su::task_parameters> &tasks) {
+    process_stripes_multi_T<float>(table, tree_sheared, unifrac_methods, alphas, dm_stripes, dm_stripes_total, tasks);
+}
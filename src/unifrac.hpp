@@ -24,6 +24,7 @@
         void faith_pd(biom_interface &table, BPTree &tree, double* result);
 
         std::string test_table_ids_are_subset_of_tree(const biom_interface &table, const BPTree &tree);
+        // Note: The fp32 methods require float stripes, the others double stripes
         void unifrac(biom_interface &table, 
                      BPTree &tree, 
                      Method unifrac_method,
@@ -31,44 +32,128 @@
                      std::vector<double*> &dm_stripes_total,
                      const task_parameters* task_p);
         
+        void unifrac(biom_interface &table, 
+                     BPTree &tree, 
+                     Method unifrac_method,
+                     std::vector<float*> &dm_stripes,
+                     std::vector<float*> &dm_stripes_total,
+                     const task_parameters* task_p);
+        
         void unifrac_vaw(biom_interface &table, 
                          BPTree &tree, 
                          Method unifrac_method,
                          std::vector<double*> &dm_stripes,
                          std::vector<double*> &dm_stripes_total,
                          const task_parameters* task_p);
+
+        void unifrac_vaw(biom_interface &table, 
+                         BPTree &tree, 
+                         Method unifrac_method,
+                         std::vector<float*> &dm_stripes,
+                         std::vector<float*> &dm_stripes_total,
+                         const task_parameters* task_p);
+
+        // Compute several methods with a single traversal of the tree
+        // There is one set of stripes and one task_parameters per method
+        // Note: All methods must match the precision of the stripes
+        void unifrac_multi(biom_interface &table,
+                           BPTree &tree,
+                           const std::vector<Method> &unifrac_methods,
+                           std::vector<std::vector<double*>> &dm_stripes,
+                           std::vector<std::vector<double*>> &dm_stripes_total,
+                           const std::vector<task_parameters> &task_ps);
+
+        void unifrac_multi(biom_interface &table,
+                           BPTree &tree,
+                           const std::vector<Method> &unifrac_methods,
+                           std::vector<std::vector<float*>> &dm_stripes,
+                           std::vector<std::vector<float*>> &dm_stripes_total,
+                           const std::vector<task_parameters> &task_ps);
+
+        // Returns true iff the method computes in fp32 (and stores float stripes)
+        inline bool is_fp32_method(Method unifrac_method) {
+            return (unifrac_method==unweighted_fp32) || (unifrac_method==weighted_normalized_fp32) ||
+                   (unifrac_method==weighted_unnormalized_fp32) || (unifrac_method==generalized_fp32) ||
+                   (unifrac_method==unweighted_unnormalized_fp32);
+        }
         
         double** deconvolute_stripes(std::vector<double*> &stripes, uint32_t n);
 
-        class ManagedStripes {
+        template<class TStripe>
+        class ManagedStripesT {
         public:
-           virtual ~ManagedStripes() {}
-           virtual const double *get_stripe(uint32_t stripe) const = 0;
+           virtual ~ManagedStripesT() {}
+           virtual const TStripe *get_stripe(uint32_t stripe) const = 0;
            virtual void release_stripe(uint32_t stripe) const = 0;
         };
 
-        class MemoryStripes : public ManagedStripes {
+        template<class TStripe>
+        class MemoryStripesT : public ManagedStripesT<TStripe> {
         private:
-           const double  * const * stripes;  // just a pointer, not owned
+           const TStripe  * const * stripes;  // just a pointer, not owned
         public:
-           MemoryStripes(const double  * const * _stripes) : stripes(_stripes) {}
-           MemoryStripes(std::vector<double*> &_stripes) : stripes(_stripes.data()) {}
-           MemoryStripes(const std::vector<double*> &_stripes) : stripes(_stripes.data()) {}
-           MemoryStripes(const std::vector<const double*> &_stripes) : stripes(_stripes.data()) {}
-           MemoryStripes(std::vector<const double*> &_stripes) : stripes(_stripes.data()) {}
+           MemoryStripesT(const TStripe  * const * _stripes) : stripes(_stripes) {}
+           MemoryStripesT(std::vector<TStripe*> &_stripes) : stripes(_stripes.data()) {}
+           MemoryStripesT(const std::vector<TStripe*> &_stripes) : stripes(_stripes.data()) {}
+           MemoryStripesT(const std::vector<const TStripe*> &_stripes) : stripes(_stripes.data()) {}
+           MemoryStripesT(std::vector<const TStripe*> &_stripes) : stripes(_stripes.data()) {}
 
-           virtual const double *get_stripe(uint32_t stripe) const {return stripes[stripe];}
+           virtual const TStripe *get_stripe(uint32_t stripe) const {return stripes[stripe];}
            virtual void release_stripe(uint32_t stripe) const {};
         };
 
+        typedef ManagedStripesT<double> ManagedStripes;
+        typedef MemoryStripesT<double> MemoryStripes;
 
         void stripes_to_condensed_form(std::vector<double*> &stripes, uint32_t n, double* cf, unsigned int start, unsigned int stop);
+        void stripes_to_condensed_form(std::vector<float*> &stripes, uint32_t n, double* cf, unsigned int start, unsigned int stop);
 
         // tile_size==0 means memory optimized
-        template<class TReal> void stripes_to_matrix_T(const ManagedStripes &stripes, const uint32_t n_samples, const uint32_t n_stripes, TReal*  __restrict__ buf2d, uint32_t tile_size=0);
+        template<class TReal, class TStripe=double> void stripes_to_matrix_T(const ManagedStripesT<TStripe> &stripes, const uint32_t n_samples, const uint32_t n_stripes, TReal*  __restrict__ buf2d, uint32_t tile_size=0);
         void stripes_to_matrix(const ManagedStripes &stripes, const uint32_t n_samples, const uint32_t n_stripes, double*  __restrict__ buf2d, uint32_t tile_size=0);
         void stripes_to_matrix_fp32(const ManagedStripes &stripes, const uint32_t n_samples, const uint32_t n_stripes, float*  __restrict__ buf2d, uint32_t tile_size=0);
 
+        // The upper triangle of a distance matrix, split in square tiles
+        //
+        // The tiles are tile_size x tile_size, and only the ones with bi<=bj
+        // (bi being the tile row, and bj the tile column) are stored,
+        // one row of tiles after the other, in a single, zeroed, buffer.
+        // Element (k,l) of tile (bi,bj) is stored at
+        //   tile(bi,bj)[(k-bi*tile_size)*tile_size + (l-bj*tile_size)]
+        // In the tiles on the diagonal, only the k<l elements are meaningful.
+        // The tile size should come from get_tile_size, so a tile's working set stays in cache.
+        template<class TFloat>
+        class DMTilesT {
+        public:
+           const uint32_t n_samples;
+           const uint32_t tile_size;
+           const uint64_t n_blocks;  // tiles per row, in the full matrix
+           const uint64_t tile_els;
+           const uint64_t bufels;
+           TFloat * const buf;
+
+           DMTilesT(const uint32_t _n_samples, const uint32_t _tile_size);
+           ~DMTilesT();
+
+           DMTilesT(const DMTilesT<TFloat>& ) = delete;
+           DMTilesT<TFloat>& operator= (const DMTilesT<TFloat>&) = delete;
+
+           const TFloat *get_tile(const uint64_t bi, const uint64_t bj) const {return buf + (bi*(2*n_blocks-bi+1)/2 + (bj-bi))*tile_els;}
+
+           // Note: Only valid for k<l
+           TFloat get_val(const uint64_t k, const uint64_t l) const {
+             return get_tile(k/tile_size, l/tile_size)[(k%tile_size)*tile_size + (l%tile_size)];
+           }
+
+           // Largest tile size (a multiple of 8) whose working set fits in cache_bytes,
+           // i.e. the 2*tile_size sample rows of row_bytes each that a tile reads,
+           // plus its n_bufs output tiles
+           static uint32_t fit_tile_size(const uint64_t row_bytes, const uint32_t n_bufs, const uint64_t cache_bytes);
+        };
+
+        // write the tiles in a 2D matrix, adding the lower triangle and the zero diagonal
+        template<class TReal, class TFloat> void tiles_to_matrix_T(const DMTilesT<TFloat> &tiles, TReal*  __restrict__ buf2d);
+
 
         template<class TReal> void condensed_form_to_matrix_T(const double*  __restrict__ cf, const uint32_t n, TReal*  __restrict__ buf2d);
         void condensed_form_to_matrix(const double*  __restrict__ cf, const uint32_t n, double*  __restrict__ buf2d);
@@ -98,7 +183,21 @@
             return val;
         }
 
+        // number of elements between two consecutive stripes of the same task
+        // round up to 64 elements (2kbit/4kbits), to simplify vectorized compute
+        inline uint64_t get_stripe_stride(uint32_t n_samples) {
+            return ((uint64_t(n_samples) + 64-1)/64)*64;
+        }
+
+        // release the stripes of a task, as allocated by process_stripes
+        // dm_stripes_total is released by process_stripes itself
+        template<class TFloat>
+        void release_stripes(std::vector<TFloat*> &dm_stripes, const su::task_parameters* task_p);
+
         // process the stripes described by tasks
+        // Note: the stripes of each task are contiguous, and must be released with release_stripes
+        // Note: fp32 methods computed into double stripes need a conversion copy,
+        //       use float stripes to avoid it
         void process_stripes(biom_interface &table, 
                              BPTree &tree_sheared, 
                              Method method,
@@ -106,6 +205,59 @@
                              std::vector<double*> &dm_stripes, 
                              std::vector<double*> &dm_stripes_total,
                              std::vector<su::task_parameters> &tasks);
+
+        // Note: Only fp32 methods supported
+        void process_stripes(biom_interface &table, 
+                             BPTree &tree_sheared, 
+                             Method method,
+                             bool variance_adjust,
+                             std::vector<float*> &dm_stripes, 
+                             std::vector<float*> &dm_stripes_total,
+                             std::vector<su::task_parameters> &tasks);
+
+        // the tile size to use with process_tiles, derived from the size of the per-sample
+        // embedded rows of the method
+        uint32_t get_tile_size(Method method);
+
+        // compute the whole distance matrix as square tiles (see DMTilesT), a single pass over the tree
+        // Returns false, without computing anything, if the tile engine cannot be used
+        // (e.g. on GPUs, with variance adjustment, for methods where the stripes are faster,
+        //  or if the UNIFRAC_USE_TILES env variable is set to NO),
+        // in which case the caller should fall back to process_stripes
+        // Note: The precision of the tiles must match the precision of the method
+        bool process_tiles(biom_interface &table,
+                           BPTree &tree_sheared,
+                           Method method,
+                           bool variance_adjust,
+                           DMTilesT<double> &dm_tiles,
+                           const su::task_parameters* task_p);
+
+        bool process_tiles(biom_interface &table,
+                           BPTree &tree_sheared,
+                           Method method,
+                           bool variance_adjust,
+                           DMTilesT<float> &dm_tiles,
+                           const su::task_parameters* task_p);
+
+        // process the stripes described by tasks, for all the methods at once
+        // dm_stripes[i] receives the stripes of unifrac_methods[i], computed with alphas[i]
+        // Note: Only fp64 methods supported
+        void process_stripes_multi(biom_interface &table,
+                                   BPTree &tree_sheared,
+                                   const std::vector<Method> &unifrac_methods,
+                                   const std::vector<double> &alphas,
+                                   std::vector<std::vector<double*>> &dm_stripes,
+                                   std::vector<std::vector<double*>> &dm_stripes_total,
+                                   std::vector<su::task_parameters> &tasks);
+
+        // Note: Only fp32 methods supported
+        void process_stripes_multi(biom_interface &table,
+                                   BPTree &tree_sheared,
+                                   const std::vector<Method> &unifrac_methods,
+                                   const std::vector<double> &alphas,
+                                   std::vector<std::vector<float*>> &dm_stripes,
+                                   std::vector<std::vector<float*>> &dm_stripes_total,
+                                   std::vector<su::task_parameters> &tasks);
     }
 #define __UNIFRAC 1
 #endif
@@ -13,6 +13,7 @@
 #include <cstdlib>
 #include <thread>
 #include <algorithm>
+#include <omp.h>
 
 #include "unifrac_cmp.hpp"
 #include "unifrac_internal.hpp"
@@ -26,12 +27,327 @@ bool SUCMP_NM::found_gpu() {
   return acc_found_gpu();
 }
 
+// Compute the proportions of the next nodes, starting at k,
+// and embed them in the fill buffers of taskObj, starting at first_emb, until max_emb.
+// On return, k points to the first node not yet processed.
+// Returns the number of filled embs.
+//
+// If order is not NULL, k indexes order, which holds the postorder positions to visit.
+// If injected is not NULL, the nodes with a non-NULL injected vector were already
+// computed and embedded elsewhere, their proportions are just copied in the prop stacks.
+template<class TaskT, class TFloat>
+static inline unsigned int embed_batch(const su::biom_interface &table,
+                                       const su::PostorderPlan &plan,
+                                       const std::vector<uint32_t> &obs_index,
+                                       TaskT &taskObj,
+                                       su::PropStackMulti<TFloat> &propstack_multi,
+                                       const su::task_parameters* task_p,
+                                       const uint32_t * const order,
+                                       const TFloat * const * const injected,
+                                       const unsigned int first_emb,
+                                       const unsigned int max_emb,
+                                       const unsigned int max_k,
+                                       unsigned int &k) {
+    const bool normalize_sample_counts = task_p->normalize_sample_counts;
+    const unsigned int num_prop_chunks = propstack_multi.get_num_stacks();
+    TFloat * const lengths = taskObj.get_fill_lengths();
+
+    const unsigned int k_start = k;
+    unsigned int filled_emb = first_emb;
+
+    // chunk the progress to maximize cache reuse
+#pragma omp parallel for 
+    for (unsigned int ck=0; ck<num_prop_chunks; ck++) {
+      su::PropStack<TFloat> &propstack = propstack_multi.get_prop_stack(ck);
+      const unsigned int tstart = propstack_multi.get_start(ck);
+      const unsigned int tend = propstack_multi.get_end(ck);
+      unsigned int my_filled_emb = first_emb;
+      unsigned int my_k=k_start;
+
+      while ((my_filled_emb<max_emb) && (my_k<max_k)) {
+        const uint32_t node = (order==NULL) ? my_k : order[my_k]; // the prop stacks are indexed by postorder position
+        my_k++;
+
+        TFloat *node_proportions = propstack.pop(node);
+        if ((injected!=NULL) && (injected[node]!=NULL)) {
+          const TFloat * const in = injected[node];
+          for (unsigned int i=tstart; i<tend; i++) node_proportions[i-tstart] = in[i];
+          continue;
+        }
+        su::set_proportions_range(node_proportions, plan, node, obs_index[node], table, tstart, tend, propstack, normalize_sample_counts);
+
+        // zero-length branches do not contribute, no need to waste an embedding slot
+        if((plan.lengths[node] == 0.0) || (task_p->bypass_tips && plan.isleaf(node)))
+            continue;
+
+        if (ck==0) { // they all do the same thing, so enough for the first to update the global state
+          lengths[filled_emb] = plan.lengths[node];
+          filled_emb++;
+        }
+        taskObj.embed_proportions_range(node_proportions, tstart, tend, my_filled_emb);
+        my_filled_emb++;
+      }
+      if (ck==0) { // they all do the same thing, so enough for the first to update the global state
+        k=my_k;
+      }
+    }
+
+    return filled_emb;
+}
+
+// Embed the next batch of nodes, starting at k, in the fill buffers of taskObj.
+// The task may merge redundant embs, in which case more nodes are embedded
+// until the batch is full.
+// Returns the number of filled embs.
+// See embed_batch for the meaning of order and injected.
+template<class TaskT, class TFloat>
+static inline unsigned int fill_batch(const su::biom_interface &table,
+                                      const su::PostorderPlan &plan,
+                                      const std::vector<uint32_t> &obs_index,
+                                      TaskT &taskObj,
+                                      su::PropStackMulti<TFloat> &propstack_multi,
+                                      const su::task_parameters* task_p,
+                                      const uint32_t * const order,
+                                      const TFloat * const * const injected,
+                                      const unsigned int max_emb,
+                                      const unsigned int max_k,
+                                      unsigned int &k) {
+    unsigned int filled_emb = 0;
+    do {
+      const unsigned int first_emb = filled_emb;
+      filled_emb = embed_batch<TaskT,TFloat>(table, plan, obs_index, taskObj, propstack_multi, task_p, order, injected, first_emb, max_emb, max_k, k);
+      filled_emb = taskObj.dedup_embedded_proportions(first_emb, filled_emb);
+    } while ((filled_emb<max_emb) && (k<max_k));
+
+    return filled_emb;
+}
+
+// Only split the tree if each thread gets at least this many nodes
+static unsigned int subtree_min_nodes_per_thread = 16384;
+
+void SUCMP_NM::set_subtree_min_nodes_per_thread(unsigned int min_nodes) {
+  subtree_min_nodes_per_thread = min_nodes;
+}
+
+unsigned int SUCMP_NM::get_subtree_min_nodes_per_thread() {
+  return subtree_min_nodes_per_thread;
+}
+
+// More ranges than threads, so that the dynamic schedule can balance the load
+static constexpr unsigned int SUBTREE_RANGES_PER_THREAD = 4;
+
+// Split the tree in ranges of whole subtrees (see PostorderPlan::split_subtrees)
+// and compute them in parallel, one range per thread, each thread into its own stripes.
+// All the contributions are additive, so the stripes are then summed into dm_stripes and dm_stripes_total,
+// in thread order, so the result does not depend on the timing of the threads.
+// On return, order holds the postorder positions still to be processed,
+// and injected the proportions of the range roots needed by them (backed by injected_buf),
+// ready to be passed to fill_batch.
+template<class TaskT, class TFloat>
+static inline void unifrac_subtrees(const su::biom_interface &table,
+                                    const su::PostorderPlan &plan,
+                                    const std::vector<uint32_t> &obs_index,
+                                    const bool want_total,
+                                    std::vector<TFloat*> &dm_stripes,
+                                    std::vector<TFloat*> &dm_stripes_total,
+                                    const su::task_parameters* task_p,
+                                    const unsigned int n_threads,
+                                    std::vector<uint32_t> &order,
+                                    std::vector<TFloat> &injected_buf,
+                                    std::vector<TFloat*> &injected) {
+    const unsigned int max_emb =  TaskT::RECOMMENDED_MAX_EMBS;
+    const uint32_t n_samples = table.n_samples;
+    const uint32_t max_size = (plan.n_nodes - 1) / (n_threads * SUBTREE_RANGES_PER_THREAD) + 1;
+
+    std::vector<uint32_t> range_starts;
+    std::vector<uint32_t> range_ends;
+    std::vector<uint32_t> residual;
+    plan.split_subtrees(max_size, max_size / 16, range_starts, range_ends, residual);
+    const unsigned int n_ranges = range_starts.size();
+
+    // the roots of the ranges are the children of the residual nodes
+    std::vector<uint32_t> roots;
+    for (unsigned int r=0; r<n_ranges; r++) {
+      for (uint32_t node=range_starts[r]; node<range_ends[r]; node++) {
+        if (plan.parents[node]>=range_ends[r]) roots.push_back(node);
+      }
+    }
+    injected_buf.resize(uint64_t(roots.size()) * n_samples);
+    injected.assign(plan.n_nodes, NULL);
+    for (uint64_t i=0; i<roots.size(); i++) injected[roots[i]] = injected_buf.data() + i*n_samples;
+
+    // both are sorted, and the roots must be visited to be available to their parents
+    order.resize(residual.size() + roots.size());
+    std::merge(residual.begin(), residual.end(), roots.begin(), roots.end(), order.begin());
+
+    // one set of stripes per thread, reduced after the parallel region
+    std::vector<std::vector<TFloat*>> thread_stripes(n_threads);
+    std::vector<std::vector<TFloat*>> thread_stripes_total(n_threads);
+
+#pragma omp parallel num_threads(n_threads)
+    {
+      omp_set_num_threads(1); // the parallelism is across the ranges
+
+      std::vector<TFloat*> &my_stripes = thread_stripes[omp_get_thread_num()];
+      std::vector<TFloat*> &my_stripes_total = thread_stripes_total[omp_get_thread_num()];
+      my_stripes.assign(dm_stripes.size(), NULL);
+      my_stripes_total.assign(dm_stripes_total.size(), NULL);
+      su::initialize_stripes<TFloat>(my_stripes, my_stripes_total, want_total, task_p);
+
+      {
+        TaskT taskObj(my_stripes, my_stripes_total, max_emb, task_p);
+        su::PropStackMulti<TFloat> propstack_multi(n_samples, plan);
+
+        // a fixed assignment of the ranges to the threads keeps the sums reproducible
+#pragma omp for schedule(static,1)
+        for (unsigned int r=0; r<n_ranges; r++) {
+          const unsigned int range_end = range_ends[r];
+          unsigned int k = range_starts[r];
+          while (k<range_end) {
+            const unsigned int filled_emb = fill_batch<TaskT,TFloat>(table, plan, obs_index, taskObj, propstack_multi, task_p, NULL, NULL, max_emb, range_end, k);
+
+            taskObj.sync_embedded_proportions(filled_emb);
+            taskObj.sync_lengths(filled_emb);
+            taskObj._run(filled_emb);
+          }
+
+          // the roots are still in the prop stacks, move them out
+          for (uint32_t node=range_starts[r]; node<range_end; node++) {
+            if (plan.parents[node]<range_end) continue;
+            TFloat * const out = injected[node];
+            for (unsigned int ck=0; ck<propstack_multi.get_num_stacks(); ck++) {
+              su::PropStack<TFloat> &propstack = propstack_multi.get_prop_stack(ck);
+              const unsigned int tstart = propstack_multi.get_start(ck);
+              const unsigned int tend = propstack_multi.get_end(ck);
+              const TFloat * const in = propstack.get(node);
+              for (unsigned int i=tstart; i<tend; i++) out[i] = in[i-tstart];
+              propstack.push(node);
+            }
+          }
+        }
+
+        taskObj.wait_completion();
+      }
+    }
+
+    // threads that were not started have no stripes
+    std::vector<const TFloat*> ins;
+    std::vector<const TFloat*> ins_total;
+    for (unsigned int t=0; t<n_threads; t++) {
+      if (thread_stripes[t].empty()) continue;
+      ins.push_back(thread_stripes[t][task_p->start]);
+      if (want_total) ins_total.push_back(thread_stripes_total[t][task_p->start]);
+    }
+    const unsigned int n_ins = ins.size();
+
+    const uint64_t bufels = su::get_stripe_stride(n_samples) * (task_p->stop - task_p->start);
+    TFloat * const out = dm_stripes[task_p->start];
+    TFloat * const out_total = want_total ? dm_stripes_total[task_p->start] : NULL;
+#pragma omp parallel for num_threads(n_threads) schedule(static)
+    for (uint64_t j=0; j<bufels; j++) {
+      TFloat sum = out[j];
+      for (unsigned int t=0; t<n_ins; t++) sum += ins[t][j];
+      out[j] = sum;
+      if (want_total) {
+        TFloat sum_total = out_total[j];
+        for (unsigned int t=0; t<n_ins; t++) sum_total += ins_total[t][j];
+        out_total[j] = sum_total;
+      }
+    }
+
+    for (unsigned int t=0; t<n_threads; t++) {
+      if (thread_stripes[t].empty()) continue;
+      su::release_stripes(thread_stripes[t], task_p);
+      if (want_total) su::release_stripes(thread_stripes_total[t], task_p);
+    }
+}
+
+// Embed the nodes [0,max_k), or order[0,max_k) if order is not NULL, in batches,
+// and run the kernel of taskObj on each batch.
+// See embed_batch for the meaning of order and injected.
+template<class TaskT, class TFloat>
+static inline void traverseTT(const su::biom_interface &table,
+                              const su::PostorderPlan &plan,
+                              const std::vector<uint32_t> &obs_index,
+                              TaskT &taskObj,
+                              su::PropStackMulti<TFloat> &propstack_multi,
+                              const su::task_parameters* task_p,
+                              const uint32_t * const order,
+                              const TFloat * const * const injected,
+                              const unsigned int max_emb,
+                              const unsigned int max_k) {
+    unsigned int k = 0; // index in tree
+    const unsigned int max_threads = omp_get_max_threads();
+    if ((max_threads<2) || omp_in_parallel() || (!taskObj.enable_pipeline())) {
+      // embed and compute in lockstep
+      while (k<max_k) {
+          const unsigned int filled_emb = fill_batch<TaskT,TFloat>(table, plan, obs_index, taskObj, propstack_multi, task_p, order, injected, max_emb, max_k, k);
+
+          taskObj.sync_embedded_proportions(filled_emb);
+          taskObj.sync_lengths(filled_emb);
+          taskObj._run(filled_emb);
+
+          su::try_report(task_p, k, max_k);
+      }
+    } else {
+      // double-buffered, one team embeds the next batch while the other runs the kernel on the current one
+      const int old_levels = omp_get_max_active_levels();
+      if (old_levels<2) omp_set_max_active_levels(2);
+
+      // start with an even split, then move threads toward whichever side is the bottleneck
+      unsigned int n_embed = max_threads/2;
+
+      unsigned int filled_emb = fill_batch<TaskT,TFloat>(table, plan, obs_index, taskObj, propstack_multi, task_p, order, injected, max_emb, max_k, k);
+      taskObj.swap_pipeline_buffers();
+
+      while (filled_emb>0) {
+          unsigned int next_filled_emb = 0;
+          double t_embed = 0.0;
+          double t_run = 0.0;
+
+          taskObj.sync_lengths(filled_emb);
+
+#pragma omp parallel sections num_threads(2)
+          {
+#pragma omp section
+            {
+              const double t0 = omp_get_wtime();
+              omp_set_num_threads(n_embed);
+              if (k<max_k) next_filled_emb = fill_batch<TaskT,TFloat>(table, plan, obs_index, taskObj, propstack_multi, task_p, order, injected, max_emb, max_k, k);
+              t_embed = omp_get_wtime() - t0;
+            }
+#pragma omp section
+            {
+              const double t0 = omp_get_wtime();
+              omp_set_num_threads(max_threads-n_embed);
+              taskObj._run(filled_emb);
+              t_run = omp_get_wtime() - t0;
+            }
+          }
+
+          taskObj.swap_pipeline_buffers();
+          filled_emb = next_filled_emb;
+
+          if ((t_embed > 1.1*t_run) && ((n_embed+1)<max_threads)) {
+            n_embed++;
+          } else if ((t_run > 1.1*t_embed) && (n_embed>1)) {
+            n_embed--;
+          }
+
+          su::try_report(task_p, k, max_k);
+      }
+
+      if (old_levels<2) omp_set_max_active_levels(old_levels);
+    }
+}
+
 template<class TaskT, class TFloat>
 inline void unifracTT(const su::biom_interface &table,
-                      const su::BPTree &tree,
+                      const su::PostorderPlan &plan,
+                      const std::vector<uint32_t> &obs_index,
                       const bool want_total,
-                      std::vector<double*> &dm_stripes,
-                      std::vector<double*> &dm_stripes_total,
+                      std::vector<TFloat*> &dm_stripes,
+                      std::vector<TFloat*> &dm_stripes_total,
                       const su::task_parameters* task_p) {
     // no processor affinity whenusing openacc or openmp
 
@@ -40,17 +356,12 @@ inline void unifracTT(const su::biom_interface &table,
         exit(EXIT_FAILURE);
     }
 
-    const bool normalize_sample_counts = task_p->normalize_sample_counts;
-    su::PropStackMulti<TFloat> propstack_multi(table.n_samples);
-
     const unsigned int max_emb =  TaskT::RECOMMENDED_MAX_EMBS;
 
-    su::initialize_stripes(std::ref(dm_stripes), std::ref(dm_stripes_total), want_total, task_p);
+    su::initialize_stripes<TFloat>(std::ref(dm_stripes), std::ref(dm_stripes_total), want_total, task_p);
 
     TaskT taskObj(std::ref(dm_stripes), std::ref(dm_stripes_total),max_emb,task_p);
 
-    TFloat * const lengths = taskObj.lengths;
-
         /*
          * The values in the example vectors correspond to index positions of an
          * element in the resulting distance matrix. So, in the example below,
@@ -96,52 +407,29 @@ inline void unifracTT(const su::biom_interface &table,
          * (see C) but that is small over large N.
          */
 
-    unsigned int k = 0; // index in tree
-    const unsigned int max_k = (tree.nparens>1) ? ((tree.nparens / 2) - 1) : 0;
+    unsigned int max_k = (plan.n_nodes>1) ? (plan.n_nodes - 1) : 0;
 
-    const unsigned int num_prop_chunks = propstack_multi.get_num_stacks();
-    while (k<max_k) {
-          const unsigned int k_start = k;
-          unsigned int filled_emb = 0;
+    // the plan knows how many vectors can be live at once, so preallocate them
+    su::PropStackMulti<TFloat> propstack_multi(table.n_samples, plan);
 
-          // chunk the progress to maximize cache reuse
-#pragma omp parallel for 
-          for (unsigned int ck=0; ck<num_prop_chunks; ck++) {
-            su::PropStack<TFloat> &propstack = propstack_multi.get_prop_stack(ck);
-            const unsigned int tstart = propstack_multi.get_start(ck);
-            const unsigned int tend = propstack_multi.get_end(ck);
-            unsigned int my_filled_emb = 0;
-            unsigned int my_k=k_start;
-
-            while ((my_filled_emb<max_emb) && (my_k<max_k)) {
-              const uint32_t node = tree.postorderselect(my_k);
-              my_k++;
+    const unsigned int max_threads = omp_get_max_threads();
 
-              TFloat *node_proportions = propstack.pop(node);
-              su::set_proportions_range(node_proportions, tree, node, table, tstart, tend, propstack, normalize_sample_counts);
-
-              if(task_p->bypass_tips && tree.isleaf(node))
-                  continue;
-
-              if (ck==0) { // they all do the same thing, so enough for the first to update the global state
-                lengths[filled_emb] = tree.lengths[node];
-                filled_emb++;
-              }
-              taskObj.embed_proportions_range(node_proportions, tstart, tend, my_filled_emb);
-              my_filled_emb++;
-            }
-            if (ck==0) { // they all do the same thing, so enough for the first to update the global state
-              k=my_k;
-            }
-          }
-
-          taskObj.sync_embedded_proportions(filled_emb);
-          taskObj.sync_lengths(filled_emb);
-          taskObj._run(filled_emb);
-          filled_emb=0;
-
-          su::try_report(task_p, k, max_k);
+    // with few samples there is a single prop stack, so the embedding cannot use more than one thread;
+    // if the tree is big enough, give each thread its own subtrees, and leave only the top of the tree
+    // Only on the CPU, accelerators do not benefit from host threads
+    std::vector<uint32_t> order;
+    std::vector<TFloat> injected_buf;
+    std::vector<TFloat*> injected;
+    if ((max_threads>1) && (!omp_in_parallel()) && (!acc_need_alt()) && (propstack_multi.get_num_stacks()==1) &&
+        (max_k >= (subtree_min_nodes_per_thread*max_threads))) {
+      unifrac_subtrees<TaskT,TFloat>(table, plan, obs_index, want_total, dm_stripes, dm_stripes_total, task_p, max_threads,
+                                     order, injected_buf, injected);
+      max_k = order.size();
     }
+    const uint32_t * const order_p = order.empty() ? NULL : order.data();
+    const TFloat * const * const injected_p = injected.empty() ? NULL : injected.data();
+
+    traverseTT<TaskT,TFloat>(table, plan, obs_index, taskObj, propstack_multi, task_p, order_p, injected_p, max_emb, max_k);
 
     taskObj.wait_completion();
 
@@ -151,42 +439,298 @@ inline void unifracTT(const su::biom_interface &table,
 
 }
 
+void SUCMP_NM::unifrac(const su::biom_interface &table,
+                       const su::PostorderPlan &plan,
+                       const std::vector<uint32_t> &obs_index,
+                       su::Method unifrac_method,
+                       std::vector<double*> &dm_stripes,
+                       std::vector<double*> &dm_stripes_total,
+                        const su::task_parameters* task_p) {
+    switch(unifrac_method) {
+        case su::unweighted:
+            unifracTT<SUCMP_NM::UnifracUnweightedTask<double>,double>(           table, plan, obs_index, true,  dm_stripes,dm_stripes_total,task_p);
+            break;
+        case su::unweighted_unnormalized:
+            unifracTT<SUCMP_NM::UnifracUnnormalizedUnweightedTask<double>,double>(table, plan, obs_index, false, dm_stripes,dm_stripes_total,task_p);
+            break;
+        case su::weighted_normalized:
+            unifracTT<SUCMP_NM::UnifracNormalizedWeightedTask<double>,double>(   table, plan, obs_index, true,  dm_stripes,dm_stripes_total,task_p);
+            break;
+        case su::weighted_unnormalized:
+            unifracTT<SUCMP_NM::UnifracUnnormalizedWeightedTask<double>,double>( table, plan, obs_index, false, dm_stripes,dm_stripes_total,task_p);
+            break;
+        case su::generalized:
+            unifracTT<SUCMP_NM::UnifracGeneralizedTask<double>,double>(          table, plan, obs_index, true,  dm_stripes,dm_stripes_total,task_p);
+            break;
+        default:
+            fprintf(stderr, "Unknown unifrac task\n");
+            exit(1);
+            break;
+    }
+}
+
 void SUCMP_NM::unifrac(const su::biom_interface &table,
                        const su::BPTree &tree,
                        su::Method unifrac_method,
                        std::vector<double*> &dm_stripes,
                        std::vector<double*> &dm_stripes_total,
+                       const su::task_parameters* task_p) {
+    // flatten the tree and resolve the leaf IDs once, so the traversal only uses indexes
+    const su::PostorderPlan plan(tree);
+    std::vector<uint32_t> obs_index;
+    su::postorder_obs_index(tree, plan, table, obs_index);
+
+    SUCMP_NM::unifrac(table, plan, obs_index, unifrac_method, dm_stripes, dm_stripes_total, task_p);
+}
+
+void SUCMP_NM::unifrac(const su::biom_interface &table,
+                       const su::PostorderPlan &plan,
+                       const std::vector<uint32_t> &obs_index,
+                       su::Method unifrac_method,
+                       std::vector<float*> &dm_stripes,
+                       std::vector<float*> &dm_stripes_total,
                         const su::task_parameters* task_p) {
+    switch(unifrac_method) {
+        case su::unweighted_fp32:
+            unifracTT<SUCMP_NM::UnifracUnweightedTask<float >,float>(            table, plan, obs_index, true,  dm_stripes,dm_stripes_total,task_p);
+            break;
+        case su::unweighted_unnormalized_fp32:
+            unifracTT<SUCMP_NM::UnifracUnnormalizedUnweightedTask<float >,float>(table, plan, obs_index, false, dm_stripes,dm_stripes_total,task_p);
+            break;
+        case su::weighted_normalized_fp32:
+            unifracTT<SUCMP_NM::UnifracNormalizedWeightedTask<float >,float>(    table, plan, obs_index, true,  dm_stripes,dm_stripes_total,task_p);
+            break;
+        case su::weighted_unnormalized_fp32:
+            unifracTT<SUCMP_NM::UnifracUnnormalizedWeightedTask<float >,float>(  table, plan, obs_index, false, dm_stripes,dm_stripes_total,task_p);
+            break;
+        case su::generalized_fp32:
+            unifracTT<SUCMP_NM::UnifracGeneralizedTask<float >,float>(           table, plan, obs_index, true,  dm_stripes,dm_stripes_total,task_p);
+            break;
+        default:
+            fprintf(stderr, "Unknown unifrac task\n");
+            exit(1);
+            break;
+    }
+}
+
+void SUCMP_NM::unifrac(const su::biom_interface &table,
+                       const su::BPTree &tree,
+                       su::Method unifrac_method,
+                       std::vector<float*> &dm_stripes,
+                       std::vector<float*> &dm_stripes_total,
+                       const su::task_parameters* task_p) {
+    // flatten the tree and resolve the leaf IDs once, so the traversal only uses indexes
+    const su::PostorderPlan plan(tree);
+    std::vector<uint32_t> obs_index;
+    su::postorder_obs_index(tree, plan, table, obs_index);
+
+    SUCMP_NM::unifrac(table, plan, obs_index, unifrac_method, dm_stripes, dm_stripes_total, task_p);
+}
+
+
+#if SUCMP_ID(SUCMP_NM)==su_cpu_SUCMP_ID
+// Compute the whole distance matrix as square tiles, see su::DMTilesT
+// Unlike the stripes, each pair is computed exactly once
+template<class TaskT, class TFloat>
+inline void unifrac_tilesTT(const su::biom_interface &table,
+                            const su::PostorderPlan &plan,
+                            const std::vector<uint32_t> &obs_index,
+                            const bool want_total,
+                            su::DMTilesT<TFloat> &dm_tiles,
+                            const su::task_parameters* task_p) {
+    if((table.n_samples != task_p->n_samples) || (dm_tiles.n_samples != task_p->n_samples)) {
+        fprintf(stderr, "Task, table and tiles n_samples not equal\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const unsigned int max_emb =  TaskT::RECOMMENDED_MAX_EMBS;
+
+    // the totals are only needed while computing
+    su::DMTilesT<TFloat> *dm_tiles_total = want_total ? new su::DMTilesT<TFloat>(dm_tiles.n_samples, dm_tiles.tile_size) : NULL;
+
+    {
+      // the task still needs the (unused) stripes, for sizing
+      std::vector<TFloat*> no_stripes(task_p->stop, NULL);
+      std::vector<TFloat*> no_stripes_total(task_p->stop, NULL);
+      TaskT taskObj(no_stripes, no_stripes_total, dm_tiles, dm_tiles_total, max_emb, task_p);
+
+      const unsigned int max_k = (plan.n_nodes>1) ? (plan.n_nodes - 1) : 0;
+
+      // the plan knows how many vectors can be live at once, so preallocate them
+      su::PropStackMulti<TFloat> propstack_multi(table.n_samples, plan);
+
+      traverseTT<TaskT,TFloat>(table, plan, obs_index, taskObj, propstack_multi, task_p, NULL, NULL, max_emb, max_k);
+
+      taskObj.wait_completion();
+
+      if(want_total) {
+          taskObj.compute_totals();
+      }
+    }
+
+    if (dm_tiles_total!=NULL) delete dm_tiles_total;
+}
+
+// Each tile reads the embedded rows of its 2*tile_size samples once per batch of embeddings,
+// so size the tiles to keep those rows, and the tile outputs, in 1/4 of a 1M L2 cache
+template<class TaskT, class TFloat, class TEmb>
+static inline uint32_t tile_sizeTT(const bool want_total) {
+    constexpr uint64_t cache_bytes = 256*1024;
+    // one sample row of embedded proportions, for a full batch
+    const uint64_t row_bytes = uint64_t(SUCMP_NM::UnifracTaskBase<TFloat,TEmb>::get_emb_els(TaskT::RECOMMENDED_MAX_EMBS))*sizeof(TEmb);
+    return su::DMTilesT<TFloat>::fit_tile_size(row_bytes, want_total ? 2 : 1, cache_bytes);
+}
+
+uint32_t SUCMP_NM::get_tile_size(su::Method unifrac_method) {
+    switch(unifrac_method) {
+        case su::unweighted:
+            return tile_sizeTT<SUCMP_NM::UnifracUnweightedTileTask<double>,double,uint64_t>(true);
+        case su::unweighted_unnormalized:
+            return tile_sizeTT<SUCMP_NM::UnifracUnnormalizedUnweightedTileTask<double>,double,uint64_t>(false);
+        case su::weighted_normalized:
+            return tile_sizeTT<SUCMP_NM::UnifracNormalizedWeightedTileTask<double>,double,double>(true);
+        case su::weighted_unnormalized:
+            return tile_sizeTT<SUCMP_NM::UnifracUnnormalizedWeightedTileTask<double>,double,double>(false);
+        case su::generalized:
+            return tile_sizeTT<SUCMP_NM::UnifracGeneralizedTileTask<double>,double,double>(true);
+        case su::unweighted_fp32:
+            return tile_sizeTT<SUCMP_NM::UnifracUnweightedTileTask<float >,float,uint64_t>(true);
+        case su::unweighted_unnormalized_fp32:
+            return tile_sizeTT<SUCMP_NM::UnifracUnnormalizedUnweightedTileTask<float >,float,uint64_t>(false);
+        case su::weighted_normalized_fp32:
+            return tile_sizeTT<SUCMP_NM::UnifracNormalizedWeightedTileTask<float >,float,float>(true);
+        case su::weighted_unnormalized_fp32:
+            return tile_sizeTT<SUCMP_NM::UnifracUnnormalizedWeightedTileTask<float >,float,float>(false);
+        case su::generalized_fp32:
+            return tile_sizeTT<SUCMP_NM::UnifracGeneralizedTileTask<float >,float,float>(true);
+        default:
+            fprintf(stderr, "Unknown unifrac task\n");
+            exit(1);
+            break;
+    }
+}
+
+void SUCMP_NM::unifrac_tiles(const su::biom_interface &table,
+                             const su::PostorderPlan &plan,
+                             const std::vector<uint32_t> &obs_index,
+                             su::Method unifrac_method,
+                             su::DMTilesT<double> &dm_tiles,
+                             const su::task_parameters* task_p) {
+    switch(unifrac_method) {
+        case su::unweighted:
+            unifrac_tilesTT<SUCMP_NM::UnifracUnweightedTileTask<double>,double>(           table, plan, obs_index, true,  dm_tiles, task_p);
+            break;
+        case su::unweighted_unnormalized:
+            unifrac_tilesTT<SUCMP_NM::UnifracUnnormalizedUnweightedTileTask<double>,double>(table, plan, obs_index, false, dm_tiles, task_p);
+            break;
+        case su::weighted_normalized:
+            unifrac_tilesTT<SUCMP_NM::UnifracNormalizedWeightedTileTask<double>,double>(   table, plan, obs_index, true,  dm_tiles, task_p);
+            break;
+        case su::weighted_unnormalized:
+            unifrac_tilesTT<SUCMP_NM::UnifracUnnormalizedWeightedTileTask<double>,double>( table, plan, obs_index, false, dm_tiles, task_p);
+            break;
+        case su::generalized:
+            unifrac_tilesTT<SUCMP_NM::UnifracGeneralizedTileTask<double>,double>(          table, plan, obs_index, true,  dm_tiles, task_p);
+            break;
+        default:
+            fprintf(stderr, "Unknown unifrac task\n");
+            exit(1);
+            break;
+    }
+}
+
+void SUCMP_NM::unifrac_tiles(const su::biom_interface &table,
+                             const su::PostorderPlan &plan,
+                             const std::vector<uint32_t> &obs_index,
+                             su::Method unifrac_method,
+                             su::DMTilesT<float> &dm_tiles,
+                             const su::task_parameters* task_p) {
+    switch(unifrac_method) {
+        case su::unweighted_fp32:
+            unifrac_tilesTT<SUCMP_NM::UnifracUnweightedTileTask<float >,float>(            table, plan, obs_index, true,  dm_tiles, task_p);
+            break;
+        case su::unweighted_unnormalized_fp32:
+            unifrac_tilesTT<SUCMP_NM::UnifracUnnormalizedUnweightedTileTask<float >,float>(table, plan, obs_index, false, dm_tiles, task_p);
+            break;
+        case su::weighted_normalized_fp32:
+            unifrac_tilesTT<SUCMP_NM::UnifracNormalizedWeightedTileTask<float >,float>(    table, plan, obs_index, true,  dm_tiles, task_p);
+            break;
+        case su::weighted_unnormalized_fp32:
+            unifrac_tilesTT<SUCMP_NM::UnifracUnnormalizedWeightedTileTask<float >,float>(  table, plan, obs_index, false, dm_tiles, task_p);
+            break;
+        case su::generalized_fp32:
+            unifrac_tilesTT<SUCMP_NM::UnifracGeneralizedTileTask<float >,float>(           table, plan, obs_index, true,  dm_tiles, task_p);
+            break;
+        default:
+            fprintf(stderr, "Unknown unifrac task\n");
+            exit(1);
+            break;
+    }
+}
+#endif
+
+template<class TaskT, class TFloat>
+static inline void add_multi_task(const bool want_total,
+                                  std::vector<TFloat*> &dm_stripes,
+                                  std::vector<TFloat*> &dm_stripes_total,
+                                  const su::task_parameters* task_p,
+                                  std::vector<SUCMP_NM::UnifracTaskItf<TFloat>*> &tasks,
+                                  std::vector<bool> &want_totals) {
+    su::initialize_stripes<TFloat>(std::ref(dm_stripes), std::ref(dm_stripes_total), want_total, task_p);
+    tasks.push_back(new SUCMP_NM::UnifracTaskWrapper<TaskT,TFloat>(dm_stripes, dm_stripes_total, TaskT::RECOMMENDED_MAX_EMBS, task_p));
+    want_totals.push_back(want_total);
+}
+
+static inline void create_multi_task(su::Method unifrac_method,
+                                     std::vector<double*> &dm_stripes,
+                                     std::vector<double*> &dm_stripes_total,
+                                     const su::task_parameters* task_p,
+                                     std::vector<SUCMP_NM::UnifracTaskItf<double>*> &tasks,
+                                     std::vector<bool> &want_totals) {
     switch(unifrac_method) {
         case su::unweighted:
-            unifracTT<SUCMP_NM::UnifracUnweightedTask<double>,double>(           table, tree, true,  dm_stripes,dm_stripes_total,task_p);
+            add_multi_task<SUCMP_NM::UnifracUnweightedTask<double>,double>(            true,  dm_stripes,dm_stripes_total,task_p,tasks,want_totals);
             break;
         case su::unweighted_unnormalized:
-            unifracTT<SUCMP_NM::UnifracUnnormalizedUnweightedTask<double>,double>(table,tree, false, dm_stripes,dm_stripes_total,task_p);
+            add_multi_task<SUCMP_NM::UnifracUnnormalizedUnweightedTask<double>,double>(false, dm_stripes,dm_stripes_total,task_p,tasks,want_totals);
             break;
         case su::weighted_normalized:
-            unifracTT<SUCMP_NM::UnifracNormalizedWeightedTask<double>,double>(   table, tree, true,  dm_stripes,dm_stripes_total,task_p);
+            add_multi_task<SUCMP_NM::UnifracNormalizedWeightedTask<double>,double>(    true,  dm_stripes,dm_stripes_total,task_p,tasks,want_totals);
             break;
         case su::weighted_unnormalized:
-            unifracTT<SUCMP_NM::UnifracUnnormalizedWeightedTask<double>,double>( table, tree, false, dm_stripes,dm_stripes_total,task_p);
+            add_multi_task<SUCMP_NM::UnifracUnnormalizedWeightedTask<double>,double>(  false, dm_stripes,dm_stripes_total,task_p,tasks,want_totals);
             break;
         case su::generalized:
-            unifracTT<SUCMP_NM::UnifracGeneralizedTask<double>,double>(          table, tree, true,  dm_stripes,dm_stripes_total,task_p);
+            add_multi_task<SUCMP_NM::UnifracGeneralizedTask<double>,double>(           true,  dm_stripes,dm_stripes_total,task_p,tasks,want_totals);
             break;
+        default:
+            fprintf(stderr, "Unknown unifrac task\n");
+            exit(1);
+            break;
+    }
+}
+
+static inline void create_multi_task(su::Method unifrac_method,
+                                     std::vector<float*> &dm_stripes,
+                                     std::vector<float*> &dm_stripes_total,
+                                     const su::task_parameters* task_p,
+                                     std::vector<SUCMP_NM::UnifracTaskItf<float>*> &tasks,
+                                     std::vector<bool> &want_totals) {
+    switch(unifrac_method) {
         case su::unweighted_fp32:
-            unifracTT<SUCMP_NM::UnifracUnweightedTask<float >,float>(            table, tree, true,  dm_stripes,dm_stripes_total,task_p);
+            add_multi_task<SUCMP_NM::UnifracUnweightedTask<float >,float>(            true,  dm_stripes,dm_stripes_total,task_p,tasks,want_totals);
             break;
         case su::unweighted_unnormalized_fp32:
-            unifracTT<SUCMP_NM::UnifracUnnormalizedUnweightedTask<float >,float>(table, tree, false, dm_stripes,dm_stripes_total,task_p);
+            add_multi_task<SUCMP_NM::UnifracUnnormalizedUnweightedTask<float >,float>(false, dm_stripes,dm_stripes_total,task_p,tasks,want_totals);
             break;
         case su::weighted_normalized_fp32:
-            unifracTT<SUCMP_NM::UnifracNormalizedWeightedTask<float >,float>(    table, tree, true,  dm_stripes,dm_stripes_total,task_p);
+            add_multi_task<SUCMP_NM::UnifracNormalizedWeightedTask<float >,float>(    true,  dm_stripes,dm_stripes_total,task_p,tasks,want_totals);
             break;
         case su::weighted_unnormalized_fp32:
-            unifracTT<SUCMP_NM::UnifracUnnormalizedWeightedTask<float >,float>(  table, tree, false, dm_stripes,dm_stripes_total,task_p);
+            add_multi_task<SUCMP_NM::UnifracUnnormalizedWeightedTask<float >,float>(  false, dm_stripes,dm_stripes_total,task_p,tasks,want_totals);
             break;
         case su::generalized_fp32:
-            unifracTT<SUCMP_NM::UnifracGeneralizedTask<float >,float>(           table, tree, true,  dm_stripes,dm_stripes_total,task_p);
+            add_multi_task<SUCMP_NM::UnifracGeneralizedTask<float >,float>(           true,  dm_stripes,dm_stripes_total,task_p,tasks,want_totals);
             break;
         default:
             fprintf(stderr, "Unknown unifrac task\n");
@@ -195,13 +739,132 @@ void SUCMP_NM::unifrac(const su::biom_interface &table,
     }
 }
 
+// Compute several methods with a single traversal of the tree
+// Each method gets its own task, with its own task parameters (e.g. alpha),
+// but the proportions of each node are computed only once.
+template<class TFloat>
+inline void unifrac_multiTT(const su::biom_interface &table,
+                            const su::PostorderPlan &plan,
+                            const std::vector<uint32_t> &obs_index,
+                            const std::vector<su::Method> &unifrac_methods,
+                            std::vector<std::vector<TFloat*>> &dm_stripes,
+                            std::vector<std::vector<TFloat*>> &dm_stripes_total,
+                            const std::vector<su::task_parameters> &task_ps) {
+    const unsigned int n_methods = unifrac_methods.size();
+    if ((n_methods==0) || (dm_stripes.size()!=n_methods) || (dm_stripes_total.size()!=n_methods) || (task_ps.size()!=n_methods)) {
+        fprintf(stderr, "Inconsistent number of methods; [%s]:%d\n", __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+    // the traversal only uses the parameters shared by all tasks
+    const su::task_parameters* task_p = &(task_ps[0]);
+
+    if(table.n_samples != task_p->n_samples) {
+        fprintf(stderr, "Task and table n_samples not equal\n");
+        exit(EXIT_FAILURE);
+    }
+
+    std::vector<SUCMP_NM::UnifracTaskItf<TFloat>*> tasks;
+    std::vector<bool> want_totals;
+    // the generalized methods share a single task, so the alphas are computed in the same inner loop
+    std::vector<std::vector<TFloat*>*> generalized_stripes;
+    std::vector<std::vector<TFloat*>*> generalized_stripes_total;
+    std::vector<const su::task_parameters*> generalized_task_ps;
+    for (unsigned int i=0; i<n_methods; i++) {
+        if ((unifrac_methods[i]==su::generalized) || (unifrac_methods[i]==su::generalized_fp32)) {
+            su::initialize_stripes<TFloat>(std::ref(dm_stripes[i]), std::ref(dm_stripes_total[i]), true, &(task_ps[i]));
+            generalized_stripes.push_back(&(dm_stripes[i]));
+            generalized_stripes_total.push_back(&(dm_stripes_total[i]));
+            generalized_task_ps.push_back(&(task_ps[i]));
+        } else {
+            create_multi_task(unifrac_methods[i], dm_stripes[i], dm_stripes_total[i], &(task_ps[i]), tasks, want_totals);
+        }
+    }
+    if (!generalized_task_ps.empty()) {
+        typedef SUCMP_NM::UnifracGeneralizedMultiTask<TFloat> GTaskT;
+        tasks.push_back(new SUCMP_NM::UnifracTaskWrapper<GTaskT,TFloat>(generalized_stripes, generalized_stripes_total,
+                                                                       GTaskT::RECOMMENDED_MAX_EMBS, generalized_task_ps));
+        want_totals.push_back(true);
+    }
+
+    unsigned int max_emb = 0;
+    for (auto task : tasks) {
+        const unsigned int task_max_emb = task->get_max_embs();
+        if ((max_emb==0) || (task_max_emb<max_emb)) max_emb = task_max_emb;
+    }
+
+    {
+      SUCMP_NM::UnifracMultiTask<TFloat> taskObj(tasks, max_emb);
+
+      const unsigned int max_k = (plan.n_nodes>1) ? (plan.n_nodes - 1) : 0;
+
+      su::PropStackMulti<TFloat> propstack_multi(table.n_samples, plan);
+
+      traverseTT<SUCMP_NM::UnifracMultiTask<TFloat>,TFloat>(table, plan, obs_index, taskObj, propstack_multi, task_p, NULL, NULL, max_emb, max_k);
+
+      taskObj.wait_completion();
+    }
+
+    for (unsigned int i=0; i<tasks.size(); i++) {
+        if (want_totals[i]) tasks[i]->compute_totals();
+        delete tasks[i];
+    }
+}
+
+void SUCMP_NM::unifrac_multi(const su::biom_interface &table,
+                             const su::PostorderPlan &plan,
+                             const std::vector<uint32_t> &obs_index,
+                             const std::vector<su::Method> &unifrac_methods,
+                             std::vector<std::vector<double*>> &dm_stripes,
+                             std::vector<std::vector<double*>> &dm_stripes_total,
+                             const std::vector<su::task_parameters> &task_ps) {
+    unifrac_multiTT<double>(table, plan, obs_index, unifrac_methods, dm_stripes, dm_stripes_total, task_ps);
+}
+
+void SUCMP_NM::unifrac_multi(const su::biom_interface &table,
+                             const su::BPTree &tree,
+                             const std::vector<su::Method> &unifrac_methods,
+                             std::vector<std::vector<double*>> &dm_stripes,
+                             std::vector<std::vector<double*>> &dm_stripes_total,
+                             const std::vector<su::task_parameters> &task_ps) {
+    // flatten the tree and resolve the leaf IDs once, so the traversal only uses indexes
+    const su::PostorderPlan plan(tree);
+    std::vector<uint32_t> obs_index;
+    su::postorder_obs_index(tree, plan, table, obs_index);
+
+    unifrac_multiTT<double>(table, plan, obs_index, unifrac_methods, dm_stripes, dm_stripes_total, task_ps);
+}
+
+void SUCMP_NM::unifrac_multi(const su::biom_interface &table,
+                             const su::PostorderPlan &plan,
+                             const std::vector<uint32_t> &obs_index,
+                             const std::vector<su::Method> &unifrac_methods,
+                             std::vector<std::vector<float*>> &dm_stripes,
+                             std::vector<std::vector<float*>> &dm_stripes_total,
+                             const std::vector<su::task_parameters> &task_ps) {
+    unifrac_multiTT<float>(table, plan, obs_index, unifrac_methods, dm_stripes, dm_stripes_total, task_ps);
+}
+
+void SUCMP_NM::unifrac_multi(const su::biom_interface &table,
+                             const su::BPTree &tree,
+                             const std::vector<su::Method> &unifrac_methods,
+                             std::vector<std::vector<float*>> &dm_stripes,
+                             std::vector<std::vector<float*>> &dm_stripes_total,
+                             const std::vector<su::task_parameters> &task_ps) {
+    // flatten the tree and resolve the leaf IDs once, so the traversal only uses indexes
+    const su::PostorderPlan plan(tree);
+    std::vector<uint32_t> obs_index;
+    su::postorder_obs_index(tree, plan, table, obs_index);
+
+    unifrac_multiTT<float>(table, plan, obs_index, unifrac_methods, dm_stripes, dm_stripes_total, task_ps);
+}
+
 
 template<class TaskT, class TFloat>
 inline void unifrac_vawTT(const su::biom_interface &table,
                           const su::BPTree &tree,
                           const bool want_total,
-                          std::vector<double*> &dm_stripes,
-                          std::vector<double*> &dm_stripes_total,
+                          std::vector<TFloat*> &dm_stripes,
+                          std::vector<TFloat*> &dm_stripes_total,
                           const su::task_parameters* task_p) {
     // no processor affinity whenusing openacc or openmp
 
@@ -211,12 +874,10 @@ inline void unifrac_vawTT(const su::biom_interface &table,
     }
 
     const bool normalize_sample_counts = task_p->normalize_sample_counts;
-    su::PropStackMulti<TFloat> propstack_multi(table.n_samples);
-    su::PropStackMulti<TFloat> countstack_multi(table.n_samples);
 
     const unsigned int max_emb = TaskT::RECOMMENDED_MAX_EMBS;
 
-    su::initialize_stripes(std::ref(dm_stripes), std::ref(dm_stripes_total), want_total, task_p);
+    su::initialize_stripes<TFloat>(std::ref(dm_stripes), std::ref(dm_stripes_total), want_total, task_p);
 
     TaskT taskObj(std::ref(dm_stripes), std::ref(dm_stripes_total), table.get_sample_counts(), max_emb, task_p);
 
@@ -225,6 +886,15 @@ inline void unifrac_vawTT(const su::biom_interface &table,
     unsigned int k = 0; // index in tree
     const unsigned int max_k = (tree.nparens>1) ? ((tree.nparens / 2) - 1) : 0;
 
+    // flatten the tree and resolve the leaf IDs once, so the traversal only uses indexes
+    const su::PostorderPlan plan(tree);
+    std::vector<uint32_t> obs_index;
+    su::postorder_obs_index(tree, plan, table, obs_index);
+
+    // the plan knows how many vectors can be live at once, so preallocate them
+    su::PropStackMulti<TFloat> propstack_multi(table.n_samples, plan);
+    su::PropStackMulti<TFloat> countstack_multi(table.n_samples, plan);
+
     const unsigned int num_prop_chunks = propstack_multi.get_num_stacks();
     while (k<max_k) {
           const unsigned int k_start = k;
@@ -241,20 +911,21 @@ inline void unifrac_vawTT(const su::biom_interface &table,
             unsigned int my_k=k_start;
 
             while ((my_filled_emb<max_emb) && (my_k<max_k)) {
-              const uint32_t node = tree.postorderselect(my_k);
+              const uint32_t node = my_k; // the prop stacks are indexed by postorder position
               my_k++;
 
               TFloat *node_proportions = propstack.pop(node);
               TFloat *node_counts = countstack.pop(node);
 
-              su::set_proportions_range(node_proportions, tree, node, table, tstart, tend, propstack, normalize_sample_counts);
-              su::set_proportions_range(node_counts, tree, node, table, tstart, tend, countstack, false);
+              su::set_proportions_range(node_proportions, plan, node, obs_index[node], table, tstart, tend, propstack, normalize_sample_counts);
+              su::set_proportions_range(node_counts, plan, node, obs_index[node], table, tstart, tend, countstack, false);
 
-              if(task_p->bypass_tips && tree.isleaf(node))
+              // zero-length branches do not contribute, no need to waste an embedding slot
+              if((plan.lengths[node] == 0.0) || (task_p->bypass_tips && plan.isleaf(node)))
                   continue;
 
               if (ck==0) { // they all do the same thing, so enough for the first to update the global state
-                lengths[filled_emb] = tree.lengths[node];
+                lengths[filled_emb] = plan.lengths[node];
                 filled_emb++;
               }
               taskObj.embed_range(node_proportions, node_counts, tstart, tend, my_filled_emb);
@@ -304,6 +975,20 @@ void SUCMP_NM::unifrac_vaw(const su::biom_interface &table,
         case su::generalized:
             unifrac_vawTT<SUCMP_NM::UnifracVawGeneralizedTask<double>,double>(          table, tree, true,  dm_stripes,dm_stripes_total,task_p);
             break;
+        default:
+            fprintf(stderr, "Unknown unifrac task\n");
+            exit(1);
+            break;
+    }
+}
+
+void SUCMP_NM::unifrac_vaw(const su::biom_interface &table,
+                           const su::BPTree &tree,
+                           su::Method unifrac_method,
+                           std::vector<float*> &dm_stripes,
+                           std::vector<float*> &dm_stripes_total,
+                           const su::task_parameters* task_p) {
+    switch(unifrac_method) {
         case su::unweighted_fp32:
             unifrac_vawTT<SUCMP_NM::UnifracVawUnweightedTask<float >,float >(           table, tree, true,  dm_stripes,dm_stripes_total,task_p);
             break;
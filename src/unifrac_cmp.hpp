@@ -25,13 +25,95 @@ namespace SUCMP_NM {
   // Returns True iff a GPU can be used
   bool found_gpu();
 
+  // The tree is split in subtrees computed in parallel only if
+  // each thread gets at least min_nodes nodes, default is 16384
+  void set_subtree_min_nodes_per_thread(unsigned int min_nodes);
+  unsigned int get_subtree_min_nodes_per_thread();
+
+  void unifrac(const su::biom_interface &table,
+               const su::BPTree &tree,
+               su::Method unifrac_method,
+               std::vector<double*> &dm_stripes,
+               std::vector<double*> &dm_stripes_total,
+               const su::task_parameters* task_p);
+
   void unifrac(const su::biom_interface &table,
                const su::BPTree &tree,
                su::Method unifrac_method,
+               std::vector<float*> &dm_stripes,
+               std::vector<float*> &dm_stripes_total,
+               const su::task_parameters* task_p);
+
+  // as above, but reusing the postorder plan of the tree and its obs index (see su::postorder_obs_index)
+  void unifrac(const su::biom_interface &table,
+               const su::PostorderPlan &plan,
+               const std::vector<uint32_t> &obs_index,
+               su::Method unifrac_method,
                std::vector<double*> &dm_stripes,
                std::vector<double*> &dm_stripes_total,
                const su::task_parameters* task_p);
 
+  void unifrac(const su::biom_interface &table,
+               const su::PostorderPlan &plan,
+               const std::vector<uint32_t> &obs_index,
+               su::Method unifrac_method,
+               std::vector<float*> &dm_stripes,
+               std::vector<float*> &dm_stripes_total,
+               const su::task_parameters* task_p);
+
+  // The tile size unifrac_tiles works best with, for the given method
+  // Only available in the CPU variant
+  uint32_t get_tile_size(su::Method unifrac_method);
+
+  // Compute the whole distance matrix as square tiles (see su::DMTilesT)
+  // Only available in the CPU variant
+  void unifrac_tiles(const su::biom_interface &table,
+                     const su::PostorderPlan &plan,
+                     const std::vector<uint32_t> &obs_index,
+                     su::Method unifrac_method,
+                     su::DMTilesT<double> &dm_tiles,
+                     const su::task_parameters* task_p);
+
+  void unifrac_tiles(const su::biom_interface &table,
+                     const su::PostorderPlan &plan,
+                     const std::vector<uint32_t> &obs_index,
+                     su::Method unifrac_method,
+                     su::DMTilesT<float> &dm_tiles,
+                     const su::task_parameters* task_p);
+
+  // Compute several methods with a single traversal of the tree
+  // There is one set of stripes and one task_parameters per method
+  void unifrac_multi(const su::biom_interface &table,
+                     const su::BPTree &tree,
+                     const std::vector<su::Method> &unifrac_methods,
+                     std::vector<std::vector<double*>> &dm_stripes,
+                     std::vector<std::vector<double*>> &dm_stripes_total,
+                     const std::vector<su::task_parameters> &task_ps);
+
+  void unifrac_multi(const su::biom_interface &table,
+                     const su::BPTree &tree,
+                     const std::vector<su::Method> &unifrac_methods,
+                     std::vector<std::vector<float*>> &dm_stripes,
+                     std::vector<std::vector<float*>> &dm_stripes_total,
+                     const std::vector<su::task_parameters> &task_ps);
+
+  // as above, but reusing the postorder plan of the tree and its obs index
+  void unifrac_multi(const su::biom_interface &table,
+                     const su::PostorderPlan &plan,
+                     const std::vector<uint32_t> &obs_index,
+                     const std::vector<su::Method> &unifrac_methods,
+                     std::vector<std::vector<double*>> &dm_stripes,
+                     std::vector<std::vector<double*>> &dm_stripes_total,
+                     const std::vector<su::task_parameters> &task_ps);
+
+  void unifrac_multi(const su::biom_interface &table,
+                     const su::PostorderPlan &plan,
+                     const std::vector<uint32_t> &obs_index,
+                     const std::vector<su::Method> &unifrac_methods,
+                     std::vector<std::vector<float*>> &dm_stripes,
+                     std::vector<std::vector<float*>> &dm_stripes_total,
+                     const std::vector<su::task_parameters> &task_ps);
+
   void unifrac_vaw(const su::biom_interface &table,
                    const su::BPTree &tree,
                    su::Method unifrac_method,
@@ -39,5 +121,12 @@ namespace SUCMP_NM {
                    std::vector<double*> &dm_stripes_total,
                    const su::task_parameters* task_p);
 
+  void unifrac_vaw(const su::biom_interface &table,
+                   const su::BPTree &tree,
+                   su::Method unifrac_method,
+                   std::vector<float*> &dm_stripes,
+                   std::vector<float*> &dm_stripes_total,
+                   const su::task_parameters* task_p);
+
 }
 
@@ -14,6 +14,7 @@
 #include <signal.h>
 #include <stdarg.h>
 #include <algorithm>
+#include <math.h>
 #include <pthread.h>
 #include <unistd.h>
 
@@ -81,40 +82,72 @@ void su::remove_report_status() {
 
 template<class TFloat>
 PropStack<TFloat>::PropStack(uint32_t vecsize) 
-: prop_stack()
-, prop_map()
+: slots()
+, free_slots()
+, node_slots()
+, slab(NULL)
+, n_slab_slots(0)
 , defaultsize(vecsize)
 {
-    prop_map.reserve(1000);
+    slots.reserve(1000);
+    free_slots.reserve(1000);
+}
+
+template<class TFloat>
+PropStack<TFloat>::PropStack(uint32_t vecsize, const PostorderPlan &plan) 
+: slots()
+, free_slots()
+, node_slots()
+, slab(NULL)
+, n_slab_slots(0)
+, defaultsize(vecsize)
+{
+    reserve(plan);
 }
 
 template<class TFloat>
 PropStack<TFloat>::~PropStack() {
-    // drain stack
-    while (!prop_stack.empty()) {
-        TFloat *vec = prop_stack.top();
-        prop_stack.pop();
-        free(vec);
-    }
+    // anything past the slab was allocated one by one
+    for(uint32_t i = n_slab_slots; i < slots.size(); i++)
+        free(slots[i]);
+    if (slab!=NULL) free(slab);
+}
 
-    // drain the map
-    for(auto it = prop_map.begin(); it != prop_map.end(); it++) {
-        TFloat *vec = it->second;
-        free(vec);
-    }
-    prop_map.clear();
+// keep each vector aligned to a cache line
+template<class TFloat>
+static inline uint64_t propstack_stride(uint32_t vecsize) {
+    return ((sizeof(TFloat) * uint64_t(vecsize) + 63) / 64) * (64 / sizeof(TFloat));
 }
 
 template<class TFloat>
-TFloat* PropStack<TFloat>::get(uint32_t i) {
-    return prop_map[i];
+void PropStack<TFloat>::reserve(const PostorderPlan &plan) {
+    if (!slots.empty()) return; // too late, already in use
+
+    node_slots.resize(plan.n_nodes);
+
+    const uint32_t n = plan.max_live;
+    if (n==0) return;
+
+    const uint64_t stride = propstack_stride<TFloat>(defaultsize);
+    int err = posix_memalign((void **)&slab, 64, sizeof(TFloat) * stride * n);
+    if(slab == NULL || err != 0) {
+        fprintf(stderr, "Failed to allocate %zd bytes, err %d; [%s]:%d\n",
+                sizeof(TFloat) * stride * n, err, __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+    n_slab_slots = n;
+
+    slots.resize(n);
+    free_slots.resize(n);
+    for(uint32_t i = 0; i < n; i++) {
+        slots[i] = slab + stride * i;
+        free_slots[i] = n - 1 - i; // the first slot will be used first
+    }
 }
 
 template<class TFloat>
 void PropStack<TFloat>::push(uint32_t node) {
-    TFloat* vec = prop_map[node];
-    prop_map.erase(node);
-    prop_stack.push(vec);
+    free_slots.push_back(node_slots[node]);
 }
 
 template<class TFloat>
@@ -123,23 +156,26 @@ TFloat* PropStack<TFloat>::pop(uint32_t node) {
      * if we don't have any available vectors, create one
      * add it to our record of known vectors so we can track our mallocs
      */
-    TFloat *vec;
-    int err = 0;
-    if(prop_stack.empty()) {
-        err = posix_memalign((void **)&vec, 32, sizeof(TFloat) * defaultsize);
+    uint32_t slot;
+    if(free_slots.empty()) {
+        TFloat *vec;
+        int err = posix_memalign((void **)&vec, 32, sizeof(TFloat) * defaultsize);
         if(vec == NULL || err != 0) {
             fprintf(stderr, "Failed to allocate %zd bytes, err %d; [%s]:%d\n",
                     sizeof(TFloat) * defaultsize, err, __FILE__, __LINE__);
             exit(EXIT_FAILURE);
         }
+        slot = slots.size();
+        slots.push_back(vec);
     }
     else {
-        vec = prop_stack.top();
-        prop_stack.pop();
+        slot = free_slots.back();
+        free_slots.pop_back();
     }
 
-    prop_map[node] = vec;
-    return vec;
+    if (node >= node_slots.size()) node_slots.resize(node + 1);
+    node_slots[node] = slot;
+    return slots[slot];
 }
 
 // make sure they get instantiated
@@ -147,44 +183,131 @@ template class su::PropStack<float>;
 template class su::PropStack<double>;
 
 
-void su::initialize_stripes(std::vector<double*> &dm_stripes,
-                            std::vector<double*> &dm_stripes_total,
+template<class TFloat>
+void su::initialize_stripes(std::vector<TFloat*> &dm_stripes,
+                            std::vector<TFloat*> &dm_stripes_total,
                             bool want_total,
                             const su::task_parameters* task_p) {
-    int err = 0;
-    for(unsigned int i = task_p->start; i < task_p->stop; i++){
-        err = posix_memalign((void **)&dm_stripes[i], 4096, sizeof(double) * task_p->n_samples);
-        if(dm_stripes[i] == NULL || err != 0) {
-            fprintf(stderr, "Failed to allocate %zd bytes, err %d; [%s]:%d\n",
-                    sizeof(double) * task_p->n_samples, err, __FILE__, __LINE__);
-            exit(EXIT_FAILURE);
-        }
-        for(unsigned int j = 0; j < task_p->n_samples; j++)
-            dm_stripes[i][j] = 0.;
-
-        if(want_total) {
-            err = posix_memalign((void **)&dm_stripes_total[i], 4096, sizeof(double) * task_p->n_samples);
-            if(dm_stripes_total[i] == NULL || err != 0) {
-                fprintf(stderr, "Failed to allocate %zd bytes err %d; [%s]:%d\n",
-                        sizeof(double) * task_p->n_samples, err, __FILE__, __LINE__);
-                exit(EXIT_FAILURE);
-            }
-            for(unsigned int j = 0; j < task_p->n_samples; j++)
-                dm_stripes_total[i][j] = 0.;
-        }
+    initialize_stripes_block(dm_stripes, task_p);
+    if(want_total)
+        initialize_stripes_block(dm_stripes_total, task_p);
+}
+
+// All the stripes of a task live in a single, zeroed, buffer,
+// padded so that the compute kernels can use it directly.
+// The buffer is owned by the first stripe of the task.
+template<class TFloat>
+void su::initialize_stripes_block(std::vector<TFloat*> &dm_stripes,
+                                  const su::task_parameters* task_p) {
+    const uint64_t n_samples_r = su::get_stripe_stride(task_p->n_samples);
+    const uint64_t bufels = n_samples_r * (task_p->stop - task_p->start);
+
+    TFloat *buf = NULL;
+    int err = posix_memalign((void **)&buf, 4096, sizeof(TFloat) * bufels);
+    if(buf == NULL || err != 0) {
+        fprintf(stderr, "Failed to allocate %zd bytes, err %d; [%s]:%d\n",
+                sizeof(TFloat) * bufels, err, __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+    for(uint64_t j = 0; j < bufels; j++)
+        buf[j] = 0.;
+
+    for(unsigned int i = task_p->start; i < task_p->stop; i++)
+        dm_stripes[i] = buf + (i - task_p->start) * n_samples_r;
+}
+
+template<class TFloat>
+void su::release_stripes(std::vector<TFloat*> &dm_stripes,
+                         const su::task_parameters* task_p) {
+    if(task_p->start < task_p->stop) {
+        if(dm_stripes[task_p->start] != NULL)
+            free(dm_stripes[task_p->start]);
+    }
+    for(unsigned int i = task_p->start; i < task_p->stop; i++)
+        dm_stripes[i] = NULL;
+}
+
+// make sure they get instantiated
+template void su::initialize_stripes<double>(std::vector<double*> &dm_stripes, std::vector<double*> &dm_stripes_total,
+                                             bool want_total, const su::task_parameters* task_p);
+template void su::initialize_stripes<float>(std::vector<float*> &dm_stripes, std::vector<float*> &dm_stripes_total,
+                                            bool want_total, const su::task_parameters* task_p);
+template void su::initialize_stripes_block<double>(std::vector<double*> &dm_stripes, const su::task_parameters* task_p);
+template void su::initialize_stripes_block<float>(std::vector<float*> &dm_stripes, const su::task_parameters* task_p);
+template void su::release_stripes<double>(std::vector<double*> &dm_stripes, const su::task_parameters* task_p);
+template void su::release_stripes<float>(std::vector<float*> &dm_stripes, const su::task_parameters* task_p);
+
+// All the tiles live in a single, zeroed, buffer, see DMTilesT
+template<class TFloat>
+static inline TFloat *alloc_tiles_buf(const uint64_t bufels) {
+    TFloat *buf = NULL;
+    int err = posix_memalign((void **)&buf, 4096, sizeof(TFloat) * bufels);
+    if(buf == NULL || err != 0) {
+        fprintf(stderr, "Failed to allocate %zd bytes, err %d; [%s]:%d\n",
+                sizeof(TFloat) * bufels, err, __FILE__, __LINE__);
+        exit(EXIT_FAILURE);
+    }
+    for(uint64_t j = 0; j < bufels; j++)
+        buf[j] = 0.;
+    return buf;
+}
+
+template<class TFloat>
+su::DMTilesT<TFloat>::DMTilesT(const uint32_t _n_samples, const uint32_t _tile_size)
+ : n_samples(_n_samples), tile_size(_tile_size)
+ , n_blocks((uint64_t(_n_samples)+(_tile_size-1))/_tile_size) // round up
+ , tile_els(uint64_t(_tile_size)*_tile_size)
+ , bufels(tile_els * ((n_blocks*(n_blocks+1))/2))
+ , buf(alloc_tiles_buf<TFloat>(bufels))
+{}
+
+template<class TFloat>
+su::DMTilesT<TFloat>::~DMTilesT() {
+    free(buf);
+}
+
+template<class TFloat>
+uint32_t su::DMTilesT<TFloat>::fit_tile_size(const uint64_t row_bytes, const uint32_t n_bufs, const uint64_t cache_bytes) {
+    constexpr uint32_t MIN_TILE_SIZE = 8;
+    constexpr uint32_t MAX_TILE_SIZE = 256;
+
+    uint32_t tile_size = MIN_TILE_SIZE;
+    while (tile_size < MAX_TILE_SIZE) {
+      const uint64_t next_size = tile_size + 8;
+      const uint64_t working_set = 2*next_size*row_bytes + n_bufs*next_size*next_size*sizeof(TFloat);
+      if (working_set > cache_bytes) break;
+      tile_size = next_size;
+    }
+    return tile_size;
+}
+
+// make sure they get instantiated
+template class su::DMTilesT<double>;
+template class su::DMTilesT<float>;
+
+void su::postorder_obs_index(const BPTree &tree,
+                             const PostorderPlan &plan,
+                             const biom_interface &table,
+                             std::vector<uint32_t> &obs_index) {
+    obs_index.resize(plan.n_nodes);
+
+#pragma omp parallel for schedule(static)
+    for(unsigned int k = 0; k < plan.n_nodes; k++) {
+        obs_index[k] = plan.isleaf(k) ? table.get_obs_index(tree.names[plan.nodes[k]]) : 0;
     }
 }
 
 template<class TFloat>
 void su::set_proportions(TFloat* __restrict__ props,
-                         const BPTree &tree,
-                         uint32_t node,
+                         const PostorderPlan &plan,
+                         uint32_t k,
+                         uint32_t obs_idx,
                          const biom_interface &table,
                          PropStack<TFloat> &ps,
                          bool normalize) {
     const double *sample_counts = table.get_sample_counts();
-    if(tree.isleaf(node)) {
-       table.get_obs_data(tree.names[node], props);
+    if(plan.isleaf(k)) {
+       table.get_obs_data(obs_idx, props);
        if (normalize) {
 #pragma omp parallel for schedule(static)
         for(unsigned int i = 0; i < table.n_samples; i++) {
@@ -193,81 +316,80 @@ void su::set_proportions(TFloat* __restrict__ props,
        }
 
     } else {
-        unsigned int current = tree.leftchild(node);
-        unsigned int right = tree.rightchild(node);
-
 #pragma omp parallel for schedule(static)
         for(unsigned int i = 0; i < table.n_samples; i++)
             props[i] = 0;
 
-        while(current <= right && current != 0) {
-            TFloat * __restrict__ vec = ps.get(current);  // pull from prop map
-            ps.push(current);  // remove from prop map, place back on stack
+        const uint32_t c_end = plan.child_start[k+1];
+        for(uint32_t c = plan.child_start[k]; c < c_end; c++) {
+            const uint32_t child = plan.children[c];
+            TFloat * __restrict__ vec = ps.get(child);  // pull from prop map
+            ps.push(child);  // remove from prop map, place back on stack
 
 #pragma omp parallel for schedule(static)
             for(unsigned int i = 0; i < table.n_samples; i++)
                 props[i] = props[i] + vec[i];
-
-            current = tree.rightsibling(current);
         }
     }
 }
 
 // make sure they get instantiated
 template void su::set_proportions(float* __restrict__ props,
-                                  const BPTree &tree,
-                                  uint32_t node,
+                                  const PostorderPlan &plan,
+                                  uint32_t k,
+                                  uint32_t obs_idx,
                                   const biom_interface &table,
                                   PropStack<float> &ps,
                                   bool normalize);
 template void su::set_proportions(double* __restrict__ props,
-                                  const BPTree &tree,
-                                  uint32_t node,
+                                  const PostorderPlan &plan,
+                                  uint32_t k,
+                                  uint32_t obs_idx,
                                   const biom_interface &table,
                                   PropStack<double> &ps,
                                   bool normalize);
 
 template<class TFloat>
 void su::set_proportions_range(TFloat* __restrict__ props,
-                               const BPTree &tree,
-                               uint32_t node,
+                               const PostorderPlan &plan,
+                               uint32_t k,
+                               uint32_t obs_idx,
                                const biom_interface &table, 
                                unsigned int start, unsigned int end,
                                PropStack<TFloat> &ps,
                                bool normalize) {
     const unsigned int els = end-start;
-    if(tree.isleaf(node)) {
-       table.get_obs_data_range(tree.names[node], start, end, normalize, props);
+    if(plan.isleaf(k)) {
+       table.get_obs_data_range(obs_idx, start, end, normalize, props);
     } else {
-        const unsigned int right = tree.rightchild(node);
-        unsigned int current = tree.leftchild(node);
-
         for(unsigned int i = 0; i < els; i++)
             props[i] = 0;
 
-        while(current <= right && current != 0) {
-            const TFloat * __restrict__ vec = ps.get(current);  // pull from prop map
-            ps.push(current);  // remove from prop map, place back on stack
+        const uint32_t c_end = plan.child_start[k+1];
+        for(uint32_t c = plan.child_start[k]; c < c_end; c++) {
+            const uint32_t child = plan.children[c];
+            const TFloat * __restrict__ vec = ps.get(child);  // pull from prop map
+            ps.push(child);  // remove from prop map, place back on stack
 
             for(unsigned int i = 0; i < els; i++)
                 props[i] += vec[i];
-
-            current = tree.rightsibling(current);
         }
     }
 }
 
 // make sure they get instantiated
 template void su::set_proportions_range(float* __restrict__ props,
-                                        const BPTree &tree,
-                                        uint32_t node,
+                                        const PostorderPlan &plan,
+                                        uint32_t k,
+                                        uint32_t obs_idx,
                                         const biom_interface &table,
                                         unsigned int start, unsigned int end,
                                         PropStack<float> &ps,
                                         bool normalize);
 template void su::set_proportions_range(double* __restrict__ props,
-                                        const BPTree &tree,
-                                        uint32_t node,
+                                        const PostorderPlan &plan,
+                                        uint32_t k,
+                                        uint32_t obs_idx,
                                         const biom_interface &table,
                                         unsigned int start, unsigned int end,
                                         PropStack<double> &ps,
@@ -293,3 +415,334 @@ std::vector<double*> su::make_strides(unsigned int n_samples) {
     return dm_stripes;
 }
 
+
+//
+// ======================= sparse-pair engine ========================
+//
+
+// The kinds of per-pair accumulation, see sparse_pair_add
+enum {SPARSE_UNWEIGHTED, SPARSE_UNWEIGHTED_UNNORMALIZED, SPARSE_WEIGHTED_NORMALIZED, SPARSE_WEIGHTED_UNNORMALIZED,
+      SPARSE_GENERALIZED_ONE, SPARSE_GENERALIZED_HALF, SPARSE_GENERALIZED_ZERO, SPARSE_GENERALIZED_ANY};
+
+// Accumulate the contribution of a single node, with proportions u and v
+// and branch length length, to the distance and to its normalization.
+// Mirrors the dense compute kernels.
+template<class TFloat, int kind>
+static inline void sparse_pair_add(TFloat &my_stripe, TFloat &my_stripe_total,
+                                   const TFloat u, const TFloat v, const TFloat length,
+                                   const TFloat g_unifrac_alpha) {
+    if constexpr ((kind==SPARSE_UNWEIGHTED) || (kind==SPARSE_UNWEIGHTED_UNNORMALIZED)) {
+       const bool u1 = (u > 0);
+       const bool v1 = (v > 0);
+       if (u1 != v1) my_stripe += length;
+       if constexpr (kind==SPARSE_UNWEIGHTED) {
+          if (u1 || v1) my_stripe_total += length;
+       }
+    } else if constexpr ((kind==SPARSE_WEIGHTED_NORMALIZED) || (kind==SPARSE_WEIGHTED_UNNORMALIZED)) {
+       // the normalization does not depend on the pairing, see sparse_sample_sums
+       my_stripe += fabs(u - v) * length;
+    } else {
+       const TFloat sum1 = u + v;
+       // same as the dense kernels, an empty node does not contribute
+       if (sum1 == 0.0) return;
+       const TFloat diff1 = fabs(u - v);
+       if constexpr (kind==SPARSE_GENERALIZED_ONE) {
+          my_stripe += diff1 * length;
+          my_stripe_total += sum1 * length;
+       } else if constexpr (kind==SPARSE_GENERALIZED_HALF) {
+          const TFloat sum_sqrt1 = sqrt(sum1);
+          my_stripe += (diff1 / sum_sqrt1) * length;
+          my_stripe_total += sum_sqrt1 * length;
+       } else if constexpr (kind==SPARSE_GENERALIZED_ZERO) {
+          my_stripe += (diff1 / sum1) * length;
+          my_stripe_total += length;
+       } else {
+          const TFloat sum_pow1 = pow(sum1, g_unifrac_alpha) * length;
+          my_stripe += sum_pow1 * (diff1 / sum1);
+          my_stripe_total += sum_pow1;
+       }
+    }
+}
+
+// Merge the sorted node lists of samples k and l
+// Nodes present in only one of the two samples are added with 0 on the other side
+template<class TFloat, int kind>
+static inline void sparse_pair_merge(const uint32_t * __restrict__ nodes_k, const TFloat * __restrict__ vals_k,
+                                     const TFloat * __restrict__ lengths_k, const uint64_t n_k,
+                                     const uint32_t * __restrict__ nodes_l, const TFloat * __restrict__ vals_l,
+                                     const TFloat * __restrict__ lengths_l, const uint64_t n_l,
+                                     const TFloat g_unifrac_alpha,
+                                     TFloat &my_stripe, TFloat &my_stripe_total) {
+    uint64_t ik = 0;
+    uint64_t il = 0;
+    while ((ik<n_k) && (il<n_l)) {
+        const uint32_t node_k = nodes_k[ik];
+        const uint32_t node_l = nodes_l[il];
+        if (node_k==node_l) {
+            sparse_pair_add<TFloat,kind>(my_stripe, my_stripe_total, vals_k[ik], vals_l[il], lengths_k[ik], g_unifrac_alpha);
+            ik++; il++;
+        } else if (node_k<node_l) {
+            sparse_pair_add<TFloat,kind>(my_stripe, my_stripe_total, vals_k[ik], TFloat(0), lengths_k[ik], g_unifrac_alpha);
+            ik++;
+        } else {
+            sparse_pair_add<TFloat,kind>(my_stripe, my_stripe_total, TFloat(0), vals_l[il], lengths_l[il], g_unifrac_alpha);
+            il++;
+        }
+    }
+    for (; ik<n_k; ik++)
+        sparse_pair_add<TFloat,kind>(my_stripe, my_stripe_total, vals_k[ik], TFloat(0), lengths_k[ik], g_unifrac_alpha);
+    for (; il<n_l; il++)
+        sparse_pair_add<TFloat,kind>(my_stripe, my_stripe_total, TFloat(0), vals_l[il], lengths_l[il], g_unifrac_alpha);
+}
+
+// The per-sample node lists, in CSR format
+template<class TFloat>
+class SparseSampleNodes {
+  public:
+    std::vector<uint64_t> starts;  // size n_samples+1
+    std::vector<uint32_t> nodes;   // postorder position, sorted within each sample
+    std::vector<TFloat> vals;      // proportion of the sample in the node
+    std::vector<TFloat> lengths;   // branch length of the node, kept inline for locality
+
+    uint64_t count(uint32_t k) const {return starts[k+1]-starts[k];}
+};
+
+// Build the sorted list of nodes each sample is present in, with its proportions.
+// The root, zero-length branches, nodes with a zero value (e.g. explicitly stored zeros)
+// and (if bypass_tips) the tips do not contribute, so are not included.
+template<class TFloat>
+static void sparse_sample_nodes(const su::biom_interface &table,
+                                const su::PostorderPlan &plan,
+                                const std::vector<uint32_t> &obs_index,
+                                const su::task_parameters* task_p,
+                                SparseSampleNodes<TFloat> &out) {
+    const uint32_t n_samples = table.n_samples;
+    const uint32_t n_nodes = plan.n_nodes;
+    const uint32_t root = n_nodes - 1;
+    const double *sample_counts = table.get_sample_counts();
+
+    // transpose the leaf values into sample-major order
+    std::vector<uint64_t> leaf_starts(n_samples+1, 0);
+    uint32_t max_nnz = 0;
+    for (uint32_t k=0; k<n_nodes; k++) {
+        if (plan.isleaf(k)) max_nnz = std::max(max_nnz, table.get_obs_nnz(obs_index[k]));
+    }
+    std::vector<uint32_t> obs_indices(max_nnz);
+    std::vector<double> obs_vals(max_nnz);
+    for (uint32_t k=0; k<n_nodes; k++) {
+        if (!plan.isleaf(k)) continue;
+        const uint32_t cnt = table.get_obs_sparse(obs_index[k], obs_indices.data(), obs_vals.data());
+        for (uint32_t j=0; j<cnt; j++) leaf_starts[obs_indices[j]+1]++;
+    }
+    for (uint32_t s=0; s<n_samples; s++) leaf_starts[s+1] += leaf_starts[s];
+
+    std::vector<uint32_t> leaf_nodes(leaf_starts[n_samples]);
+    std::vector<TFloat> leaf_vals(leaf_starts[n_samples]);
+    {
+        std::vector<uint64_t> fill(leaf_starts.begin(), leaf_starts.end()-1);
+        for (uint32_t k=0; k<n_nodes; k++) {
+            if (!plan.isleaf(k)) continue;
+            const uint32_t cnt = table.get_obs_sparse(obs_index[k], obs_indices.data(), obs_vals.data());
+            for (uint32_t j=0; j<cnt; j++) {
+                const uint32_t s = obs_indices[j];
+                const uint64_t pos = fill[s]++;
+                leaf_nodes[pos] = k;
+                leaf_vals[pos] = obs_vals[j];
+                if (task_p->normalize_sample_counts) leaf_vals[pos] /= sample_counts[s];
+            }
+        }
+    }
+
+    // now propagate up the tree, one sample at a time
+    std::vector<std::vector<uint32_t> > sample_nodes(n_samples);
+    std::vector<std::vector<TFloat> > sample_vals(n_samples);
+#pragma omp parallel
+    {
+      std::vector<TFloat> node_vals(n_nodes, 0);
+      std::vector<bool> touched(n_nodes, false);
+      std::vector<uint32_t> my_nodes;
+
+#pragma omp for schedule(dynamic,16)
+      for (uint32_t s=0; s<n_samples; s++) {
+        my_nodes.clear();
+        for (uint64_t j=leaf_starts[s]; j<leaf_starts[s+1]; j++) {
+            node_vals[leaf_nodes[j]] = leaf_vals[j];
+            // mark the path to the root, stopping at the first node already seen
+            uint32_t node = leaf_nodes[j];
+            while ((node!=root) && !touched[node]) {
+                touched[node] = true;
+                my_nodes.push_back(node);
+                node = plan.parents[node];
+            }
+        }
+        // in postorder, children come before parents, so can sum in place
+        std::sort(my_nodes.begin(), my_nodes.end());
+        for (auto node : my_nodes) {
+            const uint32_t parent = plan.parents[node];
+            if (parent!=root) node_vals[parent] += node_vals[node];
+        }
+
+        std::vector<uint32_t> &out_nodes = sample_nodes[s];
+        std::vector<TFloat> &out_vals = sample_vals[s];
+        for (auto node : my_nodes) {
+            if ((plan.lengths[node]!=0.0) && (node_vals[node]!=0.0) && !(task_p->bypass_tips && plan.isleaf(node))) {
+                out_nodes.push_back(node);
+                out_vals.push_back(node_vals[node]);
+            }
+            node_vals[node] = 0;
+            touched[node] = false;
+        }
+      }
+    }
+
+    // and finally concatenate them
+    out.starts.resize(n_samples+1);
+    out.starts[0] = 0;
+    for (uint32_t s=0; s<n_samples; s++) out.starts[s+1] = out.starts[s] + sample_nodes[s].size();
+    out.nodes.resize(out.starts[n_samples]);
+    out.vals.resize(out.starts[n_samples]);
+    out.lengths.resize(out.starts[n_samples]);
+#pragma omp parallel for schedule(static)
+    for (uint32_t s=0; s<n_samples; s++) {
+        const uint64_t offset = out.starts[s];
+        for (uint64_t j=0; j<sample_nodes[s].size(); j++) {
+            const uint32_t node = sample_nodes[s][j];
+            out.nodes[offset+j] = node;
+            out.vals[offset+j] = sample_vals[s][j];
+            out.lengths[offset+j] = plan.lengths[node];
+        }
+    }
+}
+
+template<class TFloat, int kind>
+static void unifrac_sparse_pairs_T(const SparseSampleNodes<TFloat> &samples,
+                                   const su::task_parameters* task_p,
+                                   std::vector<TFloat*> &dm_stripes) {
+    const uint32_t n_samples = task_p->n_samples;
+    const TFloat g_unifrac_alpha = task_p->g_unifrac_alpha;
+    constexpr bool is_weighted_normalized = (kind==SPARSE_WEIGHTED_NORMALIZED);
+    constexpr bool want_total = (kind==SPARSE_UNWEIGHTED) || (kind>=SPARSE_GENERALIZED_ONE);
+
+    // the weighted normalization is just the sum of the two samples
+    std::vector<TFloat> sums;
+    if constexpr (is_weighted_normalized) {
+        sums.resize(n_samples);
+#pragma omp parallel for schedule(static)
+        for (uint32_t k=0; k<n_samples; k++) {
+            TFloat my_sum = 0;
+            for (uint64_t j=samples.starts[k]; j<samples.starts[k+1]; j++)
+                my_sum += samples.vals[j] * samples.lengths[j];
+            sums[k] = my_sum;
+        }
+    }
+
+    for (unsigned int stripe=task_p->start; stripe<task_p->stop; stripe++) {
+        TFloat * const __restrict__ dm_stripe = dm_stripes[stripe];
+
+#pragma omp parallel for schedule(dynamic,64)
+        for (uint32_t k=0; k<n_samples; k++) {
+            const uint32_t l1 = (k + stripe + 1)%n_samples; // wraparound
+            const uint64_t sk = samples.starts[k];
+            const uint64_t sl = samples.starts[l1];
+
+            TFloat my_stripe = 0;
+            TFloat my_stripe_total = 0;
+            sparse_pair_merge<TFloat,kind>(samples.nodes.data()+sk, samples.vals.data()+sk, samples.lengths.data()+sk, samples.count(k),
+                                           samples.nodes.data()+sl, samples.vals.data()+sl, samples.lengths.data()+sl, samples.count(l1),
+                                           g_unifrac_alpha, my_stripe, my_stripe_total);
+
+            if constexpr (is_weighted_normalized) {
+                dm_stripe[k] = my_stripe / (sums[k] + sums[l1]);
+            } else if constexpr (want_total) {
+                dm_stripe[k] = my_stripe / my_stripe_total;
+            } else {
+                dm_stripe[k] = my_stripe;
+            }
+        }
+
+        su::try_report(task_p, stripe - task_p->start + 1, task_p->stop - task_p->start);
+    }
+}
+
+bool su::sparse_pairs_preferred(const biom_interface &table, const PostorderPlan &plan, const std::vector<uint32_t> &obs_index,
+                                Method unifrac_method) {
+    const uint32_t n_nodes = plan.n_nodes;
+    if ((n_nodes<2) || (table.n_samples<2)) return false;
+
+    // each leaf value adds at most its path to the root to the sample list
+    std::vector<uint32_t> depth(n_nodes);
+    depth[n_nodes-1] = 0;
+    for (uint32_t k=n_nodes-1; k>0; k--) {
+        const uint32_t node = k-1;  // parents always come after their children
+        depth[node] = depth[plan.parents[node]] + 1;
+    }
+    double sum_path_nodes = 0.0;
+    for (uint32_t k=0; k<n_nodes; k++) {
+        if (plan.isleaf(k)) sum_path_nodes += double(table.get_obs_nnz(obs_index[k])) * depth[k];
+    }
+    const double sample_nodes = std::min(sum_path_nodes / table.n_samples, double(n_nodes));
+
+    // the dense unweighted engine packs 64 nodes in a word, so it takes a much sparser table to beat it
+    const bool is_unweighted = (unifrac_method==unweighted) || (unifrac_method==unweighted_fp32) ||
+                               (unifrac_method==unweighted_unnormalized) || (unifrac_method==unweighted_unnormalized_fp32);
+    const double max_fraction = is_unweighted ? SPARSE_PAIRS_MAX_FRACTION_UNWEIGHTED : SPARSE_PAIRS_MAX_FRACTION;
+    return sample_nodes < (max_fraction * n_nodes);
+}
+
+template<class TFloat>
+void su::unifrac_sparse_pairs(const biom_interface &table,
+                              const PostorderPlan &plan,
+                              const std::vector<uint32_t> &obs_index,
+                              Method unifrac_method,
+                              std::vector<TFloat*> &dm_stripes,
+                              const task_parameters* task_p) {
+    SparseSampleNodes<TFloat> samples;
+    sparse_sample_nodes<TFloat>(table, plan, obs_index, task_p, samples);
+
+    // the results are final, no need for totals
+    initialize_stripes_block(dm_stripes, task_p);
+
+    switch(unifrac_method) {
+        case unweighted:
+        case unweighted_fp32:
+            unifrac_sparse_pairs_T<TFloat,SPARSE_UNWEIGHTED>(samples, task_p, dm_stripes);
+            break;
+        case unweighted_unnormalized:
+        case unweighted_unnormalized_fp32:
+            unifrac_sparse_pairs_T<TFloat,SPARSE_UNWEIGHTED_UNNORMALIZED>(samples, task_p, dm_stripes);
+            break;
+        case weighted_normalized:
+        case weighted_normalized_fp32:
+            unifrac_sparse_pairs_T<TFloat,SPARSE_WEIGHTED_NORMALIZED>(samples, task_p, dm_stripes);
+            break;
+        case weighted_unnormalized:
+        case weighted_unnormalized_fp32:
+            unifrac_sparse_pairs_T<TFloat,SPARSE_WEIGHTED_UNNORMALIZED>(samples, task_p, dm_stripes);
+            break;
+        case generalized:
+        case generalized_fp32:
+            {
+              const TFloat g_unifrac_alpha = task_p->g_unifrac_alpha;
+              if (g_unifrac_alpha==TFloat(1.0)) {
+                unifrac_sparse_pairs_T<TFloat,SPARSE_GENERALIZED_ONE>(samples, task_p, dm_stripes);
+              } else if (g_unifrac_alpha==TFloat(0.5)) {
+                unifrac_sparse_pairs_T<TFloat,SPARSE_GENERALIZED_HALF>(samples, task_p, dm_stripes);
+              } else if (g_unifrac_alpha==TFloat(0.0)) {
+                unifrac_sparse_pairs_T<TFloat,SPARSE_GENERALIZED_ZERO>(samples, task_p, dm_stripes);
+              } else {
+                unifrac_sparse_pairs_T<TFloat,SPARSE_GENERALIZED_ANY>(samples, task_p, dm_stripes);
+              }
+            }
+            break;
+        default:
+            fprintf(stderr, "Unknown unifrac task\n");
+            exit(1);
+            break;
+    }
+}
+
+// make sure they get instantiated
+template void su::unifrac_sparse_pairs<double>(const biom_interface &table, const PostorderPlan &plan, const std::vector<uint32_t> &obs_index,
+                                               Method unifrac_method, std::vector<double*> &dm_stripes, const task_parameters* task_p);
+template void su::unifrac_sparse_pairs<float>(const biom_interface &table, const PostorderPlan &plan, const std::vector<uint32_t> &obs_index,
+                                              Method unifrac_method, std::vector<float*> &dm_stripes, const task_parameters* task_p);
@@ -23,18 +23,37 @@ namespace su {
  void remove_report_status();
  void try_report(const su::task_parameters* task_p, unsigned int k, unsigned int max_k);
 
+ // Pool of node proportion vectors
+ // The vectors are addressed by slot index, and the free ones are reused last-in first-out.
  template<class TFloat>
  class PropStack {
    private:
-     std::stack<TFloat*> prop_stack;
-     std::unordered_map<uint32_t, TFloat*> prop_map;
+     std::vector<TFloat*> slots;        // all the vectors, indexed by slot
+     std::vector<uint32_t> free_slots;  // stack of the slots not in use
+     std::vector<uint32_t> node_slots;  // slot assigned to each node
+     TFloat *slab;                      // if not NULL, holds the first n_slab_slots slots
+     uint32_t n_slab_slots;
      uint32_t defaultsize;
    public:
      PropStack(uint32_t vecsize);
+
+     // Pre-allocate all the vectors needed for a traversal of plan
+     // The nodes are expected to be identified by their postorder position
+     PropStack(uint32_t vecsize, const PostorderPlan &plan);
+
      virtual ~PropStack();
+
+     // Allocate plan.max_live vectors in a single contiguous slab
+     // Must be called before any pop
+     void reserve(const PostorderPlan &plan);
+
      TFloat* pop(uint32_t i);
      void push(uint32_t i);
-     TFloat* get(uint32_t i);
+     TFloat* get(uint32_t i) {return slots[node_slots[i]];}
+
+     /* prevent default copy constructor and operator from being generated */
+     PropStack(const PropStack& other) = delete;
+     PropStack& operator= (const PropStack&) = delete;
  };
 
  // Helper class with default constructor
@@ -59,6 +78,14 @@ namespace su {
     : vecsize(_vecsize)
     , multi((vecsize + (PropStackFixed<TFloat>::DEF_VEC_SIZE-1))/PropStackFixed<TFloat>::DEF_VEC_SIZE) // round up
     {}
+
+    // Pre-allocate all the vectors needed for a traversal of plan, see PropStack
+    PropStackMulti(uint32_t _vecsize, const PostorderPlan &plan)
+    : vecsize(_vecsize)
+    , multi((vecsize + (PropStackFixed<TFloat>::DEF_VEC_SIZE-1))/PropStackFixed<TFloat>::DEF_VEC_SIZE) // round up
+    {
+      for (auto &ps : multi) ps.reserve(plan);
+    }
     ~PropStackMulti() {}
 
     uint32_t get_num_stacks() const {return (vecsize + (PropStackFixed<TFloat>::DEF_VEC_SIZE-1))/PropStackFixed<TFloat>::DEF_VEC_SIZE;}
@@ -69,28 +96,70 @@ namespace su {
     PropStackFixed<TFloat> &get_prop_stack(uint32_t idx) {return multi[idx];}
  };
 
+ // Resolve, once, the table obs index of every node in postorder.
+ // On return, obs_index[k] holds the obs index of plan.nodes[k] if it is a leaf, and 0 otherwise.
+ void postorder_obs_index(const BPTree &tree,
+                          const PostorderPlan &plan,
+                          const biom_interface &table,
+                          std::vector<uint32_t> &obs_index);
+
+ // Compute the proportions of the node at postorder position k of plan
+ // obs_idx is the pre-resolved obs index of the node (see postorder_obs_index)
+ // The prop stack must be indexed by postorder position, too.
  template<class TFloat>
  void set_proportions(TFloat* __restrict__ props,
-                      const BPTree &tree, uint32_t node,
+                      const PostorderPlan &plan, uint32_t k, uint32_t obs_idx,
                       const biom_interface &table,
                       PropStack<TFloat> &ps,
                       bool normalize = true);
 
+ // as above, but only for the samples in [start,end)
  template<class TFloat>
  void set_proportions_range(TFloat* __restrict__ props,
-                            const BPTree &tree, uint32_t node,
+                            const PostorderPlan &plan, uint32_t k, uint32_t obs_idx,
                             const biom_interface &table,unsigned int start, unsigned int end,
                             PropStack<TFloat> &ps,
                             bool normalize = true);
 
 
- void initialize_stripes(std::vector<double*> &dm_stripes,
-                         std::vector<double*> &dm_stripes_total,
+ // Allocate the stripes of the task in a single padded buffer (see get_stripe_stride)
+ // Must be released with release_stripes
+ template<class TFloat>
+ void initialize_stripes(std::vector<TFloat*> &dm_stripes,
+                         std::vector<TFloat*> &dm_stripes_total,
                          bool want_total,
                          const su::task_parameters* task_p);
 
+ template<class TFloat>
+ void initialize_stripes_block(std::vector<TFloat*> &dm_stripes,
+                               const su::task_parameters* task_p);
+
   std::vector<double*> make_strides(unsigned int n_samples);
 
+ // Sparse-pair alternative to the dense compute engine, for very shallow samples
+ //
+ // Each sample is represented by the sorted list of the nodes it is present in,
+ // and each distance is computed by merging the lists of the two samples,
+ // so the cost per pair is proportional to the nodes they touch, not to the tree size.
+ // Supports the same methods as su::unifrac (but not the variance adjusted ones).
+ // Writes the final distances in dm_stripes, so no totals are needed.
+ template<class TFloat>
+ void unifrac_sparse_pairs(const biom_interface &table,
+                           const PostorderPlan &plan,
+                           const std::vector<uint32_t> &obs_index,
+                           Method unifrac_method,
+                           std::vector<TFloat*> &dm_stripes,
+                           const task_parameters* task_p);
+
+ // Max fraction of the tree nodes a sample can touch, on average, for the sparse-pair engine to be preferred
+ static constexpr double SPARSE_PAIRS_MAX_FRACTION = 0.2;
+ static constexpr double SPARSE_PAIRS_MAX_FRACTION_UNWEIGHTED = 0.08;
+
+ // Returns true if the table is sparse enough for unifrac_sparse_pairs to beat the dense engine
+ // Uses only the table and the plan, so the caller can reuse both for whichever engine is chosen
+ bool sparse_pairs_preferred(const biom_interface &table, const PostorderPlan &plan, const std::vector<uint32_t> &obs_index,
+                             Method unifrac_method);
+
 }
 
 #endif
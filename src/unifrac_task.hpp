@@ -14,6 +14,9 @@
 #include "task_parameters.hpp"
 #include <math.h>
 #include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
 #include <stdint.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -35,13 +38,12 @@
 
 namespace SUCMP_NM {
 
-    // Note: This adds a copy, which is suboptimal
-    //       But was the easiest way to get a contiguous buffer
-    //       And it does allow for fp32 compute, when desired
+    // The stripes of a task are allocated as a single padded buffer (see su::initialize_stripes)
+    // so compute can work on them in place, in the native precision
     template<class TFloat>
     class UnifracTaskVector {
     private:
-      std::vector<double*> &dm_stripes;
+      std::vector<TFloat*> &dm_stripes;
       const su::task_parameters* const task_p;
 
     public:
@@ -52,30 +54,18 @@ namespace SUCMP_NM {
       const uint64_t  bufels;
       TFloat* const buf;
 
-      UnifracTaskVector(std::vector<double*> &_dm_stripes, const su::task_parameters* _task_p)
+      UnifracTaskVector(std::vector<TFloat*> &_dm_stripes, const su::task_parameters* _task_p)
       : dm_stripes(_dm_stripes), task_p(_task_p)
       , start_idx(task_p->start), stop_idx(task_p->stop), n_samples(task_p->n_samples)
-      , n_samples_r(((n_samples + 64-1)/64)*64) // round up to 64 elements (2kbit/4kbits)
+      , n_samples_r(su::get_stripe_stride(n_samples))
       , bufels(n_samples_r * (stop_idx-start_idx))
-      , buf((dm_stripes[start_idx]==NULL) ? NULL : (TFloat*) malloc(sizeof(TFloat) * bufels)) // dm_stripes could be null, in which case keep it null
+      , buf(dm_stripes[start_idx]) // dm_stripes could be null, in which case keep it null
       {
         // keep local copies to avoid the need for *this in the GPU
         const uint64_t  ibufels = bufels;
         TFloat* const ibuf = buf;
         if (ibuf != NULL) {
-          for(uint64_t stripe=start_idx; stripe < stop_idx; stripe++) {
-             double * dm_stripe = dm_stripes[stripe];
-             TFloat * buf_stripe = ibuf+buf_idx(stripe);
-             for(uint64_t j=0; j<n_samples; j++) {
-                // Note: We could probably just initialize to zero
-                buf_stripe[j] = dm_stripe[j];
-             }
-             for(uint64_t j=n_samples; j<n_samples_r; j++) {
-                // Avoid NaNs
-                buf_stripe[j] = 0.0;
-             }
-           }
-           acc_copyin_buf(ibuf,0,ibufels);
+          acc_copyin_buf(ibuf,0,ibufels);
         }
       }
 
@@ -92,15 +82,7 @@ namespace SUCMP_NM {
         const uint64_t  ibufels = bufels;
         TFloat* const ibuf = buf;
         if (ibuf != NULL) {
-           acc_copyout_buf(ibuf,0,ibufels);
-          for(uint64_t stripe=start_idx; stripe < stop_idx; stripe++) {
-             double * dm_stripe = dm_stripes[stripe];
-             TFloat * buf_stripe = ibuf+buf_idx(stripe);
-             for(uint64_t j=0; j<n_samples; j++) {
-              dm_stripe[j] = buf_stripe[j];
-             }
-          }
-          free(buf);
+          acc_copyout_buf(ibuf,0,ibufels);
         }
       }
 
@@ -126,19 +108,24 @@ namespace SUCMP_NM {
        private:
         TEmb * my_embedded_proportions;
         // alternate buffer only needed in async environments, like openacc
+        // or when pipelining embedding and compute on the CPU
         TEmb * my_embedded_proportions_alt; // used as temp
+        TFloat * lengths_alt;               // only used when pipelined
         bool use_alt_emb;
+        bool pipelined;
 
        public:
 
-        UnifracTaskBase(std::vector<double*> &_dm_stripes, std::vector<double*> &_dm_stripes_total, unsigned int _max_embs, const su::task_parameters* _task_p)
+        UnifracTaskBase(std::vector<TFloat*> &_dm_stripes, std::vector<TFloat*> &_dm_stripes_total, unsigned int _max_embs, const su::task_parameters* _task_p)
         : dm_stripes(_dm_stripes,_task_p), dm_stripes_total(_dm_stripes_total,_task_p), task_p(_task_p)
         , max_embs(_max_embs)
         , embsize(get_embedded_bsize(dm_stripes.n_samples_r,_max_embs))
         , lengths( (TFloat *) malloc(sizeof(TFloat) * _max_embs))
         , my_embedded_proportions((TEmb *) malloc(sizeof(TEmb)*embsize))
         , my_embedded_proportions_alt((TEmb *) NULL)
+        , lengths_alt((TFloat *) NULL)
         , use_alt_emb(false)
+        , pipelined(false)
         {
             acc_create_buf(lengths,0,max_embs);
             acc_create_buf(my_embedded_proportions,0,embsize);
@@ -158,6 +145,10 @@ namespace SUCMP_NM {
               free(my_embedded_proportions_alt);
            }
 
+           if (lengths_alt!=NULL) {
+              free(lengths_alt);
+           }
+
            acc_destroy_buf(my_embedded_proportions,0,embsize);
            acc_destroy_buf(lengths,0,max_embs);
 
@@ -165,8 +156,34 @@ namespace SUCMP_NM {
            free(lengths);
         }
 
+        // Allocate a second set of embedding buffers, so that the next batch
+        // can be embedded while the kernel is running on the current one.
+        // Only meaningful on the CPU, async accelerators already alternate buffers.
+        // Returns true if pipelining is enabled.
+        bool enable_pipeline() {
+          if (acc_need_alt()) return false;
+          if (!pipelined) {
+            my_embedded_proportions_alt = (TEmb *) malloc(sizeof(TEmb)*embsize);
+            lengths_alt = (TFloat *) malloc(sizeof(TFloat) * max_embs);
+            pipelined = true;
+          }
+          return true;
+        }
+
+        // buffers read by the kernel
         TEmb * get_embedded_proportions() {return use_alt_emb ? my_embedded_proportions_alt : my_embedded_proportions;}
-        void  set_alt_embedded_proportions() {if (my_embedded_proportions_alt!=NULL) use_alt_emb = !use_alt_emb; /*else , noop */}
+        // buffers written by embed_*, the other one if pipelined
+        TEmb * get_fill_embedded_proportions() {return (use_alt_emb!=pipelined) ? my_embedded_proportions_alt : my_embedded_proportions;}
+        TFloat * get_fill_lengths() {return pipelined ? lengths_alt : lengths;}
+
+        // when pipelined, the caller explicitly swaps the buffers with swap_pipeline_buffers
+        void  set_alt_embedded_proportions() {if ((my_embedded_proportions_alt!=NULL) && (!pipelined)) use_alt_emb = !use_alt_emb; /*else , noop */}
+
+        // the filled buffers become the ones the kernel reads, and vice versa
+        void swap_pipeline_buffers() {
+          use_alt_emb = !use_alt_emb;
+          std::swap(lengths, lengths_alt);
+        }
 
         void sync_embedded_proportions(unsigned int filled_embs)
         {
@@ -190,6 +207,10 @@ namespace SUCMP_NM {
         void embed_proportions_range(const TFloat* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb);
         void embed_proportions(const TFloat* __restrict__ in, unsigned int emb) {embed_proportions_range(in,0,dm_stripes.n_samples,emb);}
 
+        // Merge away any of the embedded [from,filled_embs) that does not need its own slot
+        // Returns the new number of filled embs; the default is to keep them all
+        unsigned int dedup_embedded_proportions(unsigned int from, unsigned int filled_embs) {return filled_embs;}
+
         void wait_completion() {
           acc_wait();
 
@@ -322,15 +343,15 @@ namespace SUCMP_NM {
 #if SUCMP_ID(SUCMP_NM)==su_cpu_SUCMP_ID
     // CPUs better at fine-grained logic, so keeping emb contiguous speeds things up
     // transpose embeded_proportions
-    template<> inline void UnifracTaskBase<double,double>::embed_proportions_range(const double* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_transpose(get_embedded_proportions(),in,start,end,emb);}
-    template<> inline void UnifracTaskBase<double,float>::embed_proportions_range(const double* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_transpose(get_embedded_proportions(),in,start,end,emb);}
-    template<> inline void UnifracTaskBase<float,float>::embed_proportions_range(const float* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_transpose(get_embedded_proportions(),in,start,end,emb);}
+    template<> inline void UnifracTaskBase<double,double>::embed_proportions_range(const double* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_transpose(get_fill_embedded_proportions(),in,start,end,emb);}
+    template<> inline void UnifracTaskBase<double,float>::embed_proportions_range(const double* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_transpose(get_fill_embedded_proportions(),in,start,end,emb);}
+    template<> inline void UnifracTaskBase<float,float>::embed_proportions_range(const float* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_transpose(get_fill_embedded_proportions(),in,start,end,emb);}
 #else
     // GPUs need parallelism (while relying on HW masking), so better to keep samples together
     // straight embeded_proportions
-    template<> inline void UnifracTaskBase<double,double>::embed_proportions_range(const double* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_straight(get_embedded_proportions(),in,start,end,emb);}
-    template<> inline void UnifracTaskBase<double,float>::embed_proportions_range(const double* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_straight(get_embedded_proportions(),in,start,end,emb);}
-    template<> inline void UnifracTaskBase<float,float>::embed_proportions_range(const float* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_straight(get_embedded_proportions(),in,start,end,emb);}
+    template<> inline void UnifracTaskBase<double,double>::embed_proportions_range(const double* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_straight(get_fill_embedded_proportions(),in,start,end,emb);}
+    template<> inline void UnifracTaskBase<double,float>::embed_proportions_range(const double* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_straight(get_fill_embedded_proportions(),in,start,end,emb);}
+    template<> inline void UnifracTaskBase<float,float>::embed_proportions_range(const float* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_straight(get_fill_embedded_proportions(),in,start,end,emb);}
 #endif
     template<> inline  unsigned int UnifracTaskBase<double,double>::get_emb_els(unsigned int max_embs) {return max_embs;}
     template<> inline  unsigned int UnifracTaskBase<double,float>::get_emb_els(unsigned int max_embs) {return max_embs;}
@@ -339,19 +360,19 @@ namespace SUCMP_NM {
 #if SUCMP_ID(SUCMP_NM)==su_cpu_SUCMP_ID
     // CPUs better at fine-grained logic, so keeping emb contiguous speeds things up
     // transposed packed bool embeded_proportions
-    template<> inline void UnifracTaskBase<double,uint32_t>::embed_proportions_range(const double* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_transp_bool(get_embedded_proportions(),in,start,end,emb);}
-    template<> inline void UnifracTaskBase<float,uint32_t>::embed_proportions_range(const float* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_transp_bool(get_embedded_proportions(),in,start,end,emb);}
+    template<> inline void UnifracTaskBase<double,uint32_t>::embed_proportions_range(const double* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_transp_bool(get_fill_embedded_proportions(),in,start,end,emb);}
+    template<> inline void UnifracTaskBase<float,uint32_t>::embed_proportions_range(const float* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_transp_bool(get_fill_embedded_proportions(),in,start,end,emb);}
 
-    template<> inline void UnifracTaskBase<double,uint64_t>::embed_proportions_range(const double* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_transp_bool(get_embedded_proportions(),in,start,end,emb);}
-    template<> inline void UnifracTaskBase<float,uint64_t>::embed_proportions_range(const float* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_transp_bool(get_embedded_proportions(),in,start,end,emb);}
+    template<> inline void UnifracTaskBase<double,uint64_t>::embed_proportions_range(const double* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_transp_bool(get_fill_embedded_proportions(),in,start,end,emb);}
+    template<> inline void UnifracTaskBase<float,uint64_t>::embed_proportions_range(const float* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_transp_bool(get_fill_embedded_proportions(),in,start,end,emb);}
 #else
     // GPUs need parallelism (while relying on HW masking), so better to keep samples together
     //packed bool embeded_proportions
-    template<> inline void UnifracTaskBase<double,uint32_t>::embed_proportions_range(const double* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_bool(get_embedded_proportions(),in,start,end,emb);}
-    template<> inline void UnifracTaskBase<float,uint32_t>::embed_proportions_range(const float* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_bool(get_embedded_proportions(),in,start,end,emb);}
+    template<> inline void UnifracTaskBase<double,uint32_t>::embed_proportions_range(const double* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_bool(get_fill_embedded_proportions(),in,start,end,emb);}
+    template<> inline void UnifracTaskBase<float,uint32_t>::embed_proportions_range(const float* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_bool(get_fill_embedded_proportions(),in,start,end,emb);}
 
-    template<> inline void UnifracTaskBase<double,uint64_t>::embed_proportions_range(const double* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_bool(get_embedded_proportions(),in,start,end,emb);}
-    template<> inline void UnifracTaskBase<float,uint64_t>::embed_proportions_range(const float* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_bool(get_embedded_proportions(),in,start,end,emb);}
+    template<> inline void UnifracTaskBase<double,uint64_t>::embed_proportions_range(const double* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_bool(get_fill_embedded_proportions(),in,start,end,emb);}
+    template<> inline void UnifracTaskBase<float,uint64_t>::embed_proportions_range(const float* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {embed_proportions_range_bool(get_fill_embedded_proportions(),in,start,end,emb);}
 #endif
     template<> inline  unsigned int UnifracTaskBase<double,uint32_t>::get_emb_els(unsigned int max_embs) {return (max_embs+31)/32;}
     template<> inline  unsigned int UnifracTaskBase<float,uint32_t>::get_emb_els(unsigned int max_embs) {return (max_embs+31)/32;}
@@ -378,7 +399,7 @@ namespace SUCMP_NM {
     class UnifracTask : public UnifracTaskBase<TFloat,TEmb> {
       public:
 
-        UnifracTask(std::vector<double*> &_dm_stripes, std::vector<double*> &_dm_stripes_total, unsigned int _max_embs, const su::task_parameters* _task_p)
+        UnifracTask(std::vector<TFloat*> &_dm_stripes, std::vector<TFloat*> &_dm_stripes_total, unsigned int _max_embs, const su::task_parameters* _task_p)
         : UnifracTaskBase<TFloat,TEmb>(_dm_stripes, _dm_stripes_total, _max_embs, _task_p) {}
 
        UnifracTask(const UnifracTask<TFloat,TEmb>& ) = delete;
@@ -413,7 +434,7 @@ namespace SUCMP_NM {
       public:
         static constexpr unsigned int RECOMMENDED_MAX_EMBS = UnifracTask<TFloat,TFloat>::RECOMMENDED_MAX_EMBS_STRAIGHT;
 
-        UnifracUnnormalizedWeightedTask(std::vector<double*> &_dm_stripes, std::vector<double*> &_dm_stripes_total, unsigned int _max_embs, const su::task_parameters* _task_p)
+        UnifracUnnormalizedWeightedTask(std::vector<TFloat*> &_dm_stripes, std::vector<TFloat*> &_dm_stripes_total, unsigned int _max_embs, const su::task_parameters* _task_p)
         : UnifracTask<TFloat,TFloat>(_dm_stripes,_dm_stripes_total,_max_embs,_task_p)
         {
           const unsigned int n_samples = this->task_p->n_samples;
@@ -460,7 +481,7 @@ namespace SUCMP_NM {
       public:
         static constexpr unsigned int RECOMMENDED_MAX_EMBS = UnifracTask<TFloat,TFloat>::RECOMMENDED_MAX_EMBS_STRAIGHT;
 
-        UnifracNormalizedWeightedTask(std::vector<double*> &_dm_stripes, std::vector<double*> &_dm_stripes_total, unsigned int _max_embs, const su::task_parameters* _task_p)
+        UnifracNormalizedWeightedTask(std::vector<TFloat*> &_dm_stripes, std::vector<TFloat*> &_dm_stripes_total, unsigned int _max_embs, const su::task_parameters* _task_p)
         : UnifracTask<TFloat,TFloat>(_dm_stripes,_dm_stripes_total,_max_embs,_task_p)
         {
           const unsigned int n_samples = this->task_p->n_samples;
@@ -509,7 +530,7 @@ namespace SUCMP_NM {
         static constexpr unsigned int RECOMMENDED_MAX_EMBS = UnifracTask<TFloat,uint64_t>::RECOMMENDED_MAX_EMBS_BOOL;
 
         // Note: _max_emb MUST be multiple of 64
-        UnifracCommonUnweightedTask(std::vector<double*> &_dm_stripes, std::vector<double*> &_dm_stripes_total, unsigned int _max_embs, const su::task_parameters* _task_p)
+        UnifracCommonUnweightedTask(std::vector<TFloat*> &_dm_stripes, std::vector<TFloat*> &_dm_stripes_total, unsigned int _max_embs, const su::task_parameters* _task_p)
         : UnifracTask<TFloat, uint64_t>(_dm_stripes,_dm_stripes_total,_max_embs,_task_p) 
         {
           const unsigned int n_samples = this->task_p->n_samples;
@@ -549,19 +570,129 @@ namespace SUCMP_NM {
           free(zcheck);
         }
 
+        // Merge the embedded [from,filled_embs) that have the same presence pattern
+        // as another emb in the fill buffer, summing their lengths into a single slot.
+        // Assumes [0,from) have already been deduplicated.
+        // Returns the new number of filled embs.
+        unsigned int dedup_embedded_proportions(unsigned int from, unsigned int filled_embs) {
+#if SUCMP_ID(SUCMP_NM)==su_cpu_SUCMP_ID
+          if (from==0) emb_index.clear(); // new batch
+          if (from>=filled_embs) return filled_embs;
+
+          uint64_t * const __restrict__ embs = this->get_fill_embedded_proportions();
+          TFloat * const __restrict__ lengths = this->get_fill_lengths();
+          const uint64_t n_samples = this->dm_stripes.n_samples;
+          const uint64_t istripe = this->get_emb_els(this->max_embs);
+          const unsigned int n_new = filled_embs - from;
+
+          // hash each emb as the sum of the keys of the samples it is present in
+          std::vector<uint64_t> hashes(n_new, 0);
+          const unsigned int el_start = from/64;
+          const unsigned int el_end = (filled_embs+63)/64;
+#pragma omp parallel for default(shared)
+          for (unsigned int el=el_start; el<el_end; el++) {
+            uint64_t el_mask = ~uint64_t(0);
+            if (el==el_start) el_mask &= ~uint64_t(0) << (from%64);
+            if ((el+1)*64 > filled_embs) el_mask &= ~(~uint64_t(0) << (filled_embs%64));
+
+            for (uint64_t i=0; i<n_samples; i++) {
+              uint64_t bits = embs[i*istripe + el] & el_mask;
+              if (bits==0) continue;
+              const uint64_t key = presence_key(i);
+              while (bits!=0) {
+                hashes[el*64 + __builtin_ctzll(bits) - from] += key;
+                bits &= bits - 1;
+              }
+            }
+          }
+
+          // decide where each new emb goes, verifying hash hits bit by bit
+          std::vector<uint32_t> dest(n_new);
+          std::vector<uint32_t> kept_src; // original position of the kept ones, indexed by dest-from
+          kept_src.reserve(n_new);
+          for (unsigned int c=0; c<n_new; c++) {
+            const uint32_t src = from + c;
+            auto it = emb_index.find(hashes[c]);
+            if (it!=emb_index.end()) {
+              const uint32_t other = it->second;
+              const uint32_t other_src = (other<from) ? other : kept_src[other-from];
+              if (same_presence(embs, istripe, n_samples, other_src, src)) {
+                dest[c] = other;
+                continue;
+              }
+            } // else, or on hash collision, a new slot
+            dest[c] = from + kept_src.size();
+            kept_src.push_back(src);
+            if (it==emb_index.end()) emb_index[hashes[c]] = dest[c];
+          }
+
+          const unsigned int new_filled = from + kept_src.size();
+          if (new_filled==filled_embs) return filled_embs; // nothing to merge
+
+          // merge the lengths; dest<=src, so can be done in place, in order
+          for (unsigned int c=0; c<n_new; c++) {
+            const uint32_t src = from + c;
+            if (dest[c]==src) continue;
+            const bool is_kept = (dest[c]>=from) && (kept_src[dest[c]-from]==src);
+            if (is_kept) lengths[dest[c]] = lengths[src];
+            else lengths[dest[c]] += lengths[src];
+          }
+
+          // and move the kept bits down, again dest<=src so in place
+#pragma omp parallel for default(shared)
+          for (uint64_t i=0; i<n_samples; i++) {
+            uint64_t * const __restrict__ row = embs + i*istripe;
+            for (unsigned int j=0; j<kept_src.size(); j++) {
+              const uint32_t src = kept_src[j];
+              const uint32_t dst = from + j;
+              if (dst==src) continue;
+              const uint64_t bit = (row[src/64] >> (src%64)) & 1;
+              row[dst/64] = (row[dst/64] & ~(uint64_t(1) << (dst%64))) | (bit << (dst%64));
+            }
+            // clear the now unused tail
+            if (new_filled%64) row[new_filled/64] &= ~(~uint64_t(0) << (new_filled%64));
+            for (unsigned int el=(new_filled+63)/64; el<el_end; el++) row[el] = 0;
+          }
+
+          return new_filled;
+#else
+          // the accelerator layout is not transposed, not worth it
+          return filled_embs;
+#endif
+        }
+
       protected:
         // temp buffers
         TFloat *sums;
         bool     *zcheck;
         uint32_t *idxs;  // assuming n_samples si really a uint32_t number
         TFloat   *stripe_sums;
+
+        // hash of the presence pattern -> emb index, for the batch being filled
+        std::unordered_map<uint64_t, uint32_t> emb_index;
+
+        // pseudo-random, but deterministic, key for each sample (splitmix64)
+        static inline uint64_t presence_key(uint64_t i) {
+          uint64_t z = (i+1) * 0x9e3779b97f4a7c15ULL;
+          z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+          z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+          return z ^ (z >> 31);
+        }
+
+        static inline bool same_presence(const uint64_t * __restrict__ embs, uint64_t istripe, uint64_t n_samples, uint32_t a, uint32_t b) {
+          for (uint64_t i=0; i<n_samples; i++) {
+            const uint64_t *row = embs + i*istripe;
+            if (((row[a/64] >> (a%64)) ^ (row[b/64] >> (b%64))) & 1) return false;
+          }
+          return true;
+        }
     };
     template<class TFloat>
     class UnifracUnweightedTask : public UnifracCommonUnweightedTask<TFloat> {
       public:
 
         // Note: _max_emb MUST be multiple of 64
-        UnifracUnweightedTask(std::vector<double*> &_dm_stripes, std::vector<double*> &_dm_stripes_total, unsigned int _max_embs, const su::task_parameters* _task_p)
+        UnifracUnweightedTask(std::vector<TFloat*> &_dm_stripes, std::vector<TFloat*> &_dm_stripes_total, unsigned int _max_embs, const su::task_parameters* _task_p)
         : UnifracCommonUnweightedTask<TFloat>(_dm_stripes,_dm_stripes_total,_max_embs,_task_p) {}
 
         UnifracUnweightedTask(const UnifracUnweightedTask<TFloat>& ) = delete;
@@ -585,7 +716,7 @@ namespace SUCMP_NM {
       public:
 
         // Note: _max_emb MUST be multiple of 64
-        UnifracUnnormalizedUnweightedTask(std::vector<double*> &_dm_stripes, std::vector<double*> &_dm_stripes_total, unsigned int _max_embs, const su::task_parameters* _task_p)
+        UnifracUnnormalizedUnweightedTask(std::vector<TFloat*> &_dm_stripes, std::vector<TFloat*> &_dm_stripes_total, unsigned int _max_embs, const su::task_parameters* _task_p)
         : UnifracCommonUnweightedTask<TFloat>(_dm_stripes,_dm_stripes_total,_max_embs,_task_p) {}
 
         UnifracUnnormalizedUnweightedTask(const UnifracUnnormalizedUnweightedTask<TFloat>& ) = delete;
@@ -611,7 +742,7 @@ namespace SUCMP_NM {
       public:
         static constexpr unsigned int RECOMMENDED_MAX_EMBS = UnifracTask<TFloat,TFloat>::RECOMMENDED_MAX_EMBS_STRAIGHT;
 
-        UnifracGeneralizedTask(std::vector<double*> &_dm_stripes, std::vector<double*> &_dm_stripes_total, unsigned int _max_embs, const su::task_parameters* _task_p)
+        UnifracGeneralizedTask(std::vector<TFloat*> &_dm_stripes, std::vector<TFloat*> &_dm_stripes_total, unsigned int _max_embs, const su::task_parameters* _task_p)
         : UnifracTask<TFloat,TFloat>(_dm_stripes,_dm_stripes_total,_max_embs,_task_p) {}
 
         UnifracGeneralizedTask(const UnifracGeneralizedTask<TFloat>& ) = delete;
@@ -632,6 +763,233 @@ namespace SUCMP_NM {
 	}
     };
 
+    // Generalized UniFrac for several alphas, sharing the embedded proportions
+    // The stripes of the first alpha are managed by the base class, the others here
+    template<class TFloat>
+    class UnifracGeneralizedMultiTask : public UnifracTask<TFloat,TFloat> {
+      private:
+        std::vector<UnifracTaskVector<TFloat>*> extra_stripes;
+        std::vector<UnifracTaskVector<TFloat>*> extra_stripes_total;
+        // buffers and alphas, in the format the kernel expects
+        std::vector<TFloat*> stripes_bufs;
+        std::vector<TFloat*> stripes_total_bufs;
+        std::vector<TFloat> alphas;
+
+      public:
+        static constexpr unsigned int RECOMMENDED_MAX_EMBS = UnifracTask<TFloat,TFloat>::RECOMMENDED_MAX_EMBS_STRAIGHT;
+
+        // one set of stripes and task parameters per alpha; only g_unifrac_alpha can differ between the task parameters
+        UnifracGeneralizedMultiTask(std::vector<std::vector<TFloat*>*> &_dm_stripes, std::vector<std::vector<TFloat*>*> &_dm_stripes_total,
+                                    unsigned int _max_embs, const std::vector<const su::task_parameters*> &_task_ps)
+        : UnifracTask<TFloat,TFloat>(*(_dm_stripes[0]),*(_dm_stripes_total[0]),_max_embs,_task_ps[0]) {
+          stripes_bufs.push_back(this->dm_stripes.buf);
+          stripes_total_bufs.push_back(this->dm_stripes_total.buf);
+          alphas.push_back((TFloat) _task_ps[0]->g_unifrac_alpha);
+          for (unsigned int a=1; a<_task_ps.size(); a++) {
+            extra_stripes.push_back(new UnifracTaskVector<TFloat>(*(_dm_stripes[a]),_task_ps[a]));
+            extra_stripes_total.push_back(new UnifracTaskVector<TFloat>(*(_dm_stripes_total[a]),_task_ps[a]));
+            stripes_bufs.push_back(extra_stripes.back()->buf);
+            stripes_total_bufs.push_back(extra_stripes_total.back()->buf);
+            alphas.push_back((TFloat) _task_ps[a]->g_unifrac_alpha);
+          }
+        }
+
+        UnifracGeneralizedMultiTask(const UnifracGeneralizedMultiTask<TFloat>& ) = delete;
+        UnifracGeneralizedMultiTask<TFloat>& operator= (const UnifracGeneralizedMultiTask<TFloat>&) = delete;
+
+        virtual ~UnifracGeneralizedMultiTask() {
+          for (auto el : extra_stripes_total) delete el;
+          for (auto el : extra_stripes) delete el;
+        }
+
+        virtual void run(unsigned int filled_embs) {_run(filled_embs);}
+
+        void _run(unsigned int filled_embs) {
+          const unsigned int n_alphas = alphas.size();
+          for (unsigned int a=0; a<n_alphas; a+=GENERALIZED_MULTI_MAX_ALPHAS) {
+            run_GeneralizedMultiTask(
+			  this->max_embs, filled_embs,
+			  this->task_p->start, this->task_p->stop, this->task_p->n_samples, this->dm_stripes.n_samples_r,
+			  this->lengths, this->get_embedded_proportions(),
+			  stripes_bufs.data()+a, stripes_total_bufs.data()+a,
+			  std::min(n_alphas-a, (unsigned int) GENERALIZED_MULTI_MAX_ALPHAS), alphas.data()+a);
+          }
+
+          // next iteration will use the alternative space
+          this->set_alt_embedded_proportions();
+	}
+
+        void compute_totals() {
+          for (unsigned int a=0; a<alphas.size(); a++) {
+            compute_stripes_totals(stripes_bufs[a], stripes_total_bufs[a], this->dm_stripes.bufels);
+          }
+	}
+    };
+
+#if SUCMP_ID(SUCMP_NM)==su_cpu_SUCMP_ID
+    /* void unifrac tile tasks, CPU only
+     *
+     * Same as the tasks above, but accumulate into the square tiles of the upper triangle
+     * of the distance matrix (see su::DMTilesT), computing each pair exactly once.
+     * The stripes vectors are only used for sizing, and must contain only NULL pointers.
+     */
+
+    // The tiles a tile task accumulates into, not owned
+    template<class TFloat>
+    class UnifracTaskTiles {
+      public:
+        const uint64_t tile_size;
+        const uint64_t bufels;
+        TFloat * const buf;
+        TFloat * const total_buf; // NULL, if the method does not use totals
+
+        UnifracTaskTiles(su::DMTilesT<TFloat> &_dm_tiles, su::DMTilesT<TFloat> *_dm_tiles_total)
+        : tile_size(_dm_tiles.tile_size), bufels(_dm_tiles.bufels), buf(_dm_tiles.buf)
+        , total_buf((_dm_tiles_total==NULL) ? NULL : _dm_tiles_total->buf) {}
+
+        void compute_totals() {
+          compute_stripes_totals(buf, total_buf, bufels);
+        }
+    };
+
+    template<class TFloat>
+    class UnifracUnnormalizedWeightedTileTask : public UnifracUnnormalizedWeightedTask<TFloat> {
+      public:
+        UnifracTaskTiles<TFloat> dm_tiles;
+
+        UnifracUnnormalizedWeightedTileTask(std::vector<TFloat*> &_dm_stripes, std::vector<TFloat*> &_dm_stripes_total,
+                                            su::DMTilesT<TFloat> &_dm_tiles, su::DMTilesT<TFloat> *_dm_tiles_total,
+                                            unsigned int _max_embs, const su::task_parameters* _task_p)
+        : UnifracUnnormalizedWeightedTask<TFloat>(_dm_stripes,_dm_stripes_total,_max_embs,_task_p)
+        , dm_tiles(_dm_tiles,_dm_tiles_total) {}
+
+        virtual void run(unsigned int filled_embs) {_run(filled_embs);}
+
+        void _run(unsigned int filled_embs) {
+           run_UnnormalizedWeightedTileTask(
+			  this->max_embs, filled_embs,
+			  this->task_p->n_samples, dm_tiles.tile_size,
+			  this->lengths,  this->get_embedded_proportions(), dm_tiles.buf,
+			  this->zcheck, this->sums);
+
+           // next iteration will use the alternative space
+           this->set_alt_embedded_proportions();
+	}
+
+        void compute_totals() {dm_tiles.compute_totals();}
+    };
+    template<class TFloat>
+    class UnifracNormalizedWeightedTileTask : public UnifracNormalizedWeightedTask<TFloat> {
+      public:
+        UnifracTaskTiles<TFloat> dm_tiles;
+
+        UnifracNormalizedWeightedTileTask(std::vector<TFloat*> &_dm_stripes, std::vector<TFloat*> &_dm_stripes_total,
+                                          su::DMTilesT<TFloat> &_dm_tiles, su::DMTilesT<TFloat> *_dm_tiles_total,
+                                          unsigned int _max_embs, const su::task_parameters* _task_p)
+        : UnifracNormalizedWeightedTask<TFloat>(_dm_stripes,_dm_stripes_total,_max_embs,_task_p)
+        , dm_tiles(_dm_tiles,_dm_tiles_total) {}
+
+        virtual void run(unsigned int filled_embs) {_run(filled_embs);}
+
+        void _run(unsigned int filled_embs) {
+          run_NormalizedWeightedTileTask(
+			    this->max_embs, filled_embs,
+			    this->task_p->n_samples, dm_tiles.tile_size,
+			    this->lengths, this->get_embedded_proportions(),
+			    dm_tiles.buf, dm_tiles.total_buf,
+			    this->zcheck, this->sums);
+
+          // next iteration will use the alternative space
+          this->set_alt_embedded_proportions();
+	}
+
+        void compute_totals() {dm_tiles.compute_totals();}
+    };
+    template<class TFloat>
+    class UnifracUnweightedTileTask : public UnifracCommonUnweightedTask<TFloat> {
+      public:
+        UnifracTaskTiles<TFloat> dm_tiles;
+
+        // Note: _max_emb MUST be multiple of 64
+        UnifracUnweightedTileTask(std::vector<TFloat*> &_dm_stripes, std::vector<TFloat*> &_dm_stripes_total,
+                                  su::DMTilesT<TFloat> &_dm_tiles, su::DMTilesT<TFloat> *_dm_tiles_total,
+                                  unsigned int _max_embs, const su::task_parameters* _task_p)
+        : UnifracCommonUnweightedTask<TFloat>(_dm_stripes,_dm_stripes_total,_max_embs,_task_p)
+        , dm_tiles(_dm_tiles,_dm_tiles_total) {}
+
+        virtual void run(unsigned int filled_embs) {_run(filled_embs);}
+
+        void _run(unsigned int filled_embs) {
+          run_UnweightedTileTask(
+			 this->get_emb_els(this->max_embs), filled_embs,
+			 this->task_p->n_samples, dm_tiles.tile_size,
+			 this->lengths, this->get_embedded_proportions(), dm_tiles.buf, dm_tiles.total_buf,
+			 this->sums, this->zcheck, this->stripe_sums);
+
+          // next iteration will use the alternative space
+          this->set_alt_embedded_proportions();
+	}
+
+        void compute_totals() {dm_tiles.compute_totals();}
+    };
+    template<class TFloat>
+    class UnifracUnnormalizedUnweightedTileTask : public UnifracCommonUnweightedTask<TFloat> {
+      public:
+        UnifracTaskTiles<TFloat> dm_tiles;
+
+        // Note: _max_emb MUST be multiple of 64
+        UnifracUnnormalizedUnweightedTileTask(std::vector<TFloat*> &_dm_stripes, std::vector<TFloat*> &_dm_stripes_total,
+                                              su::DMTilesT<TFloat> &_dm_tiles, su::DMTilesT<TFloat> *_dm_tiles_total,
+                                              unsigned int _max_embs, const su::task_parameters* _task_p)
+        : UnifracCommonUnweightedTask<TFloat>(_dm_stripes,_dm_stripes_total,_max_embs,_task_p)
+        , dm_tiles(_dm_tiles,_dm_tiles_total) {}
+
+        virtual void run(unsigned int filled_embs) {_run(filled_embs);}
+
+        void _run(unsigned int filled_embs) {
+          run_UnnormalizedUnweightedTileTask(
+			  this->get_emb_els(this->max_embs), filled_embs,
+			  this->task_p->n_samples, dm_tiles.tile_size,
+			  this->lengths, this->get_embedded_proportions(),
+			  dm_tiles.buf,
+			  this->sums, this->zcheck, this->stripe_sums);
+
+          // next iteration will use the alternative space
+          this->set_alt_embedded_proportions();
+	}
+
+        void compute_totals() {dm_tiles.compute_totals();}
+    };
+
+    template<class TFloat>
+    class UnifracGeneralizedTileTask : public UnifracGeneralizedTask<TFloat> {
+      public:
+        UnifracTaskTiles<TFloat> dm_tiles;
+
+        UnifracGeneralizedTileTask(std::vector<TFloat*> &_dm_stripes, std::vector<TFloat*> &_dm_stripes_total,
+                                   su::DMTilesT<TFloat> &_dm_tiles, su::DMTilesT<TFloat> *_dm_tiles_total,
+                                   unsigned int _max_embs, const su::task_parameters* _task_p)
+        : UnifracGeneralizedTask<TFloat>(_dm_stripes,_dm_stripes_total,_max_embs,_task_p)
+        , dm_tiles(_dm_tiles,_dm_tiles_total) {}
+
+        virtual void run(unsigned int filled_embs) {_run(filled_embs);}
+
+        void _run(unsigned int filled_embs) {
+          run_GeneralizedTileTask(
+			  this->max_embs, filled_embs,
+			  this->task_p->n_samples, dm_tiles.tile_size,
+			  this->lengths, this->get_embedded_proportions(),
+			  dm_tiles.buf, dm_tiles.total_buf,
+			  (TFloat) this->task_p->g_unifrac_alpha);
+
+          // next iteration will use the alternative space
+          this->set_alt_embedded_proportions();
+	}
+
+        void compute_totals() {dm_tiles.compute_totals();}
+    };
+#endif
+
     /* void unifrac_vaw tasks
      *
      * all methods utilize the same function signature. that signature is as follows:
@@ -660,7 +1018,7 @@ namespace SUCMP_NM {
 
         static constexpr unsigned int RECOMMENDED_MAX_EMBS = 128;
 
-        UnifracVawTask(std::vector<double*> &_dm_stripes, std::vector<double*> &_dm_stripes_total, 
+        UnifracVawTask(std::vector<TFloat*> &_dm_stripes, std::vector<TFloat*> &_dm_stripes_total, 
                     const double * _sample_counts,
                     unsigned int _max_embs, const su::task_parameters* _task_p)
         : UnifracTaskBase<TFloat,TEmb>(_dm_stripes, _dm_stripes_total, _max_embs, _task_p)
@@ -711,40 +1069,40 @@ namespace SUCMP_NM {
 
     // straight embeded_proportions
     template<> inline void UnifracVawTask<double,double>::embed_range(const double* __restrict__ in_proportions, const double* __restrict__ in_counts, unsigned int start, unsigned int end, unsigned int emb) {
-          this->embed_proportions_range_straight(this->get_embedded_proportions(),in_proportions,start,end,emb);
+          this->embed_proportions_range_straight(this->get_fill_embedded_proportions(),in_proportions,start,end,emb);
           this->embed_proportions_range_straight(this->embedded_counts,in_counts,start,end,emb);
     }
     template<> inline void UnifracVawTask<double,float>::embed_range(const double* __restrict__ in_proportions, const double* __restrict__ in_counts, unsigned int start, unsigned int end, unsigned int emb) {
-          this->embed_proportions_range_straight(this->get_embedded_proportions(),in_proportions,start,end,emb);
+          this->embed_proportions_range_straight(this->get_fill_embedded_proportions(),in_proportions,start,end,emb);
           this->embed_proportions_range_straight(this->embedded_counts,in_counts,start,end,emb);
     }
     template<> inline void UnifracVawTask<float,float>::embed_range(const float* __restrict__ in_proportions, const float* __restrict__ in_counts, unsigned int start, unsigned int end, unsigned int emb) {
-          this->embed_proportions_range_straight(this->get_embedded_proportions(),in_proportions,start,end,emb);
+          this->embed_proportions_range_straight(this->get_fill_embedded_proportions(),in_proportions,start,end,emb);
           this->embed_proportions_range_straight(this->embedded_counts,in_counts,start,end,emb);
     }
 
     //packed bool embeded_proportions
     template<> inline void UnifracVawTask<double,uint32_t>::embed_range(const double* __restrict__ in_proportions, const double* __restrict__ in_counts, unsigned int start, unsigned int end, unsigned int emb) {
-          this->embed_proportions_range_bool(this->get_embedded_proportions(),in_proportions,start,end,emb);
+          this->embed_proportions_range_bool(this->get_fill_embedded_proportions(),in_proportions,start,end,emb);
           this->embed_proportions_range_straight(this->embedded_counts,in_counts,start,end,emb);
     }
     template<> inline void UnifracVawTask<double,uint64_t>::embed_range(const double* __restrict__ in_proportions, const double* __restrict__ in_counts, unsigned int start, unsigned int end, unsigned int emb) {
-          this->embed_proportions_range_bool(this->get_embedded_proportions(),in_proportions,start,end,emb);
+          this->embed_proportions_range_bool(this->get_fill_embedded_proportions(),in_proportions,start,end,emb);
           this->embed_proportions_range_straight(this->embedded_counts,in_counts,start,end,emb);
     }
     template<> inline void UnifracVawTask<float,uint32_t>::embed_range(const float* __restrict__ in_proportions, const float* __restrict__ in_counts, unsigned int start, unsigned int end, unsigned int emb) {
-          this->embed_proportions_range_bool(this->get_embedded_proportions(),in_proportions,start,end,emb);
+          this->embed_proportions_range_bool(this->get_fill_embedded_proportions(),in_proportions,start,end,emb);
           this->embed_proportions_range_straight(this->embedded_counts,in_counts,start,end,emb);
     }
     template<> inline void UnifracVawTask<float,uint64_t>::embed_range(const float* __restrict__ in_proportions, const float* __restrict__ in_counts, unsigned int start, unsigned int end, unsigned int emb) {
-          this->embed_proportions_range_bool(this->get_embedded_proportions(),in_proportions,start,end,emb);
+          this->embed_proportions_range_bool(this->get_fill_embedded_proportions(),in_proportions,start,end,emb);
           this->embed_proportions_range_straight(this->embedded_counts,in_counts,start,end,emb);
     }
 
     template<class TFloat>
     class UnifracVawUnnormalizedWeightedTask : public UnifracVawTask<TFloat,TFloat> {
       public:
-        UnifracVawUnnormalizedWeightedTask(std::vector<double*> &_dm_stripes, std::vector<double*> &_dm_stripes_total, 
+        UnifracVawUnnormalizedWeightedTask(std::vector<TFloat*> &_dm_stripes, std::vector<TFloat*> &_dm_stripes_total, 
                     const double * _sample_counts,
                     unsigned int _max_embs, const su::task_parameters* _task_p)
         : UnifracVawTask<TFloat,TFloat>(_dm_stripes,_dm_stripes_total,_sample_counts,_max_embs,_task_p) {}
@@ -768,7 +1126,7 @@ namespace SUCMP_NM {
     template<class TFloat>
     class UnifracVawNormalizedWeightedTask : public UnifracVawTask<TFloat,TFloat> {
       public:
-        UnifracVawNormalizedWeightedTask(std::vector<double*> &_dm_stripes, std::vector<double*> &_dm_stripes_total, 
+        UnifracVawNormalizedWeightedTask(std::vector<TFloat*> &_dm_stripes, std::vector<TFloat*> &_dm_stripes_total, 
                     const double * _sample_counts,
                     unsigned int _max_embs, const su::task_parameters* _task_p)
         : UnifracVawTask<TFloat,TFloat>(_dm_stripes,_dm_stripes_total,_sample_counts,_max_embs,_task_p) {}
@@ -792,7 +1150,7 @@ namespace SUCMP_NM {
     template<class TFloat>
     class UnifracVawUnweightedTask : public UnifracVawTask<TFloat,uint32_t> {
       public:
-        UnifracVawUnweightedTask(std::vector<double*> &_dm_stripes, std::vector<double*> &_dm_stripes_total, 
+        UnifracVawUnweightedTask(std::vector<TFloat*> &_dm_stripes, std::vector<TFloat*> &_dm_stripes_total, 
                     const double * _sample_counts,
                     unsigned int _max_embs, const su::task_parameters* _task_p)
         : UnifracVawTask<TFloat,uint32_t>(_dm_stripes,_dm_stripes_total,_sample_counts,_max_embs,_task_p) {}
@@ -816,7 +1174,7 @@ namespace SUCMP_NM {
     template<class TFloat>
     class UnifracVawUnnormalizedUnweightedTask : public UnifracVawTask<TFloat,uint32_t> {
       public:
-        UnifracVawUnnormalizedUnweightedTask(std::vector<double*> &_dm_stripes, std::vector<double*> &_dm_stripes_total, 
+        UnifracVawUnnormalizedUnweightedTask(std::vector<TFloat*> &_dm_stripes, std::vector<TFloat*> &_dm_stripes_total, 
                     const double * _sample_counts,
                     unsigned int _max_embs, const su::task_parameters* _task_p)
         : UnifracVawTask<TFloat,uint32_t>(_dm_stripes,_dm_stripes_total,_sample_counts,_max_embs,_task_p) {}
@@ -840,7 +1198,7 @@ namespace SUCMP_NM {
     template<class TFloat>
     class UnifracVawGeneralizedTask : public UnifracVawTask<TFloat,TFloat> {
       public:
-        UnifracVawGeneralizedTask(std::vector<double*> &_dm_stripes, std::vector<double*> &_dm_stripes_total,
+        UnifracVawGeneralizedTask(std::vector<TFloat*> &_dm_stripes, std::vector<TFloat*> &_dm_stripes_total,
                     const double * _sample_counts,
                     unsigned int _max_embs, const su::task_parameters* _task_p)
         : UnifracVawTask<TFloat,TFloat>(_dm_stripes,_dm_stripes_total,_sample_counts,_max_embs,_task_p) {}
@@ -863,6 +1221,139 @@ namespace SUCMP_NM {
 	}
     };
 
+
+    /* Multi-method tasks
+     *
+     * Several methods can share a single traversal of the tree, and thus a single
+     * computation of the node proportions. Each method keeps its own task object,
+     * with its own embedding and stripes, while UnifracMultiTask presents them
+     * as a single task to the driver.
+     */
+
+    // Task interface independent of the embedding type, so that different tasks can be mixed
+    template<class TFloat>
+    class UnifracTaskItf {
+      public:
+        virtual ~UnifracTaskItf() {}
+
+        virtual unsigned int get_max_embs() const = 0;
+        virtual void embed_proportions_range(const TFloat* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) = 0;
+        // copy the lengths the kernel will use
+        virtual void set_lengths(const TFloat* __restrict__ in, unsigned int filled_embs) = 0;
+        virtual void sync_embedded_proportions(unsigned int filled_embs) = 0;
+        virtual void sync_lengths(unsigned int filled_embs) = 0;
+        virtual void run(unsigned int filled_embs) = 0;
+        virtual bool enable_pipeline() = 0;
+        virtual void swap_pipeline_buffers() = 0;
+        virtual void wait_completion() = 0;
+        virtual void compute_totals() = 0;
+    };
+
+    template<class TaskT, class TFloat>
+    class UnifracTaskWrapper : public UnifracTaskItf<TFloat> {
+      private:
+        TaskT taskObj;
+
+      public:
+        // forwards the arguments to the TaskT constructor
+        template<class... Args>
+        UnifracTaskWrapper(Args&&... args)
+        : taskObj(std::forward<Args>(args)...) {}
+
+        UnifracTaskWrapper(const UnifracTaskWrapper<TaskT,TFloat>& ) = delete;
+        UnifracTaskWrapper<TaskT,TFloat>& operator= (const UnifracTaskWrapper<TaskT,TFloat>&) = delete;
+
+        virtual ~UnifracTaskWrapper() {}
+
+        virtual unsigned int get_max_embs() const {return taskObj.max_embs;}
+        virtual void embed_proportions_range(const TFloat* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {
+          taskObj.embed_proportions_range(in, start, end, emb);
+        }
+        virtual void set_lengths(const TFloat* __restrict__ in, unsigned int filled_embs) {
+          for (unsigned int i=0; i<filled_embs; i++) taskObj.lengths[i] = in[i];
+        }
+        virtual void sync_embedded_proportions(unsigned int filled_embs) {taskObj.sync_embedded_proportions(filled_embs);}
+        virtual void sync_lengths(unsigned int filled_embs) {taskObj.sync_lengths(filled_embs);}
+        virtual void run(unsigned int filled_embs) {taskObj._run(filled_embs);}
+        virtual bool enable_pipeline() {return taskObj.enable_pipeline();}
+        virtual void swap_pipeline_buffers() {taskObj.swap_pipeline_buffers();}
+        virtual void wait_completion() {taskObj.wait_completion();}
+        virtual void compute_totals() {taskObj.compute_totals();}
+    };
+
+    // Forwards each batch to all the tasks
+    // The batch size must not exceed the max_embs of any of the tasks
+    template<class TFloat>
+    class UnifracMultiTask {
+      private:
+        const std::vector<UnifracTaskItf<TFloat>*> &tasks;  // not owned
+        const unsigned int max_embs;
+        TFloat * lengths;
+        TFloat * lengths_alt;  // only used when pipelined
+        bool pipelined;
+
+      public:
+        UnifracMultiTask(const std::vector<UnifracTaskItf<TFloat>*> &_tasks, unsigned int _max_embs)
+        : tasks(_tasks), max_embs(_max_embs)
+        , lengths((TFloat *) malloc(sizeof(TFloat) * _max_embs))
+        , lengths_alt((TFloat *) NULL)
+        , pipelined(false) {}
+
+        UnifracMultiTask(const UnifracMultiTask<TFloat>& ) = delete;
+        UnifracMultiTask<TFloat>& operator= (const UnifracMultiTask<TFloat>&) = delete;
+
+        ~UnifracMultiTask() {
+          if (lengths_alt!=NULL) free(lengths_alt);
+          free(lengths);
+        }
+
+        TFloat * get_fill_lengths() {return pipelined ? lengths_alt : lengths;}
+
+        void embed_proportions_range(const TFloat* __restrict__ in, unsigned int start, unsigned int end, unsigned int emb) {
+          for (auto task : tasks) task->embed_proportions_range(in, start, end, emb);
+        }
+
+        // The embs are shared by all the tasks, so they cannot be merged for any single one of them
+        unsigned int dedup_embedded_proportions(unsigned int from, unsigned int filled_embs) {return filled_embs;}
+
+        void sync_embedded_proportions(unsigned int filled_embs) {
+          for (auto task : tasks) task->sync_embedded_proportions(filled_embs);
+        }
+
+        // The only place the shared lengths are copied into the tasks
+        // Must be called before each _run, pipelined or not
+        void sync_lengths(unsigned int filled_embs) {
+          for (auto task : tasks) {
+            task->set_lengths(lengths, filled_embs);
+            task->sync_lengths(filled_embs);
+          }
+        }
+
+        void _run(unsigned int filled_embs) {
+          for (auto task : tasks) task->run(filled_embs);
+        }
+
+        // Returns true only if all the tasks can be pipelined
+        bool enable_pipeline() {
+          bool all_enabled = true;
+          for (auto task : tasks) all_enabled &= task->enable_pipeline();
+          if (all_enabled && (!pipelined)) {
+            lengths_alt = (TFloat *) malloc(sizeof(TFloat) * max_embs);
+            pipelined = true;
+          }
+          return all_enabled;
+        }
+
+        void swap_pipeline_buffers() {
+          for (auto task : tasks) task->swap_pipeline_buffers();
+          std::swap(lengths, lengths_alt);
+        }
+
+        void wait_completion() {
+          for (auto task : tasks) task->wait_completion();
+        }
+    };
+
 }
 
 #endif
@@ -12,6 +12,11 @@
 #include "unifrac_task_noclass.hpp"
 #include <cstdlib>
 
+#if !(defined(_OPENACC) || defined(OMPGPU)) && (defined(__AVX512F__) || defined(__AVX2__))
+// Used by the unweighted CPU kernels, selected by the x86_v3/v4 build variants
+#include <immintrin.h>
+#endif
+
 #if defined(OMPGPU)
 
 #include <omp.h>
@@ -29,6 +34,8 @@
 #endif
 
 // Use a moderate sized step, a few cache lines
+// The CPU kernels split the work in step_size samples by stripe units, using collapse(2),
+// so both the k and the (wraparound) l1 rows of consecutive units stay in cache
 #define STEP_SIZE(TFloat) (64*4/sizeof(TFloat))
 
 template<class TFloat>
@@ -457,7 +464,7 @@ static inline void run_VawUnnormalizedWeightedTask_T(
 #endif
 
 #else
-#pragma omp parallel for default(shared) schedule(dynamic,1)
+#pragma omp parallel for collapse(2) schedule(dynamic,step_size) default(shared)
 #endif
     for(uint64_t sk = 0; sk < sample_steps ; sk++) {
       for(uint64_t stripe = start_idx; stripe < stop_idx; stripe++) {
@@ -871,7 +878,7 @@ static inline void run_VawNormalizedWeightedTask_T(
 #endif
 
 #else
-#pragma omp parallel for schedule(dynamic,1) default(shared)
+#pragma omp parallel for collapse(2) schedule(dynamic,step_size) default(shared)
 #endif
     for(uint64_t sk = 0; sk < sample_steps ; sk++) {
       for(uint64_t stripe = start_idx; stripe < stop_idx; stripe++) {
@@ -921,8 +928,79 @@ static inline void run_VawNormalizedWeightedTask_T(
     }
 }
 
-template<class TFloat>
-static inline void run_GeneralizedTask_T(
+// Generalized UniFrac alpha values that get a dedicated kernel
+// Any other value uses the generic pow-based one
+#define GENERALIZED_ALPHA_ANY  0
+#define GENERALIZED_ALPHA_ZERO 1
+#define GENERALIZED_ALPHA_HALF 2
+#define GENERALIZED_ALPHA_ONE  3
+
+// Add the contribution of a single branch to the generalized stripe and total
+//   sum_pow1 = pow(sum1, alpha) * length
+//   my_stripe += sum_pow1 * (diff1 / sum1)
+//   my_stripe_total += sum_pow1
+// Assumes sum1 != 0
+template<class TFloat, int alpha_kind>
+static inline void GeneralizedAdd(
+                      TFloat &my_stripe,
+                      TFloat &my_stripe_total,
+                      const TFloat sum1,
+                      const TFloat diff1,
+                      const TFloat length,
+                      const TFloat g_unifrac_alpha) {
+    if constexpr (alpha_kind==GENERALIZED_ALPHA_ONE) {
+       // pow(sum1,1)/sum1 == 1
+       my_stripe += diff1 * length;
+       my_stripe_total += sum1 * length;
+    } else if constexpr (alpha_kind==GENERALIZED_ALPHA_HALF) {
+       // pow(sum1,0.5)/sum1 == 1/sqrt(sum1)
+       const TFloat sum_sqrt1 = sqrt(sum1);
+       my_stripe += (diff1 / sum_sqrt1) * length;
+       my_stripe_total += sum_sqrt1 * length;
+    } else if constexpr (alpha_kind==GENERALIZED_ALPHA_ZERO) {
+       // pow(sum1,0) == 1
+       my_stripe += (diff1 / sum1) * length;
+       my_stripe_total += length;
+    } else {
+       const TFloat sum_pow1 = pow(sum1, g_unifrac_alpha) * length;
+       my_stripe += sum_pow1 * (diff1 / sum1);
+       my_stripe_total += sum_pow1;
+    }
+}
+
+#if !(defined(_OPENACC) || defined(OMPGPU))
+// Add the generalized contribution of all the branches between samples k and l1
+// CPU only, uses transposed embedded_proportions
+template<class TFloat, int alpha_kind>
+static inline void GeneralizedPair(
+                      TFloat &my_stripe,
+                      TFloat &my_stripe_total,
+                      const TFloat * const __restrict__ embedded_proportions,
+                      const TFloat * const __restrict__ lengths,
+                      const uint64_t embs_stripe,
+                      const unsigned int filled_embs,
+                      const uint64_t k,
+                      const uint64_t l1,
+                      const TFloat g_unifrac_alpha) {
+            const uint64_t offset_k = embs_stripe*k;
+            const uint64_t offset_l = embs_stripe*l1;
+            for (uint64_t emb=0; emb<filled_embs; emb++) {
+                TFloat u1 = embedded_proportions[offset_k + emb];
+                TFloat v1 = embedded_proportions[offset_l + emb];
+                TFloat sum1 = u1 + v1;
+
+                if(sum1 != 0.0) { 
+                   TFloat length = lengths[emb];
+                   TFloat diff1 = fabs(u1 - v1);
+                   GeneralizedAdd<TFloat,alpha_kind>(my_stripe, my_stripe_total,
+                                                     sum1, diff1, length, g_unifrac_alpha);
+                }
+            }
+}
+#endif
+
+template<class TFloat, int alpha_kind>
+static inline void run_GeneralizedTask_kernel(
                 const uint64_t embs_stripe,
 		const unsigned int filled_embs,
 		const uint64_t start_idx, const uint64_t stop_idx,
@@ -939,7 +1017,7 @@ static inline void run_GeneralizedTask_T(
     // CPU version uses transposed embedded_proportions
 
     // point of thread
-#pragma omp parallel for schedule(dynamic,1) default(shared)
+#pragma omp parallel for collapse(2) schedule(dynamic,step_size) default(shared)
     for(uint64_t sk = 0; sk < sample_steps ; sk++) {
       for(uint64_t stripe = start_idx; stripe < stop_idx; stripe++) {
         for(uint64_t ik = 0; ik < step_size ; ik++) {
@@ -957,22 +1035,9 @@ static inline void run_GeneralizedTask_T(
             TFloat my_stripe = dm_stripe[k];
             TFloat my_stripe_total = dm_stripe_total[k];
 
-            const uint64_t offset_k = embs_stripe*k;
-            const uint64_t offset_l = embs_stripe*l1;
-            for (uint64_t emb=0; emb<filled_embs; emb++) {
-                TFloat u1 = embedded_proportions[offset_k + emb];
-                TFloat v1 = embedded_proportions[offset_l + emb];
-                TFloat sum1 = u1 + v1;
-
-                if(sum1 != 0.0) { 
-                   TFloat length = lengths[emb];
-                   TFloat diff1 = fabs(u1 - v1);
-                   TFloat sum_pow1 = pow(sum1, g_unifrac_alpha) * length; 
-
-                   my_stripe += sum_pow1 * (diff1 / sum1); 
-                   my_stripe_total += sum_pow1; 
-                }
-            }
+            GeneralizedPair<TFloat,alpha_kind>(my_stripe, my_stripe_total,
+                                               embedded_proportions, lengths,
+                                               embs_stripe, filled_embs, k, l1, g_unifrac_alpha);
 
             dm_stripe[k]     = my_stripe;
             dm_stripe_total[k]     = my_stripe_total;
@@ -1022,10 +1087,8 @@ static inline void run_GeneralizedTask_T(
                 if(sum1 != 0.0) { 
                    TFloat length = lengths[emb];
                    TFloat diff1 = fabs(u1 - v1);
-                   TFloat sum_pow1 = pow(sum1, g_unifrac_alpha) * length; 
-
-                   my_stripe += sum_pow1 * (diff1 / sum1); 
-                   my_stripe_total += sum_pow1; 
+                   GeneralizedAdd<TFloat,alpha_kind>(my_stripe, my_stripe_total,
+                                                     sum1, diff1, length, g_unifrac_alpha);
                 }
             }
 
@@ -1040,7 +1103,143 @@ static inline void run_GeneralizedTask_T(
 }
 
 template<class TFloat>
-static inline void run_VawGeneralizedTask_T(
+static inline void run_GeneralizedTask_T(
+                const uint64_t embs_stripe,
+		const unsigned int filled_embs,
+		const uint64_t start_idx, const uint64_t stop_idx,
+		const uint64_t n_samples, const uint64_t n_samples_r,
+		const TFloat * const __restrict__ lengths,
+		const TFloat * const __restrict__ embedded_proportions,
+		TFloat * const __restrict__ dm_stripes_buf,
+		TFloat * const __restrict__ dm_stripes_total_buf,
+		const TFloat g_unifrac_alpha) {
+    if (g_unifrac_alpha==TFloat(1.0)) {
+      run_GeneralizedTask_kernel<TFloat,GENERALIZED_ALPHA_ONE>(
+                         embs_stripe, filled_embs, start_idx, stop_idx, n_samples, n_samples_r,
+                         lengths, embedded_proportions, dm_stripes_buf, dm_stripes_total_buf, g_unifrac_alpha);
+    } else if (g_unifrac_alpha==TFloat(0.5)) {
+      run_GeneralizedTask_kernel<TFloat,GENERALIZED_ALPHA_HALF>(
+                         embs_stripe, filled_embs, start_idx, stop_idx, n_samples, n_samples_r,
+                         lengths, embedded_proportions, dm_stripes_buf, dm_stripes_total_buf, g_unifrac_alpha);
+    } else if (g_unifrac_alpha==TFloat(0.0)) {
+      run_GeneralizedTask_kernel<TFloat,GENERALIZED_ALPHA_ZERO>(
+                         embs_stripe, filled_embs, start_idx, stop_idx, n_samples, n_samples_r,
+                         lengths, embedded_proportions, dm_stripes_buf, dm_stripes_total_buf, g_unifrac_alpha);
+    } else {
+      run_GeneralizedTask_kernel<TFloat,GENERALIZED_ALPHA_ANY>(
+                         embs_stripe, filled_embs, start_idx, stop_idx, n_samples, n_samples_r,
+                         lengths, embedded_proportions, dm_stripes_buf, dm_stripes_total_buf, g_unifrac_alpha);
+    }
+}
+
+// Compute the generalized UniFrac for several alphas at once
+// dm_stripes_bufs[a] and dm_stripes_total_bufs[a] are the buffers of g_unifrac_alphas[a]
+// n_alphas must not exceed GENERALIZED_MULTI_MAX_ALPHAS
+template<class TFloat>
+static inline void run_GeneralizedMultiTask_T(
+                const uint64_t embs_stripe,
+		const unsigned int filled_embs,
+		const uint64_t start_idx, const uint64_t stop_idx,
+		const uint64_t n_samples, const uint64_t n_samples_r,
+		const TFloat * const __restrict__ lengths,
+		const TFloat * const __restrict__ embedded_proportions,
+		TFloat * const * const __restrict__ dm_stripes_bufs,
+		TFloat * const * const __restrict__ dm_stripes_total_bufs,
+		const unsigned int n_alphas,
+		const TFloat * const __restrict__ g_unifrac_alphas) {
+#if !(defined(_OPENACC) || defined(OMPGPU))
+    // CPU version uses transposed embedded_proportions
+    // u1 and v1 are loaded only once for all the alphas, and so is the log for the pow
+    constexpr uint64_t step_size = STEP_SIZE(TFloat);
+    const uint64_t sample_steps = (n_samples+(step_size-1))/step_size; // round up
+
+    int alpha_kinds[GENERALIZED_MULTI_MAX_ALPHAS];
+    bool need_log = false;
+    for (unsigned int a=0; a<n_alphas; a++) {
+      const TFloat alpha = g_unifrac_alphas[a];
+      if (alpha==TFloat(1.0)) {
+        alpha_kinds[a] = GENERALIZED_ALPHA_ONE;
+      } else if (alpha==TFloat(0.5)) {
+        alpha_kinds[a] = GENERALIZED_ALPHA_HALF;
+      } else if (alpha==TFloat(0.0)) {
+        alpha_kinds[a] = GENERALIZED_ALPHA_ZERO;
+      } else {
+        alpha_kinds[a] = GENERALIZED_ALPHA_ANY;
+        need_log = true;
+      }
+    }
+
+    // point of thread
+#pragma omp parallel for collapse(2) schedule(dynamic,step_size) default(shared)
+    for(uint64_t sk = 0; sk < sample_steps ; sk++) {
+      for(uint64_t stripe = start_idx; stripe < stop_idx; stripe++) {
+        for(uint64_t ik = 0; ik < step_size ; ik++) {
+            const uint64_t k = sk*step_size + ik;
+            const uint64_t idx = (stripe-start_idx) * n_samples_r;
+
+            if (k>=n_samples) continue; // past the limit
+
+            const uint64_t l1 = (k + stripe + 1)%n_samples; // wraparound
+
+            TFloat my_stripe[GENERALIZED_MULTI_MAX_ALPHAS];
+            TFloat my_stripe_total[GENERALIZED_MULTI_MAX_ALPHAS];
+            for (unsigned int a=0; a<n_alphas; a++) {
+              my_stripe[a] = dm_stripes_bufs[a][idx+k];
+              my_stripe_total[a] = dm_stripes_total_bufs[a][idx+k];
+            }
+
+            const uint64_t offset_k = embs_stripe*k;
+            const uint64_t offset_l = embs_stripe*l1;
+            for (uint64_t emb=0; emb<filled_embs; emb++) {
+                TFloat u1 = embedded_proportions[offset_k + emb];
+                TFloat v1 = embedded_proportions[offset_l + emb];
+                TFloat sum1 = u1 + v1;
+
+                if(sum1 != 0.0) { 
+                   const TFloat length = lengths[emb];
+                   const TFloat diff1 = fabs(u1 - v1);
+                   const TFloat log_sum1 = need_log ? log(sum1) : TFloat(0.0);
+                   for (unsigned int a=0; a<n_alphas; a++) {
+                     if (alpha_kinds[a]==GENERALIZED_ALPHA_ANY) {
+                       // pow(sum1, alpha) == exp(alpha*log(sum1))
+                       const TFloat sum_pow1 = exp(g_unifrac_alphas[a]*log_sum1) * length;
+                       my_stripe[a] += sum_pow1 * (diff1 / sum1);
+                       my_stripe_total[a] += sum_pow1;
+                     } else if (alpha_kinds[a]==GENERALIZED_ALPHA_ONE) {
+                       GeneralizedAdd<TFloat,GENERALIZED_ALPHA_ONE>(my_stripe[a], my_stripe_total[a],
+                                                                    sum1, diff1, length, g_unifrac_alphas[a]);
+                     } else if (alpha_kinds[a]==GENERALIZED_ALPHA_HALF) {
+                       GeneralizedAdd<TFloat,GENERALIZED_ALPHA_HALF>(my_stripe[a], my_stripe_total[a],
+                                                                     sum1, diff1, length, g_unifrac_alphas[a]);
+                     } else {
+                       GeneralizedAdd<TFloat,GENERALIZED_ALPHA_ZERO>(my_stripe[a], my_stripe_total[a],
+                                                                     sum1, diff1, length, g_unifrac_alphas[a]);
+                     }
+                   }
+                }
+            }
+
+            for (unsigned int a=0; a<n_alphas; a++) {
+              dm_stripes_bufs[a][idx+k] = my_stripe[a];
+              dm_stripes_total_bufs[a][idx+k] = my_stripe_total[a];
+            }
+        }
+
+      }
+    }
+#else
+    // The GPU kernels cannot follow the pointer arrays, so just run the alphas one after the other
+    // The embedded proportions are still shared between them
+    for (unsigned int a=0; a<n_alphas; a++) {
+      run_GeneralizedTask_T<TFloat>(embs_stripe, filled_embs, start_idx, stop_idx, n_samples, n_samples_r,
+                                    lengths, embedded_proportions, dm_stripes_bufs[a], dm_stripes_total_bufs[a],
+                                    g_unifrac_alphas[a]);
+    }
+#endif
+}
+
+template<class TFloat, int alpha_kind>
+static inline void run_VawGeneralizedTask_kernel(
 		const unsigned int filled_embs,
 		const uint64_t start_idx, const uint64_t stop_idx, const uint64_t n_samples, const uint64_t n_samples_r,
 		const TFloat * const __restrict__ lengths,
@@ -1066,7 +1265,7 @@ static inline void run_VawGeneralizedTask_T(
 #endif
 
 #else
-#pragma omp parallel for schedule(dynamic,1) default(shared)
+#pragma omp parallel for collapse(2) schedule(dynamic,step_size) default(shared)
 #endif
     for(uint64_t sk = 0; sk < sample_steps ; sk++) {
       for(uint64_t stripe = start_idx; stripe < stop_idx; stripe++) {
@@ -1103,10 +1302,8 @@ static inline void run_VawGeneralizedTask_T(
 
                   TFloat sum1 = (u1 + v1) / vaw;
                   TFloat sub1 = fabs(u1 - v1) / vaw;
-                  TFloat sum_pow1 = pow(sum1, g_unifrac_alpha) * length;
-
-                  my_stripe += sum_pow1 * (sub1 / sum1);
-                  my_stripe_total += sum_pow1;
+                  GeneralizedAdd<TFloat,alpha_kind>(my_stripe, my_stripe_total,
+                                                    sum1, sub1, length, g_unifrac_alpha);
                 }
             }
 
@@ -1118,6 +1315,40 @@ static inline void run_VawGeneralizedTask_T(
     }
 }
 
+template<class TFloat>
+static inline void run_VawGeneralizedTask_T(
+		const unsigned int filled_embs,
+		const uint64_t start_idx, const uint64_t stop_idx, const uint64_t n_samples, const uint64_t n_samples_r,
+		const TFloat * const __restrict__ lengths,
+		const TFloat * const __restrict__ embedded_proportions,
+		const TFloat * const __restrict__ embedded_counts,
+		const TFloat * const __restrict__ sample_total_counts ,
+		TFloat * const __restrict__ dm_stripes_buf,
+		TFloat * const __restrict__ dm_stripes_total_buf,
+		const TFloat g_unifrac_alpha) {
+    if (g_unifrac_alpha==TFloat(1.0)) {
+      run_VawGeneralizedTask_kernel<TFloat,GENERALIZED_ALPHA_ONE>(
+                         filled_embs, start_idx, stop_idx, n_samples, n_samples_r,
+                         lengths, embedded_proportions, embedded_counts, sample_total_counts,
+                         dm_stripes_buf, dm_stripes_total_buf, g_unifrac_alpha);
+    } else if (g_unifrac_alpha==TFloat(0.5)) {
+      run_VawGeneralizedTask_kernel<TFloat,GENERALIZED_ALPHA_HALF>(
+                         filled_embs, start_idx, stop_idx, n_samples, n_samples_r,
+                         lengths, embedded_proportions, embedded_counts, sample_total_counts,
+                         dm_stripes_buf, dm_stripes_total_buf, g_unifrac_alpha);
+    } else if (g_unifrac_alpha==TFloat(0.0)) {
+      run_VawGeneralizedTask_kernel<TFloat,GENERALIZED_ALPHA_ZERO>(
+                         filled_embs, start_idx, stop_idx, n_samples, n_samples_r,
+                         lengths, embedded_proportions, embedded_counts, sample_total_counts,
+                         dm_stripes_buf, dm_stripes_total_buf, g_unifrac_alpha);
+    } else {
+      run_VawGeneralizedTask_kernel<TFloat,GENERALIZED_ALPHA_ANY>(
+                         filled_embs, start_idx, stop_idx, n_samples, n_samples_r,
+                         lengths, embedded_proportions, embedded_counts, sample_total_counts,
+                         dm_stripes_buf, dm_stripes_total_buf, g_unifrac_alpha);
+    }
+}
+
 // Single step in computing Unweighted Unifrac
 
 template<class TFloat>
@@ -1278,18 +1509,285 @@ static inline void Unweighted1(
 }
 #else
 
+// Sum the lengths of the bits set in u^v (and u|v, if compute_total)
+// between two packed presence/absence rows.
+// Returns false if all the u|v values were zero.
+//
+// The generic version resolves 8 bits at a time using the pre-computed sums.
+// The x86_v4 (AVX-512) and x86_v3 (AVX2) builds instead use the bits directly
+// as lane masks on the lengths, which avoids the byte-by-byte lookups.
+// Note: Lengths past filled_embs may be stale, but their bits are always zero.
+template<bool compute_total, class TFloat>
+static inline bool UnweightedPairSumsLUT(
+                      TFloat &my_stripe,
+                      TFloat &my_stripe_total,
+                      const TFloat * const   __restrict__ lengths,
+                      const TFloat * const   __restrict__ sums,
+                      const uint64_t * const __restrict__ emb_k,
+                      const uint64_t * const __restrict__ emb_l,
+                      const unsigned int filled_embs_els_round) {
+    bool did_update = false;
+    for (uint64_t emb_el=0; emb_el<filled_embs_els_round; emb_el++) {
+        const TFloat * __restrict__ psum = &(sums[emb_el*0x800]);
+
+        uint64_t u1 = emb_k[emb_el];
+        uint64_t v1 = emb_l[emb_el];
+        uint64_t o1 = u1 | v1;
+        uint64_t x1 = u1 ^ v1;
+
+        if (o1==0) {  // zeros are prevalent
+            // nothing to do
+        } else {
+            did_update=true;
+
+            // Use the pre-computed sums
+            // Each range of 8 lengths has already been pre-computed and stored in psum
+            // Since embedded_proportions packed format is in 64-bit format for performance reasons
+            //    we need to add the 8 sums using the four 8-bits for addressing inside psum
+            for (int i=0; i<8; i++) {
+              uint8_t o1_8 = (uint8_t)(o1);
+              if (o1_8!=0) {
+                if constexpr (compute_total) my_stripe_total += psum[o1_8];
+                my_stripe       += psum[(uint8_t)(x1)];
+              }
+              o1 = o1 >> 8;
+              x1 = x1 >> 8;
+              psum += 0x100;
+            }
+        }
+    }
+    return did_update;
+}
+
+#if defined(__AVX2__)
+// horizontal sums of the SIMD accumulators
+static inline double UnweightedHSum(const __m256d acc) {
+    const __m128d h = _mm_add_pd(_mm256_castpd256_pd128(acc), _mm256_extractf128_pd(acc, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+}
+
+static inline float UnweightedHSum(const __m256 acc) {
+    __m128 h = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+    return _mm_cvtss_f32(_mm_add_ss(h, _mm_movehdup_ps(h)));
+}
+#endif
+
+#if defined(__AVX512F__)
+
+// Note: Going through memory, as the lane extraction intrinsics
+//       trigger spurious warnings in older compilers
+static inline double UnweightedHSum(const __m512d acc) {
+    alignas(64) double h[8];
+    _mm512_store_pd(h, acc);
+    const __m256d h4 = _mm256_add_pd(_mm256_load_pd(h), _mm256_load_pd(h+4));
+    return UnweightedHSum(h4);
+}
+
+static inline float UnweightedHSum(const __m512 acc) {
+    alignas(64) float h[16];
+    _mm512_store_ps(h, acc);
+    const __m256 h8 = _mm256_add_ps(_mm256_load_ps(h), _mm256_load_ps(h+8));
+    return UnweightedHSum(h8);
+}
+
+template<bool compute_total>
+static inline bool UnweightedPairSums(
+                      double &my_stripe,
+                      double &my_stripe_total,
+                      const double * const   __restrict__ lengths,
+                      const double * const   __restrict__ sums,
+                      const uint64_t * const __restrict__ emb_k,
+                      const uint64_t * const __restrict__ emb_l,
+                      const unsigned int filled_embs_els_round) {
+    bool did_update = false;
+    // two accumulators each, to shorten the dependency chains
+    __m512d acc_x0 = _mm512_setzero_pd();
+    __m512d acc_x1 = _mm512_setzero_pd();
+    __m512d acc_o0 = _mm512_setzero_pd();
+    __m512d acc_o1 = _mm512_setzero_pd();
+
+    for (uint64_t emb_el=0; emb_el<filled_embs_els_round; emb_el++) {
+        const uint64_t u1 = emb_k[emb_el];
+        const uint64_t v1 = emb_l[emb_el];
+        const uint64_t o1 = u1 | v1;
+
+        if (o1!=0) {  // zeros are prevalent
+            did_update = true;
+            const uint64_t x1 = u1 ^ v1;
+            const double * __restrict__ pl = &(lengths[emb_el*64]);
+
+            // each byte of the packed bits masks 8 lengths
+            for (int i=0; i<64; i+=16) {
+                const __m512d l0 = _mm512_loadu_pd(pl+i);
+                const __m512d l1 = _mm512_loadu_pd(pl+i+8);
+                acc_x0 = _mm512_mask_add_pd(acc_x0, (__mmask8)(x1 >> i),     acc_x0, l0);
+                acc_x1 = _mm512_mask_add_pd(acc_x1, (__mmask8)(x1 >> (i+8)), acc_x1, l1);
+                if constexpr (compute_total) {
+                acc_o0 = _mm512_mask_add_pd(acc_o0, (__mmask8)(o1 >> i),     acc_o0, l0);
+                acc_o1 = _mm512_mask_add_pd(acc_o1, (__mmask8)(o1 >> (i+8)), acc_o1, l1);
+                }
+            }
+        }
+    }
+
+    my_stripe = UnweightedHSum(_mm512_add_pd(acc_x0, acc_x1));
+    if constexpr (compute_total) {
+    my_stripe_total = UnweightedHSum(_mm512_add_pd(acc_o0, acc_o1));
+    }
+    return did_update;
+}
+
+template<bool compute_total>
+static inline bool UnweightedPairSums(
+                      float &my_stripe,
+                      float &my_stripe_total,
+                      const float * const    __restrict__ lengths,
+                      const float * const    __restrict__ sums,
+                      const uint64_t * const __restrict__ emb_k,
+                      const uint64_t * const __restrict__ emb_l,
+                      const unsigned int filled_embs_els_round) {
+    bool did_update = false;
+    __m512 acc_x0 = _mm512_setzero_ps();
+    __m512 acc_x1 = _mm512_setzero_ps();
+    __m512 acc_o0 = _mm512_setzero_ps();
+    __m512 acc_o1 = _mm512_setzero_ps();
+
+    for (uint64_t emb_el=0; emb_el<filled_embs_els_round; emb_el++) {
+        const uint64_t u1 = emb_k[emb_el];
+        const uint64_t v1 = emb_l[emb_el];
+        const uint64_t o1 = u1 | v1;
+
+        if (o1!=0) {  // zeros are prevalent
+            did_update = true;
+            const uint64_t x1 = u1 ^ v1;
+            const float * __restrict__ pl = &(lengths[emb_el*64]);
+
+            // each 16 bits of the packed bits mask 16 lengths
+            for (int i=0; i<64; i+=32) {
+                const __m512 l0 = _mm512_loadu_ps(pl+i);
+                const __m512 l1 = _mm512_loadu_ps(pl+i+16);
+                acc_x0 = _mm512_mask_add_ps(acc_x0, (__mmask16)(x1 >> i),      acc_x0, l0);
+                acc_x1 = _mm512_mask_add_ps(acc_x1, (__mmask16)(x1 >> (i+16)), acc_x1, l1);
+                if constexpr (compute_total) {
+                acc_o0 = _mm512_mask_add_ps(acc_o0, (__mmask16)(o1 >> i),      acc_o0, l0);
+                acc_o1 = _mm512_mask_add_ps(acc_o1, (__mmask16)(o1 >> (i+16)), acc_o1, l1);
+                }
+            }
+        }
+    }
+
+    my_stripe = UnweightedHSum(_mm512_add_ps(acc_x0, acc_x1));
+    if constexpr (compute_total) {
+    my_stripe_total = UnweightedHSum(_mm512_add_ps(acc_o0, acc_o1));
+    }
+    return did_update;
+}
+
+#elif defined(__AVX2__)
+
+// expand the low 8 bits of val into 8 lanes of all-ones/all-zeros
+static inline __m256i UnweightedExpand8(const uint64_t val, const __m256i bits) {
+    const __m256i bv = _mm256_set1_epi32((int)(val & 0xff));
+    return _mm256_cmpeq_epi32(_mm256_and_si256(bv, bits), bits);
+}
+
+// With only 4 lanes, the 8-bit lookups are still faster for fp64
+template<bool compute_total>
+static inline bool UnweightedPairSums(
+                      double &my_stripe,
+                      double &my_stripe_total,
+                      const double * const   __restrict__ lengths,
+                      const double * const   __restrict__ sums,
+                      const uint64_t * const __restrict__ emb_k,
+                      const uint64_t * const __restrict__ emb_l,
+                      const unsigned int filled_embs_els_round) {
+    return UnweightedPairSumsLUT<compute_total>(my_stripe, my_stripe_total, lengths, sums,
+                                                emb_k, emb_l, filled_embs_els_round);
+}
+
+template<bool compute_total>
+static inline bool UnweightedPairSums(
+                      float &my_stripe,
+                      float &my_stripe_total,
+                      const float * const    __restrict__ lengths,
+                      const float * const    __restrict__ sums,
+                      const uint64_t * const __restrict__ emb_k,
+                      const uint64_t * const __restrict__ emb_l,
+                      const unsigned int filled_embs_els_round) {
+    const __m256i bits = _mm256_setr_epi32(1,2,4,8,16,32,64,128);
+    bool did_update = false;
+    __m256 acc_x0 = _mm256_setzero_ps();
+    __m256 acc_x1 = _mm256_setzero_ps();
+    __m256 acc_o0 = _mm256_setzero_ps();
+    __m256 acc_o1 = _mm256_setzero_ps();
+
+    for (uint64_t emb_el=0; emb_el<filled_embs_els_round; emb_el++) {
+        const uint64_t u1 = emb_k[emb_el];
+        const uint64_t v1 = emb_l[emb_el];
+        uint64_t o1 = u1 | v1;
+
+        if (o1!=0) {  // zeros are prevalent
+            did_update = true;
+            uint64_t x1 = u1 ^ v1;
+            const float * __restrict__ pl = &(lengths[emb_el*64]);
+
+            // two bytes at a time, skipping the empty ones
+            for (int i=0; i<4; i++) {
+                if ((uint16_t)(o1)!=0) {
+                    const __m256 l0 = _mm256_loadu_ps(pl);
+                    const __m256 l1 = _mm256_loadu_ps(pl+8);
+                    acc_x0 = _mm256_add_ps(acc_x0, _mm256_and_ps(_mm256_castsi256_ps(UnweightedExpand8(x1,      bits)), l0));
+                    acc_x1 = _mm256_add_ps(acc_x1, _mm256_and_ps(_mm256_castsi256_ps(UnweightedExpand8(x1 >> 8, bits)), l1));
+                    if constexpr (compute_total) {
+                    acc_o0 = _mm256_add_ps(acc_o0, _mm256_and_ps(_mm256_castsi256_ps(UnweightedExpand8(o1,      bits)), l0));
+                    acc_o1 = _mm256_add_ps(acc_o1, _mm256_and_ps(_mm256_castsi256_ps(UnweightedExpand8(o1 >> 8, bits)), l1));
+                    }
+                }
+                o1 = o1 >> 16;
+                x1 = x1 >> 16;
+                pl += 16;
+            }
+        }
+    }
+
+    my_stripe = UnweightedHSum(_mm256_add_ps(acc_x0, acc_x1));
+    if constexpr (compute_total) {
+    my_stripe_total = UnweightedHSum(_mm256_add_ps(acc_o0, acc_o1));
+    }
+    return did_update;
+}
+
+#else
+
+template<bool compute_total, class TFloat>
+static inline bool UnweightedPairSums(
+                      TFloat &my_stripe,
+                      TFloat &my_stripe_total,
+                      const TFloat * const   __restrict__ lengths,
+                      const TFloat * const   __restrict__ sums,
+                      const uint64_t * const __restrict__ emb_k,
+                      const uint64_t * const __restrict__ emb_l,
+                      const unsigned int filled_embs_els_round) {
+    return UnweightedPairSumsLUT<compute_total>(my_stripe, my_stripe_total, lengths, sums,
+                                                emb_k, emb_l, filled_embs_els_round);
+}
+
+#endif
+
+// Unweighted distance and total between samples k and l1
+// Returns false if there is nothing to add
 template<class TFloat, bool compute_total>
-static inline void Unweighted1(
-                      TFloat * const __restrict__ dm_stripes_buf,
-                      TFloat * const __restrict__ dm_stripes_total_buf,
+static inline bool UnweightedPair(
+                      TFloat &my_stripe,
+                      TFloat &my_stripe_total,
                       const bool   * const __restrict__ zcheck,
                       const TFloat * const   __restrict__ stripe_sums,
+                      const TFloat * const   __restrict__ lengths,
                       const TFloat * const   __restrict__ sums,
                       const uint64_t * const __restrict__ embedded_proportions,
                       const uint64_t embs_stripe,
                       const unsigned int filled_embs_els_round,
-                      const uint64_t idx,
-                      const uint64_t n_samples_r,
                       const uint64_t k,
                       const uint64_t l1) {
        const bool allzero_k = zcheck[k];
@@ -1297,67 +1795,61 @@ static inline void Unweighted1(
 
        if (allzero_k && allzero_l1) {
           // nothing to do, would have to add 0
-       } else {
-          TFloat * const __restrict__ dm_stripe = dm_stripes_buf+idx;
-          TFloat * const __restrict__ dm_stripe_total = compute_total ? dm_stripes_total_buf+idx : NULL;
-          //TFloat *dm_stripe = dm_stripes[stripe];
-          //TFloat *dm_stripe_total = dm_stripes_total[stripe];
-
-          bool did_update = false;
-          TFloat my_stripe = 0.0;
-          TFloat my_stripe_total = 0.0;
-
-          if (allzero_k || allzero_l1) {
-            // with one side zero, | and ^ are no-ops
-            const uint64_t kl = (allzero_k) ? l1 : k; // only use the non-sero onea
-            my_stripe = stripe_sums[kl];
-            if constexpr (compute_total) {
-            my_stripe_total = my_stripe;
-            }
-            did_update = (my_stripe!=0.0);
-          } else {
-            // we need both sides
-            const uint64_t offset_k = embs_stripe*k;
-            const uint64_t offset_l = embs_stripe*l1;
-            for (uint64_t emb_el=0; emb_el<filled_embs_els_round; emb_el++) {
-                const TFloat * __restrict__ psum = &(sums[emb_el*0x800]);
+          return false;
+       }
 
-                uint64_t u1 = embedded_proportions[offset_k + emb_el];
-                uint64_t v1 = embedded_proportions[offset_l + emb_el];
-                uint64_t o1 = u1 | v1;
-                uint64_t x1 = u1 ^ v1;
+       my_stripe = 0.0;
+       my_stripe_total = 0.0;
 
-                if (o1==0) {  // zeros are prevalent
-                    // nothing to do
-                } else {
-                    did_update=true;
+       if (allzero_k || allzero_l1) {
+         // with one side zero, | and ^ are no-ops
+         const uint64_t kl = (allzero_k) ? l1 : k; // only use the non-sero onea
+         my_stripe = stripe_sums[kl];
+         if constexpr (compute_total) {
+         my_stripe_total = my_stripe;
+         }
+         return (my_stripe!=0.0);
+       }
 
-                    // Use the pre-computed sums
-                    // Each range of 8 lengths has already been pre-computed and stored in psum
-                    // Since embedded_proportions packed format is in 64-bit format for performance reasons
-                    //    we need to add the 8 sums using the four 8-bits for addressing inside psum
-		    for (int i=0; i<8; i++) {
-		      uint8_t o1_8 = (uint8_t)(o1);
-                      if (o1_8!=0) {
-                        if constexpr (compute_total) my_stripe_total += psum[o1_8];
-                        my_stripe       += psum[(uint8_t)(x1)];
-		      }
-		      o1 = o1 >> 8;
-		      x1 = x1 >> 8;
-		      psum += 0x100;
-		    }
-                }
-            }
-          } // (allzero_k || allzero_l1)
+       // we need both sides
+       return UnweightedPairSums<compute_total>(
+                                my_stripe, my_stripe_total,
+                                lengths, sums,
+                                embedded_proportions + embs_stripe*k,
+                                embedded_proportions + embs_stripe*l1,
+                                filled_embs_els_round);
+}
 
-          if (did_update) {
-              dm_stripe[k]       += my_stripe;
-              if constexpr (compute_total) {
-              dm_stripe_total[k] += my_stripe_total;
-              }
+template<class TFloat, bool compute_total>
+static inline void Unweighted1(
+                      TFloat * const __restrict__ dm_stripes_buf,
+                      TFloat * const __restrict__ dm_stripes_total_buf,
+                      const bool   * const __restrict__ zcheck,
+                      const TFloat * const   __restrict__ stripe_sums,
+                      const TFloat * const   __restrict__ lengths,
+                      const TFloat * const   __restrict__ sums,
+                      const uint64_t * const __restrict__ embedded_proportions,
+                      const uint64_t embs_stripe,
+                      const unsigned int filled_embs_els_round,
+                      const uint64_t idx,
+                      const uint64_t n_samples_r,
+                      const uint64_t k,
+                      const uint64_t l1) {
+       TFloat my_stripe;
+       TFloat my_stripe_total;
+
+       if (UnweightedPair<TFloat,compute_total>(
+                                my_stripe, my_stripe_total,
+                                zcheck, stripe_sums, lengths, sums,
+                                embedded_proportions, embs_stripe, filled_embs_els_round,
+                                k, l1)) {
+          TFloat * const __restrict__ dm_stripe = dm_stripes_buf+idx;
+          dm_stripe[k]       += my_stripe;
+          if constexpr (compute_total) {
+          TFloat * const __restrict__ dm_stripe_total = dm_stripes_total_buf+idx;
+          dm_stripe_total[k] += my_stripe_total;
           }
-       } // (allzero_k && allzero_l1)
-
+       }
 }
 #endif
 
@@ -1421,31 +1913,16 @@ static inline void UnweightedZerosAndSums(
 
 }
 
+// Pre-compute the sums of the lengths for every combination of 8 bits
+// sums must have space for 0x800 elements per 64 embs
 template<class TFloat>
-static inline void run_UnweightedTask_T(
-		const uint64_t embs_stripe,
-		const unsigned int filled_embs,
-		const uint64_t start_idx, const uint64_t stop_idx,
-		const uint64_t n_samples, const uint64_t n_samples_r,
-		const TFloat * const __restrict__ lengths,
-		const uint64_t * const __restrict__ embedded_proportions,
-		TFloat * const __restrict__ dm_stripes_buf,
-		TFloat * const __restrict__ dm_stripes_total_buf,
+static inline void UnweightedLengthSums(
 		TFloat * const __restrict__ sums,
-		bool   * const __restrict__ zcheck,
-		uint32_t* const __restrict__ idxs,
-		TFloat * const __restrict__ stripe_sums) {
-    static constexpr bool compute_total = true;
-
-    constexpr uint64_t step_size = STEP_SIZE(TFloat);
-    const uint64_t sample_steps = (n_samples+(step_size-1))/step_size; // round up
-
+		const TFloat * const __restrict__ lengths,
+		const unsigned int filled_embs) {
     const uint64_t filled_embs_els = filled_embs/64;
     const uint64_t filled_embs_rem = filled_embs%64; 
 
-    const uint64_t filled_embs_els_round = (filled_embs+63)/64;
-
-    // pre-compute sums of length elements, since they are likely to be accessed many times
     // We will use a 8-bit map, to keep it small enough to keep in L1 cache
 #if defined(OMPGPU)
     // TODO: Explore async omp target
@@ -1512,6 +1989,31 @@ static inline void run_UnweightedTask_T(
           }
         }
     }
+}
+
+template<class TFloat>
+static inline void run_UnweightedTask_T(
+		const uint64_t embs_stripe,
+		const unsigned int filled_embs,
+		const uint64_t start_idx, const uint64_t stop_idx,
+		const uint64_t n_samples, const uint64_t n_samples_r,
+		const TFloat * const __restrict__ lengths,
+		const uint64_t * const __restrict__ embedded_proportions,
+		TFloat * const __restrict__ dm_stripes_buf,
+		TFloat * const __restrict__ dm_stripes_total_buf,
+		TFloat * const __restrict__ sums,
+		bool   * const __restrict__ zcheck,
+		uint32_t* const __restrict__ idxs,
+		TFloat * const __restrict__ stripe_sums) {
+    static constexpr bool compute_total = true;
+
+    constexpr uint64_t step_size = STEP_SIZE(TFloat);
+    const uint64_t sample_steps = (n_samples+(step_size-1))/step_size; // round up
+
+    const uint64_t filled_embs_els_round = (filled_embs+63)/64;
+
+    // pre-compute sums of length elements, since they are likely to be accessed many times
+    UnweightedLengthSums(sums, lengths, filled_embs);
 
 #if !defined(OMPGPU) && defined(_OPENACC)
 #pragma acc wait
@@ -1576,7 +2078,7 @@ static inline void run_UnweightedTask_T(
             Unweighted1<TFloat,compute_total>(
                                 dm_stripes_buf,dm_stripes_total_buf,
                                 zcheck, stripe_sums,
-                                sums, embedded_proportions,
+                                lengths, sums, embedded_proportions,
                                 embs_stripe,filled_embs_els_round,idx, n_samples_r,
                                 k, l1);
            } // if k
@@ -1606,78 +2108,10 @@ static inline void run_UnnormalizedUnweightedTask_T(
     constexpr uint64_t step_size = STEP_SIZE(TFloat);
     const uint64_t sample_steps = (n_samples+(step_size-1))/step_size; // round up
 
-    const uint64_t filled_embs_els = filled_embs/64;
-    const uint64_t filled_embs_rem = filled_embs%64; 
-
     const uint64_t filled_embs_els_round = (filled_embs+63)/64;
 
     // pre-compute sums of length elements, since they are likely to be accessed many times
-    // We will use a 8-bit map, to keep it small enough to keep in L1 cache
-#if defined(OMPGPU)
-    // TODO: Explore async omp target
-#pragma omp target teams distribute parallel for collapse(2) default(shared)
-#elif defined(_OPENACC)
-#pragma acc parallel loop collapse(2) gang present(lengths,sums) async
-#else 
-#pragma omp parallel for default(shared)
-#endif
-    for (uint64_t emb_el=0; emb_el<filled_embs_els; emb_el++) {
-       for (uint64_t sub8=0; sub8<8; sub8++) {
-          const uint64_t emb8 = emb_el*8+sub8;
-          TFloat * __restrict__ psum = &(sums[emb8<<8]);
-          const TFloat * __restrict__ pl   = &(lengths[emb8*8]);
-
-#if defined(OMPGPU)
-#pragma omp simd
-#elif defined(_OPENACC)
-#pragma acc loop vector
-#endif
-          // compute all the combinations for this block (8-bits total)
-          // psum[0] = 0.0   // +0*pl[0]+0*pl[1]+0*pl[2]+...
-          // psum[1] = pl[0] // +0*pl[1]+0*pl[2]+...
-          // psum[2] = pl[1] // +0*pl[0]+0*pl[2]+
-          // psum[2] = pl[0] + pl[1]
-          // ...
-          // psum[255] = pl[1] +.. + pl[7] // + 0*pl[0]
-          // psum[255] = pl[0] +pl[1] +.. + pl[7]
-          for (uint64_t b8_i=0; b8_i<0x100; b8_i++) {
-             psum[b8_i] = (((b8_i >> 0) & 1) * pl[0]) + (((b8_i >> 1) & 1) * pl[1]) + 
-                          (((b8_i >> 2) & 1) * pl[2]) + (((b8_i >> 3) & 1) * pl[3]) +
-                          (((b8_i >> 4) & 1) * pl[4]) + (((b8_i >> 5) & 1) * pl[5]) +
-                          (((b8_i >> 6) & 1) * pl[6]) + (((b8_i >> 7) & 1) * pl[7]);
-          }
-       }
-    }
-    if (filled_embs_rem>0) { // add also the overflow elements
-       const uint64_t emb_el=filled_embs_els;
-#if defined(OMPGPU)
-#pragma omp target teams distribute parallel for default(shared)
-#elif defined(_OPENACC)
-#pragma acc parallel loop gang present(lengths,sums) async
-#else
-       // no advantage of OMP, too small
-#endif
-       for (uint64_t sub8=0; sub8<8; sub8++) {
-          // we are summing we have enough buffer in sums
-          const uint64_t emb8 = emb_el*8+sub8;
-          TFloat * __restrict__ psum = &(sums[emb8<<8]);
-
-#if defined(OMPGPU)
-#pragma omp simd
-#elif defined(_OPENACC)
-#pragma acc loop vector
-#endif
-          // compute all the combinations for this block, set to 0 any past the limit
-          // as above
-          for (uint64_t b8_i=0; b8_i<0x100; b8_i++) {
-             TFloat val= 0;
-             for (uint64_t li=(emb8*8); li<filled_embs; li++) {
-               val += ((b8_i >>  (li-(emb8*8))) & 1) * lengths[li];
-             }
-             psum[b8_i] = val;
-          }
-        }
-    }
+    UnweightedLengthSums(sums, lengths, filled_embs);
 
 #if !defined(OMPGPU) && defined(_OPENACC)
 #pragma acc wait
@@ -1740,7 +2174,7 @@ static inline void run_UnnormalizedUnweightedTask_T(
             Unweighted1<TFloat,compute_total>(
                                 dm_stripes_buf,NULL,
                                 zcheck, stripe_sums,
-                                sums, embedded_proportions,
+                                lengths, sums, embedded_proportions,
                                 embs_stripe,filled_embs_els_round,idx, n_samples_r,
                                 k, l1);
            } // if k
@@ -1780,7 +2214,7 @@ static inline void run_VawUnweightedTask_T(
 #endif
 
 #else
-#pragma omp parallel for schedule(dynamic,1) default(shared)
+#pragma omp parallel for collapse(2) schedule(dynamic,step_size) default(shared)
 #endif
     for(uint64_t sk = 0; sk < sample_steps ; sk++) {
       for(uint64_t stripe = start_idx; stripe < stop_idx; stripe++) {
@@ -1872,7 +2306,7 @@ static inline void run_VawUnnormalizedUnweightedTask_T(
 #endif
 
 #else
-#pragma omp parallel for schedule(dynamic,1) default(shared)
+#pragma omp parallel for collapse(2) schedule(dynamic,step_size) default(shared)
 #endif
     for(uint64_t sk = 0; sk < sample_steps ; sk++) {
       for(uint64_t stripe = start_idx; stripe < stop_idx; stripe++) {
@@ -1931,3 +2365,241 @@ static inline void run_VawUnnormalizedUnweightedTask_T(
     }
 }
 
+#if !(defined(_OPENACC) || defined(OMPGPU))
+/*
+ * Square tile kernels, CPU only
+ *
+ * The upper triangle of the distance matrix is split in tile_size x tile_size tiles,
+ * stored one after the other, one row of tiles at a time (see su::DMTilesT).
+ * Each (k,l) pair, with k<l, is computed exactly once, and both the k and the l samples
+ * come from a contiguous range, so the l rows of the embedded proportions
+ * are reused for every k in the tile, and the results are written contiguously.
+ */
+
+// Call pair_func(k, l, el) for all k<l pairs, el being the offset of (k,l) in the tiles buffer
+template<class TPairFunc>
+static inline void TilesForEachPair(
+                const uint64_t n_samples, const uint64_t tile_size,
+                TPairFunc pair_func) {
+    const uint64_t n_blocks = (n_samples+(tile_size-1))/tile_size; // round up
+    const uint64_t tile_els = tile_size*tile_size;
+
+    // use dynamic scheduling, since the tiles on the diagonal are only half full
+#pragma omp parallel for collapse(2) schedule(dynamic,1) default(shared)
+    for(uint64_t bi = 0; bi < n_blocks ; bi++) {
+     for(uint64_t bj = 0; bj < n_blocks ; bj++) {
+      if (bj<bi) continue; // lower triangle, nothing to do
+
+      const uint64_t tile_idx = bi*(2*n_blocks-bi+1)/2 + (bj-bi);
+      const uint64_t ks = bi*tile_size;
+      const uint64_t ls = bj*tile_size;
+      const uint64_t kmax = std::min(ks+tile_size,n_samples);
+      const uint64_t lmax = std::min(ls+tile_size,n_samples);
+
+      for(uint64_t k = ks; k < kmax ; k++) {
+        // offset of (k,0), so el = row_el + l
+        const uint64_t row_el = tile_idx*tile_els + (k-ks)*tile_size - ls;
+        for(uint64_t l = ((bi==bj) ? (k+1) : ls); l < lmax ; l++) {
+          pair_func(k, l, row_el + l);
+        } // for l
+      } // for k
+     } // for bj
+    } // for bi
+}
+
+template<class TFloat>
+static inline void run_UnnormalizedWeightedTileTask_T(
+		const uint64_t embs_stripe, const unsigned int filled_embs,
+		const uint64_t n_samples, const uint64_t tile_size,
+		const TFloat * const __restrict__ lengths,
+		const TFloat * const __restrict__ embedded_proportions,
+		TFloat * const __restrict__ dm_tiles_buf,
+		bool * const __restrict__ zcheck,
+		TFloat * const __restrict__ sums) {
+    // check for zero values and pre-compute single column sums
+    WeightedZerosAndSums(zcheck, sums,
+                         embedded_proportions, lengths,
+                         embs_stripe, filled_embs, n_samples, n_samples);
+
+    TilesForEachPair(n_samples, tile_size,
+                     [&](const uint64_t k, const uint64_t l, const uint64_t el) {
+       const bool allzero_k = zcheck[k];
+       const bool allzero_l = zcheck[l];
+
+       if (allzero_k && allzero_l) return; // nothing to do, would have to add 0
+
+       // with one side all zeros, use the pre-computed values
+       dm_tiles_buf[el] += (allzero_k) ? sums[l] :
+                           (allzero_l) ? sums[k] :
+                                         WeightedVal1(embedded_proportions, lengths,
+                                                      embs_stripe, filled_embs, n_samples,
+                                                      k, l);
+    });
+}
+
+template<class TFloat>
+static inline void run_NormalizedWeightedTileTask_T(
+		const uint64_t embs_stripe, const unsigned int filled_embs,
+		const uint64_t n_samples, const uint64_t tile_size,
+		const TFloat * const __restrict__ lengths,
+		const TFloat * const __restrict__ embedded_proportions,
+		TFloat * const __restrict__ dm_tiles_buf,
+		TFloat * const __restrict__ dm_tiles_total_buf,
+		bool * const __restrict__ zcheck,
+		TFloat * const __restrict__ sums) {
+    // check for zero values and pre-compute single column sums
+    WeightedZerosAndSums(zcheck, sums,
+                         embedded_proportions, lengths,
+                         embs_stripe, filled_embs, n_samples, n_samples);
+
+    TilesForEachPair(n_samples, tile_size,
+                     [&](const uint64_t k, const uint64_t l, const uint64_t el) {
+       const bool allzero_k = zcheck[k];
+       const bool allzero_l = zcheck[l];
+
+       if (allzero_k && allzero_l) return; // nothing to do, would have to add 0
+
+       const TFloat sum_k = sums[k];
+       const TFloat sum_l = sums[l];
+
+       // the totals can always use the distributed property
+       dm_tiles_total_buf[el] += sum_k + sum_l;
+
+       // with one side all zeros, use the pre-computed values
+       dm_tiles_buf[el] += (allzero_k) ? sum_l :
+                           (allzero_l) ? sum_k :
+                                         WeightedVal1(embedded_proportions, lengths,
+                                                      embs_stripe, filled_embs, n_samples,
+                                                      k, l);
+    });
+}
+
+template<class TFloat, bool compute_total>
+static inline void run_UnweightedTileTask_kernel(
+		const uint64_t embs_stripe,
+		const unsigned int filled_embs,
+		const uint64_t n_samples, const uint64_t tile_size,
+		const TFloat * const __restrict__ lengths,
+		const uint64_t * const __restrict__ embedded_proportions,
+		TFloat * const __restrict__ dm_tiles_buf,
+		TFloat * const __restrict__ dm_tiles_total_buf,
+		TFloat * const __restrict__ sums,
+		bool   * const __restrict__ zcheck,
+		TFloat * const __restrict__ stripe_sums) {
+    const uint64_t filled_embs_els_round = (filled_embs+63)/64;
+
+    // pre-compute sums of length elements, since they are likely to be accessed many times
+    UnweightedLengthSums(sums, lengths, filled_embs);
+
+    // check for zero values and compute stripe sums
+    UnweightedZerosAndSums(zcheck, (uint32_t*) NULL, stripe_sums,
+                           sums, embedded_proportions,
+                           embs_stripe, filled_embs_els_round, n_samples, n_samples);
+
+    TilesForEachPair(n_samples, tile_size,
+                     [&](const uint64_t k, const uint64_t l, const uint64_t el) {
+       TFloat my_stripe;
+       TFloat my_stripe_total;
+
+       if (UnweightedPair<TFloat,compute_total>(
+                                my_stripe, my_stripe_total,
+                                zcheck, stripe_sums, lengths, sums,
+                                embedded_proportions, embs_stripe, filled_embs_els_round,
+                                k, l)) {
+          dm_tiles_buf[el] += my_stripe;
+          if constexpr (compute_total) {
+          dm_tiles_total_buf[el] += my_stripe_total;
+          }
+       }
+    });
+}
+
+template<class TFloat>
+static inline void run_UnweightedTileTask_T(
+		const uint64_t embs_stripe,
+		const unsigned int filled_embs,
+		const uint64_t n_samples, const uint64_t tile_size,
+		const TFloat * const __restrict__ lengths,
+		const uint64_t * const __restrict__ embedded_proportions,
+		TFloat * const __restrict__ dm_tiles_buf,
+		TFloat * const __restrict__ dm_tiles_total_buf,
+		TFloat * const __restrict__ sums,
+		bool   * const __restrict__ zcheck,
+		TFloat * const __restrict__ stripe_sums) {
+    run_UnweightedTileTask_kernel<TFloat,true>(
+                         embs_stripe, filled_embs, n_samples, tile_size,
+                         lengths, embedded_proportions, dm_tiles_buf, dm_tiles_total_buf,
+                         sums, zcheck, stripe_sums);
+}
+
+template<class TFloat>
+static inline void run_UnnormalizedUnweightedTileTask_T(
+		const uint64_t embs_stripe,
+		const unsigned int filled_embs,
+		const uint64_t n_samples, const uint64_t tile_size,
+		const TFloat * const __restrict__ lengths,
+		const uint64_t * const __restrict__ embedded_proportions,
+		TFloat * const __restrict__ dm_tiles_buf,
+		TFloat * const __restrict__ sums,
+		bool   * const __restrict__ zcheck,
+		TFloat * const __restrict__ stripe_sums) {
+    run_UnweightedTileTask_kernel<TFloat,false>(
+                         embs_stripe, filled_embs, n_samples, tile_size,
+                         lengths, embedded_proportions, dm_tiles_buf, (TFloat*) NULL,
+                         sums, zcheck, stripe_sums);
+}
+
+template<class TFloat, int alpha_kind>
+static inline void run_GeneralizedTileTask_kernel(
+                const uint64_t embs_stripe,
+		const unsigned int filled_embs,
+		const uint64_t n_samples, const uint64_t tile_size,
+		const TFloat * const __restrict__ lengths,
+		const TFloat * const __restrict__ embedded_proportions,
+		TFloat * const __restrict__ dm_tiles_buf,
+		TFloat * const __restrict__ dm_tiles_total_buf,
+		const TFloat g_unifrac_alpha) {
+    TilesForEachPair(n_samples, tile_size,
+                     [&](const uint64_t k, const uint64_t l, const uint64_t el) {
+       TFloat my_stripe = 0.0;
+       TFloat my_stripe_total = 0.0;
+
+       GeneralizedPair<TFloat,alpha_kind>(my_stripe, my_stripe_total,
+                                          embedded_proportions, lengths,
+                                          embs_stripe, filled_embs, k, l, g_unifrac_alpha);
+
+       dm_tiles_buf[el]       += my_stripe;
+       dm_tiles_total_buf[el] += my_stripe_total;
+    });
+}
+
+template<class TFloat>
+static inline void run_GeneralizedTileTask_T(
+                const uint64_t embs_stripe,
+		const unsigned int filled_embs,
+		const uint64_t n_samples, const uint64_t tile_size,
+		const TFloat * const __restrict__ lengths,
+		const TFloat * const __restrict__ embedded_proportions,
+		TFloat * const __restrict__ dm_tiles_buf,
+		TFloat * const __restrict__ dm_tiles_total_buf,
+		const TFloat g_unifrac_alpha) {
+    if (g_unifrac_alpha==TFloat(1.0)) {
+      run_GeneralizedTileTask_kernel<TFloat,GENERALIZED_ALPHA_ONE>(
+                         embs_stripe, filled_embs, n_samples, tile_size,
+                         lengths, embedded_proportions, dm_tiles_buf, dm_tiles_total_buf, g_unifrac_alpha);
+    } else if (g_unifrac_alpha==TFloat(0.5)) {
+      run_GeneralizedTileTask_kernel<TFloat,GENERALIZED_ALPHA_HALF>(
+                         embs_stripe, filled_embs, n_samples, tile_size,
+                         lengths, embedded_proportions, dm_tiles_buf, dm_tiles_total_buf, g_unifrac_alpha);
+    } else if (g_unifrac_alpha==TFloat(0.0)) {
+      run_GeneralizedTileTask_kernel<TFloat,GENERALIZED_ALPHA_ZERO>(
+                         embs_stripe, filled_embs, n_samples, tile_size,
+                         lengths, embedded_proportions, dm_tiles_buf, dm_tiles_total_buf, g_unifrac_alpha);
+    } else {
+      run_GeneralizedTileTask_kernel<TFloat,GENERALIZED_ALPHA_ANY>(
+                         embs_stripe, filled_embs, n_samples, tile_size,
+                         lengths, embedded_proportions, dm_tiles_buf, dm_tiles_total_buf, g_unifrac_alpha);
+    }
+}
+#endif
+
@@ -122,6 +122,95 @@ namespace SUCMP_NM {
 		TFloat * const __restrict__ dm_stripes_total_buf,
 		const TFloat g_unifrac_alpha);
 
+    // Max number of alphas that run_GeneralizedMultiTask can accumulate at once
+#define GENERALIZED_MULTI_MAX_ALPHAS 8
+
+    // Compute Generalized step for several alphas at once
+    // n_alphas must not exceed GENERALIZED_MULTI_MAX_ALPHAS
+    template<class TFloat>
+    void run_GeneralizedMultiTask(
+                const uint64_t embs_stripe,
+		const unsigned int filled_embs,
+		const uint64_t start_idx, const uint64_t stop_idx,
+		const uint64_t n_samples, const uint64_t n_samples_r,
+		const TFloat * const __restrict__ lengths,
+		const TFloat * const __restrict__ embedded_proportions,
+		TFloat * const * const __restrict__ dm_stripes_bufs,
+		TFloat * const * const __restrict__ dm_stripes_total_bufs,
+		const unsigned int n_alphas,
+		const TFloat * const __restrict__ g_unifrac_alphas);
+
+    /* Unifrac tile tasks, only available in the CPU variant
+     *
+     * Same as the tasks above, but accumulate into the square tiles
+     * of the upper triangle of the distance matrix (see su::DMTilesT),
+     * instead of into stripes.
+     * dm_tiles_buf <double*> the tiles being accumulated into for unique branch length
+     * dm_tiles_total_buf <double*> the tiles being accumulated into for total branch length
+     */
+
+    // Compute UnnormalizedWeighted step
+    template<class TFloat>
+    void run_UnnormalizedWeightedTileTask(
+		const uint64_t embs_stripe, const unsigned int filled_embs,
+		const uint64_t n_samples, const uint64_t tile_size,
+		const TFloat * const __restrict__ lengths,
+		const TFloat * const __restrict__ embedded_proportions,
+		TFloat * const __restrict__ dm_tiles_buf,
+		bool * const __restrict__ zcheck,
+		TFloat * const __restrict__ sums);
+
+    // Compute NormalizedWeighted step
+    template<class TFloat>
+    void run_NormalizedWeightedTileTask(
+		const uint64_t embs_stripe, const unsigned int filled_embs,
+		const uint64_t n_samples, const uint64_t tile_size,
+		const TFloat * const __restrict__ lengths,
+		const TFloat * const __restrict__ embedded_proportions,
+		TFloat * const __restrict__ dm_tiles_buf,
+		TFloat * const __restrict__ dm_tiles_total_buf,
+		bool * const __restrict__ zcheck,
+		TFloat * const __restrict__ sums);
+
+    // Compute Unweighted step
+    template<class TFloat>
+    void run_UnweightedTileTask(
+		const uint64_t embs_stripe,
+		const unsigned int filled_embs,
+		const uint64_t n_samples, const uint64_t tile_size,
+		const TFloat * const __restrict__ lengths,
+		const uint64_t * const __restrict__ embedded_proportions,
+		TFloat * const __restrict__ dm_tiles_buf,
+		TFloat * const __restrict__ dm_tiles_total_buf,
+		TFloat * const __restrict__ sums,
+		bool   * const __restrict__ zcheck,
+		TFloat * const __restrict__ stripe_sums);
+
+    // Compute UnnormalizedUnweighted step
+    template<class TFloat>
+    void run_UnnormalizedUnweightedTileTask(
+		const uint64_t embs_stripe,
+		const unsigned int filled_embs,
+		const uint64_t n_samples, const uint64_t tile_size,
+		const TFloat * const __restrict__ lengths,
+		const uint64_t * const __restrict__ embedded_proportions,
+		TFloat * const __restrict__ dm_tiles_buf,
+		TFloat * const __restrict__ sums,
+		bool   * const __restrict__ zcheck,
+		TFloat * const __restrict__ stripe_sums);
+
+    // Compute Generalized step
+    template<class TFloat>
+    void run_GeneralizedTileTask(
+                const uint64_t embs_stripe,
+		const unsigned int filled_embs,
+		const uint64_t n_samples, const uint64_t tile_size,
+		const TFloat * const __restrict__ lengths,
+		const TFloat * const __restrict__ embedded_proportions,
+		TFloat * const __restrict__ dm_tiles_buf,
+		TFloat * const __restrict__ dm_tiles_total_buf,
+		const TFloat g_unifrac_alpha);
+
     /* Unifrac vaw tasks
      *
      * All functions utilize the same basic data structures: